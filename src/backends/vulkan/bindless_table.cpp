@@ -0,0 +1,378 @@
+/* Copyright (c) 2017-2026 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "bindless_table.hpp"
+#include "device.hpp"
+#include "image.hpp"
+#include <algorithm>
+#include <string.h>
+
+namespace Vulkan
+{
+BindlessSlotAllocator::BindlessSlotAllocator(uint32_t max_slots_)
+	: max_slots(max_slots_), next_slot(0), free_head(EmptyList), released_head(EmptyList)
+{
+	uint32_t num_chunks = (max_slots + ChunkSize - 1) >> ChunkBits;
+	chunks.reset(new std::atomic<std::atomic<uint32_t> *>[num_chunks]);
+	for (uint32_t i = 0; i < num_chunks; i++)
+		chunks[i].store(nullptr, std::memory_order_relaxed);
+}
+
+BindlessSlotAllocator::~BindlessSlotAllocator()
+{
+	uint32_t num_chunks = (max_slots + ChunkSize - 1) >> ChunkBits;
+	for (uint32_t i = 0; i < num_chunks; i++)
+		delete[] chunks[i].load(std::memory_order_relaxed);
+}
+
+std::atomic<uint32_t> &BindlessSlotAllocator::link(uint32_t slot)
+{
+	return chunks[slot >> ChunkBits].load(std::memory_order_acquire)[slot & (ChunkSize - 1)];
+}
+
+void BindlessSlotAllocator::ensure_chunk(uint32_t slot)
+{
+	auto &chunk = chunks[slot >> ChunkBits];
+	if (chunk.load(std::memory_order_acquire))
+		return;
+
+	auto *new_chunk = new std::atomic<uint32_t>[ChunkSize];
+	std::atomic<uint32_t> *expected = nullptr;
+	if (!chunk.compare_exchange_strong(expected, new_chunk, std::memory_order_acq_rel, std::memory_order_acquire))
+		delete[] new_chunk;
+}
+
+uint32_t BindlessSlotAllocator::allocate()
+{
+	// The tag in the upper 32 bits changes on every push and pop, so a stale next link can never be installed.
+	uint64_t head = free_head.load(std::memory_order_acquire);
+	while (uint32_t(head) != EmptyList)
+	{
+		uint32_t slot = uint32_t(head);
+		uint32_t next = link(slot).load(std::memory_order_relaxed);
+		uint64_t new_head = (((head >> 32) + 1) << 32) | next;
+		if (free_head.compare_exchange_weak(head, new_head, std::memory_order_acq_rel, std::memory_order_acquire))
+			return slot;
+	}
+
+	uint32_t slot = next_slot.load(std::memory_order_relaxed);
+	do
+	{
+		if (slot >= max_slots)
+			return UINT32_MAX;
+	} while (!next_slot.compare_exchange_weak(slot, slot + 1, std::memory_order_acq_rel, std::memory_order_relaxed));
+
+	ensure_chunk(slot);
+	return slot;
+}
+
+void BindlessSlotAllocator::recycle(uint32_t slot)
+{
+	uint64_t head = free_head.load(std::memory_order_relaxed);
+	uint64_t new_head;
+	do
+	{
+		link(slot).store(uint32_t(head), std::memory_order_relaxed);
+		new_head = (((head >> 32) + 1) << 32) | slot;
+	} while (!free_head.compare_exchange_weak(head, new_head, std::memory_order_release, std::memory_order_relaxed));
+}
+
+void BindlessSlotAllocator::release(uint32_t slot)
+{
+	// Push only, the list is consumed as a whole with an exchange, so there is no ABA hazard here.
+	uint32_t head = released_head.load(std::memory_order_relaxed);
+	do
+	{
+		link(slot).store(head, std::memory_order_relaxed);
+	} while (!released_head.compare_exchange_weak(head, slot, std::memory_order_release, std::memory_order_relaxed));
+}
+
+void BindlessSlotAllocator::take_released(std::vector<uint32_t> &slots)
+{
+	uint32_t slot = released_head.exchange(EmptyList, std::memory_order_acquire);
+	while (slot != EmptyList)
+	{
+		slots.push_back(slot);
+		slot = link(slot).load(std::memory_order_relaxed);
+	}
+}
+
+BindlessTable::BindlessTable(Device *device_, DescriptorSetAllocator *allocator_, uint32_t initial_capacity)
+	: device(device_), allocator(allocator_)
+{
+	use_descriptor_buffer = device->get_device_features().supports_descriptor_buffer_or_heap;
+	slots = std::make_shared<BindlessSlotAllocator>(allocator->get_max_bindless_descriptors());
+	grow(std::max(initial_capacity, 1u));
+}
+
+BindlessTable::~BindlessTable()
+{
+	if (desc_pool != VK_NULL_HANDLE)
+		device->destroy_descriptor_pool(desc_pool);
+	if (desc_buffer.get_size() != 0)
+		device->free_descriptor_buffer_allocation(desc_buffer);
+}
+
+uint32_t BindlessTable::allocate_slot()
+{
+	uint32_t slot = slots->allocate();
+	if (slot == UINT32_MAX)
+		LOGE("Bindless table is full (%u slots).\n", slots->get_max_slots());
+	return slot;
+}
+
+void BindlessTable::free_slot(uint32_t slot)
+{
+	VK_ASSERT(slot < slots->get_high_water_mark());
+
+	// The view of a write which has not been flushed yet may be destroyed right after this call.
+	{
+		std::lock_guard<std::mutex> holder{write_lock};
+		pending_writes.erase(std::remove_if(pending_writes.begin(), pending_writes.end(),
+		                                    [slot](const PendingWrite &write) { return write.slot == slot; }),
+		                     pending_writes.end());
+	}
+
+	slots->release(slot);
+}
+
+void BindlessTable::queue_write(const PendingWrite &write)
+{
+	VK_ASSERT(write.slot < slots->get_high_water_mark());
+	std::lock_guard<std::mutex> holder{write_lock};
+	pending_writes.push_back(write);
+}
+
+void BindlessTable::write_texture(uint32_t slot, const ImageView &view)
+{
+	auto &cached = view.get_float_view();
+	queue_write({ slot, cached.view, view.get_image().get_layout(VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL), cached.sampled.ptr });
+}
+
+void BindlessTable::write_texture_unorm(uint32_t slot, const ImageView &view)
+{
+	auto &cached = view.get_unorm_view();
+	queue_write({ slot, cached.view, view.get_image().get_layout(VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL), cached.sampled.ptr });
+}
+
+void BindlessTable::write_texture_srgb(uint32_t slot, const ImageView &view)
+{
+	auto &cached = view.get_srgb_view();
+	queue_write({ slot, cached.view, view.get_image().get_layout(VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL), cached.sampled.ptr });
+}
+
+uint8_t *BindlessTable::get_mapped_descriptor(uint32_t slot) const
+{
+	auto &db = device->managers.descriptor_buffer;
+	return db.get_resource_heap().mapped + desc_set.handle.offset + allocator->get_variable_offset() +
+	       VkDeviceSize(slot) * db.get_descriptor_size_for_type(VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE);
+}
+
+bool BindlessTable::grow(uint32_t new_capacity)
+{
+	new_capacity = std::min(new_capacity, slots->get_max_slots());
+	if (new_capacity <= capacity)
+		return new_capacity == capacity || capacity != 0;
+
+	if (use_descriptor_buffer)
+	{
+		auto new_buffer = allocator->allocate_bindless_buffer(1, new_capacity);
+		if (new_buffer.get_size() == 0)
+		{
+			LOGE("Failed to allocate descriptor buffer for %u bindless descriptors.\n", new_capacity);
+			return false;
+		}
+
+		// Descriptor memory can be copied as-is, so existing descriptors move without being rewritten.
+		// The old range may still be read by the GPU, so it goes through deferred destruction.
+		auto *mapped = device->managers.descriptor_buffer.get_resource_heap().mapped;
+		if (desc_buffer.get_size() != 0)
+		{
+			memcpy(mapped + new_buffer.get_offset(), mapped + desc_buffer.get_offset(),
+			       allocator->get_variable_size(capacity));
+			device->free_descriptor_buffer_allocation(desc_buffer);
+		}
+
+		desc_buffer = new_buffer;
+		desc_set.handle.offset = new_buffer.get_offset();
+		desc_set.valid = true;
+	}
+	else
+	{
+		VkDescriptorPool new_pool = allocator->allocate_bindless_pool(1, new_capacity);
+		if (new_pool == VK_NULL_HANDLE)
+			return false;
+
+		auto new_set = allocator->allocate_bindless_set(new_pool, new_capacity);
+		if (!new_set)
+		{
+			LOGE("Failed to allocate bindless set for %u descriptors.\n", new_capacity);
+			device->get_device_table().vkDestroyDescriptorPool(device->get_device(), new_pool, nullptr);
+			return false;
+		}
+
+		if (desc_pool != VK_NULL_HANDLE)
+		{
+			// Only copy descriptors which have been written. Unwritten or released ones may be stale.
+			std::vector<VkCopyDescriptorSet> copies;
+			uint32_t slot = 0;
+			while (slot < capacity)
+			{
+				if (!written_slots[slot])
+				{
+					slot++;
+					continue;
+				}
+
+				uint32_t end = slot + 1;
+				while (end < capacity && written_slots[end])
+					end++;
+
+				VkCopyDescriptorSet copy = { VK_STRUCTURE_TYPE_COPY_DESCRIPTOR_SET };
+				copy.srcSet = desc_set.handle.set;
+				copy.srcArrayElement = slot;
+				copy.dstSet = new_set.handle.set;
+				copy.dstArrayElement = slot;
+				copy.descriptorCount = end - slot;
+				copies.push_back(copy);
+				slot = end;
+			}
+
+			if (!copies.empty())
+			{
+				device->get_device_table().vkUpdateDescriptorSets(device->get_device(), 0, nullptr,
+				                                                  uint32_t(copies.size()), copies.data());
+			}
+
+			device->destroy_descriptor_pool(desc_pool);
+		}
+
+		desc_pool = new_pool;
+		desc_set = new_set;
+		written_slots.resize(new_capacity);
+	}
+
+	capacity = new_capacity;
+	return true;
+}
+
+bool BindlessTable::reserve(uint32_t new_capacity)
+{
+	return grow(new_capacity);
+}
+
+void BindlessTable::apply_writes()
+{
+	if (flush_writes.empty())
+		return;
+
+	// Writes which do not fit yet are retried on the next flush rather than dropped.
+	std::vector<PendingWrite> deferred_writes;
+
+	if (use_descriptor_buffer)
+	{
+		auto &db = device->managers.descriptor_buffer;
+		for (auto &write : flush_writes)
+		{
+			if (write.slot < capacity)
+				db.copy_sampled_image(get_mapped_descriptor(write.slot), write.payload);
+			else
+				deferred_writes.push_back(write);
+		}
+	}
+	else
+	{
+		std::vector<VkDescriptorImageInfo> infos;
+		std::vector<VkWriteDescriptorSet> writes;
+		infos.reserve(flush_writes.size());
+		writes.reserve(flush_writes.size());
+
+		for (auto &write : flush_writes)
+		{
+			if (write.slot >= capacity)
+			{
+				deferred_writes.push_back(write);
+				continue;
+			}
+
+			infos.push_back({ VK_NULL_HANDLE, write.view, write.layout });
+			VkWriteDescriptorSet desc = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+			desc.dstSet = desc_set.handle.set;
+			desc.dstArrayElement = write.slot;
+			desc.descriptorCount = 1;
+			desc.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+			writes.push_back(desc);
+			written_slots[write.slot] = true;
+		}
+
+		// Pointers are only stable once infos is complete.
+		for (size_t i = 0; i < writes.size(); i++)
+			writes[i].pImageInfo = &infos[i];
+
+		if (!writes.empty())
+		{
+			device->get_device_table().vkUpdateDescriptorSets(device->get_device(), uint32_t(writes.size()),
+			                                                  writes.data(), 0, nullptr);
+		}
+	}
+
+	flush_writes.clear();
+
+	if (!deferred_writes.empty())
+	{
+		std::lock_guard<std::mutex> holder{write_lock};
+		pending_writes.insert(pending_writes.end(), deferred_writes.begin(), deferred_writes.end());
+	}
+}
+
+void BindlessTable::flush()
+{
+	{
+		std::lock_guard<std::mutex> holder{write_lock};
+		std::swap(pending_writes, flush_writes);
+	}
+
+	// Size against the writes we are about to apply. Slots allocated after the swap
+	// can only be written by writes which land in the next flush.
+	uint32_t required = slots->get_high_water_mark();
+	for (auto &write : flush_writes)
+		required = std::max(required, write.slot + 1);
+
+	if (required > capacity && !grow(std::max(required, capacity * 2)))
+		LOGE("Failed to grow bindless table to %u descriptors, writes beyond %u are retried on the next flush.\n",
+		     required, capacity);
+
+	apply_writes();
+
+	slots->take_released(released_slots);
+	if (!released_slots.empty())
+	{
+		if (!use_descriptor_buffer)
+			for (auto slot : released_slots)
+				if (slot < capacity)
+					written_slots[slot] = false;
+
+		device->release_bindless_slots(slots, std::move(released_slots));
+		released_slots.clear();
+	}
+}
+}
@@ -0,0 +1,170 @@
+/* Copyright (c) 2017-2026 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "vulkan_headers.hpp"
+#include "vulkan_common.hpp"
+#include "descriptor_set.hpp"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace Vulkan
+{
+class Device;
+class ImageView;
+
+// Hands out stable slot indices without locking.
+// Indices are recycled through a tagged free list, released indices only enter the free list
+// once the device has retired every frame which could still reference them.
+class BindlessSlotAllocator
+{
+public:
+	explicit BindlessSlotAllocator(uint32_t max_slots);
+	~BindlessSlotAllocator();
+	void operator=(const BindlessSlotAllocator &) = delete;
+	BindlessSlotAllocator(const BindlessSlotAllocator &) = delete;
+
+	// Returns UINT32_MAX if max_slots is exhausted.
+	uint32_t allocate();
+	// Makes the slot immediately available for allocate().
+	void recycle(uint32_t slot);
+	// Queues the slot for deferred recycling.
+	void release(uint32_t slot);
+	// Takes every slot queued by release() since the last call.
+	void take_released(std::vector<uint32_t> &slots);
+
+	// One past the highest slot ever handed out.
+	uint32_t get_high_water_mark() const
+	{
+		return next_slot.load(std::memory_order_acquire);
+	}
+
+	uint32_t get_max_slots() const
+	{
+		return max_slots;
+	}
+
+private:
+	enum { ChunkBits = 12, ChunkSize = 1 << ChunkBits, EmptyList = UINT32_MAX };
+
+	// Links are stored in chunks which never move, so they can be read concurrently with growth.
+	std::unique_ptr<std::atomic<std::atomic<uint32_t> *>[]> chunks;
+	uint32_t max_slots;
+	std::atomic<uint32_t> next_slot;
+	// Slot index in the low bits, ABA tag in the high bits.
+	std::atomic<uint64_t> free_head;
+	std::atomic<uint32_t> released_head;
+
+	std::atomic<uint32_t> &link(uint32_t slot);
+	void ensure_chunk(uint32_t slot);
+};
+
+// Persistent bindless descriptor table.
+// Unlike BindlessAllocator, which builds a new set from scratch on every commit,
+// descriptors are written once into a stable slot and stay valid until the slot is freed.
+// Growing the table moves existing descriptors over without rewriting them,
+// but invalidates the previous descriptor set, so rebind get_descriptor_set() after flush().
+//
+// allocate_slot(), free_slot() and the write functions are thread-safe.
+// flush() must be externally synchronized with recording of command buffers which use the table,
+// typically it is called once per frame before recording.
+class BindlessTable : public Util::IntrusivePtrEnabled<BindlessTable, std::default_delete<BindlessTable>, HandleCounter>
+{
+public:
+	BindlessTable(Device *device, DescriptorSetAllocator *allocator, uint32_t initial_capacity);
+	~BindlessTable();
+	void operator=(const BindlessTable &) = delete;
+	BindlessTable(const BindlessTable &) = delete;
+
+	// Returns UINT32_MAX when the table cannot grow any further.
+	uint32_t allocate_slot();
+	// Contents of the slot must not be accessed by work recorded after this call.
+	// Writes to the slot which have not been flushed yet are discarded.
+	// The index is reused once the GPU is done with every frame which could have accessed it.
+	void free_slot(uint32_t slot);
+
+	// Writes become visible to command buffers recorded after the next flush().
+	// The view must outlive the slot, i.e. stay alive until free_slot() or until the slot is written again,
+	// since growing the table copies existing descriptors.
+	void write_texture(uint32_t slot, const ImageView &view);
+	void write_texture_unorm(uint32_t slot, const ImageView &view);
+	void write_texture_srgb(uint32_t slot, const ImageView &view);
+
+	// Grows the table if slots beyond the current capacity were handed out, applies pending writes
+	// in one batch and hands released slots over to the device for deferred recycling.
+	void flush();
+
+	// Explicit growth. Existing descriptors are kept.
+	bool reserve(uint32_t capacity);
+
+	BindlessDescriptorSet get_descriptor_set() const
+	{
+		return desc_set;
+	}
+
+	uint32_t get_capacity() const
+	{
+		return capacity;
+	}
+
+	// Highest slot in use + 1, i.e. how far shaders may index.
+	uint32_t get_slot_count() const
+	{
+		return slots->get_high_water_mark();
+	}
+
+private:
+	Device *device;
+	DescriptorSetAllocator *allocator;
+	std::shared_ptr<BindlessSlotAllocator> slots;
+
+	BindlessDescriptorSet desc_set;
+	VkDescriptorPool desc_pool = VK_NULL_HANDLE;
+	DescriptorBufferAllocation desc_buffer;
+	uint32_t capacity = 0;
+	bool use_descriptor_buffer;
+
+	struct PendingWrite
+	{
+		uint32_t slot;
+		VkImageView view;
+		VkImageLayout layout;
+		const uint8_t *payload;
+	};
+	std::mutex write_lock;
+	std::vector<PendingWrite> pending_writes;
+	std::vector<PendingWrite> flush_writes;
+	std::vector<uint32_t> released_slots;
+
+	// Legacy path only, to copy just the descriptors which are valid when growing.
+	std::vector<bool> written_slots;
+
+	void queue_write(const PendingWrite &write);
+	void apply_writes();
+	bool grow(uint32_t new_capacity);
+	uint8_t *get_mapped_descriptor(uint32_t slot) const;
+};
+using BindlessTableHandle = Util::IntrusivePtr<BindlessTable>;
+}
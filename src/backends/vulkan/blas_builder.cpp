@@ -0,0 +1,188 @@
+/* Copyright (c) 2017-2026 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "blas_builder.hpp"
+#include "device.hpp"
+#include "command_buffer.hpp"
+
+namespace Vulkan
+{
+void BLASBuilder::init(Device *device_)
+{
+	device = device_;
+}
+
+void BLASBuilder::teardown()
+{
+	std::lock_guard<std::mutex> holder{lock};
+	pending_builds.clear();
+	pending_compactions.clear();
+	retired.clear();
+	retiring.clear();
+}
+
+void BLASBuilder::set_scratch_budget(VkDeviceSize size)
+{
+	std::lock_guard<std::mutex> holder{lock};
+	scratch_budget = size;
+}
+
+BLASHandle BLASBuilder::enqueue(const BottomRTASCreateInfo &info)
+{
+	if (!device->get_device_features().rtas_features.accelerationStructure)
+	{
+		LOGE("RTAS not supported on this driver.\n");
+		return {};
+	}
+
+	VkAccelerationStructureBuildSizesInfoKHR size_info =
+			{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR };
+	device->get_blas_build_sizes(info, size_info);
+
+	BLASHandle blas(new BLAS);
+	blas->geometries.assign(info.geometries, info.geometries + info.count);
+	blas->mode = info.mode;
+	blas->size = size_info.accelerationStructureSize;
+	blas->scratch_size = size_info.buildScratchSize;
+	blas->update_scratch_size = size_info.updateScratchSize;
+
+	std::lock_guard<std::mutex> holder{lock};
+	pending_builds.push_back(blas);
+	return blas;
+}
+
+bool BLASBuilder::is_idle()
+{
+	std::lock_guard<std::mutex> holder{lock};
+	return pending_builds.empty() && pending_compactions.empty();
+}
+
+void BLASBuilder::record_compactions(CommandBuffer &cmd)
+{
+	// Sizes are resolved when the frame context which built the BLAS is recycled,
+	// so the builds are complete by the time we see them here.
+	size_t write_index = 0;
+	for (size_t i = 0, n = pending_compactions.size(); i < n; i++)
+	{
+		auto &compaction = pending_compactions[i];
+		if (!compaction.query->is_signalled())
+		{
+			if (write_index != i)
+				pending_compactions[write_index] = std::move(compaction);
+			write_index++;
+			continue;
+		}
+
+		auto &blas = *compaction.blas;
+		VkDeviceSize compacted_size = compaction.query->get_value();
+		if (compacted_size == 0 || compacted_size >= blas.size)
+			continue;
+
+		auto compacted = device->create_rtas(VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR, compacted_size);
+		if (!compacted)
+			continue;
+
+		cmd.compact_rtas(*compacted, *blas.rtas);
+		// TLASes built against the original keep referencing its device address,
+		// so hold on to it until they have had a frame context to notice the new generation.
+		retiring.push_back(std::move(blas.rtas));
+		blas.rtas = std::move(compacted);
+		blas.generation++;
+		blas.compacted = true;
+	}
+	pending_compactions.resize(write_index);
+}
+
+void BLASBuilder::record_builds(CommandBuffer &cmd)
+{
+	VkDeviceSize scratch_align =
+			device->get_device_features().rtas_properties.minAccelerationStructureScratchOffsetAlignment;
+	VkDeviceSize total_scratch = 0;
+
+	cmd.begin_rtas_batch();
+
+	// Always make progress, even if a single build exceeds the budget.
+	while (!pending_builds.empty())
+	{
+		auto &blas = *pending_builds.front();
+		VkDeviceSize scratch = (blas.scratch_size + scratch_align - 1) & ~(scratch_align - 1);
+		if (total_scratch != 0 && total_scratch + scratch > scratch_budget)
+			break;
+		total_scratch += scratch;
+
+		blas.rtas = device->create_rtas(VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR, blas.size);
+		if (blas.rtas)
+		{
+			blas.rtas->set_scratch_size(blas.scratch_size, blas.update_scratch_size);
+
+			BottomRTASCreateInfo info = {};
+			info.mode = blas.mode;
+			info.geometries = blas.geometries.data();
+			info.count = blas.geometries.size();
+			cmd.build_rtas(BuildMode::Build, *blas.rtas, info);
+			blas.generation++;
+
+			if (blas.mode == BLASMode::Static)
+			{
+				auto query = device->allocate_compacted_rtas_size_query(cmd.get_command_buffer());
+				cmd.write_compacted_rtas_size(*blas.rtas, *query);
+				pending_compactions.push_back({ pending_builds.front(), std::move(query) });
+			}
+		}
+
+		blas.geometries.clear();
+		blas.geometries.shrink_to_fit();
+		pending_builds.pop_front();
+	}
+
+	cmd.end_rtas_batch();
+}
+
+void BLASBuilder::flush()
+{
+	std::lock_guard<std::mutex> holder{lock};
+
+	// Originals retired in the previous frame context have had a frame to be replaced in TLASes.
+	// Destruction itself is still deferred by the device as usual.
+	retired.clear();
+	std::swap(retired, retiring);
+
+	if (pending_builds.empty() && pending_compactions.empty())
+		return;
+
+	auto cmd = device->request_command_buffer();
+	cmd->begin_region("blas-builder");
+
+	// Compact first, so the original memory can be recycled before we allocate more.
+	record_compactions(*cmd);
+	record_builds(*cmd);
+
+	// Anything submitted later on this queue may consume the results.
+	cmd->barrier(VK_PIPELINE_STAGE_2_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+	             VK_ACCESS_2_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+	             VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+	             VK_ACCESS_2_ACCELERATION_STRUCTURE_READ_BIT_KHR);
+
+	cmd->end_region();
+	device->submit(cmd);
+}
+}
@@ -0,0 +1,123 @@
+/* Copyright (c) 2017-2026 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "vulkan_common.hpp"
+#include "rtas.hpp"
+#include "query_pool.hpp"
+#include <mutex>
+#include <deque>
+#include <vector>
+
+namespace Vulkan
+{
+class Device;
+class CommandBuffer;
+
+class BLAS : public Util::IntrusivePtrEnabled<BLAS, std::default_delete<BLAS>, HandleCounter>
+{
+public:
+	// Null until the build has been submitted. For BLASMode::Static, this is replaced with the compacted RTAS
+	// once the compacted size is known.
+	// Only changes inside Device::next_frame_context(), and every change bumps get_generation().
+	inline const RTASHandle &get_rtas() const
+	{
+		return rtas;
+	}
+
+	// TLASes which reference this BLAS must be rebuilt (not updated) when the generation differs
+	// from the one they were built against. After compaction, the original is kept alive
+	// through the following frame context, so there is one frame to rebuild before it is released.
+	inline uint32_t get_generation() const
+	{
+		return generation;
+	}
+
+	inline bool is_built() const
+	{
+		return bool(rtas);
+	}
+
+	inline bool is_compacted() const
+	{
+		return compacted;
+	}
+
+private:
+	friend class BLASBuilder;
+	RTASHandle rtas;
+	uint32_t generation = 0;
+	std::vector<BottomRTASGeometry> geometries;
+	BLASMode mode = BLASMode::Static;
+	VkDeviceSize size = 0;
+	VkDeviceSize scratch_size = 0;
+	VkDeviceSize update_scratch_size = 0;
+	bool compacted = false;
+};
+using BLASHandle = Util::IntrusivePtr<BLAS>;
+
+// Device-level BLAS build service.
+// Enqueued builds are split into sub-batches whose scratch memory fits in the scratch budget,
+// and one sub-batch is submitted per frame context. Static BLASes are compacted automatically
+// once their compacted size query resolves, and the uncompacted original is freed a frame context later.
+// Since scratch is only recycled once a frame context completes,
+// peak scratch usage is roughly budget * number of frame contexts.
+class BLASBuilder
+{
+public:
+	void init(Device *device);
+	void teardown();
+
+	// Default is 64 MiB. A single build which exceeds the budget is submitted on its own.
+	void set_scratch_budget(VkDeviceSize size);
+
+	// Geometry is copied, but the vertex, index and transform buffers must remain valid until is_built().
+	BLASHandle enqueue(const BottomRTASCreateInfo &info);
+
+	// True when there is no pending build or compaction.
+	bool is_idle();
+
+	// Called by Device at the end of a frame context.
+	void flush();
+
+private:
+	Device *device = nullptr;
+	std::mutex lock;
+	VkDeviceSize scratch_budget = 64 * 1024 * 1024;
+
+	struct Compaction
+	{
+		BLASHandle blas;
+		QueryPoolHandle query;
+	};
+
+	std::deque<BLASHandle> pending_builds;
+	std::vector<Compaction> pending_compactions;
+	// Uncompacted originals which TLASes built in the previous frame context may still reference.
+	std::vector<RTASHandle> retired;
+	std::vector<RTASHandle> retiring;
+
+	void record_compactions(CommandBuffer &cmd);
+	void record_builds(CommandBuffer &cmd);
+};
+}
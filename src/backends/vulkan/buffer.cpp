@@ -43,6 +43,7 @@ ExternalHandle Buffer::export_handle()
 
 Buffer::~Buffer()
 {
+	device->notify_cookie_destroyed(get_cookie());
 	if (owns_buffer)
 	{
 		if (internal_sync)
@@ -75,6 +76,7 @@ BufferView::BufferView(Device *device_,
 
 BufferView::~BufferView()
 {
+	device->notify_cookie_destroyed(get_cookie());
 	if (internal_sync)
 		device->destroy_buffer_view_nolock(view);
 	else
@@ -22,6 +22,7 @@
 
 #define NOMINMAX
 #include "command_buffer.hpp"
+#include "command_bundle.hpp"
 #include "device.hpp"
 #include "format.hpp"
 #include "thread_id.hpp"
@@ -108,6 +109,7 @@ CommandBuffer::~CommandBuffer()
 	VK_ASSERT(!ibo_block.is_mapped());
 	VK_ASSERT(!ubo_block.is_mapped());
 	VK_ASSERT(!staging_block.is_mapped());
+	VK_ASSERT(!indirect_block.is_mapped());
 	device->lock.read_only_cache.unlock_read();
 }
 
@@ -118,6 +120,7 @@ void CommandBuffer::fill_buffer(const Buffer &dst, uint32_t value)
 
 void CommandBuffer::fill_buffer(const Buffer &dst, uint32_t value, VkDeviceSize offset, VkDeviceSize size)
 {
+	mark_split_barrier_work();
 	table.vkCmdFillBuffer(cmd, dst.get_buffer(), offset, size, value);
 }
 
@@ -127,6 +130,7 @@ void CommandBuffer::copy_buffer(const Buffer &dst, VkDeviceSize dst_offset, cons
 	const VkBufferCopy region = {
 		src_offset, dst_offset, size,
 	};
+	mark_split_barrier_work();
 	table.vkCmdCopyBuffer(cmd, src.get_buffer(), dst.get_buffer(), 1, &region);
 }
 
@@ -138,6 +142,7 @@ void CommandBuffer::copy_buffer(const Buffer &dst, const Buffer &src)
 
 void CommandBuffer::copy_buffer(const Buffer &dst, const Buffer &src, const VkBufferCopy *copies, size_t count)
 {
+	mark_split_barrier_work();
 	table.vkCmdCopyBuffer(cmd, src.get_buffer(), dst.get_buffer(), count, copies);
 }
 
@@ -153,6 +158,7 @@ void CommandBuffer::copy_image(const Vulkan::Image &dst, const Vulkan::Image &sr
 	region.srcSubresource = src_subresource;
 	region.dstSubresource = dst_subresource;
 
+	mark_split_barrier_work();
 	table.vkCmdCopyImage(cmd, src.get_image(), src.get_layout(VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL),
 	               dst.get_image(), dst.get_layout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL),
 	               1, &region);
@@ -186,6 +192,7 @@ void CommandBuffer::copy_image(const Image &dst, const Image &src)
 		VK_ASSERT(region.srcSubresource.aspectMask == region.dstSubresource.aspectMask);
 	}
 
+	mark_split_barrier_work();
 	table.vkCmdCopyImage(cmd, src.get_image(), src.get_layout(VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL),
 	                     dst.get_image(), dst.get_layout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL),
 	                     levels, regions);
@@ -194,6 +201,7 @@ void CommandBuffer::copy_image(const Image &dst, const Image &src)
 void CommandBuffer::copy_buffer_to_image(const Image &image, const Buffer &buffer, unsigned num_blits,
                                          const VkBufferImageCopy *blits)
 {
+	mark_split_barrier_work();
 	table.vkCmdCopyBufferToImage(cmd, buffer.get_buffer(),
 	                             image.get_image(), image.get_layout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL), num_blits, blits);
 }
@@ -201,6 +209,7 @@ void CommandBuffer::copy_buffer_to_image(const Image &image, const Buffer &buffe
 void CommandBuffer::copy_image_to_buffer(const Buffer &buffer, const Image &image, unsigned num_blits,
                                          const VkBufferImageCopy *blits)
 {
+	mark_split_barrier_work();
 	table.vkCmdCopyImageToBuffer(cmd, image.get_image(), image.get_layout(VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL),
 	                             buffer.get_buffer(), num_blits, blits);
 }
@@ -214,6 +223,7 @@ void CommandBuffer::copy_buffer_to_image(const Image &image, const Buffer &src,
 		row_length, slice_height,
 		subresource, offset, extent,
 	};
+	mark_split_barrier_work();
 	table.vkCmdCopyBufferToImage(cmd, src.get_buffer(), image.get_image(), image.get_layout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL),
 	                             1, &region);
 }
@@ -227,6 +237,7 @@ void CommandBuffer::copy_image_to_buffer(const Buffer &buffer, const Image &imag
 		row_length, slice_height,
 		subresource, offset, extent,
 	};
+	mark_split_barrier_work();
 	table.vkCmdCopyImageToBuffer(cmd, image.get_image(), image.get_layout(VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL),
 	                             buffer.get_buffer(), 1, &region);
 }
@@ -239,7 +250,6 @@ void CommandBuffer::clear_image(const Image &image, const VkClearValue &value)
 
 void CommandBuffer::clear_image(const Image &image, const VkClearValue &value, VkImageAspectFlags aspect)
 {
-	VK_ASSERT(!framebuffer);
 	VK_ASSERT(!actual_render_pass);
 
 	VkImageSubresourceRange range = {};
@@ -248,6 +258,8 @@ void CommandBuffer::clear_image(const Image &image, const VkClearValue &value, V
 	range.baseMipLevel = 0;
 	range.levelCount = image.get_create_info().levels;
 	range.layerCount = image.get_create_info().layers;
+
+	mark_split_barrier_work();
 	if (aspect & (VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT))
 	{
 		table.vkCmdClearDepthStencilImage(cmd, image.get_image(), image.get_layout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL),
@@ -263,8 +275,10 @@ void CommandBuffer::clear_image(const Image &image, const VkClearValue &value, V
 void CommandBuffer::clear_quad(unsigned attachment, const VkClearRect &rect, const VkClearValue &value,
                                VkImageAspectFlags aspect)
 {
-	VK_ASSERT(framebuffer);
 	VK_ASSERT(actual_render_pass);
+	flush_draw_batch();
+	if (bundle_capture)
+		bundle_capture->invalidate();
 	VkClearAttachment att = {};
 	att.clearValue = value;
 	att.colorAttachment = attachment;
@@ -272,24 +286,111 @@ void CommandBuffer::clear_quad(unsigned attachment, const VkClearRect &rect, con
 
 	auto tmp_rect = rect;
 	rect2d_transform_xy(tmp_rect.rect, current_framebuffer_surface_transform,
-						framebuffer->get_width(), framebuffer->get_height());
+						framebuffer_width, framebuffer_height);
 	table.vkCmdClearAttachments(cmd, 1, &att, 1, &tmp_rect);
 }
 
 void CommandBuffer::clear_quad(const VkClearRect &rect, const VkClearAttachment *attachments, unsigned num_attachments)
 {
-	VK_ASSERT(framebuffer);
 	VK_ASSERT(actual_render_pass);
+	flush_draw_batch();
+	if (bundle_capture)
+		bundle_capture->invalidate();
 	auto tmp_rect = rect;
 	rect2d_transform_xy(tmp_rect.rect, current_framebuffer_surface_transform,
-	                    framebuffer->get_width(), framebuffer->get_height());
+	                    framebuffer_width, framebuffer_height);
 	table.vkCmdClearAttachments(cmd, num_attachments, attachments, 1, &tmp_rect);
 }
 
-void CommandBuffer::begin_barrier_batch()
+void CommandBuffer::begin_barrier_batch(BarrierBatchMode mode)
 {
 	VK_ASSERT(!barrier_batch.active);
+	VK_ASSERT(!actual_render_pass);
 	barrier_batch.active = true;
+
+	// If events are emulated, splitting the barrier would only add overhead.
+	barrier_batch.split = mode == BarrierBatchMode::ManualSplit &&
+	                      !device->get_workarounds().emulate_event_as_pipeline_barrier;
+}
+
+void CommandBuffer::set_manual_split_barrier_min_commands(unsigned count)
+{
+	split_barrier_min_commands = count;
+}
+
+void CommandBuffer::signal_split_barriers()
+{
+	VK_ASSERT(!actual_render_pass);
+
+	// Any command recorded while split barriers are in flight counts towards the minimum before the wait.
+	for (auto &split : split_barriers)
+		split.commands_recorded++;
+
+	if (barrier_batch.memory_barriers.empty() &&
+	    barrier_batch.buffer_barriers.empty() &&
+	    barrier_batch.image_barriers.empty())
+	{
+		return;
+	}
+
+	// Everything recorded before this point is potentially a writer,
+	// so signal all barriers requested so far before the first independent command.
+	SplitBarrier split;
+	split.memory_barriers = std::move(barrier_batch.memory_barriers);
+	split.buffer_barriers = std::move(barrier_batch.buffer_barriers);
+	split.image_barriers = std::move(barrier_batch.image_barriers);
+	split.commands_recorded = 1;
+	barrier_batch.memory_barriers.clear();
+	barrier_batch.buffer_barriers.clear();
+	barrier_batch.image_barriers.clear();
+
+	VkDependencyInfo dep = { VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+	dep.pMemoryBarriers = split.memory_barriers.data();
+	dep.memoryBarrierCount = split.memory_barriers.size();
+	dep.pBufferMemoryBarriers = split.buffer_barriers.data();
+	dep.bufferMemoryBarrierCount = split.buffer_barriers.size();
+	dep.pImageMemoryBarriers = split.image_barriers.data();
+	dep.imageMemoryBarrierCount = split.image_barriers.size();
+	split.event = signal_event(dep);
+
+	split_barriers.push_back(std::move(split));
+}
+
+void CommandBuffer::wait_split_barriers()
+{
+	Util::SmallVector<PipelineEvent> events;
+	Util::SmallVector<VkDependencyInfo> deps;
+
+	for (auto &split : split_barriers)
+	{
+		if (split.commands_recorded < split_barrier_min_commands)
+		{
+			// Too close to the signal to be worth it, demote to a plain barrier.
+			// The event is still recycled as normal.
+			barrier_batch.memory_barriers.insert(barrier_batch.memory_barriers.end(),
+			                                     split.memory_barriers.begin(), split.memory_barriers.end());
+			barrier_batch.buffer_barriers.insert(barrier_batch.buffer_barriers.end(),
+			                                     split.buffer_barriers.begin(), split.buffer_barriers.end());
+			barrier_batch.image_barriers.insert(barrier_batch.image_barriers.end(),
+			                                    split.image_barriers.begin(), split.image_barriers.end());
+			continue;
+		}
+
+		VkDependencyInfo dep = { VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+		dep.pMemoryBarriers = split.memory_barriers.data();
+		dep.memoryBarrierCount = split.memory_barriers.size();
+		dep.pBufferMemoryBarriers = split.buffer_barriers.data();
+		dep.bufferMemoryBarrierCount = split.buffer_barriers.size();
+		dep.pImageMemoryBarriers = split.image_barriers.data();
+		dep.imageMemoryBarrierCount = split.image_barriers.size();
+		deps.push_back(dep);
+		events.push_back(split.event);
+	}
+
+	if (!events.empty())
+		wait_events(uint32_t(events.size()), events.data(), deps.data());
+
+	split_barriers.clear();
 }
 
 void CommandBuffer::end_barrier_batch()
@@ -297,6 +398,21 @@ void CommandBuffer::end_barrier_batch()
 	VK_ASSERT(barrier_batch.active);
 	barrier_batch.active = false;
 
+	if (barrier_batch.split)
+	{
+		barrier_batch.split = false;
+		// Barriers requested after the last command have no commands between them and the reader,
+		// and are merged with any demoted split barriers below.
+		wait_split_barriers();
+	}
+
+	if (barrier_batch.memory_barriers.empty() &&
+	    barrier_batch.buffer_barriers.empty() &&
+	    barrier_batch.image_barriers.empty())
+	{
+		return;
+	}
+
 	VkDependencyInfo dep = { VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
 	dep.pMemoryBarriers = barrier_batch.memory_barriers.data();
 	dep.memoryBarrierCount = barrier_batch.memory_barriers.size();
@@ -315,7 +431,6 @@ void CommandBuffer::end_barrier_batch()
 void CommandBuffer::full_barrier()
 {
 	VK_ASSERT(!actual_render_pass);
-	VK_ASSERT(!framebuffer);
 	barrier(VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_ACCESS_MEMORY_WRITE_BIT,
 	        VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_ACCESS_MEMORY_WRITE_BIT | VK_ACCESS_MEMORY_READ_BIT);
 }
@@ -323,7 +438,9 @@ void CommandBuffer::full_barrier()
 void CommandBuffer::pixel_barrier()
 {
 	VK_ASSERT(actual_render_pass);
-	VK_ASSERT(framebuffer);
+	flush_draw_batch();
+	if (bundle_capture)
+		bundle_capture->invalidate();
 	VkMemoryBarrier barrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
 	barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
 	barrier.dstAccessMask = VK_ACCESS_INPUT_ATTACHMENT_READ_BIT;
@@ -363,7 +480,6 @@ static inline bool is_legacy_layout(VkImageLayout layout)
 void CommandBuffer::barrier(const VkDependencyInfo &dep)
 {
 	VK_ASSERT(!actual_render_pass);
-	VK_ASSERT(!framebuffer);
 
 	if (barrier_batch.active)
 	{
@@ -594,7 +710,6 @@ void CommandBuffer::image_barrier(const Image &image,
                                   VkPipelineStageFlags2 dst_stages, VkAccessFlags2 dst_access)
 {
 	VK_ASSERT(!actual_render_pass);
-	VK_ASSERT(!framebuffer);
 	VK_ASSERT(image.get_create_info().domain != ImageDomain::Transient);
 	VK_ASSERT(!is_legacy_layout(old_layout) && !is_legacy_layout(new_layout));
 
@@ -728,6 +843,7 @@ void CommandBuffer::blit_image(const Image &dst, const Image &src,
 		{ dst_offset, add_offset(dst_offset, dst_extent) },
 	};
 
+	mark_split_barrier_work();
 	table.vkCmdBlitImage(cmd,
 	                     src.get_image(), src.get_layout(VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL),
 	                     dst.get_image(), dst.get_layout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL),
@@ -738,6 +854,7 @@ void CommandBuffer::begin_context()
 {
 	dirty = ~0u;
 	dirty_sets_realloc = ~0u;
+	dirty_sets_dynamic = 0;
 	dirty_vbos = ~0u;
 	current_pipeline = {};
 	current_pipeline_layout = VK_NULL_HANDLE;
@@ -749,11 +866,13 @@ void CommandBuffer::begin_context()
 	memset(bindings.secondary_cookies, 0, sizeof(bindings.secondary_cookies));
 	memset(&index_state, 0, sizeof(index_state));
 	memset(vbo.buffers, 0, sizeof(vbo.buffers));
+	memset(vbo.cookies, 0, sizeof(vbo.cookies));
 
 	if (debug_channel_buffer)
 		set_storage_buffer(VULKAN_NUM_DESCRIPTOR_SETS - 1, VULKAN_NUM_BINDINGS - 1, *debug_channel_buffer);
 
-	VK_ASSERT(!barrier_batch.active);
+	VK_ASSERT(!barrier_batch.active || barrier_batch.split);
+	VK_ASSERT(!draw_batch.count);
 }
 
 void CommandBuffer::begin_compute()
@@ -773,12 +892,12 @@ void CommandBuffer::begin_graphics()
 		set_surface_transform_specialization_constants();
 }
 
-void CommandBuffer::init_viewport_scissor(const RenderPassInfo &info, const Framebuffer *fb)
+void CommandBuffer::init_viewport_scissor(const RenderPassInfo &info)
 {
 	VkRect2D rect = info.render_area;
 
-	uint32_t fb_width = fb->get_width();
-	uint32_t fb_height = fb->get_height();
+	uint32_t fb_width = framebuffer_width;
+	uint32_t fb_height = framebuffer_height;
 
 	// Convert fb_width / fb_height to logical width / height if need be.
 	if (surface_transform_swaps_xy(current_framebuffer_surface_transform))
@@ -800,14 +919,14 @@ void CommandBuffer::init_viewport_scissor(const RenderPassInfo &info, const Fram
 CommandBufferHandle CommandBuffer::request_secondary_command_buffer(Device &device, const RenderPassInfo &info,
                                                                     unsigned thread_index, unsigned subpass)
 {
-	auto *fb = &device.request_framebuffer(info);
-	auto cmd = device.request_secondary_command_buffer_for_thread(thread_index, fb, subpass);
+	auto &rp = device.request_render_pass(info, true);
+	auto cmd = device.request_secondary_command_buffer_for_thread(thread_index, &rp, subpass);
 	cmd->init_surface_transform(info);
 	cmd->begin_graphics();
 
-	cmd->framebuffer = fb;
-	cmd->pipeline_state.compatible_render_pass = &fb->get_compatible_render_pass();
-	cmd->actual_render_pass = &device.request_render_pass(info, false);
+	Framebuffer::compute_dimensions(info, cmd->framebuffer_width, cmd->framebuffer_height);
+	cmd->pipeline_state.compatible_render_pass = &rp;
+	cmd->actual_render_pass = rp.uses_dynamic_rendering() ? &rp : &device.request_render_pass(info, false);
 
 	unsigned i;
 	for (i = 0; i < info.num_color_attachments; i++)
@@ -815,7 +934,7 @@ CommandBufferHandle CommandBuffer::request_secondary_command_buffer(Device &devi
 	if (info.depth_stencil)
 		cmd->framebuffer_attachments[i++] = info.depth_stencil;
 
-	cmd->init_viewport_scissor(info, fb);
+	cmd->init_viewport_scissor(info);
 	cmd->pipeline_state.subpass_index = subpass;
 	cmd->current_contents = VK_SUBPASS_CONTENTS_INLINE;
 
@@ -824,13 +943,15 @@ CommandBufferHandle CommandBuffer::request_secondary_command_buffer(Device &devi
 
 CommandBufferHandle CommandBuffer::request_secondary_command_buffer(unsigned thread_index_, unsigned subpass_)
 {
-	VK_ASSERT(framebuffer);
+	VK_ASSERT(actual_render_pass);
 	VK_ASSERT(!is_secondary);
 
-	auto secondary_cmd = device->request_secondary_command_buffer_for_thread(thread_index_, framebuffer, subpass_);
+	auto secondary_cmd = device->request_secondary_command_buffer_for_thread(
+			thread_index_, pipeline_state.compatible_render_pass, subpass_);
 	secondary_cmd->begin_graphics();
 
-	secondary_cmd->framebuffer = framebuffer;
+	secondary_cmd->framebuffer_width = framebuffer_width;
+	secondary_cmd->framebuffer_height = framebuffer_height;
 	secondary_cmd->pipeline_state.compatible_render_pass = pipeline_state.compatible_render_pass;
 	secondary_cmd->actual_render_pass = actual_render_pass;
 	memcpy(secondary_cmd->framebuffer_attachments, framebuffer_attachments, sizeof(framebuffer_attachments));
@@ -838,6 +959,7 @@ CommandBufferHandle CommandBuffer::request_secondary_command_buffer(unsigned thr
 	secondary_cmd->pipeline_state.subpass_index = subpass_;
 	secondary_cmd->viewport = viewport;
 	secondary_cmd->scissor = scissor;
+	secondary_cmd->current_framebuffer_surface_transform = current_framebuffer_surface_transform;
 	secondary_cmd->current_contents = VK_SUBPASS_CONTENTS_INLINE;
 
 	return secondary_cmd;
@@ -855,11 +977,12 @@ void CommandBuffer::submit_secondary(CommandBufferHandle secondary)
 
 void CommandBuffer::next_subpass(VkSubpassContents contents)
 {
-	VK_ASSERT(framebuffer);
 	VK_ASSERT(pipeline_state.compatible_render_pass);
 	VK_ASSERT(actual_render_pass);
 	pipeline_state.subpass_index++;
 	VK_ASSERT(pipeline_state.subpass_index < actual_render_pass->get_num_subpasses());
+	VK_ASSERT(!bundle_capture);
+	flush_draw_batch();
 	table.vkCmdNextSubpass(cmd, contents);
 	current_contents = contents;
 	begin_graphics();
@@ -918,14 +1041,27 @@ void CommandBuffer::init_surface_transform(const RenderPassInfo &info)
 
 void CommandBuffer::begin_render_pass(const RenderPassInfo &info, VkSubpassContents contents)
 {
-	VK_ASSERT(!framebuffer);
 	VK_ASSERT(!pipeline_state.compatible_render_pass);
 	VK_ASSERT(!actual_render_pass);
 
-	framebuffer = &device->request_framebuffer(info);
+	// Events cannot be signalled inside the render pass.
+	mark_split_barrier_work();
+
+	auto &compatible_render_pass = device->request_render_pass(info, true);
+	bool dynamic_rendering = compatible_render_pass.uses_dynamic_rendering();
+
+	// Dynamic rendering needs neither a VkFramebuffer nor a render pass with concrete load/store ops.
+	const Framebuffer *framebuffer = nullptr;
+	if (dynamic_rendering)
+		Framebuffer::compute_dimensions(info, framebuffer_width, framebuffer_height);
+	else
+	{
+		framebuffer = &device->request_framebuffer(info);
+		framebuffer_width = framebuffer->get_width();
+		framebuffer_height = framebuffer->get_height();
+	}
+
 	init_surface_transform(info);
-	pipeline_state.compatible_render_pass = &framebuffer->get_compatible_render_pass();
-	actual_render_pass = &device->request_render_pass(info, false);
 	pipeline_state.subpass_index = 0;
 	framebuffer_is_multiview = info.num_layers > 1;
 
@@ -936,59 +1072,113 @@ void CommandBuffer::begin_render_pass(const RenderPassInfo &info, VkSubpassConte
 	if (info.depth_stencil)
 		framebuffer_attachments[att++] = info.depth_stencil;
 
-	init_viewport_scissor(info, framebuffer);
+	init_viewport_scissor(info);
 
-	VkClearValue clear_values[VULKAN_NUM_ATTACHMENTS + 1];
-	unsigned num_clear_values = 0;
+	// In the render pass interface, we pretend we are rendering with normal
+	// un-rotated coordinates.
+	VkRect2D render_area = scissor;
+	rect2d_transform_xy(render_area, current_framebuffer_surface_transform,
+	                    framebuffer_width, framebuffer_height);
 
 	for (unsigned i = 0; i < info.num_color_attachments; i++)
-	{
-		VK_ASSERT(info.color_attachments[i]);
-		if (info.clear_attachments & (1u << i))
-		{
-			clear_values[i].color = info.clear_color[i];
-			num_clear_values = i + 1;
-		}
-
 		if (info.color_attachments[i]->get_image().is_swapchain_image())
 			swapchain_touch_in_stages(VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
-	}
 
-	if (info.depth_stencil && (info.op_flags & RENDER_PASS_OP_CLEAR_DEPTH_STENCIL_BIT) != 0)
+	pipeline_state.compatible_render_pass = &compatible_render_pass;
+
+	if (dynamic_rendering)
 	{
-		clear_values[info.num_color_attachments].depthStencil = info.clear_depth_stencil;
-		num_clear_values = info.num_color_attachments + 1;
+		actual_render_pass = &compatible_render_pass;
+		begin_dynamic_rendering(info, render_area, contents);
 	}
+	else
+	{
+		actual_render_pass = &device->request_render_pass(info, false);
 
-	VkRenderPassBeginInfo begin_info = { VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO };
-	begin_info.renderPass = actual_render_pass->get_render_pass();
-	begin_info.framebuffer = framebuffer->get_framebuffer();
-	begin_info.renderArea = scissor;
-	begin_info.clearValueCount = num_clear_values;
-	begin_info.pClearValues = clear_values;
+		VkClearValue clear_values[VULKAN_NUM_ATTACHMENTS + 1];
+		unsigned num_clear_values = 0;
 
-	// In the render pass interface, we pretend we are rendering with normal
-	// un-rotated coordinates.
-	rect2d_transform_xy(begin_info.renderArea, current_framebuffer_surface_transform,
-	                    framebuffer->get_width(), framebuffer->get_height());
+		for (unsigned i = 0; i < info.num_color_attachments; i++)
+		{
+			VK_ASSERT(info.color_attachments[i]);
+			if (info.clear_attachments & (1u << i))
+			{
+				clear_values[i].color = info.clear_color[i];
+				num_clear_values = i + 1;
+			}
+		}
 
-	table.vkCmdBeginRenderPass(cmd, &begin_info, contents);
+		if (info.depth_stencil && (info.op_flags & RENDER_PASS_OP_CLEAR_DEPTH_STENCIL_BIT) != 0)
+		{
+			clear_values[info.num_color_attachments].depthStencil = info.clear_depth_stencil;
+			num_clear_values = info.num_color_attachments + 1;
+		}
+
+		VkRenderPassBeginInfo begin_info = { VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO };
+		begin_info.renderPass = actual_render_pass->get_render_pass();
+		begin_info.framebuffer = framebuffer->get_framebuffer();
+		begin_info.renderArea = render_area;
+		begin_info.clearValueCount = num_clear_values;
+		begin_info.pClearValues = clear_values;
+
+		table.vkCmdBeginRenderPass(cmd, &begin_info, contents);
+	}
 
 	current_contents = contents;
 	begin_graphics();
 }
 
+void CommandBuffer::begin_dynamic_rendering(const RenderPassInfo &info, const VkRect2D &render_area,
+                                            VkSubpassContents contents)
+{
+	DynamicRenderingState state;
+	actual_render_pass->setup_dynamic_rendering(info, state);
+
+	// These are the implicit transitions of the render pass, so they cannot be deferred by barrier batching.
+	if (state.num_begin_barriers)
+	{
+		VkDependencyInfo dep = { VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+		dep.imageMemoryBarrierCount = state.num_begin_barriers;
+		dep.pImageMemoryBarriers = state.begin_barriers;
+		table.vkCmdPipelineBarrier2(cmd, &dep);
+	}
+
+	num_dynamic_rendering_end_barriers = state.num_end_barriers;
+	memcpy(dynamic_rendering_end_barriers, state.end_barriers,
+	       state.num_end_barriers * sizeof(*state.end_barriers));
+
+	state.info.renderArea = render_area;
+	if (contents == VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS)
+		state.info.flags |= VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT;
+	table.vkCmdBeginRendering(cmd, &state.info);
+}
+
 void CommandBuffer::end_render_pass()
 {
-	VK_ASSERT(framebuffer);
 	VK_ASSERT(actual_render_pass);
 	VK_ASSERT(pipeline_state.compatible_render_pass);
+	VK_ASSERT(!bundle_capture);
 
-	table.vkCmdEndRenderPass(cmd);
+	flush_draw_batch();
+
+	bool dynamic_rendering = actual_render_pass->uses_dynamic_rendering();
+	if (dynamic_rendering)
+		table.vkCmdEndRendering(cmd);
+	else
+		table.vkCmdEndRenderPass(cmd);
 
-	framebuffer = nullptr;
 	actual_render_pass = nullptr;
 	pipeline_state.compatible_render_pass = nullptr;
+
+	if (dynamic_rendering && num_dynamic_rendering_end_barriers)
+	{
+		VkDependencyInfo dep = { VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+		dep.imageMemoryBarrierCount = num_dynamic_rendering_end_barriers;
+		dep.pImageMemoryBarriers = dynamic_rendering_end_barriers;
+		table.vkCmdPipelineBarrier2(cmd, &dep);
+		num_dynamic_rendering_end_barriers = 0;
+	}
+
 	begin_compute();
 }
 
@@ -1482,6 +1672,14 @@ Pipeline CommandBuffer::build_graphics_pipeline(Device *device, const DeferredPi
 	pipe.renderPass = compile.compatible_render_pass->get_render_pass();
 	pipe.subpass = compile.subpass_index;
 
+	VkPipelineRenderingCreateInfo rendering_info;
+	if (compile.compatible_render_pass->uses_dynamic_rendering())
+	{
+		rendering_info = compile.compatible_render_pass->get_pipeline_rendering_info();
+		rendering_info.pNext = nullptr;
+		pipe.pNext = &rendering_info;
+	}
+
 	pipe.pViewportState = &vp;
 	pipe.pDynamicState = &dyn;
 	pipe.pColorBlendState = &blend;
@@ -1641,7 +1839,7 @@ void CommandBuffer::update_hash_graphics_pipeline(DeferredPipelineCompile &compi
 	if (out_active_vbos)
 		*out_active_vbos = active_vbos;
 
-	h.u64(compile.compatible_render_pass->get_hash());
+	h.u64(compile.compatible_render_pass->get_pipeline_compatibility_hash());
 	h.u32(compile.subpass_index);
 	h.u64(compile.program->get_hash());
 	h.u64(compile.layout->get_hash());
@@ -1717,6 +1915,8 @@ bool CommandBuffer::flush_graphics_pipeline(bool synchronous)
 void CommandBuffer::bind_pipeline(VkPipelineBindPoint bind_point, VkPipeline pipeline, uint32_t active_dynamic_state)
 {
 	table.vkCmdBindPipeline(cmd, bind_point, pipeline);
+	if (bundle_capture && bind_point == VK_PIPELINE_BIND_POINT_GRAPHICS)
+		bundle_capture->record_bind_pipeline(pipeline);
 
 	// If some dynamic state is static in the pipeline it clobbers the dynamic state.
 	// As a performance optimization don't clobber everything.
@@ -1726,7 +1926,7 @@ void CommandBuffer::bind_pipeline(VkPipelineBindPoint bind_point, VkPipeline pip
 
 VkPipeline CommandBuffer::flush_compute_state(bool synchronous)
 {
-	VK_ASSERT(!barrier_batch.active);
+	VK_ASSERT(!barrier_batch.active || barrier_batch.split);
 	if (!pipeline_state.program)
 		return VK_NULL_HANDLE;
 	VK_ASSERT(pipeline_state.layout);
@@ -1780,7 +1980,9 @@ VkPipeline CommandBuffer::flush_compute_state(bool synchronous)
 
 VkPipeline CommandBuffer::flush_render_state(bool synchronous)
 {
-	VK_ASSERT(!barrier_batch.active);
+	VK_ASSERT(!barrier_batch.active || barrier_batch.split);
+	// Batched draws must observe the state they were recorded with.
+	flush_draw_batch();
 	if (!pipeline_state.program)
 		return VK_NULL_HANDLE;
 	VK_ASSERT(pipeline_state.layout);
@@ -1837,34 +2039,46 @@ VkPipeline CommandBuffer::flush_render_state(bool synchronous)
 				table.vkCmdPushConstants(cmd, current_pipeline_layout, range.stageFlags,
 										 0, range.size,
 										 bindings.push_constant_data);
+				if (bundle_capture)
+				{
+					bundle_capture->record_push_constants(current_pipeline_layout, range.stageFlags,
+					                                      bindings.push_constant_data, range.size);
+				}
 			}
 		}
 	}
 
 	if (get_and_clear(COMMAND_BUFFER_DIRTY_VIEWPORT_BIT))
 	{
+		auto tmp_viewport = viewport;
 		if (current_framebuffer_surface_transform != VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR)
 		{
-			auto tmp_viewport = viewport;
 			viewport_transform_xy(tmp_viewport, current_framebuffer_surface_transform,
-			                      framebuffer->get_width(), framebuffer->get_height());
-			table.vkCmdSetViewport(cmd, 0, 1, &tmp_viewport);
+			                      framebuffer_width, framebuffer_height);
 		}
-		else
-			table.vkCmdSetViewport(cmd, 0, 1, &viewport);
+		table.vkCmdSetViewport(cmd, 0, 1, &tmp_viewport);
+		if (bundle_capture)
+			bundle_capture->record_viewport(tmp_viewport);
 	}
 
 	if (get_and_clear(COMMAND_BUFFER_DIRTY_SCISSOR_BIT))
 	{
 		auto tmp_scissor = scissor;
 		rect2d_transform_xy(tmp_scissor, current_framebuffer_surface_transform,
-							framebuffer->get_width(), framebuffer->get_height());
+							framebuffer_width, framebuffer_height);
 		rect2d_clip(tmp_scissor);
 		table.vkCmdSetScissor(cmd, 0, 1, &tmp_scissor);
+		if (bundle_capture)
+			bundle_capture->record_scissor(tmp_scissor);
 	}
 
 	if (pipeline_state.static_state.state.depth_bias_enable && get_and_clear(COMMAND_BUFFER_DIRTY_DEPTH_BIAS_BIT))
+	{
 		table.vkCmdSetDepthBias(cmd, dynamic_state.depth_bias_constant, 0.0f, dynamic_state.depth_bias_slope);
+		if (bundle_capture)
+			bundle_capture->record_depth_bias(dynamic_state.depth_bias_constant, dynamic_state.depth_bias_slope);
+	}
+
 	if (pipeline_state.static_state.state.stencil_test && get_and_clear(COMMAND_BUFFER_DIRTY_STENCIL_REFERENCE_BIT))
 	{
 		table.vkCmdSetStencilCompareMask(cmd, VK_STENCIL_FACE_FRONT_BIT, dynamic_state.front_compare_mask);
@@ -1873,6 +2087,15 @@ VkPipeline CommandBuffer::flush_render_state(bool synchronous)
 		table.vkCmdSetStencilCompareMask(cmd, VK_STENCIL_FACE_BACK_BIT, dynamic_state.back_compare_mask);
 		table.vkCmdSetStencilReference(cmd, VK_STENCIL_FACE_BACK_BIT, dynamic_state.back_reference);
 		table.vkCmdSetStencilWriteMask(cmd, VK_STENCIL_FACE_BACK_BIT, dynamic_state.back_write_mask);
+
+		if (bundle_capture)
+		{
+			const uint32_t stencil_state[] = {
+				dynamic_state.front_compare_mask, dynamic_state.front_reference, dynamic_state.front_write_mask,
+				dynamic_state.back_compare_mask, dynamic_state.back_reference, dynamic_state.back_write_mask,
+			};
+			bundle_capture->record_stencil(stencil_state);
+		}
 	}
 
 	uint32_t update_vbo_mask = dirty_vbos & active_vbos;
@@ -1882,6 +2105,14 @@ VkPipeline CommandBuffer::flush_render_state(bool synchronous)
 			VK_ASSERT(vbo.buffers[i] != VK_NULL_HANDLE);
 #endif
 		table.vkCmdBindVertexBuffers(cmd, binding, binding_count, vbo.buffers + binding, vbo.offsets + binding);
+
+		if (bundle_capture)
+		{
+			for (unsigned i = binding; i < binding + binding_count; i++)
+				bundle_capture->watch_cookie(vbo.cookies[i]);
+			bundle_capture->record_bind_vertex_buffers(binding, binding_count,
+			                                           vbo.buffers + binding, vbo.offsets + binding);
+		}
 	});
 	dirty_vbos &= ~update_vbo_mask;
 
@@ -1908,7 +2139,6 @@ VkPipeline CommandBuffer::get_current_graphics_pipeline()
 
 void CommandBuffer::wait_events(uint32_t count, const PipelineEvent *events, const VkDependencyInfo *deps)
 {
-	VK_ASSERT(!framebuffer);
 	VK_ASSERT(!actual_render_pass);
 
 	Util::SmallVector<VkEvent> vk_events;
@@ -1929,7 +2159,6 @@ void CommandBuffer::wait_events(uint32_t count, const PipelineEvent *events, con
 
 PipelineEvent CommandBuffer::signal_event(const VkDependencyInfo &dep)
 {
-	VK_ASSERT(!framebuffer);
 	VK_ASSERT(!actual_render_pass);
 	auto event = device->begin_signal_event();
 
@@ -1941,7 +2170,7 @@ PipelineEvent CommandBuffer::signal_event(const VkDependencyInfo &dep)
 void CommandBuffer::set_vertex_attrib(uint32_t attrib, uint32_t binding, VkFormat format, VkDeviceSize offset)
 {
 	VK_ASSERT(attrib < VULKAN_NUM_VERTEX_ATTRIBS);
-	VK_ASSERT(framebuffer);
+	VK_ASSERT(actual_render_pass);
 
 	auto &attr = pipeline_state.attribs[attrib];
 
@@ -1964,17 +2193,25 @@ void CommandBuffer::set_index_buffer(const Buffer &buffer, VkDeviceSize offset,
 		return;
 	}
 
+	flush_draw_batch();
 	index_state.buffer = buffer.get_buffer();
 	index_state.offset = offset;
 	index_state.index_type = index_type;
+	index_state.cookie = buffer.get_cookie();
 	table.vkCmdBindIndexBuffer(cmd, buffer.get_buffer(), offset, index_type);
+
+	if (bundle_capture)
+	{
+		bundle_capture->watch_cookie(index_state.cookie);
+		bundle_capture->record_bind_index_buffer(index_state.buffer, offset, index_type);
+	}
 }
 
 void CommandBuffer::set_vertex_binding(uint32_t binding, const Buffer &buffer, VkDeviceSize offset, VkDeviceSize stride,
                                        VkVertexInputRate step_rate)
 {
 	VK_ASSERT(binding < VULKAN_NUM_VERTEX_BUFFERS);
-	VK_ASSERT(framebuffer);
+	VK_ASSERT(actual_render_pass);
 
 	VkBuffer vkbuffer = buffer.get_buffer();
 	if (vbo.buffers[binding] != vkbuffer || vbo.offsets[binding] != offset)
@@ -1984,13 +2221,14 @@ void CommandBuffer::set_vertex_binding(uint32_t binding, const Buffer &buffer, V
 
 	vbo.buffers[binding] = vkbuffer;
 	vbo.offsets[binding] = offset;
+	vbo.cookies[binding] = buffer.get_cookie();
 	pipeline_state.strides[binding] = stride;
 	pipeline_state.input_rates[binding] = step_rate;
 }
 
 void CommandBuffer::set_viewport(const VkViewport &viewport_)
 {
-	VK_ASSERT(framebuffer);
+	VK_ASSERT(actual_render_pass);
 	viewport = viewport_;
 	set_dirty(COMMAND_BUFFER_DIRTY_VIEWPORT_BIT);
 }
@@ -2002,7 +2240,7 @@ const VkViewport &CommandBuffer::get_viewport() const
 
 void CommandBuffer::set_scissor(const VkRect2D &rect)
 {
-	VK_ASSERT(framebuffer);
+	VK_ASSERT(actual_render_pass);
 	VK_ASSERT(rect.offset.x >= 0);
 	VK_ASSERT(rect.offset.y >= 0);
 	scissor = rect;
@@ -2061,6 +2299,7 @@ CommandBuffer::bake_and_set_program_group(Program *const *programs, unsigned num
 										  const ExecutionSetSpecializationConstants *spec_constants,
                                           const PipelineLayout *layout)
 {
+	flush_draw_batch();
 	current_pipeline = {};
 	pipeline_state.program = nullptr;
 	set_dirty(COMMAND_BUFFER_DIRTY_PIPELINE_BIT);
@@ -2073,8 +2312,8 @@ CommandBuffer::bake_and_set_program_group(Program *const *programs, unsigned num
 #ifdef VULKAN_DEBUG
 	for (unsigned i = 0; i < num_programs; i++)
 	{
-		VK_ASSERT((framebuffer && programs[i]->get_shader(ShaderStage::Fragment)) ||
-		          (!framebuffer && programs[i]->get_shader(ShaderStage::Compute)));
+		VK_ASSERT((actual_render_pass && programs[i]->get_shader(ShaderStage::Fragment)) ||
+		          (!actual_render_pass && programs[i]->get_shader(ShaderStage::Compute)));
 	}
 #endif
 
@@ -2172,8 +2411,8 @@ void CommandBuffer::set_program(Program *program)
 	if (!program)
 		return;
 
-	VK_ASSERT((framebuffer && pipeline_state.program->get_shader(ShaderStage::Fragment)) ||
-	          (!framebuffer && pipeline_state.program->get_shader(ShaderStage::Compute)));
+	VK_ASSERT((actual_render_pass && pipeline_state.program->get_shader(ShaderStage::Fragment)) ||
+	          (!actual_render_pass && pipeline_state.program->get_shader(ShaderStage::Compute)));
 
 	set_program_layout(program->get_pipeline_layout());
 }
@@ -2243,6 +2482,8 @@ void CommandBuffer::set_program_layout(const PipelineLayout *layout)
 void *CommandBuffer::allocate_constant_data(unsigned set, unsigned binding, VkDeviceSize size)
 {
 	VK_ASSERT(size <= VULKAN_MAX_UBO_SIZE);
+	// Transient allocations are recycled, so they cannot be referenced by a bundle.
+	VK_ASSERT(!bundle_capture);
 	auto data = ubo_block.allocate(size);
 	if (!data.host)
 	{
@@ -2255,6 +2496,7 @@ void *CommandBuffer::allocate_constant_data(unsigned set, unsigned binding, VkDe
 
 void *CommandBuffer::allocate_index_data(VkDeviceSize size, VkIndexType index_type)
 {
+	VK_ASSERT(!bundle_capture);
 	auto data = ibo_block.allocate(size);
 	if (!data.host)
 	{
@@ -2291,6 +2533,7 @@ void *CommandBuffer::update_buffer(const Buffer &buffer, VkDeviceSize offset, Vk
 void CommandBuffer::update_buffer_inline(const Buffer &buffer, VkDeviceSize offset, VkDeviceSize size, const void *data)
 {
 	VK_ASSERT(size <= 64 * 1024);
+	mark_split_barrier_work();
 	table.vkCmdUpdateBuffer(cmd, buffer.get_buffer(), offset, size, data);
 }
 
@@ -2346,6 +2589,7 @@ void *CommandBuffer::update_image(const Image &image, uint32_t row_length, uint3
 void *CommandBuffer::allocate_vertex_data(unsigned binding, VkDeviceSize size, VkDeviceSize stride,
                                           VkVertexInputRate step_rate)
 {
+	VK_ASSERT(!bundle_capture);
 	auto data = vbo_block.allocate(size);
 	if (!data.host)
 	{
@@ -2398,9 +2642,22 @@ void CommandBuffer::set_uniform_buffer(unsigned set, unsigned binding, const Buf
 		b.buffer_addr_buffer.range = range;
 		b.buffer_addr_buffer.format = VK_FORMAT_UNDEFINED;
 	}
-	else if (buffer.get_cookie() != bindings.cookies[set][binding] ||
-	         b.buffer.range != range || b.buffer.offset != offset)
+	else
 	{
+		// Dynamic uniform buffers need an explicit range.
+		if (range == VK_WHOLE_SIZE)
+			range = buffer.get_create_info().size - offset;
+
+		if (buffer.get_cookie() == bindings.cookies[set][binding] && b.buffer.range == range)
+		{
+			if (b.buffer.offset != offset)
+			{
+				b.buffer.offset = offset;
+				dirty_sets_dynamic |= 1u << set;
+			}
+			return;
+		}
+
 		b.buffer = { buffer.get_buffer(), offset, range };
 	}
 
@@ -2769,9 +3026,34 @@ void CommandBuffer::flush_descriptor_binds(const VkDescriptorSet *sets,
 	if (!set_count)
 		return;
 
+	// Offsets are ordered by set, then binding, then array element.
+	uint32_t dynamic_offsets[VULKAN_NUM_DYNAMIC_UBOS];
+	uint32_t dynamic_offset_counts[VULKAN_NUM_DESCRIPTOR_SETS] = {};
+	uint32_t num_dynamic_offsets = 0;
+	uint32_t dynamic_mask = pipeline_state.layout->get_dynamic_uniform_buffer_set_mask();
+	dynamic_mask &= ((1u << set_count) - 1u) << first_set;
+
+	for_each_bit(dynamic_mask, [&](uint32_t set) {
+		auto &set_layout = pipeline_state.layout->get_resource_layout().sets[set];
+		uint32_t first_offset = num_dynamic_offsets;
+		for_each_bit(set_layout.uniform_buffer_mask, [&](uint32_t binding) {
+			unsigned array_size = set_layout.meta[binding].array_size;
+			for (unsigned i = 0; i < array_size; i++)
+			{
+				VK_ASSERT(num_dynamic_offsets < VULKAN_NUM_DYNAMIC_UBOS);
+				VK_ASSERT(bindings.bindings[set][binding + i].buffer.offset <= UINT32_MAX);
+				dynamic_offsets[num_dynamic_offsets++] = uint32_t(bindings.bindings[set][binding + i].buffer.offset);
+			}
+		});
+		dynamic_offset_counts[set] = num_dynamic_offsets - first_offset;
+	});
+
 	table.vkCmdBindDescriptorSets(
 			cmd, actual_render_pass ? VK_PIPELINE_BIND_POINT_GRAPHICS : VK_PIPELINE_BIND_POINT_COMPUTE,
-			current_pipeline_layout, first_set, set_count, sets, 0, nullptr);
+			current_pipeline_layout, first_set, set_count, sets, num_dynamic_offsets, dynamic_offsets);
+
+	if (bundle_capture && actual_render_pass)
+		capture_descriptor_binds(first_set, set_count, dynamic_offsets, dynamic_offset_counts);
 
 	set_count = 0;
 }
@@ -2813,6 +3095,62 @@ void CommandBuffer::rebind_descriptor_offset(uint32_t set, uint32_t &first_set,
 	set_count++;
 }
 
+Hash CommandBuffer::hash_descriptor_set(uint32_t set) const
+{
+	// Resources are identified by cookie rather than by Vulkan handle since handles can be recycled
+	// after destruction. Cookies are unique for the lifetime of the device.
+	auto &set_layout = pipeline_state.layout->get_resource_layout().sets[set];
+	bool dynamic_ubo = (pipeline_state.layout->get_dynamic_uniform_buffer_set_mask() & (1u << set)) != 0;
+	Hasher h;
+	h.u32(set_layout.fp_mask);
+
+	auto for_each_array_element = [&](uint32_t mask, const auto &func) {
+		for_each_bit(mask, [&](uint32_t binding) {
+			unsigned array_size = set_layout.meta[binding].array_size;
+			for (unsigned i = 0; i < array_size; i++)
+				func(binding + i);
+		});
+	};
+
+	// UBOs and SSBOs. Dynamic UBOs are written with offset 0, the offset is only supplied when binding.
+	for_each_array_element(set_layout.uniform_buffer_mask | set_layout.storage_buffer_mask, [&](uint32_t binding) {
+		h.u64(bindings.cookies[set][binding]);
+		if (!dynamic_ubo || (set_layout.storage_buffer_mask & (1u << binding)) != 0)
+			h.u64(bindings.bindings[set][binding].buffer.offset);
+		h.u64(bindings.bindings[set][binding].buffer.range);
+	});
+
+	// RTAS and texel buffers
+	for_each_array_element(set_layout.rtas_mask |
+	                       set_layout.sampled_texel_buffer_mask |
+	                       set_layout.storage_texel_buffer_mask, [&](uint32_t binding) {
+		h.u64(bindings.cookies[set][binding]);
+	});
+
+	// Sampled images
+	for_each_array_element(set_layout.sampled_image_mask, [&](uint32_t binding) {
+		h.u64(bindings.cookies[set][binding]);
+		if ((set_layout.immutable_sampler_mask & (1u << binding)) == 0)
+			h.u64(bindings.secondary_cookies[set][binding]);
+		h.u32(bindings.bindings[set][binding].image.fp.imageLayout);
+	});
+
+	// Separate images, storage images and input attachments
+	for_each_array_element(set_layout.separate_image_mask |
+	                       set_layout.storage_image_mask |
+	                       set_layout.input_attachment_mask, [&](uint32_t binding) {
+		h.u64(bindings.cookies[set][binding]);
+		h.u32(bindings.bindings[set][binding].image.fp.imageLayout);
+	});
+
+	// Separate samplers
+	for_each_array_element(set_layout.sampler_mask & ~set_layout.immutable_sampler_mask, [&](uint32_t binding) {
+		h.u64(bindings.secondary_cookies[set][binding]);
+	});
+
+	return h.get();
+}
+
 void CommandBuffer::validate_descriptor_binds(uint32_t set)
 {
 #ifdef VULKAN_DEBUG
@@ -2918,6 +3256,13 @@ void CommandBuffer::push_descriptor_set(uint32_t set)
 	table.vkCmdPushDescriptorSetWithTemplate(
 		cmd, update_template,
 		pipeline_state.layout->get_layout(), set, bindings.bindings[set]);
+
+	if (bundle_capture)
+	{
+		capture_set_cookies(set);
+		bundle_capture->record_push_descriptor_set(pipeline_state.layout->get_layout(), update_template,
+		                                           set, bindings.bindings[set]);
+	}
 }
 
 CommandBuffer::DescriptorSlice CommandBuffer::allocate_descriptor_slice(VkDeviceSize size, VkDeviceSize align)
@@ -3431,11 +3776,30 @@ void CommandBuffer::flush_descriptor_set(uint32_t set, VkDescriptorSet *sets,
 	validate_descriptor_binds(set);
 #endif
 
-	auto vk_set = pipeline_state.layout->get_allocator(set)->request_descriptor_set(thread_index, device->frame_context_index);
+	// Sets with identical contents are shared, so rebinding the same resources skips the descriptor update.
+	auto allocated = pipeline_state.layout->get_allocator(set)->find(thread_index, hash_descriptor_set(set));
+	auto vk_set = allocated.first;
 
-	VkDescriptorUpdateTemplate update_template = pipeline_state.layout->get_update_template(set);
-	VK_ASSERT(update_template);
-	table.vkUpdateDescriptorSetWithTemplate(device->get_device(), vk_set, update_template, bindings.bindings[set]);
+	if (!allocated.second)
+	{
+		VkDescriptorUpdateTemplate update_template = pipeline_state.layout->get_update_template(set);
+		VK_ASSERT(update_template);
+
+		if ((pipeline_state.layout->get_dynamic_uniform_buffer_set_mask() & (1u << set)) != 0)
+		{
+			ResourceBinding dynamic_bindings[VULKAN_NUM_BINDINGS];
+			memcpy(dynamic_bindings, bindings.bindings[set], sizeof(dynamic_bindings));
+			auto &set_layout = layout.sets[set];
+			for_each_bit(set_layout.uniform_buffer_mask, [&](uint32_t binding) {
+				unsigned array_size = set_layout.meta[binding].array_size;
+				for (unsigned i = 0; i < array_size; i++)
+					dynamic_bindings[binding + i].buffer.offset = 0;
+			});
+			table.vkUpdateDescriptorSetWithTemplate(device->get_device(), vk_set, update_template, dynamic_bindings);
+		}
+		else
+			table.vkUpdateDescriptorSetWithTemplate(device->get_device(), vk_set, update_template, bindings.bindings[set]);
+	}
 	sets[set_count++] = vk_set;
 	allocated_sets[set] = vk_set;
 }
@@ -3505,6 +3869,14 @@ void CommandBuffer::flush_descriptor_sets()
 	uint32_t first_set = 0;
 	uint32_t set_count = 0;
 
+	if (dirty_sets_dynamic)
+	{
+		uint32_t dynamic_mask = pipeline_state.layout->get_dynamic_uniform_buffer_set_mask();
+		dirty_sets_rebind |= dirty_sets_dynamic & dynamic_mask;
+		dirty_sets_realloc |= dirty_sets_dynamic & ~dynamic_mask;
+		dirty_sets_dynamic = 0;
+	}
+
 	dirty_sets_rebind |= dirty_sets_realloc;
 	uint32_t set_update_mask = layout.descriptor_set_mask & dirty_sets_rebind;
 
@@ -3575,6 +3947,12 @@ void CommandBuffer::draw(uint32_t vertex_count, uint32_t instance_count, uint32_
 	{
 		VK_ASSERT(pipeline_state.program->get_shader(ShaderStage::Vertex) != nullptr);
 		table.vkCmdDraw(cmd, vertex_count, instance_count, first_vertex, first_instance);
+
+		if (bundle_capture)
+		{
+			const uint32_t params[] = { vertex_count, instance_count, first_vertex, first_instance };
+			bundle_capture->record_draw(CommandBundle::Op::Draw, params, 4);
+		}
 	}
 	else
 		LOGE("Failed to flush render state, draw call will be dropped.\n");
@@ -3585,10 +3963,45 @@ void CommandBuffer::draw_indexed(uint32_t index_count, uint32_t instance_count,
 {
 	VK_ASSERT(!is_compute);
 	VK_ASSERT(index_state.buffer != VK_NULL_HANDLE);
-	if (flush_render_state(true) != VK_NULL_HANDLE)
+
+	if (draw_batch.enabled && !bundle_capture &&
+	    (first_instance == 0 || device->get_device_features().enabled_features.drawIndirectFirstInstance))
+	{
+		if (!flush_batched_render_state())
+		{
+			LOGE("Failed to flush render state, draw call will be dropped.\n");
+			return;
+		}
+
+		VK_ASSERT(pipeline_state.program->get_shader(ShaderStage::Vertex) != nullptr);
+
+		auto data = indirect_block.allocate(sizeof(VkDrawIndexedIndirectCommand));
+		if (!data.host)
+		{
+			device->request_indirect_block(indirect_block, sizeof(VkDrawIndexedIndirectCommand));
+			data = indirect_block.allocate(sizeof(VkDrawIndexedIndirectCommand));
+		}
+
+		auto *draw = reinterpret_cast<VkDrawIndexedIndirectCommand *>(data.host);
+		draw->indexCount = index_count;
+		draw->instanceCount = instance_count;
+		draw->firstIndex = first_index;
+		draw->vertexOffset = vertex_offset;
+		draw->firstInstance = first_instance;
+		append_draw_batch(data.buffer->get_buffer(), data.offset, 1, sizeof(VkDrawIndexedIndirectCommand));
+	}
+	else if (flush_render_state(true) != VK_NULL_HANDLE)
 	{
 		VK_ASSERT(pipeline_state.program->get_shader(ShaderStage::Vertex) != nullptr);
 		table.vkCmdDrawIndexed(cmd, index_count, instance_count, first_index, vertex_offset, first_instance);
+
+		if (bundle_capture)
+		{
+			const uint32_t params[] = {
+				index_count, instance_count, first_index, uint32_t(vertex_offset), first_instance,
+			};
+			bundle_capture->record_draw(CommandBundle::Op::DrawIndexed, params, 5);
+		}
 	}
 	else
 		LOGE("Failed to flush render state, draw call will be dropped.\n");
@@ -3608,6 +4021,8 @@ void CommandBuffer::draw_mesh_tasks(uint32_t tasks_x, uint32_t tasks_y, uint32_t
 	{
 		VK_ASSERT(pipeline_state.program->get_shader(ShaderStage::Mesh) != nullptr);
 		table.vkCmdDrawMeshTasksEXT(cmd, tasks_x, tasks_y, tasks_z);
+		if (bundle_capture)
+			bundle_capture->invalidate();
 	}
 	else
 		LOGE("Failed to flush render state, draw call will be dropped.\n");
@@ -3628,6 +4043,8 @@ void CommandBuffer::draw_mesh_tasks_indirect(const Buffer &buffer, VkDeviceSize
 	{
 		VK_ASSERT(pipeline_state.program->get_shader(ShaderStage::Mesh) != nullptr);
 		table.vkCmdDrawMeshTasksIndirectEXT(cmd, buffer.get_buffer(), offset, draw_count, stride);
+		if (bundle_capture)
+			bundle_capture->invalidate();
 	}
 	else
 		LOGE("Failed to flush render state, draw call will be dropped.\n");
@@ -3651,6 +4068,8 @@ void CommandBuffer::draw_mesh_tasks_multi_indirect(const Buffer &buffer, VkDevic
 		table.vkCmdDrawMeshTasksIndirectCountEXT(cmd, buffer.get_buffer(), offset,
 		                                         count.get_buffer(), count_offset,
 		                                         draw_count, stride);
+		if (bundle_capture)
+			bundle_capture->invalidate();
 	}
 	else
 		LOGE("Failed to flush render state, draw call will be dropped.\n");
@@ -3664,6 +4083,13 @@ void CommandBuffer::draw_indirect(const Vulkan::Buffer &buffer,
 	{
 		VK_ASSERT(pipeline_state.program->get_shader(ShaderStage::Vertex) != nullptr);
 		table.vkCmdDrawIndirect(cmd, buffer.get_buffer(), offset, draw_count, stride);
+
+		if (bundle_capture)
+		{
+			bundle_capture->watch_cookie(buffer.get_cookie());
+			bundle_capture->record_indirect_draw(CommandBundle::Op::DrawIndirect,
+			                                     buffer.get_buffer(), offset, draw_count, stride);
+		}
 	}
 	else
 		LOGE("Failed to flush render state, draw call will be dropped.\n");
@@ -3685,6 +4111,8 @@ void CommandBuffer::draw_multi_indirect(const Buffer &buffer, VkDeviceSize offse
 		table.vkCmdDrawIndirectCount(cmd, buffer.get_buffer(), offset,
 		                             count.get_buffer(), count_offset,
 		                             draw_count, stride);
+		if (bundle_capture)
+			bundle_capture->invalidate();
 	}
 	else
 		LOGE("Failed to flush render state, draw call will be dropped.\n");
@@ -3706,6 +4134,8 @@ void CommandBuffer::draw_indexed_multi_indirect(const Buffer &buffer, VkDeviceSi
 		table.vkCmdDrawIndexedIndirectCount(cmd, buffer.get_buffer(), offset,
 		                                    count.get_buffer(), count_offset,
 		                                    draw_count, stride);
+		if (bundle_capture)
+			bundle_capture->invalidate();
 	}
 	else
 		LOGE("Failed to flush render state, draw call will be dropped.\n");
@@ -3715,20 +4145,231 @@ void CommandBuffer::draw_indexed_indirect(const Vulkan::Buffer &buffer,
                                           VkDeviceSize offset, uint32_t draw_count, uint32_t stride)
 {
 	VK_ASSERT(!is_compute);
-	if (flush_render_state(true) != VK_NULL_HANDLE)
+	if (draw_batch.enabled && !bundle_capture)
+	{
+		if (flush_batched_render_state())
+		{
+			VK_ASSERT(pipeline_state.program->get_shader(ShaderStage::Vertex) != nullptr);
+			// Stride is ignored for a single draw, normalize it so that adjacent draws can be merged.
+			if (draw_count == 1)
+				stride = sizeof(VkDrawIndexedIndirectCommand);
+			append_draw_batch(buffer.get_buffer(), offset, draw_count, stride);
+		}
+		else
+			LOGE("Failed to flush render state, draw call will be dropped.\n");
+	}
+	else if (flush_render_state(true) != VK_NULL_HANDLE)
 	{
 		VK_ASSERT(pipeline_state.program->get_shader(ShaderStage::Vertex) != nullptr);
 		table.vkCmdDrawIndexedIndirect(cmd, buffer.get_buffer(), offset, draw_count, stride);
+
+		if (bundle_capture)
+		{
+			bundle_capture->watch_cookie(buffer.get_cookie());
+			bundle_capture->record_indirect_draw(CommandBundle::Op::DrawIndexedIndirect,
+			                                     buffer.get_buffer(), offset, draw_count, stride);
+		}
 	}
 	else
 		LOGE("Failed to flush render state, draw call will be dropped.\n");
 }
 
+void CommandBuffer::begin_draw_batching()
+{
+	VK_ASSERT(!is_compute);
+	// Without multi-draw indirect every batch would be a single draw anyway.
+	draw_batch.enabled = device->get_device_features().enabled_features.multiDrawIndirect == VK_TRUE;
+}
+
+void CommandBuffer::end_draw_batching()
+{
+	flush_draw_batch();
+	draw_batch.enabled = false;
+}
+
+void CommandBuffer::begin_bundle_capture(CommandBundle &bundle)
+{
+	VK_ASSERT(actual_render_pass);
+	VK_ASSERT(!bundle_capture);
+	flush_draw_batch();
+
+	bundle.begin_capture(pipeline_state.compatible_render_pass->get_pipeline_compatibility_hash(),
+	                     pipeline_state.subpass_index,
+	                     current_framebuffer_surface_transform);
+
+	if (desc_buffer_enable || desc_heap_enable)
+	{
+		LOGE("Command bundles are not supported with descriptor buffers or heaps.\n");
+		return;
+	}
+
+	bundle_capture = &bundle;
+
+	// The bundle must be self-contained, so everything it depends on is recorded again.
+	invalidate_bound_state();
+}
+
+void CommandBuffer::end_bundle_capture()
+{
+	if (!bundle_capture)
+		return;
+
+	bundle_capture->end_capture();
+	bundle_capture = nullptr;
+}
+
+void CommandBuffer::invalidate_bound_state()
+{
+	current_pipeline = {};
+	set_dirty(COMMAND_BUFFER_DIRTY_PIPELINE_BIT | COMMAND_BUFFER_DIRTY_PUSH_CONSTANTS_BIT | COMMAND_BUFFER_DYNAMIC_BITS);
+	dirty_sets_realloc = ~0u;
+	dirty_vbos = ~0u;
+
+	if (index_state.buffer != VK_NULL_HANDLE)
+	{
+		table.vkCmdBindIndexBuffer(cmd, index_state.buffer, index_state.offset, index_state.index_type);
+		if (bundle_capture)
+		{
+			bundle_capture->watch_cookie(index_state.cookie);
+			bundle_capture->record_bind_index_buffer(index_state.buffer, index_state.offset, index_state.index_type);
+		}
+	}
+}
+
+void CommandBuffer::capture_set_cookies(uint32_t set)
+{
+	auto &set_layout = pipeline_state.layout->get_resource_layout().sets[set];
+	uint32_t mask = set_layout.sampled_image_mask | set_layout.storage_image_mask |
+	                set_layout.uniform_buffer_mask | set_layout.storage_buffer_mask |
+	                set_layout.rtas_mask | set_layout.sampled_texel_buffer_mask |
+	                set_layout.storage_texel_buffer_mask | set_layout.input_attachment_mask |
+	                set_layout.sampler_mask | set_layout.separate_image_mask;
+
+	for_each_bit(mask, [&](uint32_t binding) {
+		unsigned array_size = set_layout.meta[binding].array_size;
+		for (unsigned i = 0; i < array_size; i++)
+		{
+			bundle_capture->watch_cookie(bindings.cookies[set][binding + i]);
+			bundle_capture->watch_cookie(bindings.secondary_cookies[set][binding + i]);
+		}
+	});
+}
+
+void CommandBuffer::capture_descriptor_binds(uint32_t first_set, uint32_t set_count,
+                                             const uint32_t *dynamic_offsets, const uint32_t *dynamic_offset_counts)
+{
+	auto &layout = pipeline_state.layout->get_resource_layout();
+	CommandBundle::DescriptorSetBind binds[VULKAN_NUM_DESCRIPTOR_SETS];
+	uint32_t num_dynamic_offsets = 0;
+
+	// Bindless sets are owned by the application and can be retired or reallocated
+	// behind our back, so a bundle cannot safely hold on to them.
+	if (layout.bindless_descriptor_set_mask & (((1u << set_count) - 1u) << first_set))
+	{
+		bundle_capture->invalidate();
+		return;
+	}
+
+	for (uint32_t i = 0; i < set_count; i++)
+	{
+		uint32_t set = first_set + i;
+		auto &bind = binds[i];
+		bind = {};
+		bind.num_dynamic_offsets = dynamic_offset_counts[set];
+		num_dynamic_offsets += bind.num_dynamic_offsets;
+
+		// Keep enough to rewrite the set if it has been recycled by the time the bundle is replayed.
+		bind.allocator = pipeline_state.layout->get_allocator(set);
+		bind.hash = hash_descriptor_set(set);
+		bind.update_template = pipeline_state.layout->get_update_template(set);
+		bind.snapshot = bundle_capture->push_snapshot(bindings.bindings[set]);
+
+		if (bind.num_dynamic_offsets)
+		{
+			auto &set_layout = layout.sets[set];
+			auto &snapshot = bundle_capture->snapshots[bind.snapshot];
+			for_each_bit(set_layout.uniform_buffer_mask, [&](uint32_t binding) {
+				unsigned array_size = set_layout.meta[binding].array_size;
+				for (unsigned j = 0; j < array_size; j++)
+					snapshot.bindings[binding + j].buffer.offset = 0;
+			});
+		}
+
+		capture_set_cookies(set);
+	}
+
+	bundle_capture->record_bind_descriptor_sets(current_pipeline_layout, first_set, binds, set_count,
+	                                            dynamic_offsets, num_dynamic_offsets);
+}
+
+bool CommandBuffer::render_state_is_clean() const
+{
+	CommandBufferDirtyFlags dirty_mask = COMMAND_BUFFER_DIRTY_STATIC_STATE_BIT |
+	                                     COMMAND_BUFFER_DIRTY_PIPELINE_BIT |
+	                                     COMMAND_BUFFER_DIRTY_STATIC_VERTEX_BIT |
+	                                     COMMAND_BUFFER_DIRTY_PUSH_CONSTANTS_BIT |
+	                                     COMMAND_BUFFER_DIRTY_VIEWPORT_BIT |
+	                                     COMMAND_BUFFER_DIRTY_SCISSOR_BIT;
+
+	// These bits are left dirty by flush_render_state() when the pipeline does not consume them.
+	if (pipeline_state.static_state.state.depth_bias_enable)
+		dirty_mask |= COMMAND_BUFFER_DIRTY_DEPTH_BIAS_BIT;
+	if (pipeline_state.static_state.state.stencil_test)
+		dirty_mask |= COMMAND_BUFFER_DIRTY_STENCIL_REFERENCE_BIT;
+
+	return current_pipeline.pipeline != VK_NULL_HANDLE &&
+	       (dirty & dirty_mask) == 0 &&
+	       (dirty_sets_realloc | dirty_sets_rebind | dirty_sets_dynamic) == 0 &&
+	       (dirty_vbos & active_vbos) == 0;
+}
+
+bool CommandBuffer::flush_batched_render_state()
+{
+	// Pending draws were recorded against the currently bound state.
+	// If anything changed since, they have to be submitted before the new state is bound.
+	if (draw_batch.count && render_state_is_clean())
+		return true;
+	return flush_render_state(true) != VK_NULL_HANDLE;
+}
+
+void CommandBuffer::append_draw_batch(VkBuffer buffer, VkDeviceSize offset, uint32_t count, uint32_t stride)
+{
+	uint32_t max_count = device->get_gpu_properties().limits.maxDrawIndirectCount;
+
+	// Only contiguous draws in the same buffer can be merged.
+	if (draw_batch.count &&
+	    (draw_batch.buffer != buffer || draw_batch.stride != stride ||
+	     draw_batch.offset + VkDeviceSize(draw_batch.count) * stride != offset ||
+	     count > max_count - draw_batch.count))
+	{
+		flush_draw_batch();
+	}
+
+	if (!draw_batch.count)
+	{
+		draw_batch.buffer = buffer;
+		draw_batch.offset = offset;
+		draw_batch.stride = stride;
+	}
+
+	draw_batch.count += count;
+}
+
+void CommandBuffer::flush_draw_batch()
+{
+	if (!draw_batch.count)
+		return;
+
+	table.vkCmdDrawIndexedIndirect(cmd, draw_batch.buffer, draw_batch.offset, draw_batch.count, draw_batch.stride);
+	draw_batch.count = 0;
+}
+
 void CommandBuffer::dispatch_indirect(const Buffer &buffer, VkDeviceSize offset)
 {
 	VK_ASSERT(is_compute);
 	if (flush_compute_state(true) != VK_NULL_HANDLE)
 	{
+		mark_split_barrier_work();
 		table.vkCmdDispatchIndirect(cmd, buffer.get_buffer(), offset);
 	}
 	else
@@ -3745,6 +4386,8 @@ void CommandBuffer::execute_indirect_commands(
 	VK_ASSERT((is_compute && (indirect_layout->get_shader_stages() & VK_SHADER_STAGE_COMPUTE_BIT) != 0) ||
 	          (!is_compute && (indirect_layout->get_shader_stages() & VK_SHADER_STAGE_COMPUTE_BIT) == 0));
 	VK_ASSERT(device->get_device_features().device_generated_commands_features.deviceGeneratedCommands);
+	if (bundle_capture)
+		bundle_capture->invalidate();
 
 	if (is_compute)
 	{
@@ -3753,6 +4396,7 @@ void CommandBuffer::execute_indirect_commands(
 			LOGE("Failed to flush compute state, dispatch will be dropped.\n");
 			return;
 		}
+		mark_split_barrier_work();
 	}
 	else
 	{
@@ -3825,15 +4469,20 @@ void CommandBuffer::dispatch(uint32_t groups_x, uint32_t groups_y, uint32_t grou
 {
 	VK_ASSERT(is_compute);
 	if (flush_compute_state(true) != VK_NULL_HANDLE)
+	{
+		mark_split_barrier_work();
 		table.vkCmdDispatch(cmd, groups_x, groups_y, groups_z);
+	}
 	else
 		LOGE("Failed to flush render state, dispatch will be dropped.\n");
 }
 
 void CommandBuffer::begin_rtas_batch()
 {
-	VK_ASSERT(!framebuffer);
+	VK_ASSERT(!actual_render_pass);
 	VK_ASSERT(!rtas_batch.in_batch);
+	// RTAS batches emit their own barriers.
+	VK_ASSERT(!barrier_batch.split);
 	rtas_batch.in_batch = true;
 }
 
@@ -3999,35 +4648,42 @@ void CommandBuffer::build_tlas_batch()
 
 	required_scratch_storage += rtas_batch.instances.size() * sizeof(VkDeviceAddress);
 
-	// Could add scratch for this, but we shouldn't be building more than one TLAS per frame or something ...
-	BufferCreateInfo scratch_info = {};
-	scratch_info.size = required_scratch_storage;
-	scratch_info.usage = VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR;
-	scratch_info.domain = BufferDomain::LinkedDeviceHost;
-	auto instance_storage_scratch = device->create_buffer(scratch_info);
-	VkDeviceAddress va = instance_storage_scratch->get_device_address();
-
-	auto *upload_instances = static_cast<VkAccelerationStructureInstanceKHR *>(
-			device->map_host_buffer(*instance_storage_scratch, MEMORY_ACCESS_WRITE_BIT));
+	// Packed ranges are consumed directly.
+	BufferHandle instance_storage_scratch;
+	VkDeviceAddress va = 0;
 
-	for (auto &instance : rtas_batch.instances)
+	if (required_scratch_storage)
 	{
-		if (instance.bda == 0)
+		// Could add scratch for this, but we shouldn't be building more than one TLAS per frame or something ...
+		BufferCreateInfo scratch_info = {};
+		scratch_info.size = required_scratch_storage;
+		scratch_info.usage = VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR;
+		scratch_info.domain = BufferDomain::LinkedDeviceHost;
+		instance_storage_scratch = device->create_buffer(scratch_info);
+		va = instance_storage_scratch->get_device_address();
+
+		auto *upload_instances = static_cast<VkAccelerationStructureInstanceKHR *>(
+				device->map_host_buffer(*instance_storage_scratch, MEMORY_ACCESS_WRITE_BIT));
+
+		for (auto &instance : rtas_batch.instances)
 		{
-			*upload_instances++ = *instance.instance;
-			instance.bda = va;
-			va += sizeof(*instance.instance);
+			if (instance.bda == 0)
+			{
+				*upload_instances++ = *instance.instance;
+				instance.bda = va;
+				va += sizeof(*instance.instance);
+			}
 		}
-	}
 
-	auto *addrs = reinterpret_cast<VkDeviceAddress *>(upload_instances);
-	for (auto &instance : rtas_batch.instances)
-	{
-		VK_ASSERT(instance.bda);
-		*addrs++ = instance.bda;
-	}
+		auto *addrs = reinterpret_cast<VkDeviceAddress *>(upload_instances);
+		for (auto &instance : rtas_batch.instances)
+		{
+			VK_ASSERT(instance.bda);
+			*addrs++ = instance.bda;
+		}
 
-	device->unmap_host_buffer(*instance_storage_scratch, MEMORY_ACCESS_WRITE_BIT);
+		device->unmap_host_buffer(*instance_storage_scratch, MEMORY_ACCESS_WRITE_BIT);
+	}
 
 	for (size_t i = 0, n = rtas_batch.ranges.size(); i < n; i++)
 	{
@@ -4038,8 +4694,16 @@ void CommandBuffer::build_tlas_batch()
 
 		auto &inst = geom.geometry.instances;
 		inst.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR;
-		inst.arrayOfPointers = VK_TRUE;
-		inst.data.deviceAddress = va + rtas_batch.ranges[i].start * sizeof(VkDeviceAddress);
+		if (rtas_batch.ranges[i].packed)
+		{
+			inst.arrayOfPointers = VK_FALSE;
+			inst.data.deviceAddress = rtas_batch.ranges[i].packed;
+		}
+		else
+		{
+			inst.arrayOfPointers = VK_TRUE;
+			inst.data.deviceAddress = va + rtas_batch.ranges[i].start * sizeof(VkDeviceAddress);
+		}
 
 		// Rest is 0.
 		range.primitiveCount = rtas_batch.ranges[i].count;
@@ -4051,7 +4715,7 @@ void CommandBuffer::build_tlas_batch()
 
 void CommandBuffer::end_rtas_batch()
 {
-	VK_ASSERT(!framebuffer);
+	VK_ASSERT(!actual_render_pass);
 	VK_ASSERT(rtas_batch.in_batch);
 	rtas_batch.in_batch = false;
 
@@ -4090,7 +4754,7 @@ void CommandBuffer::end_rtas_batch()
 
 void CommandBuffer::compact_rtas(const Vulkan::RTAS &dst, const Vulkan::RTAS &src)
 {
-	VK_ASSERT(!framebuffer);
+	VK_ASSERT(!actual_render_pass);
 	VK_ASSERT(!rtas_batch.in_batch);
 
 	VkCopyAccelerationStructureInfoKHR info = { VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR };
@@ -4102,35 +4766,36 @@ void CommandBuffer::compact_rtas(const Vulkan::RTAS &dst, const Vulkan::RTAS &sr
 
 void CommandBuffer::write_compacted_rtas_size(const RTAS &rtas, const QueryPoolResult &query)
 {
-	VK_ASSERT(!framebuffer);
+	VK_ASSERT(!actual_render_pass);
 	VK_ASSERT(rtas_batch.in_batch);
 	rtas_batch.queries.push_back({ rtas.get_rtas(), query.get_query_pool(), query.get_query_pool_index() });
 }
 
 void CommandBuffer::build_rtas(BuildMode mode, const RTAS &rtas, const TopRTASCreateInfo &info)
 {
-	VK_ASSERT(!framebuffer);
+	VK_ASSERT(!actual_render_pass);
 	VK_ASSERT(rtas_batch.in_batch);
 
-	VK_ASSERT(rtas_batch.ranges.size() == rtas_batch.instances.size());
+	VK_ASSERT(rtas_batch.ranges.size() == rtas_batch.build_modes.size());
 	RTASBatch::Range new_range = { rtas.get_rtas(), mode == BuildMode::Update ? rtas.get_rtas() : VK_NULL_HANDLE,
 	                               rtas.get_scratch_size(mode),
-	                               rtas_batch.instances.size(), info.count };
-	rtas_batch.instances.insert(rtas_batch.instances.end(), info.instances, info.instances + info.count);
+	                               rtas_batch.instances.size(), info.count, info.packed_instances };
+	if (!info.packed_instances)
+		rtas_batch.instances.insert(rtas_batch.instances.end(), info.instances, info.instances + info.count);
 	rtas_batch.ranges.push_back(new_range);
 	rtas_batch.build_modes.push_back(mode);
 }
 
 void CommandBuffer::build_rtas(BuildMode mode, const RTAS &rtas, const BottomRTASCreateInfo &info)
 {
-	VK_ASSERT(!framebuffer);
+	VK_ASSERT(!actual_render_pass);
 	VK_ASSERT(rtas_batch.in_batch);
 	VK_ASSERT(mode == BuildMode::Build || info.mode == BLASMode::Skinned);
 
 	VK_ASSERT(rtas_batch.ranges.size() == rtas_batch.blas_modes.size());
 	RTASBatch::Range new_range = { rtas.get_rtas(), mode == BuildMode::Update ? rtas.get_rtas() : VK_NULL_HANDLE,
 								   rtas.get_scratch_size(mode),
-	                               rtas_batch.geometries.size(), info.count };
+	                               rtas_batch.geometries.size(), info.count, 0 };
 	rtas_batch.ranges.push_back(new_range);
 	rtas_batch.geometries.insert(rtas_batch.geometries.end(), info.geometries, info.geometries + info.count);
 	rtas_batch.build_modes.push_back(mode);
@@ -4308,12 +4973,14 @@ void CommandBuffer::save_state(CommandBufferSaveStateFlags flags, CommandBufferS
 
 QueryPoolHandle CommandBuffer::write_timestamp(VkPipelineStageFlags2 stage)
 {
+	flush_draw_batch();
 	return device->write_timestamp(cmd, stage);
 }
 
 void CommandBuffer::end_threaded_recording()
 {
 	VK_ASSERT(!debug_channel_buffer);
+	flush_draw_batch();
 
 	if (is_ended || borrowed)
 		return;
@@ -4349,6 +5016,8 @@ void CommandBuffer::end()
 		device->request_uniform_block_nolock(ubo_block, 0);
 	if (staging_block.is_mapped())
 		device->request_staging_block_nolock(staging_block, 0);
+	if (indirect_block.is_mapped())
+		device->request_indirect_block_nolock(indirect_block, 0);
 	if (desc_buffer.get_size())
 		device->free_descriptor_buffer_allocation_nolock(desc_buffer);
 
@@ -4361,6 +5030,7 @@ void CommandBuffer::end()
 
 void CommandBuffer::insert_label(const char *name, const float *color)
 {
+	flush_draw_batch();
 	if (!device->ext.supports_debug_utils || !vkCmdInsertDebugUtilsLabelEXT)
 		return;
 
@@ -4382,6 +5052,13 @@ void CommandBuffer::insert_label(const char *name, const float *color)
 
 void CommandBuffer::begin_region(const char *name, const float *color)
 {
+	flush_draw_batch();
+	// Always push so the stack stays balanced when a capture begins or ends mid-region.
+	if (device->managers.profiler.is_capturing_gpu_regions())
+		profile_regions.push_back({ name, write_timestamp(VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT) });
+	else
+		profile_regions.push_back({});
+
 	if (!device->ext.supports_debug_utils || !vkCmdBeginDebugUtilsLabelEXT)
 		return;
 
@@ -4403,8 +5080,20 @@ void CommandBuffer::begin_region(const char *name, const float *color)
 
 void CommandBuffer::end_region()
 {
+	flush_draw_batch();
 	if (device->ext.supports_debug_utils && vkCmdEndDebugUtilsLabelEXT)
 		vkCmdEndDebugUtilsLabelEXT(cmd);
+
+	if (!profile_regions.empty())
+	{
+		auto &region = profile_regions.back();
+		if (region.start_ts)
+		{
+			device->register_profile_region(type, std::move(region.name), std::move(region.start_ts),
+			                                write_timestamp(VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT));
+		}
+		profile_regions.pop_back();
+	}
 }
 
 void CommandBuffer::enable_profiling()
@@ -222,12 +222,14 @@ struct IndexState
 	VkBuffer buffer;
 	VkDeviceSize offset;
 	VkIndexType index_type;
+	uint64_t cookie;
 };
 
 struct VertexBindingState
 {
 	VkBuffer buffers[VULKAN_NUM_VERTEX_BUFFERS];
 	VkDeviceSize offsets[VULKAN_NUM_VERTEX_BUFFERS];
+	uint64_t cookies[VULKAN_NUM_VERTEX_BUFFERS];
 };
 
 enum CommandBufferSavedStateBits
@@ -281,10 +283,12 @@ struct CommandBufferDeleter
 };
 
 class Device;
+class CommandBundle;
 class CommandBuffer : public Util::IntrusivePtrEnabled<CommandBuffer, CommandBufferDeleter, HandleCounter>
 {
 public:
 	friend struct CommandBufferDeleter;
+	friend class CommandBundle;
 	enum class Type
 	{
 		Generic = QUEUE_INDEX_GRAPHICS,
@@ -375,9 +379,28 @@ public:
 	                          const VkExtent3D &extent, unsigned row_length, unsigned slice_height,
 	                          const VkImageSubresourceLayers &subresrouce);
 
-	void begin_barrier_batch();
+	enum class BarrierBatchMode
+	{
+		// Barriers are merged and emitted as one pipeline barrier in end_barrier_batch().
+		Deferred,
+		// Barriers are split into an event signal and wait, placed by the caller.
+		// Nothing tracks which command last wrote a resource, so call begin_barrier_batch()
+		// right after the last writer and end_barrier_batch() right before the first reader.
+		// Barriers recorded in between are signalled as an event lazily, right before the next
+		// transfer, dispatch or render pass, and waited for in end_barrier_batch().
+		// Work recorded inside the batch must not depend on the batched barriers and
+		// must not emit barriers on its own.
+		// If too few commands were recorded between signal and wait, a plain barrier is used instead.
+		ManualSplit
+	};
+
+	void begin_barrier_batch(BarrierBatchMode mode = BarrierBatchMode::Deferred);
 	void end_barrier_batch();
 
+	// Number of transfer, dispatch or render pass commands which must be recorded between signal and wait
+	// before a manual split barrier is considered worthwhile. Defaults to 1.
+	void set_manual_split_barrier_min_commands(unsigned count);
+
 	void full_barrier();
 	void pixel_barrier();
 
@@ -532,6 +555,22 @@ public:
 	                  int32_t vertex_offset = 0, uint32_t first_instance = 0);
 	void draw_mesh_tasks(uint32_t tasks_x, uint32_t tasks_y, uint32_t tasks_z);
 
+	// Opt-in batching of draw_indexed() and draw_indexed_indirect().
+	// Consecutive draws which see the same render state (pipeline, descriptor sets, push constants,
+	// vertex and index buffers, dynamic state) are written to an indirect buffer and
+	// submitted as a single multi-draw indirect once state changes, another command is recorded
+	// or end_draw_batching() is called.
+	// Requires multiDrawIndirect, otherwise draws are recorded as-is.
+	void begin_draw_batching();
+	void end_draw_batching();
+
+	// Draws recorded between begin_bundle_capture() and end_bundle_capture() are recorded as normal
+	// and also captured into bundle for later replay, see CommandBundle.
+	// Must be called inside a render pass. Only the plain descriptor set path can be captured,
+	// binding a bindless set invalidates the bundle.
+	void begin_bundle_capture(CommandBundle &bundle);
+	void end_bundle_capture();
+
 	void dispatch(uint32_t groups_x, uint32_t groups_y, uint32_t groups_z);
 
 	void draw_indirect(const Buffer &buffer, VkDeviceSize offset, uint32_t draw_count, uint32_t stride);
@@ -862,8 +901,12 @@ private:
 	VkCommandBuffer cmd;
 	Type type;
 
-	const Framebuffer *framebuffer = nullptr;
 	const RenderPass *actual_render_pass = nullptr;
+	uint32_t framebuffer_width = 0;
+	uint32_t framebuffer_height = 0;
+	// Swapchain images rendered to with dynamic rendering are transitioned back after the pass.
+	VkImageMemoryBarrier2 dynamic_rendering_end_barriers[2 * VULKAN_NUM_ATTACHMENTS];
+	unsigned num_dynamic_rendering_end_barriers = 0;
 	const Vulkan::ImageView *framebuffer_attachments[VULKAN_NUM_ATTACHMENTS + 1] = {};
 
 	IndexState index_state = {};
@@ -884,6 +927,8 @@ private:
 	CommandBufferDirtyFlags dirty = ~0u;
 	uint32_t dirty_sets_realloc = 0;
 	uint32_t dirty_sets_rebind = 0;
+	// Sets where only uniform buffer offsets changed. Resolved to rebind or realloc depending on the layout.
+	uint32_t dirty_sets_dynamic = 0;
 	uint32_t dirty_vbos = 0;
 	uint32_t active_vbos = 0;
 	VkPipelineStageFlags2 uses_swapchain_in_stages = 0;
@@ -932,6 +977,7 @@ private:
 	void allocate_descriptor_offset(uint32_t set, uint32_t &first_set, uint32_t &set_count);
 	void flush_descriptor_offsets(uint32_t &first_set, uint32_t &set_count);
 	void validate_descriptor_binds(uint32_t set);
+	Util::Hash hash_descriptor_set(uint32_t set) const;
 	void allocate_descriptor_heap_set(uint32_t set);
 	void rebind_descriptor_heap_set(uint32_t set);
 
@@ -949,6 +995,27 @@ private:
 	BufferBlock ibo_block;
 	BufferBlock ubo_block;
 	BufferBlock staging_block;
+	BufferBlock indirect_block;
+
+	struct
+	{
+		VkBuffer buffer = VK_NULL_HANDLE;
+		VkDeviceSize offset = 0;
+		uint32_t count = 0;
+		uint32_t stride = 0;
+		bool enabled = false;
+	} draw_batch;
+
+	bool render_state_is_clean() const;
+	bool flush_batched_render_state();
+	void append_draw_batch(VkBuffer buffer, VkDeviceSize offset, uint32_t count, uint32_t stride);
+	void flush_draw_batch();
+
+	CommandBundle *bundle_capture = nullptr;
+	void invalidate_bound_state();
+	void capture_descriptor_binds(uint32_t first_set, uint32_t set_count,
+	                              const uint32_t *dynamic_offsets, const uint32_t *dynamic_offset_counts);
+	void capture_set_cookies(uint32_t set);
 
 	DescriptorBufferAllocation desc_buffer = {};
 	VkDeviceSize desc_buffer_alloc_offset = 0;
@@ -963,11 +1030,20 @@ private:
 	                 uint64_t cookie);
 	void set_buffer_view_common(unsigned set, unsigned binding, const BufferView &view, VkDescriptorType type);
 
-	void init_viewport_scissor(const RenderPassInfo &info, const Framebuffer *framebuffer);
+	void init_viewport_scissor(const RenderPassInfo &info);
+	void begin_dynamic_rendering(const RenderPassInfo &info, const VkRect2D &render_area, VkSubpassContents contents);
 	void init_surface_transform(const RenderPassInfo &info);
 	VkSurfaceTransformFlagBitsKHR current_framebuffer_surface_transform = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
 
 	bool profiling = false;
+
+	struct ProfileRegion
+	{
+		std::string name;
+		QueryPoolHandle start_ts;
+	};
+	Util::SmallVector<ProfileRegion, 8> profile_regions;
+
 	std::string debug_channel_tag;
 	Vulkan::BufferHandle debug_channel_buffer;
 	DebugChannelInterface *debug_channel_interface = nullptr;
@@ -991,11 +1067,31 @@ private:
 		Util::SmallVector<VkBufferMemoryBarrier2> buffer_barriers;
 		Util::SmallVector<VkImageMemoryBarrier2> image_barriers;
 		bool active = false;
+		bool split = false;
 	} barrier_batch;
 
+	struct SplitBarrier
+	{
+		PipelineEvent event;
+		Util::SmallVector<VkMemoryBarrier2> memory_barriers;
+		Util::SmallVector<VkBufferMemoryBarrier2> buffer_barriers;
+		Util::SmallVector<VkImageMemoryBarrier2> image_barriers;
+		unsigned commands_recorded = 0;
+	};
+	std::vector<SplitBarrier> split_barriers;
+	unsigned split_barrier_min_commands = 1;
+
+	void signal_split_barriers();
+	void wait_split_barriers();
+	inline void mark_split_barrier_work()
+	{
+		if (barrier_batch.split)
+			signal_split_barriers();
+	}
+
 	struct RTASBatch
 	{
-		struct Range { VkAccelerationStructureKHR dst, src; VkDeviceSize scratch; size_t start, count; };
+		struct Range { VkAccelerationStructureKHR dst, src; VkDeviceSize scratch; size_t start, count; VkDeviceAddress packed; };
 		struct Query { VkAccelerationStructureKHR rtas; VkQueryPool pool; uint32_t index; };
 
 		Util::SmallVector<VkAccelerationStructureGeometryKHR, 4> geometries_conv;
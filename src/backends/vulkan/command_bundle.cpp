@@ -0,0 +1,355 @@
+/* Copyright (c) 2017-2026 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "command_bundle.hpp"
+#include "command_buffer.hpp"
+#include "device.hpp"
+#include <string.h>
+#include <algorithm>
+
+namespace Vulkan
+{
+CommandBundle::CommandBundle(Device &device_)
+	: device(device_)
+{
+}
+
+CommandBundle::~CommandBundle()
+{
+	reset();
+}
+
+void CommandBundle::reset()
+{
+	if (!cookies.empty())
+		device.unwatch_bundle_cookies(this, cookies.data(), cookies.size());
+
+	commands.clear();
+	pipelines.clear();
+	set_binds.clear();
+	sets.clear();
+	snapshots.clear();
+	push_sets.clear();
+	push_constants.clear();
+	dynamic_offsets.clear();
+	bytes.clear();
+	vertex_buffers.clear();
+	vertex_offsets.clear();
+	indirect_draws.clear();
+	cookies.clear();
+
+	captured = false;
+	invalidated.store(false, std::memory_order_relaxed);
+}
+
+void CommandBundle::begin_capture(Util::Hash render_pass_hash, unsigned subpass_,
+                                  VkSurfaceTransformFlagBitsKHR transform)
+{
+	reset();
+	compatible_render_pass = render_pass_hash;
+	subpass = subpass_;
+	surface_transform = transform;
+}
+
+void CommandBundle::end_capture()
+{
+	captured = true;
+}
+
+void CommandBundle::invalidate()
+{
+	invalidated.store(true, std::memory_order_release);
+}
+
+void CommandBundle::watch_cookie(uint64_t cookie)
+{
+	if (cookie && device.watch_bundle_cookie(this, cookie))
+		cookies.push_back(cookie);
+}
+
+void CommandBundle::push_command(Op op, uint32_t first, uint32_t count, uint32_t data)
+{
+	commands.push_back({ op, first, count, data });
+}
+
+uint32_t CommandBundle::push_bytes(const void *data, size_t size)
+{
+	auto offset = uint32_t(bytes.size());
+	bytes.resize(bytes.size() + size);
+	memcpy(bytes.data() + offset, data, size);
+	return offset;
+}
+
+uint32_t CommandBundle::push_snapshot(const ResourceBinding *bindings)
+{
+	snapshots.emplace_back();
+	memcpy(snapshots.back().bindings, bindings, sizeof(snapshots.back().bindings));
+	return uint32_t(snapshots.size() - 1);
+}
+
+void CommandBundle::record_bind_pipeline(VkPipeline pipeline)
+{
+	push_command(Op::BindPipeline, 0, 0, uint32_t(pipelines.size()));
+	pipelines.push_back(pipeline);
+}
+
+void CommandBundle::record_bind_descriptor_sets(VkPipelineLayout layout, uint32_t first_set,
+                                                const DescriptorSetBind *binds, uint32_t count,
+                                                const uint32_t *offsets, uint32_t num_offsets)
+{
+	push_command(Op::BindDescriptorSets, first_set, count, uint32_t(set_binds.size()));
+	set_binds.push_back({ layout, first_set, uint32_t(sets.size()), uint32_t(dynamic_offsets.size()) });
+	sets.insert(sets.end(), binds, binds + count);
+	dynamic_offsets.insert(dynamic_offsets.end(), offsets, offsets + num_offsets);
+}
+
+void CommandBundle::record_push_descriptor_set(VkPipelineLayout layout, VkDescriptorUpdateTemplate update_template,
+                                               uint32_t set, const ResourceBinding *bindings)
+{
+	push_command(Op::PushDescriptorSet, set, 0, uint32_t(push_sets.size()));
+	push_sets.push_back({ layout, update_template, push_snapshot(bindings) });
+}
+
+void CommandBundle::record_push_constants(VkPipelineLayout layout, VkShaderStageFlags stages,
+                                          const void *data, uint32_t size)
+{
+	VK_ASSERT(size <= VULKAN_PUSH_CONSTANT_SIZE);
+	push_command(Op::PushConstants, 0, 0, uint32_t(push_constants.size()));
+	push_constants.push_back({ layout, stages, size, push_bytes(data, size) });
+}
+
+void CommandBundle::record_viewport(const VkViewport &viewport)
+{
+	push_command(Op::SetViewport, 0, 0, push_bytes(&viewport, sizeof(viewport)));
+}
+
+void CommandBundle::record_scissor(const VkRect2D &scissor)
+{
+	push_command(Op::SetScissor, 0, 0, push_bytes(&scissor, sizeof(scissor)));
+}
+
+void CommandBundle::record_depth_bias(float constant, float slope)
+{
+	const float params[2] = { constant, slope };
+	push_command(Op::SetDepthBias, 0, 0, push_bytes(params, sizeof(params)));
+}
+
+void CommandBundle::record_stencil(const uint32_t *state)
+{
+	push_command(Op::SetStencil, 0, 0, push_bytes(state, 6 * sizeof(uint32_t)));
+}
+
+void CommandBundle::record_bind_vertex_buffers(uint32_t first_binding, uint32_t count,
+                                               const VkBuffer *buffers, const VkDeviceSize *offsets)
+{
+	push_command(Op::BindVertexBuffers, first_binding, count, uint32_t(vertex_buffers.size()));
+	vertex_buffers.insert(vertex_buffers.end(), buffers, buffers + count);
+	vertex_offsets.insert(vertex_offsets.end(), offsets, offsets + count);
+}
+
+void CommandBundle::record_bind_index_buffer(VkBuffer buffer, VkDeviceSize offset, VkIndexType index_type)
+{
+	push_command(Op::BindIndexBuffer, uint32_t(index_type), 0, uint32_t(vertex_buffers.size()));
+	vertex_buffers.push_back(buffer);
+	vertex_offsets.push_back(offset);
+}
+
+void CommandBundle::record_draw(Op op, const uint32_t *params, uint32_t num_params)
+{
+	push_command(op, 0, num_params, push_bytes(params, num_params * sizeof(uint32_t)));
+}
+
+void CommandBundle::record_indirect_draw(Op op, VkBuffer buffer, VkDeviceSize offset,
+                                         uint32_t draw_count, uint32_t stride)
+{
+	push_command(op, 0, 0, uint32_t(indirect_draws.size()));
+	indirect_draws.push_back({ buffer, offset, draw_count, stride });
+}
+
+bool CommandBundle::replay(CommandBuffer &cmd, const CommandBundlePatch *patch) const
+{
+	if (!is_valid())
+		return false;
+
+	VK_ASSERT(!cmd.bundle_capture);
+	if (!cmd.actual_render_pass || !cmd.pipeline_state.compatible_render_pass ||
+	    cmd.pipeline_state.compatible_render_pass->get_pipeline_compatibility_hash() != compatible_render_pass ||
+	    cmd.pipeline_state.subpass_index != subpass ||
+	    cmd.current_framebuffer_surface_transform != surface_transform)
+	{
+		LOGE("Command bundle is not compatible with the current subpass.\n");
+		return false;
+	}
+
+	cmd.flush_draw_batch();
+
+	auto &table = cmd.table;
+	VkCommandBuffer vk_cmd = cmd.cmd;
+
+	for (auto &command : commands)
+	{
+		switch (command.op)
+		{
+		case Op::BindPipeline:
+			table.vkCmdBindPipeline(vk_cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines[command.data]);
+			break;
+
+		case Op::BindDescriptorSets:
+		{
+			auto &bind = set_binds[command.data];
+			VkDescriptorSet vk_sets[VULKAN_NUM_DESCRIPTOR_SETS];
+			uint32_t offsets[VULKAN_NUM_DYNAMIC_UBOS];
+			uint32_t num_offsets = 0;
+
+			for (uint32_t i = 0; i < command.count; i++)
+			{
+				auto &set = sets[bind.first_bind + i];
+
+				// Cached sets age out when unused, so resolve by content every time.
+				// A miss hands out a vacant set which is written from the snapshot.
+				auto allocated = set.allocator->find(cmd.thread_index, set.hash);
+				if (!allocated.second && allocated.first != VK_NULL_HANDLE)
+				{
+					table.vkUpdateDescriptorSetWithTemplate(device.get_device(), allocated.first,
+					                                        set.update_template,
+					                                        snapshots[set.snapshot].bindings);
+				}
+				vk_sets[i] = allocated.first;
+
+				uint32_t delta = patch ? patch->dynamic_offset_delta[bind.first_set + i] : 0;
+				for (uint32_t j = 0; j < set.num_dynamic_offsets; j++, num_offsets++)
+					offsets[num_offsets] = dynamic_offsets[bind.first_dynamic_offset + num_offsets] + delta;
+			}
+
+			table.vkCmdBindDescriptorSets(vk_cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, bind.layout,
+			                              bind.first_set, command.count, vk_sets, num_offsets, offsets);
+			break;
+		}
+
+		case Op::PushDescriptorSet:
+		{
+			auto &push = push_sets[command.data];
+			table.vkCmdPushDescriptorSetWithTemplate(vk_cmd, push.update_template, push.layout, command.first,
+			                                         snapshots[push.snapshot].bindings);
+			break;
+		}
+
+		case Op::PushConstants:
+		{
+			auto &push = push_constants[command.data];
+			uint8_t push_data[VULKAN_PUSH_CONSTANT_SIZE];
+			memcpy(push_data, bytes.data() + push.data, push.size);
+
+			if (patch && patch->push_constant_data && patch->push_constant_offset < push.size)
+			{
+				uint32_t size = std::min(patch->push_constant_size, push.size - patch->push_constant_offset);
+				memcpy(push_data + patch->push_constant_offset, patch->push_constant_data, size);
+			}
+
+			table.vkCmdPushConstants(vk_cmd, push.layout, push.stages, 0, push.size, push_data);
+			break;
+		}
+
+		case Op::SetViewport:
+		{
+			VkViewport viewport;
+			memcpy(&viewport, bytes.data() + command.data, sizeof(viewport));
+			table.vkCmdSetViewport(vk_cmd, 0, 1, &viewport);
+			break;
+		}
+
+		case Op::SetScissor:
+		{
+			VkRect2D scissor;
+			memcpy(&scissor, bytes.data() + command.data, sizeof(scissor));
+			table.vkCmdSetScissor(vk_cmd, 0, 1, &scissor);
+			break;
+		}
+
+		case Op::SetDepthBias:
+		{
+			float params[2];
+			memcpy(params, bytes.data() + command.data, sizeof(params));
+			table.vkCmdSetDepthBias(vk_cmd, params[0], 0.0f, params[1]);
+			break;
+		}
+
+		case Op::SetStencil:
+		{
+			uint32_t state[6];
+			memcpy(state, bytes.data() + command.data, sizeof(state));
+			table.vkCmdSetStencilCompareMask(vk_cmd, VK_STENCIL_FACE_FRONT_BIT, state[0]);
+			table.vkCmdSetStencilReference(vk_cmd, VK_STENCIL_FACE_FRONT_BIT, state[1]);
+			table.vkCmdSetStencilWriteMask(vk_cmd, VK_STENCIL_FACE_FRONT_BIT, state[2]);
+			table.vkCmdSetStencilCompareMask(vk_cmd, VK_STENCIL_FACE_BACK_BIT, state[3]);
+			table.vkCmdSetStencilReference(vk_cmd, VK_STENCIL_FACE_BACK_BIT, state[4]);
+			table.vkCmdSetStencilWriteMask(vk_cmd, VK_STENCIL_FACE_BACK_BIT, state[5]);
+			break;
+		}
+
+		case Op::BindVertexBuffers:
+			table.vkCmdBindVertexBuffers(vk_cmd, command.first, command.count,
+			                             vertex_buffers.data() + command.data,
+			                             vertex_offsets.data() + command.data);
+			break;
+
+		case Op::BindIndexBuffer:
+			table.vkCmdBindIndexBuffer(vk_cmd, vertex_buffers[command.data], vertex_offsets[command.data],
+			                           VkIndexType(command.first));
+			break;
+
+		case Op::Draw:
+		{
+			uint32_t params[4];
+			memcpy(params, bytes.data() + command.data, sizeof(params));
+			table.vkCmdDraw(vk_cmd, params[0], params[1], params[2], params[3]);
+			break;
+		}
+
+		case Op::DrawIndexed:
+		{
+			uint32_t params[5];
+			memcpy(params, bytes.data() + command.data, sizeof(params));
+			table.vkCmdDrawIndexed(vk_cmd, params[0], params[1], params[2], int32_t(params[3]), params[4]);
+			break;
+		}
+
+		case Op::DrawIndirect:
+		{
+			auto &draw = indirect_draws[command.data];
+			table.vkCmdDrawIndirect(vk_cmd, draw.buffer, draw.offset, draw.draw_count, draw.stride);
+			break;
+		}
+
+		case Op::DrawIndexedIndirect:
+		{
+			auto &draw = indirect_draws[command.data];
+			table.vkCmdDrawIndexedIndirect(vk_cmd, draw.buffer, draw.offset, draw.draw_count, draw.stride);
+			break;
+		}
+		}
+	}
+
+	cmd.invalidate_bound_state();
+	return true;
+}
+}
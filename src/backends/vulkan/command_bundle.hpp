@@ -0,0 +1,203 @@
+/* Copyright (c) 2017-2026 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "vulkan_headers.hpp"
+#include "limits.hpp"
+#include "shader.hpp"
+#include <atomic>
+#include <vector>
+
+namespace Vulkan
+{
+class Device;
+class CommandBuffer;
+class DescriptorSetAllocator;
+
+// Applied on top of the recorded data when replaying a bundle.
+struct CommandBundlePatch
+{
+	// Overrides bytes [push_constant_offset, push_constant_offset + push_constant_size) of every
+	// recorded push constant block, e.g. a view-projection matrix shared by all draws.
+	const void *push_constant_data = nullptr;
+	uint32_t push_constant_offset = 0;
+	uint32_t push_constant_size = 0;
+
+	// Added to every dynamic uniform buffer offset of a set, e.g. to select the slice of a
+	// per-frame ring buffer. Only sets on the dynamic uniform buffer path have dynamic offsets.
+	uint32_t dynamic_offset_delta[VULKAN_NUM_DESCRIPTOR_SETS] = {};
+};
+
+// A sequence of draws captured once from a CommandBuffer with pipelines and descriptor sets resolved.
+// Replaying skips the state machine entirely and emits the captured commands directly.
+// The bundle is invalidated when any buffer, image, view or sampler it references is destroyed.
+class CommandBundle
+{
+public:
+	explicit CommandBundle(Device &device);
+	~CommandBundle();
+	void operator=(const CommandBundle &) = delete;
+	CommandBundle(const CommandBundle &) = delete;
+
+	// Valid from a successful capture until reset() or until a referenced resource is destroyed.
+	bool is_valid() const
+	{
+		return captured && !invalidated.load(std::memory_order_acquire);
+	}
+
+	void reset();
+
+	// cmd must be in a subpass compatible with the one the bundle was captured in.
+	// The state tracked by cmd is invalidated, so the next draw on cmd flushes everything again.
+	// Returns false without recording anything if the bundle cannot be replayed into cmd.
+	bool replay(CommandBuffer &cmd, const CommandBundlePatch *patch = nullptr) const;
+
+	size_t get_command_count() const
+	{
+		return commands.size();
+	}
+
+private:
+	friend class CommandBuffer;
+	friend class Device;
+
+	enum class Op : uint8_t
+	{
+		BindPipeline,
+		BindDescriptorSets,
+		PushDescriptorSet,
+		PushConstants,
+		SetViewport,
+		SetScissor,
+		SetDepthBias,
+		SetStencil,
+		BindVertexBuffers,
+		BindIndexBuffer,
+		Draw,
+		DrawIndexed,
+		DrawIndirect,
+		DrawIndexedIndirect
+	};
+
+	// Payloads live in the side arrays below, first and count index into them.
+	struct Command
+	{
+		Op op;
+		uint32_t first;
+		uint32_t count;
+		uint32_t data;
+	};
+
+	struct BindingSnapshot
+	{
+		ResourceBinding bindings[VULKAN_NUM_BINDINGS];
+	};
+
+	struct DescriptorSetBind
+	{
+		DescriptorSetAllocator *allocator;
+		Util::Hash hash;
+		VkDescriptorUpdateTemplate update_template;
+		uint32_t snapshot;
+		uint32_t num_dynamic_offsets;
+	};
+
+	struct DescriptorSetsBind
+	{
+		VkPipelineLayout layout;
+		uint32_t first_set;
+		uint32_t first_bind;
+		uint32_t first_dynamic_offset;
+	};
+
+	struct PushDescriptorSet
+	{
+		VkPipelineLayout layout;
+		VkDescriptorUpdateTemplate update_template;
+		uint32_t snapshot;
+	};
+
+	struct PushConstants
+	{
+		VkPipelineLayout layout;
+		VkShaderStageFlags stages;
+		uint32_t size;
+		uint32_t data;
+	};
+
+	struct IndirectDraw
+	{
+		VkBuffer buffer;
+		VkDeviceSize offset;
+		uint32_t draw_count;
+		uint32_t stride;
+	};
+
+	Device &device;
+	std::vector<Command> commands;
+	std::vector<VkPipeline> pipelines;
+	std::vector<DescriptorSetsBind> set_binds;
+	std::vector<DescriptorSetBind> sets;
+	std::vector<BindingSnapshot> snapshots;
+	std::vector<PushDescriptorSet> push_sets;
+	std::vector<PushConstants> push_constants;
+	std::vector<uint32_t> dynamic_offsets;
+	std::vector<uint8_t> bytes;
+	std::vector<VkBuffer> vertex_buffers;
+	std::vector<VkDeviceSize> vertex_offsets;
+	std::vector<IndirectDraw> indirect_draws;
+	std::vector<uint64_t> cookies;
+
+	Util::Hash compatible_render_pass = 0;
+	unsigned subpass = 0;
+	VkSurfaceTransformFlagBitsKHR surface_transform = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
+	bool captured = false;
+	std::atomic_bool invalidated{false};
+
+	void begin_capture(Util::Hash render_pass_hash, unsigned subpass, VkSurfaceTransformFlagBitsKHR transform);
+	void end_capture();
+	void invalidate();
+
+	void watch_cookie(uint64_t cookie);
+	void push_command(Op op, uint32_t first = 0, uint32_t count = 0, uint32_t data = 0);
+	uint32_t push_bytes(const void *data, size_t size);
+	uint32_t push_snapshot(const ResourceBinding *bindings);
+
+	void record_bind_pipeline(VkPipeline pipeline);
+	void record_push_descriptor_set(VkPipelineLayout layout, VkDescriptorUpdateTemplate update_template,
+	                                uint32_t set, const ResourceBinding *bindings);
+	void record_bind_descriptor_sets(VkPipelineLayout layout, uint32_t first_set,
+	                                 const DescriptorSetBind *binds, uint32_t count,
+	                                 const uint32_t *offsets, uint32_t num_offsets);
+	void record_push_constants(VkPipelineLayout layout, VkShaderStageFlags stages, const void *data, uint32_t size);
+	void record_viewport(const VkViewport &viewport);
+	void record_scissor(const VkRect2D &scissor);
+	void record_depth_bias(float constant, float slope);
+	void record_stencil(const uint32_t *state);
+	void record_bind_vertex_buffers(uint32_t first_binding, uint32_t count,
+	                                const VkBuffer *buffers, const VkDeviceSize *offsets);
+	void record_bind_index_buffer(VkBuffer buffer, VkDeviceSize offset, VkIndexType index_type);
+	void record_draw(Op op, const uint32_t *params, uint32_t num_params);
+	void record_indirect_draw(Op op, VkBuffer buffer, VkDeviceSize offset, uint32_t draw_count, uint32_t stride);
+};
+}
@@ -0,0 +1,259 @@
+/* Copyright (c) 2017-2026 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "completion_thread.hpp"
+#include "device.hpp"
+#include <algorithm>
+
+namespace Vulkan
+{
+CompletionThread::~CompletionThread()
+{
+	teardown();
+}
+
+void CompletionThread::init(Device *device_, const VkSemaphore *timelines_)
+{
+	device = device_;
+
+	if (timelines_)
+	{
+		std::copy(timelines_, timelines_ + QUEUE_INDEX_COUNT, timelines);
+
+		VkSemaphoreTypeCreateInfo type_info = { VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO };
+		VkSemaphoreCreateInfo info = { VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
+		info.pNext = &type_info;
+		type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+		type_info.initialValue = 0;
+
+		if (device->get_device_table().vkCreateSemaphore(device->get_device(), &info, nullptr, &wakeup) != VK_SUCCESS)
+		{
+			// The thread still dispatches callbacks handed over with add_ready().
+			LOGW("Failed to create wakeup semaphore, falling back to frame context completion callbacks.\n");
+			wakeup = VK_NULL_HANDLE;
+		}
+	}
+
+	thread = std::thread(&CompletionThread::thread_main, this);
+}
+
+void CompletionThread::teardown()
+{
+	if (thread.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> holder{lock};
+			shutdown = true;
+			if (in_gpu_wait)
+				wakeup_gpu_wait();
+		}
+		cond.notify_one();
+		thread.join();
+	}
+
+	if (!device)
+		return;
+
+	auto &table = device->get_device_table();
+
+	// Anything still pending can only complete once the GPU is done. Callers may be blocking on these,
+	// so run them all rather than dropping them. If the device is lost, the wait returns early, which is fine too.
+	std::vector<std::function<void ()>> funcs;
+	collect_all(funcs);
+	if (!funcs.empty())
+	{
+		table.vkDeviceWaitIdle(device->get_device());
+		for (auto &func : funcs)
+			func();
+	}
+
+	if (wakeup != VK_NULL_HANDLE)
+	{
+		table.vkDestroySemaphore(device->get_device(), wakeup, nullptr);
+		wakeup = VK_NULL_HANDLE;
+	}
+}
+
+void CompletionThread::wakeup_gpu_wait()
+{
+	VkSemaphoreSignalInfo info = { VK_STRUCTURE_TYPE_SEMAPHORE_SIGNAL_INFO };
+	info.semaphore = wakeup;
+	info.value = ++wakeup_value;
+	if (device->get_device_table().vkSignalSemaphore(device->get_device(), &info) != VK_SUCCESS)
+		LOGE("Failed to signal wakeup semaphore.\n");
+}
+
+void CompletionThread::add(QueueIndices queue, uint64_t timeline_value, std::function<void ()> func)
+{
+	VK_ASSERT(wakeup != VK_NULL_HANDLE);
+
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		if (shutdown)
+			return;
+
+		// Raced with a failed GPU wait. Nothing can be waited on anymore, so dispatch right away.
+		if (wait_failed.load(std::memory_order_relaxed))
+		{
+			ready.push_back(std::move(func));
+			cond.notify_one();
+			return;
+		}
+
+		auto &callbacks = pending[queue];
+
+		// The GPU wait only covers the earliest value of each queue, so it must be restarted.
+		if (in_gpu_wait && (callbacks.empty() || timeline_value < callbacks.front().value))
+			wakeup_gpu_wait();
+
+		auto itr = std::upper_bound(callbacks.begin(), callbacks.end(), timeline_value,
+		                            [](uint64_t value, const Callback &callback) {
+			                            return value < callback.value;
+		                            });
+		callbacks.insert(itr, { timeline_value, std::move(func) });
+	}
+	cond.notify_one();
+}
+
+void CompletionThread::add_ready(std::function<void ()> func)
+{
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		if (shutdown)
+			return;
+		ready.push_back(std::move(func));
+	}
+	cond.notify_one();
+}
+
+bool CompletionThread::has_pending() const
+{
+	for (auto &callbacks : pending)
+		if (!callbacks.empty())
+			return true;
+	return false;
+}
+
+void CompletionThread::collect_completed(std::vector<std::function<void ()>> &funcs)
+{
+	auto &table = device->get_device_table();
+
+	for (int i = 0; i < QUEUE_INDEX_COUNT; i++)
+	{
+		auto &callbacks = pending[i];
+		if (callbacks.empty())
+			continue;
+
+		uint64_t completed = 0;
+		if (table.vkGetSemaphoreCounterValue(device->get_device(), timelines[i], &completed) != VK_SUCCESS)
+			continue;
+
+		auto itr = callbacks.begin();
+		for (; itr != callbacks.end() && itr->value <= completed; ++itr)
+			funcs.push_back(std::move(itr->func));
+		callbacks.erase(callbacks.begin(), itr);
+	}
+
+	for (auto &func : ready)
+		funcs.push_back(std::move(func));
+	ready.clear();
+}
+
+void CompletionThread::collect_all(std::vector<std::function<void ()>> &funcs)
+{
+	for (auto &callbacks : pending)
+	{
+		for (auto &callback : callbacks)
+			funcs.push_back(std::move(callback.func));
+		callbacks.clear();
+	}
+
+	for (auto &func : ready)
+		funcs.push_back(std::move(func));
+	ready.clear();
+}
+
+void CompletionThread::thread_main()
+{
+	auto &table = device->get_device_table();
+	std::vector<std::function<void ()>> funcs;
+	std::unique_lock<std::mutex> holder{lock};
+
+	for (;;)
+	{
+		cond.wait(holder, [this]() {
+			return shutdown || !ready.empty() || has_pending();
+		});
+
+		if (!shutdown && has_pending())
+		{
+			VkSemaphore sems[QUEUE_INDEX_COUNT + 1];
+			uint64_t values[QUEUE_INDEX_COUNT + 1];
+			VkSemaphoreWaitInfo info = { VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO };
+			info.flags = VK_SEMAPHORE_WAIT_ANY_BIT;
+
+			for (int i = 0; i < QUEUE_INDEX_COUNT; i++)
+			{
+				if (!pending[i].empty())
+				{
+					sems[info.semaphoreCount] = timelines[i];
+					values[info.semaphoreCount] = pending[i].front().value;
+					info.semaphoreCount++;
+				}
+			}
+
+			sems[info.semaphoreCount] = wakeup;
+			values[info.semaphoreCount] = wakeup_value + 1;
+			info.semaphoreCount++;
+			info.pSemaphores = sems;
+			info.pValues = values;
+
+			in_gpu_wait = true;
+			holder.unlock();
+			VkResult result = table.vkWaitSemaphores(device->get_device(), &info, UINT64_MAX);
+			holder.lock();
+			in_gpu_wait = false;
+
+			if (result != VK_SUCCESS)
+			{
+				// Nothing more can be waited for, so release every waiter instead of leaving them blocked.
+				// From here on, the Device hands new callbacks over through add_ready().
+				LOGE("Failed to wait for queue timelines, dispatching all pending completion callbacks.\n");
+				wait_failed.store(true, std::memory_order_relaxed);
+				collect_all(funcs);
+			}
+		}
+
+		collect_completed(funcs);
+		bool exit_thread = shutdown;
+
+		holder.unlock();
+		for (auto &func : funcs)
+			func();
+		funcs.clear();
+		holder.lock();
+
+		if (exit_thread)
+			break;
+	}
+}
+}
@@ -0,0 +1,92 @@
+/* Copyright (c) 2017-2026 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "vulkan_common.hpp"
+#include "vulkan_headers.hpp"
+#include <functional>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+namespace Vulkan
+{
+class Device;
+
+// Dispatches GPU completion callbacks from a single host thread.
+// With timeline semaphores, the thread waits on every queue timeline with pending callbacks at once.
+// A host-signalled timeline semaphore is part of the wait, so new callbacks and teardown can interrupt it.
+// Without timeline semaphores, the Device hands over callbacks once their frame context is recycled.
+class CompletionThread
+{
+public:
+	~CompletionThread();
+
+	// timelines has QUEUE_INDEX_COUNT entries, or is nullptr if timeline semaphores are not supported.
+	void init(Device *device, const VkSemaphore *timelines);
+	// Waits for the device to go idle, then dispatches every remaining callback.
+	void teardown();
+
+	// False if timeline semaphores are not supported, the thread could not set up its GPU wait,
+	// or a GPU wait failed (e.g. device lost).
+	// In that case, callbacks must be deferred by the caller and handed over with add_ready().
+	bool supports_timeline_waits() const
+	{
+		return wakeup != VK_NULL_HANDLE && !wait_failed.load(std::memory_order_relaxed);
+	}
+
+	// Requires supports_timeline_waits().
+	void add(QueueIndices queue, uint64_t timeline_value, std::function<void ()> func);
+	// For callbacks which are known to have completed.
+	void add_ready(std::function<void ()> func);
+
+private:
+	Device *device = nullptr;
+	std::thread thread;
+	std::mutex lock;
+	std::condition_variable cond;
+
+	struct Callback
+	{
+		uint64_t value;
+		std::function<void ()> func;
+	};
+	std::vector<Callback> pending[QUEUE_INDEX_COUNT];
+	std::vector<std::function<void ()>> ready;
+
+	VkSemaphore timelines[QUEUE_INDEX_COUNT] = {};
+	VkSemaphore wakeup = VK_NULL_HANDLE;
+	uint64_t wakeup_value = 0;
+	bool in_gpu_wait = false;
+	bool shutdown = false;
+	std::atomic_bool wait_failed{false};
+
+	void thread_main();
+	bool has_pending() const;
+	void collect_completed(std::vector<std::function<void ()>> &funcs);
+	void collect_all(std::vector<std::function<void ()>> &funcs);
+	void wakeup_gpu_wait();
+};
+}
@@ -31,17 +31,53 @@ namespace Vulkan
 {
 DescriptorSetAllocator::DescriptorSetAllocator(Hash hash, Device *device_, const DescriptorSetLayout &layout,
                                                const uint32_t *stages_for_binds,
-                                               const ImmutableSampler * const *immutable_samplers)
+                                               const ImmutableSampler * const *immutable_samplers,
+                                               bool dynamic_uniform_buffers)
 	: IntrusiveHashMapEnabled<DescriptorSetAllocator>(hash)
 	, device(device_)
 	, table(device_->get_device_table())
 {
 	bindless = layout.meta[0].array_size == DescriptorSetLayout::UNSIZED_ARRAY;
+	bool heap = device->get_device_features().descriptor_heap_features.descriptorHeap == VK_TRUE;
+
+	// Dynamic offsets only exist for real descriptor sets.
+	dynamic_ubo = dynamic_uniform_buffers && !bindless && !heap && !device->ext.supports_descriptor_buffer;
+
+	if (bindless)
+	{
+		// Bindless sets share one unified layout (see Device::merge_combined_resource_layout),
+		// so the same bound applies to programs, descriptor pools and persistent tables.
+		// Use as much of the device limits as is reasonable, but never less than what we have always assumed.
+		auto &limits = device->get_gpu_properties().limits;
+		auto &props12 = device->get_device_features().vk12_props;
+		uint32_t max_descriptors;
+		if (device->ext.supports_descriptor_buffer_or_heap)
+		{
+			max_descriptors = std::min(limits.maxDescriptorSetSampledImages,
+			                           limits.maxPerStageDescriptorSampledImages);
+		}
+		else
+		{
+			max_descriptors = std::min(props12.maxDescriptorSetUpdateAfterBindSampledImages,
+			                           props12.maxPerStageDescriptorUpdateAfterBindSampledImages);
+		}
+
+		// A bindless set has no other bindings, but the non-bindless sets of a pipeline layout
+		// count against the same per-stage limit, so leave room for them.
+		constexpr uint32_t other_descriptors = VULKAN_NUM_BINDINGS * (VULKAN_NUM_DESCRIPTOR_SETS - 1);
+		max_descriptors = max_descriptors > other_descriptors ? max_descriptors - other_descriptors : 0;
+		bindless_max_descriptors = std::max(max_descriptors, VULKAN_NUM_BINDINGS_BINDLESS_VARYING);
+		bindless_max_descriptors = std::min(bindless_max_descriptors, VULKAN_NUM_BINDINGS_BINDLESS_TABLE);
+	}
 
 	if (!bindless)
 	{
 		unsigned count = device_->num_thread_indices * device_->per_frame.size();
 		per_thread_and_frame.resize(count);
+
+		per_thread_cache.resize(device_->num_thread_indices);
+		for (auto &cache : per_thread_cache)
+			cache.reset(new PerThreadCache);
 	}
 
 	if (bindless && !device->get_device_features().vk12_features.descriptorIndexing)
@@ -87,7 +123,7 @@ DescriptorSetAllocator::DescriptorSetAllocator(Hash hash, Device *device_, const
 		unsigned pool_array_size;
 		if (array_size == DescriptorSetLayout::UNSIZED_ARRAY)
 		{
-			array_size = VULKAN_NUM_BINDINGS_BINDLESS_VARYING;
+			array_size = bindless_max_descriptors;
 			pool_array_size = array_size;
 		}
 		else
@@ -128,7 +164,7 @@ DescriptorSetAllocator::DescriptorSetAllocator(Hash hash, Device *device_, const
 
 		if (layout.uniform_buffer_mask & (1u << i))
 		{
-			auto type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+			auto type = dynamic_ubo ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
 			bindings.push_back({ i, type, array_size, stages, nullptr });
 			pool_size.push_back({ type, pool_array_size });
 			types++;
@@ -194,8 +230,6 @@ DescriptorSetAllocator::DescriptorSetAllocator(Hash hash, Device *device_, const
 		}
 	}
 
-	bool heap = device->get_device_features().descriptor_heap_features.descriptorHeap == VK_TRUE;
-
 	if (!heap)
 	{
 #ifdef VULKAN_DEBUG
@@ -249,8 +283,8 @@ DescriptorSetAllocator::DescriptorSetAllocator(Hash hash, Device *device_, const
 		device->register_descriptor_set_layout(set_layout_pool, get_hash(), info);
 #endif
 
-	// Push descriptors is not used with descriptor buffer.
-	if (!bindless && device->get_device_features().vk14_features.pushDescriptor &&
+	// Push descriptors is not used with descriptor buffer, and cannot contain dynamic descriptors.
+	if (!bindless && !dynamic_ubo && device->get_device_features().vk14_features.pushDescriptor &&
 	    !heap && !device->get_device_features().descriptor_buffer_features.descriptorBuffer)
 	{
 		info.flags |= VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT;
@@ -354,6 +388,79 @@ void DescriptorSetAllocator::begin_frame()
 		// It would be safe to set all offsets to 0 here, but that's a little wasteful.
 		for (uint32_t i = 0; i < device->num_thread_indices; i++)
 			per_thread_and_frame[i * device->per_frame.size() + device->frame_context_index].offset = 0;
+
+		// Sets which have not been used for VULKAN_DESCRIPTOR_RING_SIZE frames become vacant.
+		// The ring is far longer than the number of frame contexts, so the GPU is done with them.
+		for (auto &cache : per_thread_cache)
+			cache->set_nodes.begin_frame();
+	}
+}
+
+std::pair<VkDescriptorSet, bool> DescriptorSetAllocator::find(unsigned thread_index, Hash hash)
+{
+	VK_ASSERT(!bindless);
+	auto &state = *per_thread_cache[thread_index];
+
+	auto *node = state.set_nodes.request(hash);
+	if (node)
+	{
+		state.hits++;
+		return { node->set, true };
+	}
+
+	state.misses++;
+	node = state.set_nodes.request_vacant(hash);
+	if (node)
+		return { node->set, false };
+
+	VkDescriptorPoolCreateInfo info = { VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+	info.maxSets = VULKAN_NUM_SETS_PER_POOL;
+	if (!pool_size.empty())
+	{
+		info.poolSizeCount = pool_size.size();
+		info.pPoolSizes = pool_size.data();
+	}
+
+	VkDescriptorPool pool;
+	if (table.vkCreateDescriptorPool(device->get_device(), &info, nullptr, &pool) != VK_SUCCESS)
+	{
+		LOGE("Failed to create descriptor pool.\n");
+		return { VK_NULL_HANDLE, false };
+	}
+
+	VkDescriptorSet sets[VULKAN_NUM_SETS_PER_POOL];
+	VkDescriptorSetLayout layouts[VULKAN_NUM_SETS_PER_POOL];
+	std::fill(std::begin(layouts), std::end(layouts), set_layout_pool);
+
+	VkDescriptorSetAllocateInfo alloc = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+	alloc.descriptorPool = pool;
+	alloc.descriptorSetCount = VULKAN_NUM_SETS_PER_POOL;
+	alloc.pSetLayouts = layouts;
+
+	if (table.vkAllocateDescriptorSets(device->get_device(), &alloc, sets) != VK_SUCCESS)
+	{
+		LOGE("Failed to allocate descriptor sets.\n");
+		table.vkDestroyDescriptorPool(device->get_device(), pool, nullptr);
+		return { VK_NULL_HANDLE, false };
+	}
+
+	state.pools.push_back(pool);
+
+	for (auto set : sets)
+		state.set_nodes.make_vacant(set);
+
+	return { state.set_nodes.request_vacant(hash)->set, false };
+}
+
+void DescriptorSetAllocator::accumulate_cache_stats(DescriptorSetCacheStats &stats)
+{
+	for (auto &cache : per_thread_cache)
+	{
+		stats.hits += cache->hits;
+		stats.misses += cache->misses;
+		stats.allocated_sets += cache->pools.size() * VULKAN_NUM_SETS_PER_POOL;
+		cache->hits = 0;
+		cache->misses = 0;
 	}
 }
 
@@ -432,6 +539,14 @@ void DescriptorSetAllocator::clear()
 		state.offset = 0;
 		state.object_pool = {};
 	}
+
+	for (auto &cache : per_thread_cache)
+	{
+		cache->set_nodes.clear();
+		for (auto &pool : cache->pools)
+			table.vkDestroyDescriptorPool(device->get_device(), pool, nullptr);
+		cache->pools.clear();
+	}
 }
 
 DescriptorSetAllocator::~DescriptorSetAllocator()
@@ -25,10 +25,12 @@
 #include "hash.hpp"
 #include "object_pool.hpp"
 #include "temporary_hashmap.hpp"
+#include "intrusive.hpp"
 #include "vulkan_headers.hpp"
 #include "sampler.hpp"
 #include "limits.hpp"
 #include "dynamic_array.hpp"
+#include <memory>
 #include <utility>
 #include <vector>
 #include "cookie.hpp"
@@ -135,12 +137,23 @@ enum class BindlessResourceType
 	Image
 };
 
+// Counters for the content-hashed descriptor set cache, summed over all threads and layouts.
+// hits and misses are totals since device creation, allocated_sets is the number of live sets.
+// Sampled at frame boundaries.
+struct DescriptorSetCacheStats
+{
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+	uint64_t allocated_sets = 0;
+};
+
 class DescriptorSetAllocator : public HashedObject<DescriptorSetAllocator>
 {
 public:
 	DescriptorSetAllocator(Util::Hash hash, Device *device, const DescriptorSetLayout &layout,
 	                       const uint32_t *stages_for_bindings,
-	                       const ImmutableSampler * const *immutable_samplers);
+	                       const ImmutableSampler * const *immutable_samplers,
+	                       bool dynamic_uniform_buffers);
 	~DescriptorSetAllocator();
 	void operator=(const DescriptorSetAllocator &) = delete;
 	DescriptorSetAllocator(const DescriptorSetAllocator &) = delete;
@@ -148,6 +161,17 @@ public:
 	void begin_frame();
 	VkDescriptorSet request_descriptor_set(unsigned thread_index, unsigned frame_context);
 
+	// Looks up a set previously written with the same contents. Returns the set and whether it is a hit.
+	// On a miss, the returned set is free to be written and is cached under hash from now on.
+	// hash must cover the identity (cookies) of every bound resource, cookies are never reused,
+	// so sets which refer to destroyed resources can never be hit again.
+	// Such sets age out after VULKAN_DESCRIPTOR_RING_SIZE frames without use and are recycled.
+	std::pair<VkDescriptorSet, bool> find(unsigned thread_index, Util::Hash hash);
+
+	// Adds hits and misses since the last call and the current number of cached sets to stats.
+	// Must be called where no command buffers are being recorded.
+	void accumulate_cache_stats(DescriptorSetCacheStats &stats);
+
 	VkDescriptorSetLayout get_layout_for_pool() const
 	{
 		return set_layout_pool;
@@ -165,6 +189,20 @@ public:
 		return bindless;
 	}
 
+	// Uniform buffers are UNIFORM_BUFFER_DYNAMIC. Such sets are written with a base offset of 0
+	// and the actual offsets are supplied when binding. There is no push layout in this case.
+	bool has_dynamic_uniform_buffers() const
+	{
+		return dynamic_ubo;
+	}
+
+	// Upper bound for the variable descriptor count of a bindless set.
+	// Every bindless layout shares this bound, so tables and programs agree on the layout.
+	uint32_t get_max_bindless_descriptors() const
+	{
+		return bindless_max_descriptors;
+	}
+
 	// Legacy descriptors.
 	VkDescriptorPool allocate_bindless_pool(unsigned num_sets, unsigned num_descriptors);
 	BindlessDescriptorSet allocate_bindless_set(VkDescriptorPool pool, unsigned num_descriptors);
@@ -214,8 +252,31 @@ private:
 	};
 
 	std::vector<PerThreadAndFrame> per_thread_and_frame;
+
+	struct DescriptorSetNode : Util::TemporaryHashmapEnabled<DescriptorSetNode>,
+	                           Util::IntrusiveListEnabled<DescriptorSetNode>
+	{
+		explicit DescriptorSetNode(VkDescriptorSet set_)
+			: set(set_)
+		{
+		}
+
+		VkDescriptorSet set;
+	};
+
+	struct PerThreadCache
+	{
+		Util::TemporaryHashmap<DescriptorSetNode, VULKAN_DESCRIPTOR_RING_SIZE, true> set_nodes;
+		std::vector<VkDescriptorPool> pools;
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+	};
+	std::vector<std::unique_ptr<PerThreadCache>> per_thread_cache;
+
 	std::vector<VkDescriptorPoolSize> pool_size;
 	bool bindless = false;
+	bool dynamic_ubo = false;
+	uint32_t bindless_max_descriptors = 0;
 };
 
 class BindlessAllocator
@@ -30,6 +30,7 @@
 #include "type_to_string.hpp"
 #include "quirks.hpp"
 #include "timer.hpp"
+#include "environment.hpp"
 #include <algorithm>
 #include <string.h>
 #include <stdlib.h>
@@ -518,7 +519,8 @@ const PipelineLayout *Device::request_pipeline_layout(const CombinedResourceLayo
 }
 
 DescriptorSetAllocator *Device::request_descriptor_set_allocator(const DescriptorSetLayout &layout, const uint32_t *stages_for_bindings,
-                                                                 const ImmutableSampler * const *immutable_samplers_)
+                                                                 const ImmutableSampler * const *immutable_samplers_,
+                                                                 bool dynamic_uniform_buffers)
 {
 	Hasher h;
 	h.data(reinterpret_cast<const uint32_t *>(&layout), sizeof(layout));
@@ -527,12 +529,16 @@ DescriptorSetAllocator *Device::request_descriptor_set_allocator(const Descripto
 		VK_ASSERT(immutable_samplers_ && immutable_samplers_[bit]);
 		h.u64(immutable_samplers_[bit]->get_hash());
 	});
+	h.u32(uint32_t(dynamic_uniform_buffers));
 	auto hash = h.get();
 
 	LOCK_CACHE();
 	auto *ret = descriptor_set_allocators.find(hash);
 	if (!ret)
-		ret = descriptor_set_allocators.emplace_yield(hash, hash, this, layout, stages_for_bindings, immutable_samplers_);
+	{
+		ret = descriptor_set_allocators.emplace_yield(hash, hash, this, layout, stages_for_bindings,
+		                                              immutable_samplers_, dynamic_uniform_buffers);
+	}
 	return ret;
 }
 
@@ -992,7 +998,23 @@ void Device::set_context(const Context &context)
 	managers.ibo.set_max_retained_blocks(256);
 	managers.ubo.set_max_retained_blocks(64);
 	managers.staging.set_max_retained_blocks(32);
+
+	// Draw batching writes tightly packed indirect commands, so only the 4 byte offset alignment applies.
+	managers.indirect.init(this, 64 * 1024, 4, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+	managers.indirect.set_max_retained_blocks(32);
 	managers.descriptor_buffer.init(this);
+	managers.blas_builder.init(this);
+	managers.readback.init(this);
+
+	if (ext.vk12_features.timelineSemaphore)
+	{
+		VkSemaphore timelines[QUEUE_INDEX_COUNT];
+		for (int i = 0; i < QUEUE_INDEX_COUNT; i++)
+			timelines[i] = queue_data[i].timeline_semaphore;
+		managers.completion.init(this, timelines);
+	}
+	else
+		managers.completion.init(this, nullptr);
 
 	init_stock_samplers();
 
@@ -1017,6 +1039,10 @@ void Device::set_context(const Context &context)
 
 	init_calibrated_timestamps();
 
+	unsigned profile_frames = Util::get_environment_uint("GRANITE_PROFILE_FRAMES", 0);
+	if (profile_frames)
+		begin_profile_capture(Util::get_environment_string("GRANITE_PROFILE_PATH", "granite-profile.json"), profile_frames);
+
 #ifdef GRANITE_VULKAN_SYSTEM_HANDLES
 	resource_manager.init();
 #endif
@@ -1244,6 +1270,17 @@ void Device::request_staging_block_nolock(BufferBlock &block, VkDeviceSize size)
 	request_block(*this, block, size, managers.staging, frame().staging_blocks);
 }
 
+void Device::request_indirect_block(BufferBlock &block, VkDeviceSize size)
+{
+	LOCK();
+	request_indirect_block_nolock(block, size);
+}
+
+void Device::request_indirect_block_nolock(BufferBlock &block, VkDeviceSize size)
+{
+	request_block(*this, block, size, managers.indirect, frame().indirect_blocks);
+}
+
 void Device::submit(CommandBufferHandle &cmd, Fence *fence, unsigned semaphore_count, Semaphore *semaphores)
 {
 	cmd->end_debug_channel();
@@ -1393,6 +1430,10 @@ void Device::submit_nolock(CommandBufferHandle cmd, Fence *fence, unsigned semap
 	}
 
 	decrement_frame_counter_nolock();
+
+	// Once nothing is recording, garbage collected so far is covered by the flushed submissions.
+	if (lock.counter == 0 && seal_garbage_nolock())
+		reclaim_garbage_nolock(0);
 }
 
 void Device::submit_external(CommandBuffer::Type type)
@@ -1460,7 +1501,10 @@ void Device::submit_empty_inner(QueueIndices physical_type, InternalFence *fence
 		fence->fence = cleared_fence;
 
 	auto start_ts = write_calibrated_timestamp_nolock();
+	int64_t profile_start_ns = managers.profiler.is_capturing() ? Util::get_current_time_nsecs() : 0;
 	auto result = submit_batches(composer, queue, cleared_fence);
+	if (profile_start_ns)
+		managers.profiler.write_submission(physical_type, profile_start_ns, Util::get_current_time_nsecs());
 	auto end_ts = write_calibrated_timestamp_nolock();
 	register_time_interval_nolock("CPU", std::move(start_ts), std::move(end_ts), "submit");
 
@@ -1875,7 +1919,10 @@ void Device::submit_queue(QueueIndices physical_type, InternalFence *fence,
 	                   fence, semaphore_count, semaphores);
 
 	auto start_ts = write_calibrated_timestamp_nolock();
+	int64_t profile_start_ns = managers.profiler.is_capturing() ? Util::get_current_time_nsecs() : 0;
 	auto result = submit_batches(composer, queue, cleared_fence, profiling_iteration);
+	if (profile_start_ns)
+		managers.profiler.write_submission(physical_type, profile_start_ns, Util::get_current_time_nsecs());
 	auto end_ts = write_calibrated_timestamp_nolock();
 	register_time_interval_nolock("CPU", std::move(start_ts), std::move(end_ts), "submit");
 
@@ -1924,6 +1971,9 @@ void Device::end_frame_nolock()
 			VK_ASSERT(queue_data[i].wait_semaphores.empty());
 		}
 	}
+
+	seal_garbage_nolock();
+	frame().garbage_frame_serial = garbage_frame_serial++;
 }
 
 void Device::flush_frame()
@@ -2026,7 +2076,7 @@ void Device::submit_secondary(CommandBuffer &primary, CommandBuffer &secondary)
 }
 
 CommandBufferHandle Device::request_secondary_command_buffer_for_thread(unsigned thread_index,
-                                                                        const Framebuffer *framebuffer,
+                                                                        const RenderPass *render_pass,
                                                                         unsigned subpass,
                                                                         CommandBuffer::Type type)
 {
@@ -2038,11 +2088,26 @@ CommandBufferHandle Device::request_secondary_command_buffer_for_thread(unsigned
 	VkCommandBufferInheritanceInfo inherit = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO };
 
 	inherit.framebuffer = VK_NULL_HANDLE;
-	inherit.renderPass = framebuffer->get_compatible_render_pass().get_render_pass();
+	inherit.renderPass = render_pass->get_render_pass();
 	inherit.subpass = subpass;
 	info.pInheritanceInfo = &inherit;
 	info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
 
+	VkCommandBufferInheritanceRenderingInfo inheritance_rendering =
+		{ VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO };
+	if (render_pass->uses_dynamic_rendering())
+	{
+		auto &rendering_info = render_pass->get_pipeline_rendering_info();
+		inheritance_rendering.viewMask = rendering_info.viewMask;
+		inheritance_rendering.colorAttachmentCount = rendering_info.colorAttachmentCount;
+		inheritance_rendering.pColorAttachmentFormats = rendering_info.pColorAttachmentFormats;
+		inheritance_rendering.depthAttachmentFormat = rendering_info.depthAttachmentFormat;
+		inheritance_rendering.stencilAttachmentFormat = rendering_info.stencilAttachmentFormat;
+		inheritance_rendering.rasterizationSamples = VkSampleCountFlagBits(render_pass->get_sample_count(subpass));
+		inheritance_rendering.pNext = inherit.pNext;
+		inherit.pNext = &inheritance_rendering;
+	}
+
 	VkBindHeapInfoEXT resource_heap = { VK_STRUCTURE_TYPE_BIND_HEAP_INFO_EXT };
 	VkBindHeapInfoEXT sampler_heap = { VK_STRUCTURE_TYPE_BIND_HEAP_INFO_EXT };
 	VkCommandBufferInheritanceDescriptorHeapInfoEXT inheritance_heap =
@@ -2064,6 +2129,7 @@ CommandBufferHandle Device::request_secondary_command_buffer_for_thread(unsigned
 		sampler_heap.reservedRangeOffset = heap.reserved_offset;
 		sampler_heap.reservedRangeSize = heap.size - heap.reserved_offset;
 
+		inheritance_heap.pNext = inherit.pNext;
 		inherit.pNext = &inheritance_heap;
 	}
 
@@ -2130,8 +2196,11 @@ Device::~Device()
 	wsi.release.reset();
 	wsi.swapchain.clear();
 	managers.descriptor_buffer.teardown();
+	managers.blas_builder.teardown();
 
 	wait_idle();
+	managers.completion.teardown();
+	managers.readback.teardown();
 
 	managers.timestamps.log_simple();
 
@@ -2312,9 +2381,179 @@ Device::PerFrame::PerFrame(Device *device_, unsigned frame_index_)
 	}
 }
 
+bool Device::Garbage::empty() const
+{
+	return allocations.empty() &&
+	       destroyed_framebuffers.empty() &&
+	       destroyed_samplers.empty() &&
+	       destroyed_image_views.empty() &&
+	       destroyed_buffer_views.empty() &&
+	       destroyed_images.empty() &&
+	       destroyed_buffers.empty() &&
+	       destroyed_rtas.empty() &&
+	       destroyed_descriptor_pools.empty() &&
+	       destroyed_execution_sets.empty() &&
+	       descriptor_buffer_allocs.empty() &&
+	       cached_descriptor_payloads.empty() &&
+	       bindless_slot_releases.empty();
+}
+
+bool Device::seal_garbage_nolock()
+{
+	if (pending_garbage.empty() || per_frame.empty())
+		return false;
+
+	// Submissions which are not flushed yet don't have a timeline value.
+	for (auto &submissions : frame().submissions)
+		if (!submissions.empty())
+			return false;
+
+	for (int i = 0; i < QUEUE_INDEX_COUNT; i++)
+		pending_garbage.timeline_values[i] = queue_data[i].current_timeline;
+	pending_garbage.frame_serial = garbage_frame_serial;
+	sealed_garbage.push_back(std::move(pending_garbage));
+	pending_garbage = {};
+	return true;
+}
+
+void Device::reclaim_garbage_nolock(uint64_t completed_frame_serial)
+{
+	uint64_t completed_values[QUEUE_INDEX_COUNT] = {};
+	bool has_completed_values = false;
+	bool has_timeline = ext.vk12_features.timelineSemaphore;
+
+	while (!sealed_garbage.empty())
+	{
+		auto &garbage = sealed_garbage.front();
+		bool complete = garbage.frame_serial <= completed_frame_serial;
+
+		if (!complete && has_timeline)
+		{
+			if (!has_completed_values)
+			{
+				for (int i = 0; i < QUEUE_INDEX_COUNT && has_timeline; i++)
+				{
+					if (queue_data[i].timeline_semaphore == VK_NULL_HANDLE ||
+					    table->vkGetSemaphoreCounterValue(device, queue_data[i].timeline_semaphore,
+					                                      &completed_values[i]) != VK_SUCCESS)
+					{
+						has_timeline = false;
+					}
+				}
+				has_completed_values = true;
+			}
+
+			complete = has_timeline;
+			for (int i = 0; i < QUEUE_INDEX_COUNT && complete; i++)
+				if (garbage.timeline_values[i] > completed_values[i])
+					complete = false;
+		}
+
+		// Sealed in order, so later garbage cannot be complete either.
+		if (!complete)
+			break;
+
+		free_garbage_nolock(garbage);
+		sealed_garbage.pop_front();
+	}
+}
+
+void Device::free_garbage_nolock(Garbage &garbage)
+{
+	for (auto &framebuffer : garbage.destroyed_framebuffers)
+		table->vkDestroyFramebuffer(device, framebuffer, nullptr);
+	for (auto &sampler : garbage.destroyed_samplers)
+		managers.descriptor_buffer.destroy_sampler(sampler);
+	for (auto &view : garbage.destroyed_image_views)
+		managers.descriptor_buffer.free_image_view(view);
+	for (auto &view : garbage.destroyed_buffer_views)
+		managers.descriptor_buffer.free_buffer_view(view);
+	for (auto &image : garbage.destroyed_images)
+		table->vkDestroyImage(device, image, nullptr);
+	for (auto &rtas : garbage.destroyed_rtas)
+		table->vkDestroyAccelerationStructureKHR(device, rtas, nullptr);
+	for (auto &buffer : garbage.destroyed_buffers)
+		table->vkDestroyBuffer(device, buffer, nullptr);
+	for (auto &pool : garbage.destroyed_descriptor_pools)
+		table->vkDestroyDescriptorPool(device, pool, nullptr);
+	for (auto &exec_set : garbage.destroyed_execution_sets)
+		table->vkDestroyIndirectExecutionSetEXT(device, exec_set, nullptr);
+	managers.descriptor_buffer.free(garbage.descriptor_buffer_allocs.data(), garbage.descriptor_buffer_allocs.size());
+	managers.descriptor_buffer.free_cached_descriptors(
+			garbage.cached_descriptor_payloads.data(), garbage.cached_descriptor_payloads.size());
+	for (auto &release : garbage.bindless_slot_releases)
+		for (auto slot : release.slots)
+			release.allocator->recycle(slot);
+
+	if (!garbage.allocations.empty())
+	{
+		std::lock_guard<std::mutex> holder{lock.memory_lock};
+		for (auto &alloc : garbage.allocations)
+			alloc.free_immediate(managers.memory);
+	}
+
+	garbage.destroyed_framebuffers.clear();
+	garbage.destroyed_samplers.clear();
+	garbage.destroyed_image_views.clear();
+	garbage.destroyed_buffer_views.clear();
+	garbage.destroyed_images.clear();
+	garbage.destroyed_buffers.clear();
+	garbage.destroyed_rtas.clear();
+	garbage.destroyed_execution_sets.clear();
+	garbage.destroyed_descriptor_pools.clear();
+	garbage.allocations.clear();
+	garbage.descriptor_buffer_allocs.clear();
+	garbage.cached_descriptor_payloads.clear();
+	garbage.bindless_slot_releases.clear();
+}
+
+void Device::add_completion_callback(CommandBuffer::Type type, uint64_t timeline_value, std::function<void ()> func)
+{
+	if (managers.completion.supports_timeline_waits())
+	{
+		managers.completion.add(get_physical_queue_type(type), timeline_value, std::move(func));
+	}
+	else
+	{
+		LOCK();
+		frame().completion_callbacks.push_back(std::move(func));
+	}
+}
+
+void Device::add_completion_callback(CommandBuffer::Type type, std::function<void ()> func)
+{
+	LOCK();
+	auto physical_type = get_physical_queue_type(type);
+
+	if (managers.completion.supports_timeline_waits())
+	{
+		flush_frame_nolock(physical_type);
+		managers.completion.add(physical_type, queue_data[physical_type].current_timeline, std::move(func));
+	}
+	else
+		frame().completion_callbacks.push_back(std::move(func));
+}
+
+uint64_t Device::get_current_timeline_value(CommandBuffer::Type type)
+{
+	LOCK();
+	return queue_data[get_physical_queue_type(type)].current_timeline;
+}
+
+void Device::reclaim()
+{
+	LOCK();
+	if (lock.counter == 0)
+	{
+		flush_frame_nolock();
+		seal_garbage_nolock();
+	}
+	reclaim_garbage_nolock(0);
+}
+
 void Device::free_memory_nolock(const DeviceAllocation &alloc)
 {
-	frame().allocations.push_back(alloc);
+	pending_garbage.allocations.push_back(alloc);
 }
 
 #ifdef VULKAN_DEBUG
@@ -2431,12 +2670,12 @@ void Device::free_cached_descriptor_payload(const CachedDescriptorPayload &paylo
 
 void Device::destroy_image_view_nolock(const CachedImageView &view)
 {
-	frame().destroyed_image_views.push_back(view);
+	pending_garbage.destroyed_image_views.push_back(view);
 }
 
 void Device::destroy_buffer_view_nolock(const CachedBufferView &view)
 {
-	frame().destroyed_buffer_views.push_back(view);
+	pending_garbage.destroyed_buffer_views.push_back(view);
 }
 
 void Device::destroy_semaphore_nolock(VkSemaphore semaphore)
@@ -2476,12 +2715,70 @@ void Device::reset_fence_nolock(VkFence fence, bool observed_wait)
 
 void Device::free_descriptor_buffer_allocation_nolock(const DescriptorBufferAllocation &alloc)
 {
-	frame().descriptor_buffer_allocs.push_back(alloc);
+	pending_garbage.descriptor_buffer_allocs.push_back(alloc);
 }
 
 void Device::free_cached_descriptor_payload_nolock(const CachedDescriptorPayload &payload)
 {
-	frame().cached_descriptor_payloads.push_back(payload);
+	pending_garbage.cached_descriptor_payloads.push_back(payload);
+}
+
+void Device::release_bindless_slots(std::shared_ptr<BindlessSlotAllocator> allocator, std::vector<uint32_t> slots)
+{
+	LOCK();
+	pending_garbage.bindless_slot_releases.push_back({ std::move(allocator), std::move(slots) });
+}
+
+bool Device::watch_bundle_cookie(CommandBundle *bundle, uint64_t cookie)
+{
+	std::lock_guard<std::mutex> holder{bundle_watch.lock};
+	auto &bundles = bundle_watch.cookies[cookie];
+	if (std::find(bundles.begin(), bundles.end(), bundle) != bundles.end())
+		return false;
+
+	bundles.push_back(bundle);
+	bundle_watch.count.fetch_add(1, std::memory_order_relaxed);
+	return true;
+}
+
+void Device::unwatch_bundle_cookies(CommandBundle *bundle, const uint64_t *cookies, size_t count)
+{
+	std::lock_guard<std::mutex> holder{bundle_watch.lock};
+	for (size_t i = 0; i < count; i++)
+	{
+		auto itr = bundle_watch.cookies.find(cookies[i]);
+		if (itr == bundle_watch.cookies.end())
+			continue;
+
+		auto &bundles = itr->second;
+		auto bundle_itr = std::find(bundles.begin(), bundles.end(), bundle);
+		if (bundle_itr == bundles.end())
+			continue;
+
+		*bundle_itr = bundles.back();
+		bundles.pop_back();
+		bundle_watch.count.fetch_sub(1, std::memory_order_relaxed);
+		if (bundles.empty())
+			bundle_watch.cookies.erase(itr);
+	}
+}
+
+void Device::notify_cookie_destroyed(uint64_t cookie)
+{
+	// Resources are destroyed all the time, don't take the lock unless a bundle is alive.
+	if (bundle_watch.count.load(std::memory_order_relaxed) == 0)
+		return;
+
+	std::lock_guard<std::mutex> holder{bundle_watch.lock};
+	auto itr = bundle_watch.cookies.find(cookie);
+	if (itr == bundle_watch.cookies.end())
+		return;
+
+	// The bundle keeps the cookie in its own list, unwatching a cookie which is gone is a no-op.
+	for (auto *bundle : itr->second)
+		bundle->invalidate();
+	bundle_watch.count.fetch_sub(uint32_t(itr->second.size()), std::memory_order_relaxed);
+	bundle_watch.cookies.erase(itr);
 }
 
 PipelineEvent Device::request_pipeline_event()
@@ -2491,44 +2788,44 @@ PipelineEvent Device::request_pipeline_event()
 
 void Device::destroy_image_nolock(VkImage image)
 {
-	VK_ASSERT(!exists(frame().destroyed_images, image));
-	frame().destroyed_images.push_back(image);
+	VK_ASSERT(!exists(pending_garbage.destroyed_images, image));
+	pending_garbage.destroyed_images.push_back(image);
 }
 
 void Device::destroy_buffer_nolock(VkBuffer buffer)
 {
-	VK_ASSERT(!exists(frame().destroyed_buffers, buffer));
-	frame().destroyed_buffers.push_back(buffer);
+	VK_ASSERT(!exists(pending_garbage.destroyed_buffers, buffer));
+	pending_garbage.destroyed_buffers.push_back(buffer);
 }
 
 void Device::destroy_rtas_nolock(VkAccelerationStructureKHR rtas)
 {
-	VK_ASSERT(!exists(frame().destroyed_rtas, rtas));
-	frame().destroyed_rtas.push_back(rtas);
+	VK_ASSERT(!exists(pending_garbage.destroyed_rtas, rtas));
+	pending_garbage.destroyed_rtas.push_back(rtas);
 }
 
 void Device::destroy_indirect_execution_set_nolock(VkIndirectExecutionSetEXT exec_set)
 {
-	VK_ASSERT(!exists(frame().destroyed_execution_sets, exec_set));
-	frame().destroyed_execution_sets.push_back(exec_set);
+	VK_ASSERT(!exists(pending_garbage.destroyed_execution_sets, exec_set));
+	pending_garbage.destroyed_execution_sets.push_back(exec_set);
 }
 
 void Device::destroy_descriptor_pool_nolock(VkDescriptorPool desc_pool)
 {
-	VK_ASSERT(!exists(frame().destroyed_descriptor_pools, desc_pool));
-	frame().destroyed_descriptor_pools.push_back(desc_pool);
+	VK_ASSERT(!exists(pending_garbage.destroyed_descriptor_pools, desc_pool));
+	pending_garbage.destroyed_descriptor_pools.push_back(desc_pool);
 }
 
 void Device::destroy_sampler_nolock(VkSampler sampler)
 {
-	VK_ASSERT(!exists(frame().destroyed_samplers, sampler));
-	frame().destroyed_samplers.push_back(sampler);
+	VK_ASSERT(!exists(pending_garbage.destroyed_samplers, sampler));
+	pending_garbage.destroyed_samplers.push_back(sampler);
 }
 
 void Device::destroy_framebuffer_nolock(VkFramebuffer framebuffer)
 {
-	VK_ASSERT(!exists(frame().destroyed_framebuffers, framebuffer));
-	frame().destroyed_framebuffers.push_back(framebuffer);
+	VK_ASSERT(!exists(pending_garbage.destroyed_framebuffers, framebuffer));
+	pending_garbage.destroyed_framebuffers.push_back(framebuffer);
 }
 
 void Device::wait_idle()
@@ -2558,12 +2855,14 @@ void Device::wait_idle_nolock()
 	managers.ubo.reset();
 	managers.ibo.reset();
 	managers.staging.reset();
+	managers.indirect.reset();
 	for (auto &frame : per_frame)
 	{
 		frame->vbo_blocks.clear();
 		frame->ibo_blocks.clear();
 		frame->ubo_blocks.clear();
 		frame->staging_blocks.clear();
+		frame->indirect_blocks.clear();
 	}
 
 	framebuffer_allocator.clear();
@@ -2583,6 +2882,12 @@ void Device::wait_idle_nolock()
 		frame->trim_command_pools();
 	}
 
+	// Everything released above went into pending_garbage after end_frame_nolock() sealed the rest.
+	// The device is idle, so all of it can be freed right away.
+	seal_garbage_nolock();
+	reclaim_garbage_nolock(UINT64_MAX);
+	free_garbage_nolock(pending_garbage);
+
 	{
 		LOCK_MEMORY();
 		managers.memory.garbage_collect();
@@ -2643,6 +2948,9 @@ bool Device::next_frame_context_is_non_blocking()
 
 void Device::next_frame_context()
 {
+	// Records through the public API, so must happen before we drain.
+	managers.blas_builder.flush();
+
 	DRAIN_FRAME_LOCK();
 
 	if (frame_context_begin_ts)
@@ -2660,10 +2968,17 @@ void Device::next_frame_context()
 
 	if (!ext.supports_descriptor_buffer_or_heap)
 	{
+		descriptor_set_cache_stats.allocated_sets = 0;
 		for (auto &allocator: descriptor_set_allocators.get_read_only())
+		{
+			allocator.accumulate_cache_stats(descriptor_set_cache_stats);
 			allocator.begin_frame();
+		}
 		for (auto &allocator: descriptor_set_allocators.get_read_write())
+		{
+			allocator.accumulate_cache_stats(descriptor_set_cache_stats);
 			allocator.begin_frame();
+		}
 	}
 
 	VK_ASSERT(!per_frame.empty());
@@ -2675,6 +2990,7 @@ void Device::next_frame_context()
 
 	frame().begin();
 	recalibrate_timestamps();
+	managers.profiler.next_frame_context(unsigned(per_frame.size()));
 	frame_context_begin_ts = write_calibrated_timestamp_nolock();
 }
 
@@ -2689,6 +3005,12 @@ QueryPoolHandle Device::write_timestamp_nolock(VkCommandBuffer cmd, VkPipelineSt
 	return frame().query_pool_ts.write_timestamp(cmd, stage);
 }
 
+QueryPoolHandle Device::allocate_compacted_rtas_size_query(VkCommandBuffer cmd)
+{
+	LOCK();
+	return frame().query_pool_rtas.allocate_query(cmd);
+}
+
 QueryPoolHandle Device::write_calibrated_timestamp()
 {
 	LOCK();
@@ -2824,6 +3146,35 @@ void Device::register_time_interval_nolock(std::string tid, QueryPoolHandle star
 	}
 }
 
+void Device::register_profile_region(CommandBuffer::Type type, std::string name,
+                                     QueryPoolHandle start_ts, QueryPoolHandle end_ts)
+{
+	LOCK();
+	frame().profile_regions.push_back({ get_physical_queue_type(type), std::move(name),
+	                                    std::move(start_ts), std::move(end_ts) });
+}
+
+bool Device::begin_profile_capture(const std::string &path, unsigned frame_count)
+{
+	return managers.profiler.begin_capture(path.c_str(), frame_count,
+	                                       calibrated_time_domain != VK_TIME_DOMAIN_DEVICE_KHR);
+}
+
+Profiler &Device::get_profiler()
+{
+	return managers.profiler;
+}
+
+BLASBuilder &Device::get_blas_builder()
+{
+	return managers.blas_builder;
+}
+
+ReadbackManager &Device::get_readback_manager()
+{
+	return managers.readback;
+}
+
 void Device::add_frame_counter_nolock()
 {
 	lock.counter++;
@@ -2915,7 +3266,7 @@ void Device::PerFrame::begin()
 	for (auto &channel : debug_channels)
 		device.parse_debug_channel(channel);
 
-	// Free the debug channel buffers here, and they will immediately be recycled by the destroyed_buffers right below.
+	// Free the debug channel buffers here, they are reclaimed along with other deferred garbage.
 	debug_channels.clear();
 
 	for (auto &block : vbo_blocks)
@@ -2926,62 +3277,33 @@ void Device::PerFrame::begin()
 		managers.ubo.recycle_block(block);
 	for (auto &block : staging_blocks)
 		managers.staging.recycle_block(block);
+	for (auto &block : indirect_blocks)
+		managers.indirect.recycle_block(block);
 	vbo_blocks.clear();
 	ibo_blocks.clear();
 	ubo_blocks.clear();
 	staging_blocks.clear();
+	indirect_blocks.clear();
 
-	for (auto &framebuffer : destroyed_framebuffers)
-		table.vkDestroyFramebuffer(vkdevice, framebuffer, nullptr);
-	for (auto &sampler : destroyed_samplers)
-		managers.descriptor_buffer.destroy_sampler(sampler);
-	for (auto &view : destroyed_image_views)
-		managers.descriptor_buffer.free_image_view(view);
-	for (auto &view : destroyed_buffer_views)
-		managers.descriptor_buffer.free_buffer_view(view);
-	for (auto &image : destroyed_images)
-		table.vkDestroyImage(vkdevice, image, nullptr);
-	for (auto &rtas : destroyed_rtas)
-		table.vkDestroyAccelerationStructureKHR(vkdevice, rtas, nullptr);
-	for (auto &buffer : destroyed_buffers)
-		table.vkDestroyBuffer(vkdevice, buffer, nullptr);
 	for (auto &semaphore : destroyed_semaphores)
 		table.vkDestroySemaphore(vkdevice, semaphore, nullptr);
-	for (auto &pool : destroyed_descriptor_pools)
-		table.vkDestroyDescriptorPool(vkdevice, pool, nullptr);
-	for (auto &exec_set : destroyed_execution_sets)
-		table.vkDestroyIndirectExecutionSetEXT(vkdevice, exec_set, nullptr);
 	for (auto &semaphore : recycled_semaphores)
 		managers.semaphore.recycle(semaphore);
 	for (auto &event : recycled_events)
 		managers.event.recycle(event);
-	managers.descriptor_buffer.free(descriptor_buffer_allocs.data(), descriptor_buffer_allocs.size());
-	managers.descriptor_buffer.free_cached_descriptors(
-			cached_descriptor_payloads.data(), cached_descriptor_payloads.size());
 	VK_ASSERT(consumed_semaphores.empty());
 
-	if (!allocations.empty())
-	{
-		std::lock_guard<std::mutex> holder{device.lock.memory_lock};
-		for (auto &alloc : allocations)
-			alloc.free_immediate(managers.memory);
-	}
-
-	destroyed_framebuffers.clear();
-	destroyed_samplers.clear();
-	destroyed_image_views.clear();
-	destroyed_buffer_views.clear();
-	destroyed_images.clear();
-	destroyed_buffers.clear();
-	destroyed_rtas.clear();
-	destroyed_execution_sets.clear();
 	destroyed_semaphores.clear();
-	destroyed_descriptor_pools.clear();
 	recycled_semaphores.clear();
 	recycled_events.clear();
-	allocations.clear();
-	descriptor_buffer_allocs.clear();
-	cached_descriptor_payloads.clear();
+
+	for (auto &func : completion_callbacks)
+		managers.completion.add_ready(std::move(func));
+	completion_callbacks.clear();
+
+	device.reclaim_garbage_nolock(in_destructor ? UINT64_MAX : garbage_frame_serial);
+	if (in_destructor)
+		device.free_garbage_nolock(device.pending_garbage);
 
 	if (!in_destructor)
 		device.register_time_interval_nolock("CPU", std::move(wait_fence_ts), device.write_calibrated_timestamp_nolock(), "fence + recycle");
@@ -3031,8 +3353,19 @@ void Device::PerFrame::begin()
 		device.system_handles.timeline_trace_file->submit_event(e);
 	}
 
+	for (auto &region : profile_regions)
+	{
+		if (region.start_ts->is_signalled() && region.end_ts->is_signalled())
+		{
+			managers.profiler.write_gpu_region(region.queue, region.name,
+			                                   device.convert_timestamp_to_absolute_nsec(*region.start_ts),
+			                                   device.convert_timestamp_to_absolute_nsec(*region.end_ts));
+		}
+	}
+
 	managers.timestamps.mark_end_of_frame_context();
 	timestamp_intervals.clear();
+	profile_regions.clear();
 }
 
 Device::PerFrame::~PerFrame()
@@ -3279,6 +3612,53 @@ BufferViewHandle Device::create_buffer_view(const BufferViewCreateInfo &view_inf
 	return BufferViewHandle(handle_pool.buffer_views.allocate(this, view, view_info));
 }
 
+static bool setup_conversion_info(const Device &device, VkImageViewCreateInfo &create_info,
+                                  VkSamplerYcbcrConversionInfo &conversion,
+                                  const ImmutableYcbcrConversion *ycbcr_conversion)
+{
+	if (ycbcr_conversion)
+	{
+		if (!device.get_device_features().vk11_features.samplerYcbcrConversion)
+			return false;
+		conversion = { VK_STRUCTURE_TYPE_SAMPLER_YCBCR_CONVERSION_INFO };
+		conversion.conversion = ycbcr_conversion->get_conversion();
+		conversion.pNext = create_info.pNext;
+		create_info.pNext = &conversion;
+	}
+
+	return true;
+}
+
+static bool setup_astc_decode_mode_info(const Device &device, VkImageViewCreateInfo &create_info,
+                                        VkImageViewASTCDecodeModeEXT &astc_info)
+{
+	if (!device.get_device_features().supports_astc_decode_mode)
+		return true;
+
+	auto type = format_compression_type(create_info.format);
+	if (type != FormatCompressionType::ASTC)
+		return true;
+
+	if (format_is_srgb(create_info.format))
+		return true;
+
+	if (format_is_compressed_hdr(create_info.format))
+	{
+		if (device.get_device_features().astc_decode_features.decodeModeSharedExponent)
+			astc_info.decodeMode = VK_FORMAT_E5B9G9R9_UFLOAT_PACK32;
+		else
+			astc_info.decodeMode = VK_FORMAT_R16G16B16A16_SFLOAT;
+	}
+	else
+	{
+		astc_info.decodeMode = VK_FORMAT_R8G8B8A8_UNORM;
+	}
+
+	astc_info.pNext = create_info.pNext;
+	create_info.pNext = &astc_info;
+	return true;
+}
+
 class ImageResourceHolder
 {
 public:
@@ -3300,13 +3680,8 @@ public:
 	VkImage image = VK_NULL_HANDLE;
 	VkDeviceMemory memory = VK_NULL_HANDLE;
 	CachedImageView image_view = {};
-	CachedImageView depth_view = {};
-	CachedImageView stencil_view = {};
-	CachedImageView unorm_view = {};
-	CachedImageView srgb_view = {};
+	SecondaryImageViewInfo secondary;
 	VkImageViewType default_view_type = VK_IMAGE_VIEW_TYPE_MAX_ENUM;
-	std::vector<CachedImageView> rt_views;
-	std::vector<CachedImageView> mip_views;
 	DeviceAllocation allocation;
 	DeviceAllocator *allocator = nullptr;
 	bool owned = true;
@@ -3316,23 +3691,6 @@ public:
 		return default_view_type;
 	}
 
-	bool setup_conversion_info(VkImageViewCreateInfo &create_info,
-	                           VkSamplerYcbcrConversionInfo &conversion,
-	                           const ImmutableYcbcrConversion *ycbcr_conversion) const
-	{
-		if (ycbcr_conversion)
-		{
-			if (!device->get_device_features().vk11_features.samplerYcbcrConversion)
-				return false;
-			conversion = { VK_STRUCTURE_TYPE_SAMPLER_YCBCR_CONVERSION_INFO };
-			conversion.conversion = ycbcr_conversion->get_conversion();
-			conversion.pNext = create_info.pNext;
-			create_info.pNext = &conversion;
-		}
-
-		return true;
-	}
-
 	bool setup_view_usage_info(VkImageViewCreateInfo &create_info, VkImageUsageFlags usage,
 	                           VkImageUsageFlags &view_usage) const
 	{
@@ -3354,35 +3712,6 @@ public:
 		return true;
 	}
 
-	bool setup_astc_decode_mode_info(VkImageViewCreateInfo &create_info, VkImageViewASTCDecodeModeEXT &astc_info) const
-	{
-		if (!device->get_device_features().supports_astc_decode_mode)
-			return true;
-
-		auto type = format_compression_type(create_info.format);
-		if (type != FormatCompressionType::ASTC)
-			return true;
-
-		if (format_is_srgb(create_info.format))
-			return true;
-
-		if (format_is_compressed_hdr(create_info.format))
-		{
-			if (device->get_device_features().astc_decode_features.decodeModeSharedExponent)
-				astc_info.decodeMode = VK_FORMAT_E5B9G9R9_UFLOAT_PACK32;
-			else
-				astc_info.decodeMode = VK_FORMAT_R16G16B16A16_SFLOAT;
-		}
-		else
-		{
-			astc_info.decodeMode = VK_FORMAT_R8G8B8A8_UNORM;
-		}
-
-		astc_info.pNext = create_info.pNext;
-		create_info.pNext = &astc_info;
-		return true;
-	}
-
 	bool create_default_views(const ImageCreateInfo &create_info, const VkImageViewCreateInfo *view_info,
 	                          const ImmutableYcbcrConversion *ycbcr_conversion,
 	                          bool create_unorm_srgb_views = false, bool create_mip_level_views = false,
@@ -3419,115 +3748,71 @@ public:
 			default_view_info = *view_info;
 
 		view_info = &default_view_info;
-		if (!setup_conversion_info(default_view_info, conversion_info, ycbcr_conversion))
+		if (!setup_conversion_info(*device, default_view_info, conversion_info, ycbcr_conversion))
 			return false;
 
 		if (!setup_view_usage_info(default_view_info, create_info.usage, view_usage))
 			return false;
 
-		if (!setup_astc_decode_mode_info(default_view_info, astc_decode_mode_info))
-			return false;
-
-		if (!create_alt_views(*view_info, create_info.layout, view_usage))
-			return false;
-
-		if (!create_render_target_views(*view_info, create_info.layout, view_usage))
+		if (!setup_astc_decode_mode_info(*device, default_view_info, astc_decode_mode_info))
 			return false;
 
 		if (!create_default_view(*view_info, create_info.layout, view_usage))
 			return false;
 
+		// Everything else is created by the ImageView on first use.
+		secondary.view_info = *view_info;
+		secondary.view_info.pNext = nullptr;
+		secondary.ycbcr_conversion = ycbcr_conversion;
+		secondary.usage = view_usage;
+		setup_alt_views(*view_info, view_usage);
+		setup_render_target_views(*view_info, view_usage);
+
 		if (create_unorm_srgb_views)
 		{
-			auto info = *view_info;
-			auto srgb_unorm_usage = view_usage;
-
-			if (create_info.usage & VK_IMAGE_USAGE_STORAGE_BIT)
-				srgb_unorm_usage |= VK_IMAGE_USAGE_STORAGE_BIT;
-			info.format = view_formats[0];
-			if (!device->managers.descriptor_buffer.create_image_view(info, srgb_unorm_usage, create_info.layout, unorm_view))
-				return false;
-
-			srgb_unorm_usage &= ~VK_IMAGE_USAGE_STORAGE_BIT;
-			info.format = view_formats[1];
-			if (!device->managers.descriptor_buffer.create_image_view(info, srgb_unorm_usage, create_info.layout, srgb_view))
-				return false;
+			secondary.unorm_format = view_formats[0];
+			secondary.srgb_format = view_formats[1];
 		}
 
-		if (create_mip_level_views && !create_mip_views(*view_info, create_info.layout, view_usage))
-			return false;
+		if (create_mip_level_views)
+			setup_mip_views(*view_info);
 
 		return true;
 	}
 
 private:
-	bool create_render_target_views(const VkImageViewCreateInfo &info, ImageLayout layout, VkImageUsageFlags view_usage)
+	void setup_render_target_views(const VkImageViewCreateInfo &info, VkImageUsageFlags view_usage)
 	{
 		if (info.viewType == VK_IMAGE_VIEW_TYPE_3D)
-			return true;
+			return;
 
 		constexpr VkImageUsageFlags render_target_usage =
 				VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
 				VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
 
 		// If we have a render target, and non-trivial case (layers = 1, levels = 1),
-		// create an array of render targets which correspond to each layer (mip 0).
+		// render targets correspond to each layer (mip 0).
 		if ((view_usage & render_target_usage) != 0 &&
 		    ((info.subresourceRange.levelCount > 1) || (info.subresourceRange.layerCount > 1)))
 		{
-			rt_views.reserve(info.subresourceRange.layerCount);
-			view_usage &= render_target_usage;
-
-			auto view_info = info;
-			view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
-			view_info.subresourceRange.baseMipLevel = info.subresourceRange.baseMipLevel;
-			for (uint32_t layer = 0; layer < info.subresourceRange.layerCount; layer++)
-			{
-				view_info.subresourceRange.levelCount = 1;
-				view_info.subresourceRange.layerCount = 1;
-				view_info.subresourceRange.baseArrayLayer = layer + info.subresourceRange.baseArrayLayer;
-
-				CachedImageView rt_view = {};
-				if (!device->managers.descriptor_buffer.create_image_view(view_info, view_usage, layout, rt_view))
-					return false;
-				rt_views.push_back(rt_view);
-			}
+			secondary.num_render_target_views = info.subresourceRange.layerCount;
 		}
-
-		return true;
 	}
 
-	bool create_mip_views(const VkImageViewCreateInfo &info, ImageLayout layout, VkImageUsageFlags view_usage)
+	void setup_mip_views(const VkImageViewCreateInfo &info)
 	{
 		VK_ASSERT(info.subresourceRange.levelCount != VK_REMAINING_MIP_LEVELS);
-		if (info.subresourceRange.levelCount <= 1)
-			return true;
-		mip_views.reserve(info.subresourceRange.levelCount);
-
-		view_usage &= VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
-		auto view_info = info;
-
-		for (unsigned level = 0; level < info.subresourceRange.levelCount; level++)
-		{
-			view_info.subresourceRange.baseMipLevel = level;
-			view_info.subresourceRange.levelCount = 1;
-
-			CachedImageView mip_view = {};
-			if (!device->managers.descriptor_buffer.create_image_view(view_info, view_usage, layout, mip_view))
-				return false;
-			mip_views.push_back(mip_view);
-		}
-
-		return true;
+		if (info.subresourceRange.levelCount > 1)
+			secondary.num_mip_views = info.subresourceRange.levelCount;
 	}
 
-	bool create_alt_views(const VkImageViewCreateInfo &info, ImageLayout layout, VkImageUsageFlags view_usage)
+	void setup_alt_views(const VkImageViewCreateInfo &info, VkImageUsageFlags view_usage)
 	{
 		if (info.viewType == VK_IMAGE_VIEW_TYPE_CUBE ||
 		    info.viewType == VK_IMAGE_VIEW_TYPE_CUBE_ARRAY ||
 		    info.viewType == VK_IMAGE_VIEW_TYPE_3D)
 		{
-			return true;
+			return;
 		}
 
 		constexpr VkImageUsageFlags sampled_usage =
@@ -3536,20 +3821,8 @@ private:
 		if (info.subresourceRange.aspectMask == (VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT) &&
 		    (view_usage & sampled_usage) != 0)
 		{
-			auto view_info = info;
-			view_usage &= sampled_usage;
-
-			// We need this to be able to sample the texture, or otherwise use it as a non-pure DS attachment.
-			view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
-			if (!device->managers.descriptor_buffer.create_image_view(view_info, view_usage, layout, depth_view))
-				return false;
-
-			view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_STENCIL_BIT;
-			if (!device->managers.descriptor_buffer.create_image_view(view_info, view_usage, layout, stencil_view))
-				return false;
+			secondary.depth_stencil_views = true;
 		}
-
-		return true;
 	}
 
 	bool create_default_view(const VkImageViewCreateInfo &info, ImageLayout layout, VkImageUsageFlags usage)
@@ -3562,14 +3835,6 @@ private:
 	{
 		auto &m = device->managers.descriptor_buffer;
 		m.free_image_view(image_view);
-		m.free_image_view(depth_view);
-		m.free_image_view(stencil_view);
-		m.free_image_view(unorm_view);
-		m.free_image_view(srgb_view);
-		for (auto &view : rt_views)
-			m.free_image_view(view);
-		for (auto &view : mip_views)
-			m.free_image_view(view);
 
 		VkDevice vkdevice = device->get_device();
 
@@ -3582,6 +3847,22 @@ private:
 	}
 };
 
+bool Device::create_secondary_image_view(const VkImageViewCreateInfo &info,
+                                         const ImmutableYcbcrConversion *ycbcr_conversion,
+                                         VkImageUsageFlags usage, ImageLayout layout, CachedImageView &view)
+{
+	auto view_info = info;
+	VkSamplerYcbcrConversionInfo conversion_info = { VK_STRUCTURE_TYPE_SAMPLER_YCBCR_CONVERSION_INFO };
+	VkImageViewASTCDecodeModeEXT astc_decode_mode_info = { VK_STRUCTURE_TYPE_IMAGE_VIEW_ASTC_DECODE_MODE_EXT };
+
+	if (!setup_conversion_info(*this, view_info, conversion_info, ycbcr_conversion))
+		return false;
+	if (!setup_astc_decode_mode_info(*this, view_info, astc_decode_mode_info))
+		return false;
+
+	return managers.descriptor_buffer.create_image_view(view_info, usage, layout, view);
+}
+
 ImageViewHandle Device::create_image_view(const ImageViewCreateInfo &create_info)
 {
 	ImageResourceHolder holder(this);
@@ -3632,9 +3913,7 @@ ImageViewHandle Device::create_image_view(const ImageViewCreateInfo &create_info
 	if (ret)
 	{
 		holder.owned = false;
-		ret->set_separate_depth_stencil_views(holder.depth_view, holder.stencil_view);
-		ret->set_render_target_views(std::move(holder.rt_views));
-		ret->set_mip_views(std::move(holder.mip_views));
+		ret->set_secondary_views(holder.secondary);
 		return ret;
 	}
 	else
@@ -4313,11 +4592,7 @@ ImageHandle Device::create_image_from_staging_buffer(const ImageCreateInfo &crea
 		holder.owned = false;
 		if (has_view)
 		{
-			handle->get_view().set_separate_depth_stencil_views(holder.depth_view, holder.stencil_view);
-			handle->get_view().set_render_target_views(holder.rt_views);
-			handle->get_view().set_mip_views(holder.mip_views);
-			handle->get_view().set_unorm_view(holder.unorm_view);
-			handle->get_view().set_srgb_view(holder.srgb_view);
+			handle->get_view().set_secondary_views(holder.secondary);
 		}
 	}
 
@@ -4576,11 +4851,10 @@ SamplerHandle Device::create_sampler(const SamplerCreateInfo &sampler_info)
 	return SamplerHandle(handle_pool.samplers.allocate(this, sampler, sampler_info, false));
 }
 
-BindlessDescriptorPoolHandle Device::create_bindless_descriptor_pool(BindlessResourceType type,
-                                                                     unsigned num_sets, unsigned num_descriptors)
+DescriptorSetAllocator *Device::request_bindless_set_allocator(BindlessResourceType type)
 {
 	if (!ext.vk12_features.descriptorIndexing)
-		return BindlessDescriptorPoolHandle{nullptr};
+		return nullptr;
 
 	DescriptorSetLayout layout;
 	const uint32_t stages_for_sets[VULKAN_NUM_BINDINGS] = { VK_SHADER_STAGE_ALL };
@@ -4595,17 +4869,24 @@ BindlessDescriptorPoolHandle Device::create_bindless_descriptor_pool(BindlessRes
 		break;
 
 	default:
-		return BindlessDescriptorPoolHandle{nullptr};
+		return nullptr;
 	}
 
-	auto *allocator = request_descriptor_set_allocator(layout, stages_for_sets, nullptr);
+	return request_descriptor_set_allocator(layout, stages_for_sets, nullptr);
+}
+
+BindlessDescriptorPoolHandle Device::create_bindless_descriptor_pool(BindlessResourceType type,
+                                                                     unsigned num_sets, unsigned num_descriptors)
+{
+	auto *allocator = request_bindless_set_allocator(type);
+	if (!allocator)
+		return BindlessDescriptorPoolHandle{nullptr};
 
 	VkDescriptorPool pool = VK_NULL_HANDLE;
 
 	if (!ext.supports_descriptor_buffer_or_heap)
 	{
-		if (allocator)
-			pool = allocator->allocate_bindless_pool(num_sets, num_descriptors);
+		pool = allocator->allocate_bindless_pool(num_sets, num_descriptors);
 
 		if (!pool)
 		{
@@ -4619,6 +4900,22 @@ BindlessDescriptorPoolHandle Device::create_bindless_descriptor_pool(BindlessRes
 	return BindlessDescriptorPoolHandle{handle};
 }
 
+BindlessTableHandle Device::create_bindless_table(BindlessResourceType type, unsigned initial_capacity)
+{
+	auto *allocator = request_bindless_set_allocator(type);
+	if (!allocator)
+		return BindlessTableHandle{nullptr};
+
+	BindlessTableHandle table{new BindlessTable(this, allocator, initial_capacity)};
+	if (!table->get_descriptor_set())
+	{
+		LOGE("Failed to allocate bindless table.\n");
+		return BindlessTableHandle{nullptr};
+	}
+
+	return table;
+}
+
 void Device::fill_buffer_sharing_indices(VkBufferCreateInfo &info, uint32_t *sharing_indices)
 {
 	for (auto &i : queue_info.family_indices)
@@ -4861,7 +5158,7 @@ RTASHandle Device::create_rtas(const TopRTASCreateInfo &info, CommandBuffer *cmd
 	geom.geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR;
 	auto &inst = geom.geometry.instances;
 	inst.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR;
-	inst.arrayOfPointers = VK_TRUE;
+	inst.arrayOfPointers = info.packed_instances ? VK_FALSE : VK_TRUE;
 	geom_info.geometryCount = 1;
 	geom_info.pGeometries = &geom;
 
@@ -4878,30 +5175,10 @@ RTASHandle Device::create_rtas(const TopRTASCreateInfo &info, CommandBuffer *cmd
 	return handle;
 }
 
-RTASHandle Device::create_rtas(const BottomRTASCreateInfo &info, CommandBuffer *cmd, QueryPoolHandle *compacted_size)
+void Device::get_blas_build_sizes(const BottomRTASCreateInfo &info, VkAccelerationStructureBuildSizesInfoKHR &size_info)
 {
-	if (!ext.rtas_features.accelerationStructure)
-	{
-		LOGE("RTAS not supported on this driver.\n");
-		return {};
-	}
-
-	if (compacted_size && !cmd)
-	{
-		LOGE("If specifying compacted size, must have a command buffer.\n");
-		return {};
-	}
-
-	if (compacted_size && info.mode != BLASMode::Static)
-	{
-		LOGE("Only Static mode supports compaction.\n");
-		return {};
-	}
-
 	VkAccelerationStructureBuildGeometryInfoKHR geom_info =
 			{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR };
-	VkAccelerationStructureBuildSizesInfoKHR size_info =
-			{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR };
 
 	geom_info.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
 	geom_info.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
@@ -4954,8 +5231,33 @@ RTASHandle Device::create_rtas(const BottomRTASCreateInfo &info, CommandBuffer *
 	table->vkGetAccelerationStructureBuildSizesKHR(
 			device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
 			&geom_info, primitive_counts.data(), &size_info);
+}
 
-	auto handle = create_rtas(geom_info.type, size_info.accelerationStructureSize);
+RTASHandle Device::create_rtas(const BottomRTASCreateInfo &info, CommandBuffer *cmd, QueryPoolHandle *compacted_size)
+{
+	if (!ext.rtas_features.accelerationStructure)
+	{
+		LOGE("RTAS not supported on this driver.\n");
+		return {};
+	}
+
+	if (compacted_size && !cmd)
+	{
+		LOGE("If specifying compacted size, must have a command buffer.\n");
+		return {};
+	}
+
+	if (compacted_size && info.mode != BLASMode::Static)
+	{
+		LOGE("Only Static mode supports compaction.\n");
+		return {};
+	}
+
+	VkAccelerationStructureBuildSizesInfoKHR size_info =
+			{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR };
+	get_blas_build_sizes(info, size_info);
+
+	auto handle = create_rtas(VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR, size_info.accelerationStructureSize);
 	handle->set_scratch_size(size_info.buildScratchSize, size_info.updateScratchSize);
 
 	if (cmd)
@@ -4964,7 +5266,7 @@ RTASHandle Device::create_rtas(const BottomRTASCreateInfo &info, CommandBuffer *
 
 		if (compacted_size)
 		{
-			auto query = frame().query_pool_rtas.allocate_query(cmd->get_command_buffer());
+			auto query = allocate_compacted_rtas_size_query(cmd->get_command_buffer());
 			cmd->write_compacted_rtas_size(*handle, *query);
 			*compacted_size = std::move(query);
 		}
@@ -24,6 +24,7 @@
 
 #include "buffer.hpp"
 #include "command_buffer.hpp"
+#include "command_bundle.hpp"
 #include "command_pool.hpp"
 #include "fence.hpp"
 #include "fence_manager.hpp"
@@ -40,8 +41,14 @@
 #include "buffer_pool.hpp"
 #include "indirect_layout.hpp"
 #include "pipeline_cache.hpp"
+#include "profiler.hpp"
+#include "blas_builder.hpp"
+#include "completion_thread.hpp"
+#include "readback.hpp"
+#include "bindless_table.hpp"
 #include <memory>
 #include <vector>
+#include <deque>
 #include <functional>
 #include <unordered_map>
 #include <stdio.h>
@@ -188,6 +195,7 @@ public:
 	friend struct BufferDeleter;
 	friend class RTAS;
 	friend struct RTASDeleter;
+	friend class BLASBuilder;
 	friend class BufferView;
 	friend struct BufferViewDeleter;
 	friend class ImageView;
@@ -197,8 +205,10 @@ public:
 	friend struct LinearHostImageDeleter;
 	friend class CommandBuffer;
 	friend struct CommandBufferDeleter;
+	friend class CommandBundle;
 	friend class BindlessDescriptorPool;
 	friend struct BindlessDescriptorPoolDeleter;
+	friend class BindlessTable;
 	friend class Program;
 	friend class WSI;
 	friend class Cookie;
@@ -273,6 +283,19 @@ public:
 	void wait_idle();
 	void end_frame_context();
 
+	// GPU completion callbacks. func is called from a dedicated host thread once the queue timeline
+	// has reached timeline_value, or, if timeline waits are unavailable, once the current frame context is recycled.
+	void add_completion_callback(CommandBuffer::Type type, uint64_t timeline_value, std::function<void ()> func);
+	// Attaches to everything submitted to the queue so far. Pending submissions on that queue are flushed.
+	void add_completion_callback(CommandBuffer::Type type, std::function<void ()> func);
+	// Timeline value of the last flushed submission on the queue.
+	uint64_t get_current_timeline_value(CommandBuffer::Type type);
+
+	// Frees destroyed objects whose last possible use has completed on the GPU.
+	// This happens automatically on submission and frame context boundaries, but can be called at any time,
+	// e.g. while streaming. If no command buffer is being recorded, pending submissions are flushed first.
+	void reclaim();
+
 	// RenderDoc integration API for app-guided captures.
 	static bool init_renderdoc_capture();
 	// Calls next_frame_context() and begins a renderdoc capture.
@@ -364,6 +387,17 @@ public:
 	// Generic creation methods.
 	RTASHandle create_rtas(VkAccelerationStructureTypeKHR type, VkDeviceSize size);
 	RTASHandle create_rtas(VkAccelerationStructureTypeKHR type, BufferHandle buffer, VkDeviceSize offset, VkDeviceSize size);
+	// Scratch-budgeted BLAS builds spread over frame contexts with automatic compaction.
+	BLASBuilder &get_blas_builder();
+
+	// Non-blocking buffer and image readbacks through pooled host cached staging buffers.
+	ReadbackManager &get_readback_manager();
+
+	// Hit rate of descriptor set reuse for the legacy descriptor set path, updated in next_frame_context().
+	const DescriptorSetCacheStats &get_descriptor_set_cache_stats() const
+	{
+		return descriptor_set_cache_stats;
+	}
 
 	// Create staging buffers for images.
 
@@ -382,6 +416,8 @@ public:
 
 	BindlessDescriptorPoolHandle create_bindless_descriptor_pool(BindlessResourceType type,
 	                                                             unsigned num_sets, unsigned num_descriptors);
+	// Persistent bindless table with stable slots. Grows on demand up to the device limit.
+	BindlessTableHandle create_bindless_table(BindlessResourceType type, unsigned initial_capacity);
 
 	// Render pass helpers.
 	bool image_format_is_supported(VkFormat format, VkFormatFeatureFlags2KHR required, VkImageTiling tiling = VK_IMAGE_TILING_OPTIMAL) const;
@@ -546,6 +582,12 @@ public:
 	void timestamp_log_reset();
 	void timestamp_log(const TimestampIntervalReportCallback &cb) const;
 
+	// Captures GPU regions, CPU regions and queue submissions of the next frame_count frame contexts
+	// into a Chrome trace file. Can also be triggered with GRANITE_PROFILE_FRAMES and GRANITE_PROFILE_PATH.
+	bool begin_profile_capture(const std::string &path, unsigned frame_count);
+	// For CPU regions, see ProfilerScope.
+	Profiler &get_profiler();
+
 private:
 	VkInstance instance = VK_NULL_HANDLE;
 	VkPhysicalDevice gpu = VK_NULL_HANDLE;
@@ -565,8 +607,10 @@ private:
 	void request_index_block(BufferBlock &block, VkDeviceSize size);
 	void request_uniform_block(BufferBlock &block, VkDeviceSize size);
 	void request_staging_block(BufferBlock &block, VkDeviceSize size);
+	void request_indirect_block(BufferBlock &block, VkDeviceSize size);
 
 	QueryPoolHandle write_timestamp(VkCommandBuffer cmd, VkPipelineStageFlags2 stage);
+	QueryPoolHandle allocate_compacted_rtas_size_query(VkCommandBuffer cmd);
 
 	void set_acquire_semaphore(unsigned index, Semaphore acquire);
 	void set_present_id(VkSwapchainKHR low_latency_swapchain, uint64_t present_id);
@@ -578,7 +622,9 @@ private:
 	                                              const ImmutableSamplerBank *immutable_samplers);
 	DescriptorSetAllocator *request_descriptor_set_allocator(const DescriptorSetLayout &layout,
 	                                                         const uint32_t *stages_for_sets,
-	                                                         const ImmutableSampler * const *immutable_samplers);
+	                                                         const ImmutableSampler * const *immutable_samplers,
+	                                                         bool dynamic_uniform_buffers = false);
+	DescriptorSetAllocator *request_bindless_set_allocator(BindlessResourceType type);
 	const Framebuffer &request_framebuffer(const RenderPassInfo &info);
 	const RenderPass &request_render_pass(const RenderPassInfo &info, bool compatible);
 
@@ -599,6 +645,8 @@ private:
 	QueryPoolHandle write_calibrated_timestamp_nolock();
 	void register_time_interval_nolock(std::string tid, QueryPoolHandle start_ts, QueryPoolHandle end_ts,
 	                                   const std::string &tag);
+	void register_profile_region(CommandBuffer::Type type, std::string name,
+	                             QueryPoolHandle start_ts, QueryPoolHandle end_ts);
 
 	// Make sure this is deleted last.
 	HandlePool handle_pool;
@@ -620,9 +668,13 @@ private:
 		FenceManager fence;
 		SemaphoreManager semaphore;
 		EventManager event;
-		BufferPool vbo, ibo, ubo, staging;
+		BufferPool vbo, ibo, ubo, staging, indirect;
 		TimestampIntervalManager timestamps;
 		DescriptorBufferAllocator descriptor_buffer;
+		Profiler profiler;
+		BLASBuilder blas_builder;
+		CompletionThread completion;
+		ReadbackManager readback;
 	};
 	Managers managers;
 
@@ -636,6 +688,14 @@ private:
 		bool async_frame_context = false;
 	} lock;
 
+	// Resource cookies referenced by captured command bundles.
+	struct
+	{
+		std::mutex lock;
+		std::unordered_map<uint64_t, std::vector<CommandBundle *>> cookies;
+		std::atomic_uint32_t count{0};
+	} bundle_watch;
+
 	struct PerFrame
 	{
 		PerFrame(Device *device, unsigned index);
@@ -662,26 +722,15 @@ private:
 		std::vector<BufferBlock> ibo_blocks;
 		std::vector<BufferBlock> ubo_blocks;
 		std::vector<BufferBlock> staging_blocks;
+		std::vector<BufferBlock> indirect_blocks;
 
 		std::vector<VkFence> wait_and_recycle_fences;
 
-		std::vector<DeviceAllocation> allocations;
-		std::vector<VkFramebuffer> destroyed_framebuffers;
-		std::vector<VkSampler> destroyed_samplers;
-		std::vector<CachedImageView> destroyed_image_views;
-		std::vector<CachedBufferView> destroyed_buffer_views;
-		std::vector<VkImage> destroyed_images;
-		std::vector<VkBuffer> destroyed_buffers;
-		std::vector<VkAccelerationStructureKHR> destroyed_rtas;
-		std::vector<VkDescriptorPool> destroyed_descriptor_pools;
 		Util::SmallVector<CommandBufferHandle> submissions[QUEUE_INDEX_COUNT];
 		std::vector<VkSemaphore> recycled_semaphores;
 		std::vector<VkEvent> recycled_events;
 		std::vector<VkSemaphore> destroyed_semaphores;
 		std::vector<VkSemaphore> consumed_semaphores;
-		std::vector<VkIndirectExecutionSetEXT> destroyed_execution_sets;
-		std::vector<DescriptorBufferAllocation> descriptor_buffer_allocs;
-		std::vector<CachedDescriptorPayload> cached_descriptor_payloads;
 
 		struct DebugChannel
 		{
@@ -700,8 +749,60 @@ private:
 		};
 		std::vector<TimestampIntervalHandles> timestamp_intervals;
 
+		struct ProfileRegion
+		{
+			QueueIndices queue;
+			std::string name;
+			QueryPoolHandle start_ts;
+			QueryPoolHandle end_ts;
+		};
+		std::vector<ProfileRegion> profile_regions;
+		std::vector<std::function<void ()>> completion_callbacks;
+
+		// Garbage sealed while this frame context was active is complete once it is recycled.
+		uint64_t garbage_frame_serial = 0;
 		bool in_destructor = false;
 	};
+
+	// Deferred destruction. Destroyed objects are collected in pending_garbage until no command buffer
+	// which could reference them is being recorded or waiting to be flushed to a queue.
+	// They are then sealed with the current timeline value of every queue and reclaimed
+	// as soon as all queues have passed those values, at the latest when the frame context is recycled.
+	struct Garbage
+	{
+		std::vector<DeviceAllocation> allocations;
+		std::vector<VkFramebuffer> destroyed_framebuffers;
+		std::vector<VkSampler> destroyed_samplers;
+		std::vector<CachedImageView> destroyed_image_views;
+		std::vector<CachedBufferView> destroyed_buffer_views;
+		std::vector<VkImage> destroyed_images;
+		std::vector<VkBuffer> destroyed_buffers;
+		std::vector<VkAccelerationStructureKHR> destroyed_rtas;
+		std::vector<VkDescriptorPool> destroyed_descriptor_pools;
+		std::vector<VkIndirectExecutionSetEXT> destroyed_execution_sets;
+		std::vector<DescriptorBufferAllocation> descriptor_buffer_allocs;
+		std::vector<CachedDescriptorPayload> cached_descriptor_payloads;
+
+		struct BindlessSlotRelease
+		{
+			std::shared_ptr<BindlessSlotAllocator> allocator;
+			std::vector<uint32_t> slots;
+		};
+		std::vector<BindlessSlotRelease> bindless_slot_releases;
+
+		uint64_t timeline_values[QUEUE_INDEX_COUNT] = {};
+		uint64_t frame_serial = 0;
+
+		bool empty() const;
+	};
+	Garbage pending_garbage;
+	std::deque<Garbage> sealed_garbage;
+	uint64_t garbage_frame_serial = 1;
+
+	bool seal_garbage_nolock();
+	void reclaim_garbage_nolock(uint64_t completed_frame_serial);
+	void free_garbage_nolock(Garbage &garbage);
+
 	// The per frame structure must be destroyed after
 	// the hashmap data structures below, so it must be declared before.
 	std::vector<std::unique_ptr<PerFrame>> per_frame;
@@ -778,6 +879,7 @@ private:
 
 	VulkanCache<PipelineLayout> pipeline_layouts;
 	VulkanCache<DescriptorSetAllocator> descriptor_set_allocators;
+	DescriptorSetCacheStats descriptor_set_cache_stats;
 	VulkanCache<RenderPass> render_passes;
 	VulkanCache<Shader> shaders;
 	VulkanCache<Program> programs;
@@ -818,6 +920,9 @@ private:
 	void destroy_rtas(VkAccelerationStructureKHR rtas);
 	void destroy_image(VkImage image);
 	void destroy_image_view(const CachedImageView &view);
+	bool create_secondary_image_view(const VkImageViewCreateInfo &info,
+	                                 const ImmutableYcbcrConversion *ycbcr_conversion,
+	                                 VkImageUsageFlags usage, ImageLayout layout, CachedImageView &view);
 	void destroy_buffer_view(const CachedBufferView &view);
 	void destroy_sampler(VkSampler sampler);
 	void destroy_framebuffer(VkFramebuffer framebuffer);
@@ -831,9 +936,15 @@ private:
 	void destroy_indirect_execution_set(VkIndirectExecutionSetEXT exec_set);
 	void free_descriptor_buffer_allocation(const DescriptorBufferAllocation &alloc);
 	void free_cached_descriptor_payload(const CachedDescriptorPayload &payload);
+	void release_bindless_slots(std::shared_ptr<BindlessSlotAllocator> allocator, std::vector<uint32_t> slots);
+
+	bool watch_bundle_cookie(CommandBundle *bundle, uint64_t cookie);
+	void unwatch_bundle_cookies(CommandBundle *bundle, const uint64_t *cookies, size_t count);
+	void notify_cookie_destroyed(uint64_t cookie);
 
 	void destroy_buffer_nolock(VkBuffer buffer);
 	void destroy_rtas_nolock(VkAccelerationStructureKHR rtas);
+	void get_blas_build_sizes(const BottomRTASCreateInfo &info, VkAccelerationStructureBuildSizesInfoKHR &size_info);
 	void destroy_image_nolock(VkImage image);
 	void destroy_image_view_nolock(const CachedImageView &view);
 	void destroy_buffer_view_nolock(const CachedBufferView &view);
@@ -865,9 +976,10 @@ private:
 	void request_index_block_nolock(BufferBlock &block, VkDeviceSize size);
 	void request_uniform_block_nolock(BufferBlock &block, VkDeviceSize size);
 	void request_staging_block_nolock(BufferBlock &block, VkDeviceSize size);
+	void request_indirect_block_nolock(BufferBlock &block, VkDeviceSize size);
 
 	CommandBufferHandle request_secondary_command_buffer_for_thread(unsigned thread_index,
-	                                                                const Framebuffer *framebuffer,
+	                                                                const RenderPass *render_pass,
 	                                                                unsigned subpass,
 	                                                                CommandBuffer::Type type = CommandBuffer::Type::Generic);
 	void add_frame_counter_nolock();
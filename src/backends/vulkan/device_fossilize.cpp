@@ -492,7 +492,12 @@ bool Device::enqueue_create_graphics_pipeline(Fossilize::Hash hash,
 		}
 	}
 
-	if (create_info->renderPass == VK_NULL_HANDLE)
+	// Pipelines for dynamic rendering have no render pass, but must be replayable on this device.
+	auto *rendering_info = find_pnext<VkPipelineRenderingCreateInfo>(
+		create_info->pNext, VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO);
+	bool dynamic_rendering = rendering_info && ext.vk13_features.dynamicRendering;
+
+	if (create_info->renderPass == VK_NULL_HANDLE && !dynamic_rendering)
 	{
 		*pipeline = VK_NULL_HANDLE;
 		replayer_state->progress.pipelines.fetch_add(1, std::memory_order_release);
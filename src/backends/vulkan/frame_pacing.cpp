@@ -0,0 +1,202 @@
+/* Copyright (c) 2017-2026 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "frame_pacing.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace Vulkan
+{
+void FramePacer::Filter::add(double sample)
+{
+	if (!valid)
+	{
+		mean = sample;
+		deviation = 0.0;
+		valid = true;
+		return;
+	}
+
+	// Fast enough to track load changes within a few frames, slow enough to ignore single spikes.
+	constexpr double rate = 1.0 / 8.0;
+	deviation += (std::abs(sample - mean) - deviation) * rate;
+	mean += (sample - mean) * rate;
+}
+
+uint64_t FramePacer::Filter::get() const
+{
+	// Budget for a reasonably pessimistic frame, not the average one.
+	return valid ? uint64_t(std::max(mean + 2.0 * deviation, 0.0)) : 0;
+}
+
+void FramePacer::reset()
+{
+	for (auto &record : history)
+		record = {};
+	cpu_filter = {};
+	gpu_filter = {};
+	estimates = {};
+	display_latency_index = 0;
+	display_latency_lower_bound = 0;
+	last_feedback_id = 0;
+	last_present_done = 0;
+	feedback_samples = 0;
+}
+
+void FramePacer::set_safety_margin(uint64_t margin_ns)
+{
+	safety_margin = margin_ns;
+}
+
+void FramePacer::set_refresh_rate(uint64_t refresh_duration_, bool vrr_)
+{
+	refresh_duration = refresh_duration_;
+	vrr = vrr_;
+}
+
+FramePacer::FrameRecord *FramePacer::find_record(uint64_t present_id)
+{
+	auto &record = history[present_id % HistorySize];
+	return record.present_id == present_id ? &record : nullptr;
+}
+
+void FramePacer::begin_frame(uint64_t present_id, uint64_t input_time, uint64_t target_present)
+{
+	auto &record = history[present_id % HistorySize];
+	record.present_id = present_id;
+	record.input_time = input_time;
+	record.submit_time = 0;
+	record.target_present = target_present;
+}
+
+void FramePacer::end_frame(uint64_t present_id, uint64_t submit_time)
+{
+	auto *record = find_record(present_id);
+	if (!record)
+		return;
+
+	record->submit_time = submit_time;
+	if (submit_time > record->input_time)
+		cpu_filter.add(double(submit_time - record->input_time));
+	estimates.cpu_time = cpu_filter.get();
+}
+
+void FramePacer::update_display_latency(const FrameRecord &record, uint64_t gpu_done, uint64_t present_done)
+{
+	// Present done - GPU done is an upper bound of the display latency, since for FIFO it includes the time
+	// spent waiting for vblank. Paced frames cannot tighten it further, since that wait is exactly
+	// the budget we added ourselves, so only unpaced frames contribute to the windowed minimum.
+	if (!record.target_present)
+	{
+		display_latency_window[display_latency_index++ % DisplayLatencyWindow] = present_done - gpu_done;
+		unsigned count = std::min<unsigned>(display_latency_index, DisplayLatencyWindow);
+		estimates.display_latency = *std::min_element(display_latency_window, display_latency_window + count);
+		return;
+	}
+
+	// Guard band above a known lower bound.
+	uint64_t guard = refresh_duration / 16;
+
+	if (present_done > record.target_present + refresh_duration / 2)
+	{
+		// If the GPU was done before the target and we still missed it,
+		// the display latency must be larger than what we had left.
+		if (gpu_done < record.target_present)
+			display_latency_lower_bound = std::max<uint64_t>(display_latency_lower_bound, record.target_present - gpu_done);
+		estimates.display_latency = std::max<uint64_t>(estimates.display_latency, display_latency_lower_bound + guard);
+	}
+	else
+	{
+		// On time. Probe slowly towards the lower bound to win back latency.
+		uint64_t floor_latency = display_latency_lower_bound + guard;
+		uint64_t step = refresh_duration / 512;
+		if (estimates.display_latency > floor_latency + step)
+			estimates.display_latency -= step;
+		else
+			estimates.display_latency = std::max<uint64_t>(estimates.display_latency, floor_latency);
+	}
+}
+
+void FramePacer::add_feedback(uint64_t present_id, uint64_t gpu_done, uint64_t present_done)
+{
+	if (present_id <= last_feedback_id || present_done == 0)
+		return;
+
+	last_feedback_id = present_id;
+	last_present_done = present_done;
+
+	auto *record = find_record(present_id);
+	if (!record || !record->submit_time)
+		return;
+
+	// Without a GPU done timestamp, the best we can do is to fold everything into GPU time,
+	// which makes the pacer more conservative since it includes time spent waiting for vblank.
+	uint64_t gpu_end = gpu_done ? gpu_done : present_done;
+	if (gpu_end > record->submit_time)
+		gpu_filter.add(double(gpu_end - record->submit_time));
+	estimates.gpu_time = gpu_filter.get();
+
+	if (gpu_done && present_done > gpu_done)
+		update_display_latency(*record, gpu_done, present_done);
+
+	if (present_done > record->input_time)
+		estimates.input_to_present = present_done - record->input_time;
+
+	feedback_samples++;
+}
+
+uint64_t FramePacer::get_required_time() const
+{
+	return estimates.cpu_time + estimates.gpu_time + estimates.display_latency + safety_margin;
+}
+
+bool FramePacer::plan_frame(uint64_t present_id, uint64_t now, uint64_t &wake_time, uint64_t &target_present) const
+{
+	if (refresh_duration == 0 || feedback_samples < MinFeedbackSamples || present_id <= last_feedback_id)
+		return false;
+
+	uint64_t required = get_required_time();
+	uint64_t earliest = now + required;
+
+	// Assume one present per refresh cycle since the last frame we know about.
+	uint64_t target = last_present_done + (present_id - last_feedback_id) * refresh_duration;
+
+	if (target < earliest)
+	{
+		if (vrr)
+		{
+			// VRR can present at any time after the minimum duration.
+			target = earliest;
+		}
+		else
+		{
+			// FRR is quantized to refresh cycles.
+			uint64_t cycles = (earliest - target + refresh_duration - 1) / refresh_duration;
+			target += cycles * refresh_duration;
+		}
+	}
+
+	target_present = target;
+	wake_time = target - required;
+	return true;
+}
+}
@@ -0,0 +1,116 @@
+/* Copyright (c) 2017-2026 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+namespace Vulkan
+{
+// Closed-loop frame pacing based on presentation feedback.
+// The pacer tracks, per present ID, when input was sampled and when the frame was submitted for present.
+// Together with the GPU done and present done timestamps reported back by WSI,
+// it estimates CPU time, GPU time (submit to GPU done) and display latency (GPU done to present done).
+// From this it plans the target present time of the next frame, and how long the application
+// can wait before sampling input while still hitting that target.
+// All timestamps are in the Util::get_current_time_nsecs() domain.
+class FramePacer
+{
+public:
+	struct Estimates
+	{
+		uint64_t cpu_time;
+		uint64_t gpu_time;
+		uint64_t display_latency;
+		// Measured, not estimated. Input sample to present done of the last reported frame.
+		uint64_t input_to_present;
+	};
+
+	void reset();
+
+	// Extra time budgeted on top of the estimates to absorb OS sleep granularity and jitter.
+	void set_safety_margin(uint64_t margin_ns);
+
+	// For FRR, refresh_duration is the refresh cycle.
+	// For VRR, refresh_duration is the minimum duration between presents.
+	void set_refresh_rate(uint64_t refresh_duration, bool vrr);
+
+	// Called right after input is sampled for present_id.
+	// target_present is the planned target from plan_frame(), or 0 if the frame was not paced.
+	void begin_frame(uint64_t present_id, uint64_t input_time, uint64_t target_present);
+	// Called right before present_id is presented.
+	void end_frame(uint64_t present_id, uint64_t submit_time);
+	// present_done must be non-zero. gpu_done may be 0 if it is not reported.
+	void add_feedback(uint64_t present_id, uint64_t gpu_done, uint64_t present_done);
+
+	// Plans the frame which will be presented with present_id.
+	// On success, wake_time is when input should be sampled, and target_present is the time
+	// the frame is expected to be displayed. If wake_time <= now, input should be sampled immediately.
+	// Returns false if there is not enough feedback yet.
+	bool plan_frame(uint64_t present_id, uint64_t now, uint64_t &wake_time, uint64_t &target_present) const;
+
+	const Estimates &get_estimates() const
+	{
+		return estimates;
+	}
+
+private:
+	struct FrameRecord
+	{
+		uint64_t present_id;
+		uint64_t input_time;
+		uint64_t submit_time;
+		uint64_t target_present;
+	};
+
+	struct Filter
+	{
+		double mean;
+		double deviation;
+		bool valid;
+
+		void add(double sample);
+		uint64_t get() const;
+	};
+
+	enum { HistorySize = 16, MinFeedbackSamples = 4, DisplayLatencyWindow = 32 };
+	FrameRecord history[HistorySize] = {};
+	uint64_t display_latency_window[DisplayLatencyWindow] = {};
+	unsigned display_latency_index = 0;
+	uint64_t display_latency_lower_bound = 0;
+
+	Filter cpu_filter = {};
+	Filter gpu_filter = {};
+	Estimates estimates = {};
+
+	uint64_t refresh_duration = 0;
+	uint64_t safety_margin = 1000000;
+	uint64_t last_feedback_id = 0;
+	uint64_t last_present_done = 0;
+	unsigned feedback_samples = 0;
+	bool vrr = false;
+
+	FrameRecord *find_record(uint64_t present_id);
+	uint64_t get_required_time() const;
+	void update_display_latency(const FrameRecord &record, uint64_t gpu_done, uint64_t present_done);
+};
+}
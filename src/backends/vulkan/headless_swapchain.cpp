@@ -0,0 +1,196 @@
+/* Copyright (c) 2017-2026 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "headless_swapchain.hpp"
+#include "format.hpp"
+#include "logging.hpp"
+
+namespace Vulkan
+{
+HeadlessSwapchain::~HeadlessSwapchain()
+{
+	teardown();
+}
+
+bool HeadlessSwapchain::init(WSI &wsi_, unsigned width_, unsigned height_, VkFormat format_, unsigned num_images,
+                             FrameCallback callback_)
+{
+	teardown();
+
+	if (num_images == 0 || format_has_depth_or_stencil_aspect(format_))
+		return false;
+
+	uint32_t block_width, block_height;
+	TextureFormatLayout::format_block_dim(format_, block_width, block_height);
+	if (block_width != 1 || block_height != 1)
+	{
+		LOGE("Headless swapchain does not support compressed formats.\n");
+		return false;
+	}
+
+	wsi = &wsi_;
+	device = &wsi->get_device();
+	callback = std::move(callback_);
+	width = width_;
+	height = height_;
+	format = format_;
+	row_pitch = size_t(width) * TextureFormatLayout::format_block_size(format, VK_IMAGE_ASPECT_COLOR_BIT);
+
+	auto info = ImageCreateInfo::render_target(width, height, format);
+	info.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+	// Readback happens on the async transfer queue.
+	info.misc = IMAGE_MISC_CONCURRENT_QUEUE_GRAPHICS_BIT | IMAGE_MISC_CONCURRENT_QUEUE_ASYNC_TRANSFER_BIT;
+	info.initial_layout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+
+	BufferCreateInfo buffer_info;
+	buffer_info.domain = BufferDomain::CachedHost;
+	buffer_info.size = row_pitch * height;
+	buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+	images.resize(num_images);
+	slots.resize(num_images);
+
+	for (unsigned i = 0; i < num_images; i++)
+	{
+		images[i] = device->create_image(info);
+		slots[i].readback = device->create_buffer(buffer_info);
+		if (!images[i] || !slots[i].readback)
+		{
+			LOGE("Failed to create headless swapchain resources.\n");
+			images.clear();
+			slots.clear();
+			wsi = nullptr;
+			device = nullptr;
+			return false;
+		}
+
+		// Render passes will transition to this layout when done, like PRESENT_SRC for a real swapchain.
+		images[i]->set_swapchain_layout(VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+		device->set_name(*images[i], "headless-swapchain");
+	}
+
+	index = 0;
+	frame_index = 0;
+	return wsi->init_external_swapchain(images);
+}
+
+void HeadlessSwapchain::wait_idle()
+{
+	std::unique_lock<std::mutex> holder{lock};
+	cond.wait(holder, [this]() {
+		for (auto &slot : slots)
+			if (slot.busy)
+				return false;
+		return true;
+	});
+}
+
+void HeadlessSwapchain::teardown()
+{
+	if (!device)
+		return;
+
+	wait_idle();
+	images.clear();
+	slots.clear();
+	wsi = nullptr;
+	device = nullptr;
+}
+
+void HeadlessSwapchain::begin_frame(double frame_time)
+{
+	VK_ASSERT(wsi);
+	auto &slot = slots[index];
+
+	// The GPU side is already ordered through the acquire semaphore,
+	// but the host buffer cannot be overwritten while the consumer is still reading it.
+	{
+		std::unique_lock<std::mutex> holder{lock};
+		cond.wait(holder, [&]() { return !slot.busy; });
+	}
+
+	wsi->set_external_frame(index, std::move(slot.acquire), frame_time);
+	slot.acquire.reset();
+}
+
+bool HeadlessSwapchain::end_frame()
+{
+	VK_ASSERT(wsi);
+	auto release = wsi->consume_external_release_semaphore();
+	if (!release)
+		return false;
+
+	unsigned slot_index = index;
+	auto &slot = slots[slot_index];
+	index = (index + 1) % unsigned(slots.size());
+
+	device->add_wait_semaphore(CommandBuffer::Type::AsyncTransfer, std::move(release),
+	                           VK_PIPELINE_STAGE_2_COPY_BIT, true);
+
+	// The render pass already transitioned the image to TRANSFER_SRC, and the semaphore makes the writes visible.
+	auto cmd = device->request_command_buffer(CommandBuffer::Type::AsyncTransfer);
+	cmd->copy_image_to_buffer(*slot.readback, *images[slot_index], 0, {}, { width, height, 1 }, 0, 0,
+	                          { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 });
+	cmd->barrier(VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+	             VK_PIPELINE_STAGE_2_HOST_BIT, VK_ACCESS_2_HOST_READ_BIT);
+
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		slot.busy = true;
+	}
+
+	device->submit(cmd, nullptr, 1, &slot.acquire);
+
+	uint64_t frame = frame_index++;
+	device->add_completion_callback(CommandBuffer::Type::AsyncTransfer, [this, slot_index, frame]() {
+		deliver(slot_index, frame);
+	});
+
+	return true;
+}
+
+void HeadlessSwapchain::deliver(unsigned slot_index, uint64_t frame)
+{
+	auto &slot = slots[slot_index];
+
+	Frame out = {};
+	out.data = device->map_host_buffer(*slot.readback, MEMORY_ACCESS_READ_BIT);
+	out.row_pitch = row_pitch;
+	out.width = width;
+	out.height = height;
+	out.format = format;
+	out.frame_index = frame;
+
+	if (out.data)
+	{
+		if (callback)
+			callback(out);
+		device->unmap_host_buffer(*slot.readback, MEMORY_ACCESS_READ_BIT);
+	}
+	else
+		LOGE("Failed to map headless readback buffer.\n");
+
+	std::lock_guard<std::mutex> holder{lock};
+	slot.busy = false;
+	cond.notify_all();
+}
+}
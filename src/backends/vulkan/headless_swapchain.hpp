@@ -0,0 +1,105 @@
+/* Copyright (c) 2017-2026 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "wsi.hpp"
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+
+namespace Vulkan
+{
+// Offscreen presentation target for WSI external swapchains.
+// Rotates between N images. Every presented image is copied into a persistently mapped host buffer
+// on the async transfer queue, and handed to a consumer callback once the copy completes.
+// The render thread never waits for readbacks, except when the consumer falls N frames behind.
+//
+// Usage:
+// - headless.init(wsi, ...)
+// - headless.begin_frame(frame_time) (calls WSI::set_external_frame())
+// - wsi.begin_frame(), render to swapchain, wsi.end_frame()
+// - headless.end_frame() (consumes the release semaphore and kicks the readback)
+class HeadlessSwapchain
+{
+public:
+	struct Frame
+	{
+		// Tightly packed rows, valid until the callback returns.
+		const void *data;
+		size_t row_pitch;
+		unsigned width;
+		unsigned height;
+		VkFormat format;
+		uint64_t frame_index;
+	};
+
+	// Called from the device's completion thread.
+	using FrameCallback = std::function<void (const Frame &)>;
+
+	~HeadlessSwapchain();
+
+	bool init(WSI &wsi, unsigned width, unsigned height, VkFormat format, unsigned num_images,
+	          FrameCallback callback);
+	// Waits for all readbacks to be delivered. Must be called before the device is torn down.
+	void teardown();
+
+	void begin_frame(double frame_time);
+	// Returns false if nothing was rendered to the swapchain this frame.
+	bool end_frame();
+
+	// Blocks until every frame submitted so far has been delivered.
+	void wait_idle();
+
+	unsigned get_num_images() const
+	{
+		return unsigned(images.size());
+	}
+
+private:
+	WSI *wsi = nullptr;
+	Device *device = nullptr;
+	FrameCallback callback;
+
+	struct Slot
+	{
+		BufferHandle readback;
+		// Signalled by the readback copy, waited on by the next render to the image.
+		Semaphore acquire;
+		bool busy = false;
+	};
+
+	std::vector<ImageHandle> images;
+	std::vector<Slot> slots;
+	unsigned width = 0;
+	unsigned height = 0;
+	VkFormat format = VK_FORMAT_UNDEFINED;
+	size_t row_pitch = 0;
+	unsigned index = 0;
+	uint64_t frame_index = 0;
+
+	std::mutex lock;
+	std::condition_variable cond;
+
+	void deliver(unsigned slot_index, uint64_t frame);
+};
+}
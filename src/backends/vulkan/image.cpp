@@ -34,6 +34,90 @@ ImageView::ImageView(Device *device_, const CachedImageView &view_, const ImageV
 {
 }
 
+void ImageView::set_secondary_views(const SecondaryImageViewInfo &info_)
+{
+	VK_ASSERT(!render_target_views && !mip_views);
+	secondary = info_;
+	secondary.view_info.pNext = nullptr;
+
+	if (secondary.num_render_target_views)
+	{
+		render_target_views.reset(new LazyView[secondary.num_render_target_views]);
+		for (unsigned i = 0; i < secondary.num_render_target_views; i++)
+			render_target_views[i].store(nullptr, std::memory_order_relaxed);
+	}
+
+	if (secondary.num_mip_views)
+	{
+		mip_views.reset(new LazyView[secondary.num_mip_views]);
+		for (unsigned i = 0; i < secondary.num_mip_views; i++)
+			mip_views[i].store(nullptr, std::memory_order_relaxed);
+	}
+}
+
+const CachedImageView &ImageView::get_secondary_view(LazyView &slot, SecondaryView type, unsigned index) const
+{
+	auto *cached = slot.load(std::memory_order_acquire);
+	if (cached)
+		return *cached;
+
+	auto view_info = secondary.view_info;
+	auto usage = secondary.usage;
+
+	switch (type)
+	{
+	case SecondaryView::Depth:
+	case SecondaryView::Stencil:
+		// We need this to be able to sample the texture, or otherwise use it as a non-pure DS attachment.
+		usage &= VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+		view_info.subresourceRange.aspectMask =
+				type == SecondaryView::Depth ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_STENCIL_BIT;
+		break;
+
+	case SecondaryView::RenderTarget:
+		usage &= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+		view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		view_info.subresourceRange.baseArrayLayer += index;
+		view_info.subresourceRange.levelCount = 1;
+		view_info.subresourceRange.layerCount = 1;
+		break;
+
+	case SecondaryView::Mip:
+		usage &= VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
+		view_info.subresourceRange.baseMipLevel += index;
+		view_info.subresourceRange.levelCount = 1;
+		break;
+
+	case SecondaryView::Unorm:
+		// The default format may not support storage, but the UNORM one might.
+		view_info.format = secondary.unorm_format;
+		usage |= info.image->get_create_info().usage & VK_IMAGE_USAGE_STORAGE_BIT;
+		break;
+
+	case SecondaryView::Srgb:
+		view_info.format = secondary.srgb_format;
+		usage &= ~VK_IMAGE_USAGE_STORAGE_BIT;
+		break;
+	}
+
+	auto *created = new CachedImageView();
+	if (!device->create_secondary_image_view(view_info, secondary.ycbcr_conversion, usage,
+	                                         info.image->get_create_info().layout, *created))
+	{
+		LOGE("Failed to create secondary image view.\n");
+		delete created;
+		return view;
+	}
+
+	if (slot.compare_exchange_strong(cached, created, std::memory_order_acq_rel, std::memory_order_acquire))
+		return *created;
+
+	// Another thread published the view first. Ours was never used, so it can be freed right away.
+	device->managers.descriptor_buffer.free_image_view(*created);
+	delete created;
+	return *cached;
+}
+
 const CachedImageView &ImageView::get_render_target_view(unsigned layer) const
 {
 	// Transient images just have one layer.
@@ -42,12 +126,12 @@ const CachedImageView &ImageView::get_render_target_view(unsigned layer) const
 
 	VK_ASSERT(layer < get_create_info().layers);
 
-	if (render_target_views.empty())
+	if (!render_target_views)
 		return view;
 	else
 	{
-		VK_ASSERT(layer < render_target_views.size());
-		return render_target_views[layer];
+		VK_ASSERT(layer < secondary.num_render_target_views);
+		return get_secondary_view(render_target_views[layer], SecondaryView::RenderTarget, layer);
 	}
 }
 
@@ -55,15 +139,37 @@ const CachedImageView &ImageView::get_mip_view(unsigned level) const
 {
 	VK_ASSERT(level < get_create_info().levels);
 
-	if (mip_views.empty())
+	if (!mip_views)
 		return view;
 	else
 	{
-		VK_ASSERT(level < mip_views.size());
-		return mip_views[level];
+		VK_ASSERT(level < secondary.num_mip_views);
+		return get_secondary_view(mip_views[level], SecondaryView::Mip, level);
 	}
 }
 
+const CachedImageView &ImageView::get_float_view() const
+{
+	return secondary.depth_stencil_views ? get_secondary_view(depth_view, SecondaryView::Depth, 0) : view;
+}
+
+const CachedImageView &ImageView::get_integer_view() const
+{
+	return secondary.depth_stencil_views ? get_secondary_view(stencil_view, SecondaryView::Stencil, 0) : view;
+}
+
+const CachedImageView &ImageView::get_unorm_view() const
+{
+	return secondary.unorm_format != VK_FORMAT_UNDEFINED ?
+	       get_secondary_view(unorm_view, SecondaryView::Unorm, 0) : view;
+}
+
+const CachedImageView &ImageView::get_srgb_view() const
+{
+	return secondary.srgb_format != VK_FORMAT_UNDEFINED ?
+	       get_secondary_view(srgb_view, SecondaryView::Srgb, 0) : view;
+}
+
 void ImageView::free_cached_view(CachedImageView &cached)
 {
 	if (internal_sync)
@@ -74,15 +180,26 @@ void ImageView::free_cached_view(CachedImageView &cached)
 
 ImageView::~ImageView()
 {
+	device->notify_cookie_destroyed(get_cookie());
 	free_cached_view(view);
-	free_cached_view(depth_view);
-	free_cached_view(stencil_view);
-	free_cached_view(unorm_view);
-	free_cached_view(srgb_view);
-	for (auto &v : render_target_views)
-		free_cached_view(v);
-	for (auto &v : mip_views)
-		free_cached_view(v);
+
+	const auto free_secondary_view = [this](LazyView &slot) {
+		auto *cached = slot.load(std::memory_order_acquire);
+		if (cached)
+		{
+			free_cached_view(*cached);
+			delete cached;
+		}
+	};
+
+	free_secondary_view(depth_view);
+	free_secondary_view(stencil_view);
+	free_secondary_view(unorm_view);
+	free_secondary_view(srgb_view);
+	for (unsigned i = 0; render_target_views && i < secondary.num_render_target_views; i++)
+		free_secondary_view(render_target_views[i]);
+	for (unsigned i = 0; mip_views && i < secondary.num_mip_views; i++)
+		free_secondary_view(mip_views[i]);
 }
 
 unsigned ImageView::get_view_width() const
@@ -28,6 +28,8 @@
 #include "memory_allocator.hpp"
 #include "vulkan_headers.hpp"
 #include <algorithm>
+#include <atomic>
+#include <memory>
 
 namespace Vulkan
 {
@@ -111,6 +113,20 @@ struct ImageViewCreateInfo
 
 class ImageView;
 
+// Describes the secondary views of an ImageView. They are only created on first use,
+// since most sampled textures never need anything but the default view.
+struct SecondaryImageViewInfo
+{
+	VkImageViewCreateInfo view_info = { VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO }; // pNext is not used.
+	const ImmutableYcbcrConversion *ycbcr_conversion = nullptr;
+	VkImageUsageFlags usage = 0;
+	VkFormat unorm_format = VK_FORMAT_UNDEFINED;
+	VkFormat srgb_format = VK_FORMAT_UNDEFINED;
+	unsigned num_render_target_views = 0;
+	unsigned num_mip_views = 0;
+	bool depth_stencil_views = false;
+};
+
 struct ImageViewDeleter
 {
 	void operator()(ImageView *view);
@@ -126,37 +142,7 @@ public:
 
 	~ImageView();
 
-	void set_separate_depth_stencil_views(const CachedImageView &depth, const CachedImageView &stencil)
-	{
-		VK_ASSERT(depth_view.view == VK_NULL_HANDLE);
-		VK_ASSERT(stencil_view.view == VK_NULL_HANDLE);
-		depth_view = depth;
-		stencil_view = stencil;
-	}
-
-	void set_render_target_views(std::vector<CachedImageView> views)
-	{
-		VK_ASSERT(render_target_views.empty());
-		render_target_views = std::move(views);
-	}
-
-	void set_mip_views(std::vector<CachedImageView> views)
-	{
-		VK_ASSERT(mip_views.empty());
-		mip_views = std::move(views);
-	}
-
-	void set_unorm_view(const CachedImageView &view_)
-	{
-		VK_ASSERT(unorm_view.view == VK_NULL_HANDLE);
-		unorm_view = view_;
-	}
-
-	void set_srgb_view(const CachedImageView &view_)
-	{
-		VK_ASSERT(srgb_view.view == VK_NULL_HANDLE);
-		srgb_view = view_;
-	}
+	void set_secondary_views(const SecondaryImageViewInfo &info);
 
 	// By default, gets a combined view which includes all aspects in the image.
 	// This would be used mostly for render targets.
@@ -171,28 +157,15 @@ public:
 	// Gets an image view which only includes floating point domains.
 	// Takes effect when we want to sample from an image which is Depth/Stencil,
 	// but we only want to sample depth.
-	const CachedImageView &get_float_view() const
-	{
-		return depth_view.view != VK_NULL_HANDLE ? depth_view : view;
-	}
+	const CachedImageView &get_float_view() const;
 
 	// Gets an image view which only includes integer domains.
 	// Takes effect when we want to sample from an image which is Depth/Stencil,
 	// but we only want to sample stencil.
-	const CachedImageView &get_integer_view() const
-	{
-		return stencil_view.view != VK_NULL_HANDLE ? stencil_view : view;
-	}
+	const CachedImageView &get_integer_view() const;
 
-	const CachedImageView &get_unorm_view() const
-	{
-		return unorm_view.view != VK_NULL_HANDLE ? unorm_view : view;
-	}
-
-	const CachedImageView &get_srgb_view() const
-	{
-		return srgb_view.view != VK_NULL_HANDLE ? srgb_view : view;
-	}
+	const CachedImageView &get_unorm_view() const;
+	const CachedImageView &get_srgb_view() const;
 
 	VkFormat get_format() const
 	{
@@ -216,14 +189,30 @@ public:
 private:
 	Device *device;
 	CachedImageView view = {};
-	std::vector<CachedImageView> render_target_views;
-	std::vector<CachedImageView> mip_views;
-	CachedImageView depth_view = {};
-	CachedImageView stencil_view = {};
-	CachedImageView unorm_view = {};
-	CachedImageView srgb_view = {};
 	ImageViewCreateInfo info;
 
+	// Secondary views are published with a CAS, so lookups never lock.
+	// If two threads race to create the same view, the loser destroys its copy.
+	using LazyView = std::atomic<CachedImageView *>;
+	SecondaryImageViewInfo secondary;
+	std::unique_ptr<LazyView[]> render_target_views;
+	std::unique_ptr<LazyView[]> mip_views;
+	mutable LazyView depth_view{nullptr};
+	mutable LazyView stencil_view{nullptr};
+	mutable LazyView unorm_view{nullptr};
+	mutable LazyView srgb_view{nullptr};
+
+	enum class SecondaryView
+	{
+		Depth,
+		Stencil,
+		RenderTarget,
+		Mip,
+		Unorm,
+		Srgb
+	};
+
+	const CachedImageView &get_secondary_view(LazyView &slot, SecondaryView type, unsigned index) const;
 	void free_cached_view(CachedImageView &cached);
 };
 
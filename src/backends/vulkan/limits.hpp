@@ -28,6 +28,9 @@ constexpr unsigned VULKAN_NUM_DESCRIPTOR_SETS = 4;
 constexpr unsigned VULKAN_NUM_DYNAMIC_UBOS = 8; // Vulkan min-spec
 constexpr unsigned VULKAN_NUM_BINDINGS = 32;
 constexpr unsigned VULKAN_NUM_BINDINGS_BINDLESS_VARYING = 16 * 1024;
+// Upper bound of the bindless layout when the device supports more than VULKAN_NUM_BINDINGS_BINDLESS_VARYING.
+// Descriptor pools still allocate at most VULKAN_NUM_BINDINGS_BINDLESS_VARYING, only persistent tables use the extra range.
+constexpr unsigned VULKAN_NUM_BINDINGS_BINDLESS_TABLE = 1024 * 1024;
 constexpr unsigned VULKAN_NUM_ATTACHMENTS = 8;
 constexpr unsigned VULKAN_NUM_VERTEX_ATTRIBS = 16;
 constexpr unsigned VULKAN_NUM_VERTEX_BUFFERS = 4;
@@ -32,6 +32,7 @@
 #include "aabb.hpp"
 #include "environment.hpp"
 #include <float.h>
+#include <algorithm>
 
 namespace Vulkan
 {
@@ -43,8 +44,12 @@ ResourceManager::ResourceManager(Device *device_)
 	, mesh_header_allocator(*device_, 32, 15)
 	, mesh_stream_allocator(*device_, 8, 17)
 	, mesh_payload_allocator(*device_, 32, 17)
+	, mesh_lod_allocator(*device_, 32, 15)
 {
 	assets.reserve(Granite::AssetID::MaxIDs);
+	mesh_last_used.reset(new std::atomic_uint32_t[Granite::AssetID::MaxIDs]());
+	for (uint32_t i = 0; i < Granite::AssetID::MaxIDs; i++)
+		mesh_last_used[i].store(0, std::memory_order_relaxed);
 }
 
 ResourceManager::~ResourceManager()
@@ -158,9 +163,12 @@ void ResourceManager::init_mesh_assets()
 		attribute_buffer_allocator.set_element_size(1, sizeof(float) * 2 + sizeof(uint32_t) * 2);
 		attribute_buffer_allocator.set_element_size(2, sizeof(uint32_t) * 2);
 
-		opaque.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+		// Transfer usage is needed for compaction.
+		opaque.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+		               VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
 		index_buffer_allocator.prime(&opaque);
-		opaque.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+		opaque.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+		               VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
 		attribute_buffer_allocator.prime(&opaque);
 
 		if (mesh_encoding != MeshEncoding::Classic)
@@ -189,8 +197,13 @@ void ResourceManager::init_mesh_assets()
 		opaque.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
 		mesh_header_allocator.prime(&opaque);
 		mesh_stream_allocator.prime(&opaque);
+		opaque.usage |= VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
 		mesh_payload_allocator.prime(&opaque);
 	}
+
+	mesh_lod_allocator.set_element_size(0, Meshlet::MaxLODs * sizeof(Meshlet::RuntimeLOD));
+	opaque.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	mesh_lod_allocator.prime(&opaque);
 }
 
 void ResourceManager::init()
@@ -400,7 +413,6 @@ bool ResourceManager::allocate_asset_mesh(Granite::AssetID id, const Meshlet::Me
 	if (!view.format_header)
 		return false;
 
-	std::lock_guard<std::mutex> holder{mesh_allocator_lock};
 	auto &asset = assets[id.id];
 
 	bool ret = true;
@@ -431,56 +443,112 @@ bool ResourceManager::allocate_asset_mesh(Granite::AssetID id, const Meshlet::Me
 			ret = indirect_buffer_allocator.allocate(view.num_bounds_256, &asset.mesh.indirect_or_header);
 	}
 
-	if (mesh_encoding == MeshEncoding::Classic)
-	{
-		asset.mesh.draw.indexed = {
-			view.total_primitives * 3, 1,
-			asset.mesh.index_or_payload.offset,
-			int32_t(asset.mesh.attr_or_stream.offset), 0,
-		};
-	}
+	if (ret)
+		ret = mesh_lod_allocator.allocate(1, &asset.mesh.lod_table);
+
+	if (ret)
+		update_mesh_draws(asset, view);
 	else
-	{
-		asset.mesh.draw.meshlet = {
-			asset.mesh.indirect_or_header.offset,
-			view.num_bounds_256,
-			view.format_header->style,
-		};
-	}
+		free_asset_mesh(asset);
 
-	if (!ret)
+	return ret;
+}
+
+void ResourceManager::update_mesh_draws(Asset &asset, const Meshlet::MeshView &view)
+{
+	// All LODs live in the same allocation, each LOD is a sub-range of it.
+	auto &chain = asset.mesh.lod_chain;
+	chain.lod_count = view.num_lods;
+	chain.lod_table_offset = asset.mesh.lod_table.offset;
+
+	for (uint32_t lod = 0; lod < view.num_lods; lod++)
 	{
-		if (mesh_encoding == MeshEncoding::MeshletEncoded)
+		auto &lod_header = view.lods[lod];
+		chain.errors[lod] = lod_header.error;
+
+		if (mesh_encoding == MeshEncoding::Classic)
 		{
-			mesh_payload_allocator.free(asset.mesh.index_or_payload);
-			mesh_stream_allocator.free(asset.mesh.attr_or_stream);
-			mesh_header_allocator.free(asset.mesh.indirect_or_header);
+			chain.lods[lod].indexed = {
+				view.lod_primitive_counts[lod] * 3, 1,
+				(asset.mesh.index_or_payload.offset + view.lod_primitive_offsets[lod]) * 3,
+				int32_t(asset.mesh.attr_or_stream.offset), 0,
+			};
 		}
 		else
 		{
-			index_buffer_allocator.free(asset.mesh.index_or_payload);
-			attribute_buffer_allocator.free(asset.mesh.attr_or_stream);
-			indirect_buffer_allocator.free(asset.mesh.indirect_or_header);
+			chain.lods[lod].meshlet = {
+				asset.mesh.indirect_or_header.offset + lod_header.meshlet_offset / Meshlet::ChunkFactor,
+				(lod_header.meshlet_count + Meshlet::ChunkFactor - 1) / Meshlet::ChunkFactor,
+				view.format_header->style,
+			};
 		}
+	}
+
+	asset.mesh.draw = chain.lods[0];
+}
 
-		asset.mesh = {};
+void ResourceManager::free_asset_mesh(Asset &asset)
+{
+	if (mesh_encoding == MeshEncoding::MeshletEncoded)
+	{
+		mesh_payload_allocator.free(asset.mesh.index_or_payload);
+		mesh_stream_allocator.free(asset.mesh.attr_or_stream);
+		mesh_header_allocator.free(asset.mesh.indirect_or_header);
 	}
-	return ret;
+	else
+	{
+		index_buffer_allocator.free(asset.mesh.index_or_payload);
+		attribute_buffer_allocator.free(asset.mesh.attr_or_stream);
+		indirect_buffer_allocator.free(asset.mesh.indirect_or_header);
+	}
+
+	mesh_lod_allocator.free(asset.mesh.lod_table);
+	asset.mesh = {};
 }
 
-void ResourceManager::instantiate_asset_mesh(Granite::AssetManager &manager_,
-                                             Granite::AssetID id,
-                                             Granite::File &file)
+void ResourceManager::upload_mesh_lod_table(CommandBuffer &cmd, const Asset &asset)
 {
-	Granite::FileMappingHandle mapping;
-	if (file.get_size())
-		mapping = file.map();
+	auto &chain = asset.mesh.lod_chain;
+	auto *lods = static_cast<Meshlet::RuntimeLOD *>(
+			cmd.update_buffer(*mesh_lod_allocator.get_buffer(0, 0),
+			                  asset.mesh.lod_table.offset * Meshlet::MaxLODs * sizeof(Meshlet::RuntimeLOD),
+			                  Meshlet::MaxLODs * sizeof(Meshlet::RuntimeLOD)));
 
-	Meshlet::MeshView view = {};
-	if (mapping)
-		view = Meshlet::create_mesh_view(*mapping);
-	bool ret = allocate_asset_mesh(id, view);
+	for (uint32_t i = 0; i < Meshlet::MaxLODs; i++)
+	{
+		uint32_t lod = std::min<uint32_t>(i, chain.lod_count - 1);
+		auto &draw = chain.lods[lod];
+
+		if (mesh_encoding == MeshEncoding::Classic)
+			lods[i] = { draw.indexed.firstIndex, draw.indexed.indexCount, chain.errors[lod], draw.indexed.vertexOffset };
+		else
+			lods[i] = { draw.meshlet.offset, draw.meshlet.count, chain.errors[lod], 0 };
+	}
+}
+
+void ResourceManager::upload_encoded_mesh_streams(CommandBuffer &cmd, const Asset &asset,
+                                                  const Meshlet::MeshView &view)
+{
+	size_t total_streams = view.format_header->meshlet_count * view.format_header->stream_count;
+	size_t total_padded_streams = view.num_bounds_256 * Meshlet::ChunkFactor * view.format_header->stream_count;
+
+	auto *streams = static_cast<Meshlet::Stream *>(
+			cmd.update_buffer(*mesh_stream_allocator.get_buffer(0, 0),
+			                  asset.mesh.attr_or_stream.offset * sizeof(Meshlet::Stream),
+			                  total_padded_streams * sizeof(Meshlet::Stream)));
+
+	for (uint32_t i = 0; i < total_streams; i++)
+	{
+		auto in_stream = view.streams[i];
+		in_stream.offset_in_words += asset.mesh.index_or_payload.offset;
+		streams[i] = in_stream;
+	}
+
+	memset(streams + total_streams, 0, (total_padded_streams - total_streams) * sizeof(Meshlet::Stream));
+}
 
+uint64_t ResourceManager::upload_asset_mesh(Granite::AssetID id, const Meshlet::MeshView &view)
+{
 	// Decode the meshlet. Later, we'll have to do a lot of device specific stuff here to select optimal
 	// processing:
 	// - Native meshlets
@@ -490,135 +558,182 @@ void ResourceManager::instantiate_asset_mesh(Granite::AssetManager &manager_,
 
 	auto &asset = assets[id.id];
 
-	if (ret)
+	if (mesh_encoding == MeshEncoding::MeshletEncoded)
 	{
-		size_t total_streams = view.format_header->meshlet_count * view.format_header->stream_count;
-		size_t total_padded_streams = view.num_bounds_256 * Meshlet::ChunkFactor * view.format_header->stream_count;
+		auto cmd = device->request_command_buffer(CommandBuffer::Type::AsyncTransfer);
+
+		void *payload_data = cmd->update_buffer(*mesh_payload_allocator.get_buffer(0, 0),
+		                                        asset.mesh.index_or_payload.offset * sizeof(Meshlet::PayloadWord),
+		                                        view.format_header->payload_size_words * sizeof(Meshlet::PayloadWord));
+		memcpy(payload_data, view.payload, view.format_header->payload_size_words * sizeof(Meshlet::PayloadWord));
+
+		auto *headers = static_cast<Meshlet::RuntimeHeaderEncoded *>(
+				cmd->update_buffer(*mesh_header_allocator.get_buffer(0, 0),
+				                   asset.mesh.indirect_or_header.offset * sizeof(Meshlet::RuntimeHeaderEncoded),
+				                   view.num_bounds_256 * sizeof(Meshlet::RuntimeHeaderEncoded)));
 
-		if (mesh_encoding == MeshEncoding::MeshletEncoded)
+		for (uint32_t i = 0, n = view.num_bounds_256; i < n; i++)
 		{
-			auto cmd = device->request_command_buffer(CommandBuffer::Type::AsyncTransfer);
+			headers[i].stream_offset = asset.mesh.attr_or_stream.offset +
+			                           i * Meshlet::ChunkFactor * view.format_header->stream_count;
+		}
 
-			void *payload_data = cmd->update_buffer(*mesh_payload_allocator.get_buffer(0, 0),
-			                                        asset.mesh.index_or_payload.offset * sizeof(Meshlet::PayloadWord),
-			                                        view.format_header->payload_size_words * sizeof(Meshlet::PayloadWord));
-			memcpy(payload_data, view.payload, view.format_header->payload_size_words * sizeof(Meshlet::PayloadWord));
+		auto *bounds = static_cast<Meshlet::Bound *>(
+				cmd->update_buffer(*mesh_header_allocator.get_buffer(0, 1),
+				                   asset.mesh.indirect_or_header.offset * sizeof(Meshlet::Bound),
+				                   view.num_bounds_256 * sizeof(Meshlet::Bound)));
+		memcpy(bounds, view.bounds_256, view.num_bounds_256 * sizeof(Meshlet::Bound));
 
-			auto *headers = static_cast<Meshlet::RuntimeHeaderEncoded *>(
-					cmd->update_buffer(*mesh_header_allocator.get_buffer(0, 0),
-					                   asset.mesh.indirect_or_header.offset * sizeof(Meshlet::RuntimeHeaderEncoded),
-					                   view.num_bounds_256 * sizeof(Meshlet::RuntimeHeaderEncoded)));
+		upload_encoded_mesh_streams(*cmd, asset, view);
+		upload_mesh_lod_table(*cmd, asset);
 
-			for (uint32_t i = 0, n = view.num_bounds_256; i < n; i++)
-			{
-				headers[i].stream_offset = asset.mesh.attr_or_stream.offset +
-				                           i * Meshlet::ChunkFactor * view.format_header->stream_count;
-			}
+		Semaphore sem;
+		device->submit(cmd, nullptr, 1, &sem);
+		device->add_wait_semaphore(CommandBuffer::Type::Generic, std::move(sem),
+		                           VK_PIPELINE_STAGE_2_MESH_SHADER_BIT_EXT |
+		                           VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, false);
+	}
+	else
+	{
+		auto cmd = device->request_command_buffer(CommandBuffer::Type::AsyncCompute);
+
+		BufferCreateInfo buf = {};
+		buf.domain = BufferDomain::Host;
+		buf.size = view.format_header->payload_size_words * sizeof(Meshlet::PayloadWord);
+		buf.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+		auto payload = device->create_buffer(buf, view.payload);
+
+		Meshlet::DecodeInfo info = {};
+		info.target_style = view.format_header->style;
+		if (mesh_encoding == MeshEncoding::Classic)
+			info.flags |= Meshlet::DECODE_MODE_UNROLLED_MESH;
+		else if (!device->get_device_features().vk14_features.indexTypeUint8)
+			info.flags |= Meshlet::DECODE_MODE_INDEX_16;
+		info.ibo = index_buffer_allocator.get_buffer(0, 0);
 
+		for (unsigned i = 0; i < 3; i++)
+			info.streams[i] = attribute_buffer_allocator.get_buffer(0, i);
+
+		info.payload = payload.get();
+
+		info.push.primitive_offset = asset.mesh.index_or_payload.offset;
+		info.push.vertex_offset = asset.mesh.attr_or_stream.offset;
+
+		info.runtime_style = mesh_encoding == MeshEncoding::MeshletDecoded ?
+		                     Meshlet::RuntimeStyle::Meshlet : Meshlet::RuntimeStyle::MDI;
+
+		if (mesh_encoding != MeshEncoding::Classic)
+		{
 			auto *bounds = static_cast<Meshlet::Bound *>(
-					cmd->update_buffer(*mesh_header_allocator.get_buffer(0, 1),
+					cmd->update_buffer(*indirect_buffer_allocator.get_buffer(0, 1),
 					                   asset.mesh.indirect_or_header.offset * sizeof(Meshlet::Bound),
 					                   view.num_bounds_256 * sizeof(Meshlet::Bound)));
 			memcpy(bounds, view.bounds_256, view.num_bounds_256 * sizeof(Meshlet::Bound));
 
-			auto *streams = static_cast<Meshlet::Stream *>(
-					cmd->update_buffer(*mesh_stream_allocator.get_buffer(0, 0),
-					                   asset.mesh.attr_or_stream.offset * sizeof(Meshlet::Stream),
-									   total_padded_streams * sizeof(Meshlet::Stream)));
+			info.indirect = indirect_buffer_allocator.get_buffer(0, 0);
+			info.indirect_offset = asset.mesh.indirect_or_header.offset;
+		}
 
-			for (uint32_t i = 0; i < total_streams; i++)
-			{
-				auto in_stream = view.streams[i];
-				in_stream.offset_in_words += asset.mesh.index_or_payload.offset;
-				streams[i] = in_stream;
-			}
+		Meshlet::decode_mesh(*cmd, info, view);
+		upload_mesh_lod_table(*cmd, asset);
 
-			memset(streams + total_streams, 0, (total_padded_streams - total_streams) * sizeof(Meshlet::Stream));
+		Semaphore sem;
+		device->submit(cmd, nullptr, 1, &sem);
+		device->add_wait_semaphore(CommandBuffer::Type::Generic, std::move(sem),
+		                           VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT |
+		                           VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT, false);
+	}
 
-			Semaphore sem;
-			device->submit(cmd, nullptr, 1, &sem);
-			device->add_wait_semaphore(CommandBuffer::Type::Generic, std::move(sem),
-			                           VK_PIPELINE_STAGE_2_MESH_SHADER_BIT_EXT |
-			                           VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, false);
-		}
-		else
+	uint64_t cost = 0;
+	if (mesh_encoding == MeshEncoding::MeshletEncoded)
+	{
+		cost += view.format_header->payload_size_words * mesh_payload_allocator.get_element_size(0);
+		cost += view.num_bounds_256 * mesh_header_allocator.get_element_size(0);
+		cost += view.num_bounds_256 * mesh_header_allocator.get_element_size(1);
+		cost += view.format_header->meshlet_count * view.format_header->stream_count * mesh_stream_allocator.get_element_size(0);
+	}
+	else
+	{
+		cost += view.total_primitives * index_buffer_allocator.get_element_size(0);
+		cost += view.total_vertices * attribute_buffer_allocator.get_element_size(0);
+		cost += view.total_vertices * attribute_buffer_allocator.get_element_size(1);
+		cost += view.total_vertices * attribute_buffer_allocator.get_element_size(2);
+		if (mesh_encoding != MeshEncoding::Classic)
 		{
-			auto cmd = device->request_command_buffer(CommandBuffer::Type::AsyncCompute);
+			cost += view.format_header->meshlet_count * indirect_buffer_allocator.get_element_size(0);
+			cost += view.format_header->meshlet_count * indirect_buffer_allocator.get_element_size(1);
+		}
+	}
 
-			BufferCreateInfo buf = {};
-			buf.domain = BufferDomain::Host;
-			buf.size = view.format_header->payload_size_words * sizeof(Meshlet::PayloadWord);
-			buf.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
-			auto payload = device->create_buffer(buf, view.payload);
+	cost += mesh_lod_allocator.get_element_size(0);
 
-			Meshlet::DecodeInfo info = {};
-			info.target_style = view.format_header->style;
-			if (mesh_encoding == MeshEncoding::Classic)
-				info.flags |= Meshlet::DECODE_MODE_UNROLLED_MESH;
-			else if (!device->get_device_features().vk14_features.indexTypeUint8)
-				info.flags |= Meshlet::DECODE_MODE_INDEX_16;
-			info.ibo = index_buffer_allocator.get_buffer(0, 0);
+	return cost;
+}
 
-			for (unsigned i = 0; i < 3; i++)
-				info.streams[i] = attribute_buffer_allocator.get_buffer(0, i);
+void ResourceManager::instantiate_asset_mesh(Granite::AssetManager &manager_,
+                                             Granite::AssetID id,
+                                             Granite::File &file)
+{
+	Granite::FileMappingHandle mapping;
+	if (file.get_size())
+		mapping = file.map();
+
+	Meshlet::MeshView view = {};
+	if (mapping)
+		view = Meshlet::create_mesh_view(*mapping);
 
-			info.payload = payload.get();
+	// Without a mesh budget, nothing is streamed, so there is no reason to retain mappings or compact.
+	bool streaming;
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		streaming = mesh_budget != 0;
+	}
 
-			info.push.primitive_offset = asset.mesh.index_or_payload.offset;
-			info.push.vertex_offset = asset.mesh.attr_or_stream.offset;
+	bool ret;
+	{
+		std::lock_guard<std::mutex> holder{mesh_allocator_lock};
+		ret = allocate_asset_mesh(id, view);
+		if (!ret && view.format_header && streaming)
+			mesh_compaction_requested = true;
+	}
 
-			info.runtime_style = mesh_encoding == MeshEncoding::MeshletDecoded ?
-			                     Meshlet::RuntimeStyle::Meshlet : Meshlet::RuntimeStyle::MDI;
+	uint64_t cost = 0;
+	if (ret)
+		cost = upload_asset_mesh(id, view);
 
-			if (mesh_encoding != MeshEncoding::Classic)
-			{
-				auto *bounds = static_cast<Meshlet::Bound *>(
-						cmd->update_buffer(*indirect_buffer_allocator.get_buffer(0, 1),
-						                   asset.mesh.indirect_or_header.offset * sizeof(Meshlet::Bound),
-						                   view.num_bounds_256 * sizeof(Meshlet::Bound)));
-				memcpy(bounds, view.bounds_256, view.num_bounds_256 * sizeof(Meshlet::Bound));
-
-				info.indirect = indirect_buffer_allocator.get_buffer(0, 0);
-				info.indirect_offset = asset.mesh.indirect_or_header.offset;
-			}
+	auto &asset = assets[id.id];
 
-			Meshlet::decode_mesh(*cmd, info, view);
+	std::lock_guard<std::mutex> holder{lock};
+	updates.push_back(id);
+	manager_.update_cost(id, cost);
 
-			Semaphore sem;
-			device->submit(cmd, nullptr, 1, &sem);
-			device->add_wait_semaphore(CommandBuffer::Type::Generic, std::move(sem),
-			                           VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT |
-			                           VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT, false);
-		}
+	if (asset.mesh_evicted)
+	{
+		asset.mesh_evicted = false;
+		mesh_evicted_count--;
 	}
+	asset.mesh_pending = false;
 
-	uint64_t cost = 0;
+	asset.mesh_cost = cost;
 	if (ret)
+		mesh_resident_size += cost;
+
+	// Keep the mapping around so the mesh can be streamed back in after eviction.
+	// If there was no room, treat the mesh as evicted, it is retried after the next compaction.
+	if (view.format_header && streaming)
 	{
-		if (mesh_encoding == MeshEncoding::MeshletEncoded)
-		{
-			cost += view.format_header->payload_size_words * mesh_payload_allocator.get_element_size(0);
-			cost += view.num_bounds_256 * mesh_header_allocator.get_element_size(0);
-			cost += view.num_bounds_256 * mesh_header_allocator.get_element_size(1);
-			cost += view.format_header->meshlet_count * view.format_header->stream_count * mesh_stream_allocator.get_element_size(0);
-		}
-		else
+		asset.mesh_mapping = std::move(mapping);
+		asset.mesh_view = view;
+
+		if (!ret)
 		{
-			cost += view.total_primitives * index_buffer_allocator.get_element_size(0);
-			cost += view.total_vertices * attribute_buffer_allocator.get_element_size(0);
-			cost += view.total_vertices * attribute_buffer_allocator.get_element_size(1);
-			cost += view.total_vertices * attribute_buffer_allocator.get_element_size(2);
-			if (mesh_encoding != MeshEncoding::Classic)
-			{
-				cost += view.format_header->meshlet_count * indirect_buffer_allocator.get_element_size(0);
-				cost += view.format_header->meshlet_count * indirect_buffer_allocator.get_element_size(1);
-			}
+			asset.mesh_evicted = true;
+			asset.mesh_pending = true;
+			mesh_evicted_count++;
 		}
 	}
+	mesh_last_used[id.id].store(mesh_frame_index.load(std::memory_order_relaxed), std::memory_order_relaxed);
 
-	std::lock_guard<std::mutex> holder{lock};
-	updates.push_back(id);
-	manager_.update_cost(id, ret ? cost : 0);
 	asset.latchable = true;
 	cond.notify_all();
 }
@@ -678,6 +793,7 @@ void ResourceManager::latch_handles()
 
 	views.resize(assets.size());
 	draws.resize(assets.size());
+	lod_chains.resize(assets.size());
 
 	for (auto &update : updates)
 	{
@@ -691,23 +807,27 @@ void ResourceManager::latch_handles()
 			{
 				{
 					std::lock_guard<std::mutex> holder_alloc{mesh_allocator_lock};
-					if (mesh_encoding == MeshEncoding::MeshletEncoded)
-					{
-						mesh_payload_allocator.free(asset.mesh.index_or_payload);
-						mesh_stream_allocator.free(asset.mesh.attr_or_stream);
-						mesh_header_allocator.free(asset.mesh.indirect_or_header);
-					}
-					else
-					{
-						index_buffer_allocator.free(asset.mesh.index_or_payload);
-						attribute_buffer_allocator.free(asset.mesh.attr_or_stream);
-						indirect_buffer_allocator.free(asset.mesh.indirect_or_header);
-					}
+					free_asset_mesh(asset);
 				}
-				asset.mesh = {};
+
+				if (asset.mesh_evicted)
+				{
+					mesh_evicted_count--;
+				}
+				else
+				{
+					mesh_resident_size -= asset.mesh_cost;
+					mesh_fragmented_size += asset.mesh_cost;
+				}
+				asset.mesh_mapping.reset();
+				asset.mesh_view = {};
+				asset.mesh_cost = 0;
+				asset.mesh_evicted = false;
+				asset.mesh_pending = false;
 			}
 
 			draws[update.id] = asset.mesh.draw;
+			lod_chains[update.id] = asset.mesh.lod_chain;
 		}
 		else
 		{
@@ -729,6 +849,349 @@ void ResourceManager::latch_handles()
 		}
 	}
 	updates.clear();
+
+	update_mesh_residency();
+	mesh_frame_index.fetch_add(1, std::memory_order_relaxed);
+}
+
+void ResourceManager::set_mesh_budget(VkDeviceSize budget)
+{
+	std::lock_guard<std::mutex> holder{lock};
+	mesh_budget = budget;
+}
+
+void ResourceManager::request_mesh_compaction()
+{
+	std::lock_guard<std::mutex> holder{mesh_allocator_lock};
+	mesh_compaction_requested = true;
+}
+
+VkDeviceSize ResourceManager::get_mesh_resident_size() const
+{
+	std::lock_guard<std::mutex> holder{lock};
+	return mesh_resident_size;
+}
+
+bool ResourceManager::mesh_is_resident(const Asset &asset) const
+{
+	return asset.asset_class == Granite::AssetClass::Mesh && asset.latchable &&
+	       !asset.mesh_evicted && asset.mesh_view.format_header;
+}
+
+void ResourceManager::publish_mesh_draws(Granite::AssetID id)
+{
+	auto &asset = assets[id.id];
+	draws[id.id] = asset.mesh.draw;
+	lod_chains[id.id] = asset.mesh.lod_chain;
+}
+
+void ResourceManager::stream_in_meshes(bool request_compaction)
+{
+	uint32_t frame_index = mesh_frame_index.load(std::memory_order_relaxed);
+
+	// Stream in evicted meshes which were requested since last latch, and meshes which never fit.
+	for (uint32_t i = 0, n = mesh_evicted_count ? assets.size() : 0; i < n; i++)
+	{
+		auto &asset = assets[i];
+		if (asset.asset_class != Granite::AssetClass::Mesh || !asset.latchable || !asset.mesh_evicted)
+			continue;
+		if (!asset.mesh_pending && mesh_last_used[i].load(std::memory_order_relaxed) != frame_index)
+			continue;
+
+		Granite::AssetID id{i};
+		bool ret;
+		{
+			std::lock_guard<std::mutex> holder{mesh_allocator_lock};
+			ret = allocate_asset_mesh(id, asset.mesh_view);
+			if (!ret && request_compaction)
+				mesh_compaction_requested = true;
+		}
+
+		if (ret)
+		{
+			asset.mesh_cost = upload_asset_mesh(id, asset.mesh_view);
+			asset.mesh_evicted = false;
+			asset.mesh_pending = false;
+			mesh_evicted_count--;
+			mesh_resident_size += asset.mesh_cost;
+			publish_mesh_draws(id);
+		}
+	}
+}
+
+void ResourceManager::update_mesh_residency()
+{
+	stream_in_meshes(true);
+
+	if (mesh_budget && mesh_resident_size > mesh_budget)
+		evict_cold_meshes();
+
+	// Holes from evictions and releases are only packed once they add up, so a steady trickle
+	// of evictions does not turn into a full compaction every frame.
+	// An allocation failure compacts right away.
+	// Compaction relies on the retained mappings, which only exist while streaming.
+	bool compact;
+	{
+		std::lock_guard<std::mutex> holder{mesh_allocator_lock};
+		compact = mesh_budget != 0 &&
+		          (mesh_compaction_requested ||
+		           (mesh_fragmented_size &&
+		            mesh_fragmented_size >= mesh_resident_size / MeshCompactionFragmentationDivider));
+		mesh_compaction_requested = false;
+	}
+
+	if (compact)
+	{
+		compact_mesh_buffers();
+		mesh_fragmented_size = 0;
+
+		// Compaction may have made room for meshes which failed to allocate above.
+		// Don't request another compaction if they still do not fit.
+		stream_in_meshes(false);
+	}
+}
+
+void ResourceManager::evict_cold_meshes()
+{
+	struct Candidate
+	{
+		uint32_t id;
+		uint32_t last_used;
+	};
+	std::vector<Candidate> candidates;
+
+	for (uint32_t i = 0, n = assets.size(); i < n; i++)
+	{
+		if (!mesh_is_resident(assets[i]))
+			continue;
+
+		// Anything used recently may still be referenced by frames in flight, or will likely be needed again.
+		uint32_t last_used = mesh_last_used[i].load(std::memory_order_relaxed);
+		if (mesh_frame_index.load(std::memory_order_relaxed) - last_used >= MeshEvictionMinIdleFrames)
+			candidates.push_back({ i, last_used });
+	}
+
+	std::sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b) {
+		return a.last_used < b.last_used;
+	});
+
+	std::lock_guard<std::mutex> holder{mesh_allocator_lock};
+
+	for (auto &candidate : candidates)
+	{
+		if (mesh_resident_size <= mesh_budget)
+			break;
+
+		auto &asset = assets[candidate.id];
+		free_asset_mesh(asset);
+		asset.mesh_evicted = true;
+		mesh_evicted_count++;
+		mesh_resident_size -= asset.mesh_cost;
+		mesh_fragmented_size += asset.mesh_cost;
+		publish_mesh_draws(Granite::AssetID{candidate.id});
+	}
+}
+
+void ResourceManager::compact_mesh_buffers()
+{
+	struct Move
+	{
+		uint32_t id;
+		uint32_t old_index_or_payload;
+		uint32_t old_attr;
+		bool evicted;
+	};
+	std::vector<Move> moves;
+
+	for (uint32_t i = 0, n = assets.size(); i < n; i++)
+		if (mesh_is_resident(assets[i]))
+			moves.push_back({ i, assets[i].mesh.index_or_payload.offset, assets[i].mesh.attr_or_stream.offset, false });
+
+	if (moves.empty())
+		return;
+
+	bool encoded = mesh_encoding == MeshEncoding::MeshletEncoded;
+
+	auto get_size = [&](const Move &move) -> uint32_t {
+		auto &view = assets[move.id].mesh_view;
+		return encoded ? view.format_header->payload_size_words : view.total_vertices;
+	};
+
+	// Reallocate large meshes first, so small ones fill in the gaps.
+	std::sort(moves.begin(), moves.end(), [&](const Move &a, const Move &b) {
+		return get_size(a) > get_size(b);
+	});
+
+	std::lock_guard<std::mutex> holder{mesh_allocator_lock};
+
+	// Only the large data buffers move. Headers, bounds and LOD tables stay in place and are rewritten.
+	for (auto &move : moves)
+	{
+		auto &asset = assets[move.id];
+		if (encoded)
+		{
+			mesh_payload_allocator.free(asset.mesh.index_or_payload);
+		}
+		else
+		{
+			index_buffer_allocator.free(asset.mesh.index_or_payload);
+			attribute_buffer_allocator.free(asset.mesh.attr_or_stream);
+		}
+	}
+
+	for (auto &move : moves)
+	{
+		auto &asset = assets[move.id];
+		auto &view = asset.mesh_view;
+		bool ret;
+
+		if (encoded)
+		{
+			ret = mesh_payload_allocator.allocate(view.format_header->payload_size_words, &asset.mesh.index_or_payload);
+		}
+		else
+		{
+			ret = index_buffer_allocator.allocate(view.total_primitives, &asset.mesh.index_or_payload);
+			if (ret)
+				ret = attribute_buffer_allocator.allocate(view.total_vertices, &asset.mesh.attr_or_stream);
+		}
+
+		// Should not happen since we just freed the same amount of space, but pending uploads can pin holes.
+		// Data in the old location may be overwritten now, so the mesh has to be streamed in again.
+		if (!ret)
+		{
+			LOGW("Failed to reallocate mesh during compaction, evicting.\n");
+			free_asset_mesh(asset);
+			asset.mesh_evicted = true;
+			asset.mesh_pending = true;
+			mesh_evicted_count++;
+			mesh_resident_size -= asset.mesh_cost;
+			publish_mesh_draws(Granite::AssetID{move.id});
+			move.evicted = true;
+		}
+	}
+
+	struct Range
+	{
+		uint32_t old_offset;
+		uint32_t new_offset;
+		uint32_t count;
+	};
+
+	std::vector<Range> payload_ranges, index_ranges, attr_ranges;
+	for (auto &move : moves)
+	{
+		if (move.evicted)
+			continue;
+
+		auto &asset = assets[move.id];
+		auto &view = asset.mesh_view;
+
+		if (encoded)
+		{
+			payload_ranges.push_back({ move.old_index_or_payload, asset.mesh.index_or_payload.offset,
+			                           view.format_header->payload_size_words });
+		}
+		else
+		{
+			index_ranges.push_back({ move.old_index_or_payload, asset.mesh.index_or_payload.offset,
+			                         view.total_primitives });
+			attr_ranges.push_back({ move.old_attr, asset.mesh.attr_or_stream.offset, view.total_vertices });
+		}
+	}
+
+	// Uploads run on an async queue and the graphics queue only waits for them at the stages which
+	// read mesh data. An upload in flight could otherwise land in a range which is about to be moved or reused.
+	// A semaphore signalled on the upload queue covers everything submitted there before it.
+	{
+		auto upload_type = encoded ? CommandBuffer::Type::AsyncTransfer : CommandBuffer::Type::AsyncCompute;
+		auto upload_cmd = device->request_command_buffer(upload_type);
+		Semaphore sem;
+		device->submit(upload_cmd, nullptr, 1, &sem);
+		device->add_wait_semaphore(CommandBuffer::Type::Generic, std::move(sem),
+		                           VK_PIPELINE_STAGE_2_COPY_BIT | VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, false);
+	}
+
+	auto cmd = device->request_command_buffer();
+	cmd->barrier(VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_MEMORY_WRITE_BIT,
+	             VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_READ_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT);
+
+	// Ranges overlap, so go through a scratch buffer: gather into scratch, then scatter back.
+	auto move_ranges = [&](const MeshBufferAllocator &allocator, const std::vector<Range> &ranges) {
+		for (unsigned soa = 0; soa < allocator.get_soa_count(); soa++)
+		{
+			VkDeviceSize element_size = allocator.get_element_size(soa);
+			auto &buffer = *allocator.get_buffer(0, soa);
+
+			Util::SmallVector<VkBufferCopy> gather, scatter;
+			VkDeviceSize scratch_size = 0;
+			for (auto &range : ranges)
+			{
+				if (range.old_offset == range.new_offset)
+					continue;
+
+				VkDeviceSize size = range.count * element_size;
+				gather.push_back({ range.old_offset * element_size, scratch_size, size });
+				scatter.push_back({ scratch_size, range.new_offset * element_size, size });
+				scratch_size += size;
+			}
+
+			if (gather.empty())
+				continue;
+
+			BufferCreateInfo info = {};
+			info.domain = BufferDomain::Device;
+			info.size = scratch_size;
+			info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+			auto scratch = device->create_buffer(info);
+
+			cmd->copy_buffer(*scratch, buffer, gather.data(), gather.size());
+			cmd->barrier(VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+			             VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_READ_BIT);
+			cmd->copy_buffer(buffer, *scratch, scatter.data(), scatter.size());
+		}
+	};
+
+	if (encoded)
+	{
+		move_ranges(mesh_payload_allocator, payload_ranges);
+	}
+	else
+	{
+		move_ranges(index_buffer_allocator, index_ranges);
+		move_ranges(attribute_buffer_allocator, attr_ranges);
+	}
+
+	// Rewrite everything which embeds absolute offsets.
+	for (auto &move : moves)
+	{
+		if (move.evicted)
+			continue;
+
+		auto &asset = assets[move.id];
+		auto &view = asset.mesh_view;
+
+		if (encoded)
+		{
+			upload_encoded_mesh_streams(*cmd, asset, view);
+		}
+		else if (mesh_encoding != MeshEncoding::Classic)
+		{
+			Meshlet::upload_indirect_buffer(*cmd, *indirect_buffer_allocator.get_buffer(0, 0),
+			                                asset.mesh.indirect_or_header.offset, view,
+			                                mesh_encoding == MeshEncoding::MeshletDecoded ?
+			                                Meshlet::RuntimeStyle::Meshlet : Meshlet::RuntimeStyle::MDI,
+			                                asset.mesh.index_or_payload.offset, asset.mesh.attr_or_stream.offset);
+		}
+
+		update_mesh_draws(asset, view);
+		upload_mesh_lod_table(*cmd, asset);
+		publish_mesh_draws(Granite::AssetID{move.id});
+	}
+
+	cmd->barrier(VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+	             VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_MEMORY_READ_BIT);
+	device->submit(cmd);
 }
 
 const Buffer *ResourceManager::get_index_buffer() const
@@ -779,6 +1242,11 @@ const Buffer *ResourceManager::get_cluster_bounds_buffer() const
 		return indirect_buffer_allocator.get_buffer(0, 1);
 }
 
+const Buffer *ResourceManager::get_mesh_lod_buffer() const
+{
+	return mesh_lod_allocator.get_buffer(0, 0);
+}
+
 bool ResourceManager::mesh_rendering_is_hierarchical_task() const
 {
 	return device->get_gpu_properties().vendorID == VENDOR_ID_AMD;
@@ -821,6 +1289,11 @@ void MeshBufferAllocator::set_element_size(unsigned soa_index, uint32_t element_
 	global_allocator.element_size[soa_index] = element_size;
 }
 
+unsigned MeshBufferAllocator::get_soa_count() const
+{
+	return global_allocator.soa_count;
+}
+
 uint32_t MeshBufferAllocator::get_element_size(unsigned soa_index) const
 {
 	VK_ASSERT(soa_index < global_allocator.soa_count);
@@ -30,6 +30,8 @@
 #include "small_vector.hpp"
 #include <mutex>
 #include <condition_variable>
+#include <atomic>
+#include <memory>
 
 namespace Vulkan
 {
@@ -68,6 +70,7 @@ public:
 	MeshBufferAllocator(Device &device, uint32_t sub_block_size, uint32_t num_sub_blocks_in_arena_log2);
 	void set_soa_count(unsigned soa_count);
 	void set_element_size(unsigned soa_index, uint32_t element_size);
+	unsigned get_soa_count() const;
 	uint32_t get_element_size(unsigned soa_index) const;
 	const Buffer *get_buffer(unsigned index, unsigned soa_index) const;
 
@@ -113,6 +116,7 @@ public:
 		VkDrawIndexedIndirectCommand indexed;
 	};
 
+	// Returns the finest LOD.
 	DrawCall get_mesh_draw_range(Granite::AssetID id) const
 	{
 		if (id.id < draws.size())
@@ -121,6 +125,38 @@ public:
 			return {};
 	}
 
+	struct MeshLODChain
+	{
+		DrawCall lods[Meshlet::MaxLODs];
+		float errors[Meshlet::MaxLODs];
+		uint32_t lod_count;
+		// Index into get_mesh_lod_buffer(), in units of Meshlet::MaxLODs Meshlet::RuntimeLOD entries.
+		uint32_t lod_table_offset;
+	};
+
+	// Selects the coarsest LOD where error * lod_error_scale <= max_projected_error.
+	// lod_error_scale converts object-space error into the unit of max_projected_error, e.g. for pixels:
+	// object_scale * 0.5 * viewport_height * projection[1][1] / view_distance.
+	DrawCall get_mesh_draw_range(Granite::AssetID id, float lod_error_scale, float max_projected_error) const
+	{
+		if (id.id >= lod_chains.size())
+			return {};
+
+		auto &chain = lod_chains[id.id];
+		uint32_t lod = 0;
+		while (lod + 1 < chain.lod_count && chain.errors[lod + 1] * lod_error_scale <= max_projected_error)
+			lod++;
+		return chain.lods[lod];
+	}
+
+	const MeshLODChain *get_mesh_lod_chain(Granite::AssetID id) const
+	{
+		if (id.id < lod_chains.size() && lod_chains[id.id].lod_count)
+			return &lod_chains[id.id];
+		else
+			return nullptr;
+	}
+
 	MeshEncoding get_mesh_encoding() const
 	{
 		return mesh_encoding;
@@ -137,6 +173,24 @@ public:
 	const Buffer *get_meshlet_stream_header_buffer() const;
 
 	const Buffer *get_cluster_bounds_buffer() const;
+	// Array of Meshlet::RuntimeLOD for GPU-side LOD selection in the indirect paths.
+	const Buffer *get_mesh_lod_buffer() const;
+
+	// Mesh streaming. Meshes which have not been marked as used for a while are evicted
+	// when resident mesh memory exceeds the budget, and streamed back in from their retained
+	// file mapping the next time they are marked as used. Eviction and compaction of the
+	// global mesh buffers happen in latch_handles(), which is also where draw ranges are remapped.
+	// A budget of 0 (default) disables streaming altogether: no eviction, no retained mappings and no compaction.
+	void set_mesh_budget(VkDeviceSize budget);
+	VkDeviceSize get_mesh_resident_size() const;
+	void request_mesh_compaction();
+
+	// Thread-safe, call for every mesh which is rendered in a frame.
+	void mark_mesh_used(Granite::AssetID id)
+	{
+		if (id.id < Granite::AssetID::MaxIDs)
+			mesh_last_used[id.id].store(mesh_frame_index.load(std::memory_order_relaxed), std::memory_order_relaxed);
+	}
 
 	// Mesh shading requires some vendor specific tuning.
 	bool mesh_rendering_is_hierarchical_task() const;
@@ -160,19 +214,27 @@ private:
 		ImageHandle image;
 		struct
 		{
-			Util::AllocatedSlice index_or_payload, attr_or_stream, indirect_or_header;
+			Util::AllocatedSlice index_or_payload, attr_or_stream, indirect_or_header, lod_table;
 			DrawCall draw;
+			MeshLODChain lod_chain;
 		} mesh;
+		Granite::FileMappingHandle mesh_mapping;
+		Meshlet::MeshView mesh_view = {};
+		uint64_t mesh_cost = 0;
+		bool mesh_evicted = false;
+		// Initial allocation failed. Retried every latch until it fits, whether or not the mesh is used.
+		bool mesh_pending = false;
 		Granite::AssetClass asset_class = Granite::AssetClass::ImageZeroable;
 		bool latchable = false;
 	};
 
-	std::mutex lock;
+	mutable std::mutex lock;
 	std::condition_variable cond;
 
 	std::vector<Asset> assets;
 	std::vector<const ImageView *> views;
 	std::vector<DrawCall> draws;
+	std::vector<MeshLODChain> lod_chains;
 	std::vector<Granite::AssetID> updates;
 
 	ImageHandle fallback_color;
@@ -196,10 +258,34 @@ private:
 	MeshBufferAllocator mesh_header_allocator;
 	MeshBufferAllocator mesh_stream_allocator;
 	MeshBufferAllocator mesh_payload_allocator;
+	MeshBufferAllocator mesh_lod_allocator;
 
 	MeshEncoding mesh_encoding = MeshEncoding::Classic;
 
 	bool allocate_asset_mesh(Granite::AssetID id, const Meshlet::MeshView &view);
+	void free_asset_mesh(Asset &asset);
+	void update_mesh_draws(Asset &asset, const Meshlet::MeshView &view);
+	uint64_t upload_asset_mesh(Granite::AssetID id, const Meshlet::MeshView &view);
+	void upload_encoded_mesh_streams(CommandBuffer &cmd, const Asset &asset, const Meshlet::MeshView &view);
+	void upload_mesh_lod_table(CommandBuffer &cmd, const Asset &asset);
+
+	enum { MeshEvictionMinIdleFrames = 8 };
+	// Compact once holes make up this fraction (1 / N) of resident mesh memory.
+	enum { MeshCompactionFragmentationDivider = 4 };
+	std::unique_ptr<std::atomic_uint32_t[]> mesh_last_used;
+	std::atomic_uint32_t mesh_frame_index{0};
+	uint32_t mesh_evicted_count = 0;
+	VkDeviceSize mesh_budget = 0;
+	VkDeviceSize mesh_resident_size = 0;
+	VkDeviceSize mesh_fragmented_size = 0;
+	bool mesh_compaction_requested = false;
+
+	bool mesh_is_resident(const Asset &asset) const;
+	void publish_mesh_draws(Granite::AssetID id);
+	void update_mesh_residency();
+	void stream_in_meshes(bool request_compaction);
+	void evict_cold_meshes();
+	void compact_mesh_buffers();
 
 	void init_mesh_assets();
 };
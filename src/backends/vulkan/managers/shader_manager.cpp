@@ -127,6 +127,20 @@ const ShaderTemplateVariant *ShaderTemplate::register_variant(
 	auto *ret = variants.find(hash);
 	if (!ret)
 	{
+#ifdef GRANITE_VULKAN_SHADER_MANAGER_RUNTIME_COMPILER
+#ifndef GRANITE_SHIPPING
+		std::shared_ptr<Granite::GLSLCompiler> variant_compiler;
+		unsigned generation;
+		{
+			std::lock_guard<std::mutex> holder{recompile_lock};
+			variant_compiler = compiler;
+			generation = compiler_generation;
+		}
+#else
+		auto variant_compiler = compiler;
+#endif
+#endif
+
 		auto *variant = variants.allocate();
 		variant->hash = complete_hash;
 
@@ -163,11 +177,11 @@ const ShaderTemplateVariant *ShaderTemplate::register_variant(
 			{
 				variant->spirv = static_shader;
 #ifdef GRANITE_VULKAN_SHADER_MANAGER_RUNTIME_COMPILER
-				update_variant_cache(*variant);
+				update_variant_cache(variant->hash, variant->spirv);
 #endif
 			}
 #ifdef GRANITE_VULKAN_SHADER_MANAGER_RUNTIME_COMPILER
-			else if (compiler)
+			else if (variant_compiler)
 			{
 #ifdef VULKAN_DEBUG
 				std::string hash_debug_str;
@@ -191,7 +205,7 @@ const ShaderTemplateVariant *ShaderTemplate::register_variant(
 				{
 					GRANITE_SCOPED_TIMELINE_EVENT_FILE(device->get_system_handles().timeline_trace_file,
 					                                   "glsl-compile");
-					variant->spirv = compiler->compile(error_message, defines);
+					variant->spirv = variant_compiler->compile(error_message, defines);
 				}
 
 				if (variant->spirv.empty())
@@ -200,7 +214,7 @@ const ShaderTemplateVariant *ShaderTemplate::register_variant(
 					variants.free(variant);
 					return nullptr;
 				}
-				update_variant_cache(*variant);
+				update_variant_cache(variant->hash, variant->spirv);
 			}
 			else
 				return nullptr;
@@ -229,44 +243,81 @@ const ShaderTemplateVariant *ShaderTemplate::register_variant(
 		if (defines)
 			variant->defines = *defines;
 
+#if defined(GRANITE_VULKAN_SHADER_MANAGER_RUNTIME_COMPILER) && !defined(GRANITE_SHIPPING)
+		std::lock_guard<std::mutex> holder{recompile_lock};
 		ret = variants.insert_yield(hash, variant);
+		if (ret == variant)
+		{
+			// Not part of the snapshot taken by prepare_recompile().
+			if (pending_compiler)
+				late_variants.push_back(variant);
+			else if (generation != compiler_generation && compiler)
+			{
+				// A recompile was committed while this variant compiled against the old source.
+				recompile_variant(*compiler, *variant);
+				commit_variant(*variant);
+			}
+		}
+#else
+		ret = variants.insert_yield(hash, variant);
+#endif
 	}
 	return ret;
 }
 
 #ifdef GRANITE_VULKAN_SHADER_MANAGER_RUNTIME_COMPILER
 #ifndef GRANITE_SHIPPING
-void ShaderTemplate::recompile_variant(ShaderTemplateVariant &variant)
+void ShaderTemplate::recompile_variant(Granite::GLSLCompiler &variant_compiler, ShaderTemplateVariant &variant) const
 {
 	std::string error_message;
-	auto newspirv = compiler->compile(error_message, &variant.defines);
-	if (newspirv.empty())
+	variant.recompiled_spirv = variant_compiler.compile(error_message, &variant.defines);
+	if (variant.recompiled_spirv.empty())
 	{
 		LOGE("Failed to compile shader: %s\n%s\n", path.c_str(), error_message.c_str());
 		for (auto &define : variant.defines)
 			LOGE("  Define: %s = %d\n", define.first.c_str(), define.second);
-		return;
 	}
+}
+
+void ShaderTemplate::commit_variant(ShaderTemplateVariant &variant)
+{
+	auto newspirv = std::move(variant.recompiled_spirv);
+	variant.recompiled_spirv.clear();
+
+	// Keep the old shader around on failure.
+	if (newspirv.empty())
+		return;
+
+	update_variant_cache(variant.hash, newspirv);
 
-	variant.spirv = std::move(newspirv);
-	variant.instance++;
-	update_variant_cache(variant);
+	// Only bump the instance if the SPIR-V changed, so programs which are not affected by an edit
+	// are not recreated.
+	bool changed;
+	if (variant.spirv.empty())
+		changed = Shader::hash(newspirv.data(), newspirv.size() * sizeof(uint32_t)) != variant.spirv_hash;
+	else
+		changed = newspirv != variant.spirv;
+
+	if (changed)
+	{
+		variant.spirv = std::move(newspirv);
+		variant.instance++;
+	}
 }
 #endif
 
-void ShaderTemplate::update_variant_cache(const ShaderTemplateVariant &variant)
+void ShaderTemplate::update_variant_cache(Util::Hash variant_hash, const std::vector<uint32_t> &spirv)
 {
-	if (variant.spirv.empty())
+	if (spirv.empty())
 		return;
 
-	auto shader_hash = Shader::hash(variant.spirv.data(),
-	                                variant.spirv.size() * sizeof(uint32_t));
+	auto shader_hash = Shader::hash(spirv.data(), spirv.size() * sizeof(uint32_t));
 
 	ResourceLayout layout;
-	Shader::reflect_resource_layout(layout, variant.spirv.data(), variant.spirv.size() * sizeof(uint32_t));
+	Shader::reflect_resource_layout(layout, spirv.data(), spirv.size() * sizeof(uint32_t));
 
 #ifndef GRANITE_SHIPPING
-	auto *var_to_shader = cache.variant_to_shader.find(variant.hash);
+	auto *var_to_shader = cache.variant_to_shader.find(variant_hash);
 	if (var_to_shader)
 	{
 		// This is only updated from inotify callbacks, so threading shouldn't really be a concern.
@@ -276,36 +327,76 @@ void ShaderTemplate::update_variant_cache(const ShaderTemplateVariant &variant)
 	else
 #endif
 	{
-		cache.variant_to_shader.emplace_yield(variant.hash, source_hash, shader_hash);
+		cache.variant_to_shader.emplace_yield(variant_hash, source_hash, shader_hash);
 	}
 
 	cache.shader_to_layout.emplace_yield(shader_hash, layout);
 }
 
 #ifndef GRANITE_SHIPPING
-void ShaderTemplate::recompile()
+bool ShaderTemplate::prepare_recompile()
 {
-	// Recompile all variants.
 	if (!device->get_system_handles().filesystem)
-		return;
+		return false;
 	auto newcompiler = std::make_unique<Granite::GLSLCompiler>(*device->get_system_handles().filesystem);
 	newcompiler->set_target(device->get_device_features().device_api_core_version >= VK_API_VERSION_1_3 ?
 	                        Granite::Target::Vulkan13 : Granite::Target::Vulkan11);
 	if (!newcompiler->set_source_from_file(path, Granite::Stage(force_stage)))
-		return;
+		return false;
 	newcompiler->set_include_directories(&include_directories);
 	if (!newcompiler->preprocess())
 	{
 		LOGE("Failed to preprocess updated shader: %s\n", path.c_str());
-		return;
+		return false;
 	}
-	compiler = std::move(newcompiler);
-	source_hash = compiler->get_source_hash();
 
+	// The source hash covers the fully preprocessed source with every include resolved.
+	// If it did not change, the edit cannot affect any variant of this template.
+	if (compiler && newcompiler->get_source_hash() == source_hash)
+		return false;
+
+	// From here on, new variants are queued in late_variants instead of being missed by the snapshot.
+	std::lock_guard<std::mutex> holder{recompile_lock};
+	pending_compiler = std::move(newcompiler);
+	recompile_variants.clear();
+	late_variants.clear();
 	for (auto &variant : variants.get_read_only())
-		recompile_variant(variant);
+		recompile_variants.push_back(&variant);
 	for (auto &variant : variants.get_read_write())
-		recompile_variant(variant);
+		recompile_variants.push_back(&variant);
+	return true;
+}
+
+void ShaderTemplate::enqueue_recompile(Granite::TaskGroup *group)
+{
+	auto &variant_compiler = *pending_compiler;
+	for (auto *variant : recompile_variants)
+	{
+		if (group)
+			group->enqueue_task([this, &variant_compiler, variant]() { recompile_variant(variant_compiler, *variant); });
+		else
+			recompile_variant(variant_compiler, *variant);
+	}
+}
+
+void ShaderTemplate::commit_recompile()
+{
+	std::lock_guard<std::mutex> holder{recompile_lock};
+
+	for (auto *variant : late_variants)
+	{
+		recompile_variant(*pending_compiler, *variant);
+		recompile_variants.push_back(variant);
+	}
+	late_variants.clear();
+
+	compiler = std::move(pending_compiler);
+	source_hash = compiler->get_source_hash();
+	compiler_generation++;
+
+	for (auto *variant : recompile_variants)
+		commit_variant(*variant);
+	recompile_variants.clear();
 }
 #endif
 
@@ -684,10 +775,36 @@ void ShaderManager::recompile(const Granite::FileNotifyInfo &info)
 	if (info.type == Granite::FileNotifyType::FileDeleted)
 		return;
 
-	auto &deps = dependees[info.path];
-	for (auto &dep : deps)
+	std::vector<ShaderTemplate *> stale;
+	for (auto *dep : dependees[info.path])
+		if (dep->prepare_recompile())
+			stale.push_back(dep);
+
+	if (stale.empty())
+		return;
+
+	GRANITE_SCOPED_TIMELINE_EVENT_FILE(device->get_system_handles().timeline_trace_file, "glsl-recompile");
+
+	if (auto *thread_group = device->get_system_handles().thread_group)
+	{
+		auto task = thread_group->create_task();
+		task->set_desc("glsl-recompile");
+		for (auto *dep : stale)
+			dep->enqueue_recompile(task.get());
+		task->flush();
+		task->wait();
+	}
+	else
+	{
+		for (auto *dep : stale)
+			dep->enqueue_recompile(nullptr);
+	}
+
+	// Swap in every template at once, so a program never pairs a stage built against
+	// the new includes with a stale stage from the same edit.
+	for (auto *dep : stale)
 	{
-		dep->recompile();
+		dep->commit_recompile();
 		dep->register_dependencies(*this);
 	}
 }
@@ -26,6 +26,7 @@
 #include "vulkan_common.hpp"
 #include "filesystem.hpp"
 #include <memory>
+#include <mutex>
 #include <unordered_map>
 #include <unordered_set>
 #include <string>
@@ -72,6 +73,8 @@ struct ShaderTemplateVariant : public Util::IntrusiveHashMapEnabled<ShaderTempla
 	std::vector<std::pair<std::string, int>> defines;
 	Shader *precompiled_shader = nullptr;
 	unsigned instance = 0;
+	// Result of a pending recompile, swapped into spirv by ShaderTemplate::commit_recompile().
+	std::vector<uint32_t> recompiled_spirv;
 
 	Vulkan::Shader *resolve(Vulkan::Device &device) const;
 };
@@ -112,7 +115,15 @@ public:
 
 #ifndef GRANITE_SHIPPING
 	// We'll never want to recompile shaders in runtime outside a dev environment.
-	void recompile();
+	// Recompiling is split into phases so that many templates can compile in parallel
+	// and swap in the results together.
+	// Returns false if the preprocessed source is unchanged or fails to preprocess.
+	bool prepare_recompile();
+	// Compiles every variant which existed in prepare_recompile(), as separate tasks in group if it is not null.
+	void enqueue_recompile(Granite::TaskGroup *group);
+	// Must only be called after every task from enqueue_recompile() has completed.
+	// Variants registered since prepare_recompile() are compiled here.
+	void commit_recompile();
 #endif
 
 private:
@@ -123,13 +134,23 @@ private:
 	Util::Hash path_hash = 0;
 	std::vector<uint32_t> static_shader;
 #ifdef GRANITE_VULKAN_SHADER_MANAGER_RUNTIME_COMPILER
-	std::unique_ptr<Granite::GLSLCompiler> compiler;
+	// Shared so register_variant() can keep compiling against it while a recompile swaps it out.
+	std::shared_ptr<Granite::GLSLCompiler> compiler;
 	const std::vector<std::string> &include_directories;
-	void update_variant_cache(const ShaderTemplateVariant &variant);
+	void update_variant_cache(Util::Hash variant_hash, const std::vector<uint32_t> &spirv);
 	Util::Hash source_hash = 0;
 #ifndef GRANITE_SHIPPING
 	// We'll never want to recompile shaders in runtime outside a dev environment.
-	void recompile_variant(ShaderTemplateVariant &variant);
+	std::unique_ptr<Granite::GLSLCompiler> pending_compiler;
+	// Guards compiler, pending_compiler and the variant lists against register_variant().
+	std::mutex recompile_lock;
+	// Snapshot taken by prepare_recompile().
+	std::vector<ShaderTemplateVariant *> recompile_variants;
+	// Registered while a recompile is pending.
+	std::vector<ShaderTemplateVariant *> late_variants;
+	unsigned compiler_generation = 0;
+	void recompile_variant(Granite::GLSLCompiler &variant_compiler, ShaderTemplateVariant &variant) const;
+	void commit_variant(ShaderTemplateVariant &variant);
 #endif
 #endif
 	VulkanCache<ShaderTemplateVariant> variants;
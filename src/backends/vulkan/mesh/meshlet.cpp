@@ -43,7 +43,8 @@ MeshView create_mesh_view(const Granite::FileMapping &mapping)
 	auto *ptr = mapping.data<unsigned char>();
 	auto *end_ptr = ptr + mapping.get_size();
 
-	if (memcmp(ptr, magic, sizeof(magic)) != 0)
+	bool has_lods = memcmp(ptr, magic_lod, sizeof(magic_lod)) == 0;
+	if (!has_lods && memcmp(ptr, magic, sizeof(magic)) != 0)
 	{
 		LOGE("Invalid MESHLET2 magic.\n");
 		return {};
@@ -54,6 +55,54 @@ MeshView create_mesh_view(const Granite::FileMapping &mapping)
 	view.format_header = reinterpret_cast<const FormatHeader *>(ptr);
 	ptr += sizeof(*view.format_header);
 
+	if (has_lods)
+	{
+		if (end_ptr - ptr < ptrdiff_t(sizeof(uint32_t)))
+			return {};
+
+		uint32_t lod_count;
+		memcpy(&lod_count, ptr, sizeof(lod_count));
+		ptr += sizeof(lod_count);
+
+		if (lod_count == 0 || lod_count > MaxLODs)
+		{
+			LOGE("Invalid LOD count %u.\n", lod_count);
+			return {};
+		}
+
+		if (end_ptr - ptr < ptrdiff_t(lod_count * sizeof(LODHeader)))
+			return {};
+
+		memcpy(view.lods, ptr, lod_count * sizeof(LODHeader));
+		ptr += lod_count * sizeof(LODHeader);
+		view.num_lods = lod_count;
+
+		for (uint32_t i = 0; i < lod_count; i++)
+		{
+			auto &lod = view.lods[i];
+			if (lod.meshlet_count == 0 || (lod.meshlet_offset % ChunkFactor) != 0 ||
+			    lod.meshlet_offset + lod.meshlet_count > view.format_header->meshlet_count ||
+			    lod.meshlet_offset + lod.meshlet_count < lod.meshlet_offset)
+			{
+				LOGE("Invalid meshlet range for LOD %u.\n", i);
+				return {};
+			}
+
+			if (i && lod.error < view.lods[i - 1].error)
+			{
+				LOGE("LOD errors must be monotonic.\n");
+				return {};
+			}
+		}
+	}
+	else
+	{
+		view.lods[0].meshlet_offset = 0;
+		view.lods[0].meshlet_count = view.format_header->meshlet_count;
+		view.lods[0].error = 0.0f;
+		view.num_lods = 1;
+	}
+
 	if (end_ptr - ptr < ptrdiff_t(view.format_header->meshlet_count * sizeof(Bound)))
 		return {};
 	view.bounds = reinterpret_cast<const Bound *>(ptr);
@@ -84,6 +133,15 @@ MeshView create_mesh_view(const Granite::FileMapping &mapping)
 	for (uint32_t i = 0, n = view.format_header->meshlet_count; i < n; i++)
 	{
 		auto counts = view.streams[i * view.format_header->stream_count].u.counts;
+
+		for (uint32_t lod = 0; lod < view.num_lods; lod++)
+		{
+			if (i == view.lods[lod].meshlet_offset)
+				view.lod_primitive_offsets[lod] = view.total_primitives;
+			if (i >= view.lods[lod].meshlet_offset && i < view.lods[lod].meshlet_offset + view.lods[lod].meshlet_count)
+				view.lod_primitive_counts[lod] += counts.prim_count;
+		}
+
 		view.total_primitives += counts.prim_count;
 		view.total_vertices += counts.vert_count;
 	}
@@ -91,9 +149,9 @@ MeshView create_mesh_view(const Granite::FileMapping &mapping)
 	return view;
 }
 
-static void upload_indirect_buffer(CommandBuffer &cmd, const Vulkan::Buffer &indirect_buffer, uint32_t alloc_offset,
-                                   const MeshView &view, RuntimeStyle runtime_style,
-                                   uint32_t global_prim_offset, uint32_t global_vert_offset)
+void upload_indirect_buffer(CommandBuffer &cmd, const Vulkan::Buffer &indirect_buffer, uint32_t alloc_offset,
+                            const MeshView &view, RuntimeStyle runtime_style,
+                            uint32_t global_prim_offset, uint32_t global_vert_offset)
 {
 	size_t total_padded_meshlets = view.num_bounds_256 * ChunkFactor;
 	size_t total_meshlets = view.format_header->meshlet_count;
@@ -43,6 +43,7 @@ namespace Meshlet
 static constexpr unsigned MaxStreams = 8;
 static constexpr unsigned MaxElements = 32;
 static constexpr unsigned ChunkFactor = 256 / MaxElements;
+static constexpr unsigned MaxLODs = 8;
 
 struct Stream
 {
@@ -108,6 +109,31 @@ struct FormatHeader
 	uint32_t payload_size_words;
 };
 
+// MESHLET5 adds a LOD table after FormatHeader: uint32_t lod_count, followed by lod_count LODHeaders.
+// Each LOD is a contiguous range of meshlets, finest LOD first.
+// meshlet_offset must be aligned to ChunkFactor, the encoder pads with empty meshlets.
+// error is the object-space geometric deviation against LOD 0 and must increase monotonically.
+// Only the loader lives here, there is no exporter or simplifier which writes MESHLET5 yet.
+struct LODHeader
+{
+	uint32_t meshlet_offset;
+	uint32_t meshlet_count;
+	float error;
+	uint32_t padding;
+};
+static_assert(sizeof(LODHeader) == 16, "Unexpected LODHeader size.");
+
+// GPU-visible LOD table, MaxLODs entries per mesh. Unused entries replicate the coarsest LOD,
+// so LOD selection can scan all entries without knowing the LOD count.
+struct RuntimeLOD
+{
+	uint32_t offset; // In units of 256 primitive chunks, or firstIndex for classic encoding.
+	uint32_t count; // In units of 256 primitive chunks, or indexCount for classic encoding.
+	float error;
+	int32_t vertex_offset; // Classic encoding only.
+};
+static_assert(sizeof(RuntimeLOD) == 16, "Unexpected RuntimeLOD size.");
+
 using PayloadWord = uint32_t;
 
 struct MeshView
@@ -121,9 +147,16 @@ struct MeshView
 	uint32_t total_vertices;
 	uint32_t num_bounds;
 	uint32_t num_bounds_256;
+
+	// For files without a LOD table, a single LOD covering all meshlets is synthesized.
+	LODHeader lods[MaxLODs];
+	uint32_t lod_primitive_offsets[MaxLODs];
+	uint32_t lod_primitive_counts[MaxLODs];
+	uint32_t num_lods;
 };
 
 static const char magic[8] = { 'M', 'E', 'S', 'H', 'L', 'E', 'T', '4' };
+static const char magic_lod[8] = { 'M', 'E', 'S', 'H', 'L', 'E', 'T', '5' };
 
 MeshView create_mesh_view(const Granite::FileMapping &mapping);
 
@@ -156,5 +189,11 @@ struct DecodeInfo
 };
 
 bool decode_mesh(Vulkan::CommandBuffer &cmd, const DecodeInfo &decode_info, const MeshView &view);
+
+// Writes the runtime headers for RuntimeStyle::Meshlet or RuntimeStyle::MDI, as done by decode_mesh.
+// Useful when decoded data moves, since the headers embed absolute offsets.
+void upload_indirect_buffer(Vulkan::CommandBuffer &cmd, const Vulkan::Buffer &indirect_buffer, uint32_t alloc_offset,
+                            const MeshView &view, RuntimeStyle runtime_style,
+                            uint32_t global_prim_offset, uint32_t global_vert_offset);
 }
 }
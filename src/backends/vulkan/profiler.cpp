@@ -0,0 +1,267 @@
+/* Copyright (c) 2017-2026 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "profiler.hpp"
+#include "logging.hpp"
+#include "timer.hpp"
+#include <vector>
+
+namespace Vulkan
+{
+// Fixed tids, so GPU queues and submissions sort before CPU threads in the viewer.
+static constexpr uint32_t GPUQueueTidBase = 1;
+static constexpr uint32_t SubmitTidBase = 16;
+static constexpr uint32_t CPUThreadTidBase = 256;
+
+static const char *queue_names[QUEUE_INDEX_COUNT] = {
+	"Graphics", "Compute", "Transfer", "Video decode", "Video encode",
+};
+
+struct CPURegion
+{
+	std::string name;
+	int64_t start_ns;
+	bool captured;
+};
+
+static std::atomic_uint32_t next_cpu_thread_index;
+
+struct CPUThreadState
+{
+	std::vector<CPURegion> regions;
+	uint32_t tid = CPUThreadTidBase + next_cpu_thread_index.fetch_add(1, std::memory_order_relaxed);
+	uint32_t named_generation = 0;
+};
+
+static thread_local CPUThreadState cpu_thread_state;
+
+static void write_json_string(FILE *file, const char *str)
+{
+	fputc('"', file);
+	for (; *str; str++)
+	{
+		auto c = static_cast<unsigned char>(*str);
+		if (c == '"' || c == '\\')
+			fprintf(file, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(file, "\\u%04x", c);
+		else
+			fputc(c, file);
+	}
+	fputc('"', file);
+}
+
+Profiler::~Profiler()
+{
+	close_file();
+}
+
+bool Profiler::begin_capture(const char *path, unsigned frame_count, bool gpu_regions)
+{
+	std::lock_guard<std::mutex> holder{lock};
+	if (state != State::Idle)
+	{
+		LOGE("Profile capture already in progress.\n");
+		return false;
+	}
+
+	if (frame_count == 0)
+		return false;
+
+	file = fopen(path, "w");
+	if (!file)
+	{
+		LOGE("Failed to open profile capture file: %s.\n", path);
+		return false;
+	}
+
+	// Events are streamed as they are resolved, a big buffer keeps this off the hot path.
+	setvbuf(file, nullptr, _IOFBF, 1024 * 1024);
+	fputs("[\n", file);
+	first_event = true;
+
+	gpu_regions_supported = gpu_regions;
+	if (!gpu_regions)
+		LOGW("Calibrated timestamps not supported, GPU regions will not be captured.\n");
+
+	capture_frame_count = frame_count;
+	frames_remaining = frame_count;
+	capture_generation++;
+	state = State::Pending;
+
+	LOGI("Capturing %u frames to %s.\n", frame_count, path);
+	return true;
+}
+
+void Profiler::end_capture()
+{
+	std::lock_guard<std::mutex> holder{lock};
+	capturing.store(false, std::memory_order_relaxed);
+	close_file();
+	state = State::Idle;
+}
+
+void Profiler::close_file()
+{
+	if (file)
+	{
+		fputs("\n]\n", file);
+		fclose(file);
+		file = nullptr;
+	}
+}
+
+void Profiler::begin_event()
+{
+	if (!first_event)
+		fputs(",\n", file);
+	first_event = false;
+}
+
+void Profiler::write_thread_name(uint32_t tid, const char *name)
+{
+	begin_event();
+	fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", tid);
+	write_json_string(file, name);
+	fputs("}}", file);
+}
+
+void Profiler::write_duration_event(const char *cat, const char *name, uint32_t tid, int64_t start_ns, int64_t end_ns)
+{
+	begin_event();
+	fputs("{\"name\":", file);
+	write_json_string(file, name);
+	fprintf(file, ",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+	        cat, tid, 1e-3 * double(start_ns - base_ns), 1e-3 * double(end_ns - start_ns));
+}
+
+void Profiler::next_frame_context(unsigned frames_in_flight)
+{
+	std::lock_guard<std::mutex> holder{lock};
+	int64_t now = Util::get_current_time_nsecs();
+
+	switch (state)
+	{
+	case State::Pending:
+		base_ns = now;
+		frame_index = 0;
+		for (int i = 0; i < QUEUE_INDEX_COUNT; i++)
+		{
+			write_thread_name(GPUQueueTidBase + i, (std::string("GPU ") + queue_names[i]).c_str());
+			write_thread_name(SubmitTidBase + i, (std::string("Submit ") + queue_names[i]).c_str());
+		}
+		state = State::Capturing;
+		capturing.store(true, std::memory_order_relaxed);
+		break;
+
+	case State::Capturing:
+		if (--frames_remaining == 0)
+		{
+			capturing.store(false, std::memory_order_relaxed);
+			state = State::Draining;
+			// Once every frame context has been recycled, all GPU regions are resolved.
+			frames_remaining = frames_in_flight;
+		}
+		break;
+
+	case State::Draining:
+		if (--frames_remaining == 0)
+		{
+			close_file();
+			state = State::Idle;
+			LOGI("Profile capture of %u frames complete.\n", capture_frame_count);
+		}
+		return;
+
+	default:
+		return;
+	}
+
+	if (state == State::Capturing)
+	{
+		begin_event();
+		fprintf(file, "{\"name\":\"Frame %u\",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":%u,\"ts\":%.3f}",
+		        frame_index++, GPUQueueTidBase, 1e-3 * double(now - base_ns));
+	}
+}
+
+void Profiler::write_gpu_region(QueueIndices queue, const std::string &name, int64_t start_ns, int64_t end_ns)
+{
+	std::lock_guard<std::mutex> holder{lock};
+	if (file && (state == State::Capturing || state == State::Draining))
+		write_duration_event("gpu", name.c_str(), GPUQueueTidBase + queue, start_ns, end_ns);
+}
+
+void Profiler::write_submission(QueueIndices queue, int64_t start_ns, int64_t end_ns)
+{
+	std::lock_guard<std::mutex> holder{lock};
+	if (state == State::Capturing)
+		write_duration_event("submit", "vkQueueSubmit2", SubmitTidBase + queue, start_ns, end_ns);
+}
+
+void Profiler::begin_cpu_region(const char *name)
+{
+	// Keep the stack balanced even when not capturing, since regions can straddle the trigger.
+	bool captured = is_capturing();
+	cpu_thread_state.regions.push_back({ captured ? name : std::string(),
+	                                     captured ? Util::get_current_time_nsecs() : 0,
+	                                     captured });
+}
+
+void Profiler::end_cpu_region()
+{
+	auto &thread_state = cpu_thread_state;
+	if (thread_state.regions.empty())
+		return;
+
+	auto region = std::move(thread_state.regions.back());
+	thread_state.regions.pop_back();
+
+	if (!region.captured)
+		return;
+
+	int64_t end_ns = Util::get_current_time_nsecs();
+	std::lock_guard<std::mutex> holder{lock};
+	if (state != State::Capturing)
+		return;
+
+	if (thread_state.named_generation != capture_generation)
+	{
+		thread_state.named_generation = capture_generation;
+		write_thread_name(thread_state.tid,
+		                  ("CPU thread " + std::to_string(thread_state.tid - CPUThreadTidBase)).c_str());
+	}
+
+	write_duration_event("cpu", region.name.c_str(), thread_state.tid, region.start_ns, end_ns);
+}
+
+ProfilerScope::ProfilerScope(Profiler &profiler_, const char *name)
+	: profiler(profiler_)
+{
+	profiler.begin_cpu_region(name);
+}
+
+ProfilerScope::~ProfilerScope()
+{
+	profiler.end_cpu_region();
+}
+}
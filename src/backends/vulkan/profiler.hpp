@@ -0,0 +1,106 @@
+/* Copyright (c) 2017-2026 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "vulkan_common.hpp"
+#include <stdio.h>
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+
+namespace Vulkan
+{
+// Captures nested GPU regions (CommandBuffer::begin_region/end_region), CPU regions and queue submissions
+// on the calibrated host timeline and streams them as a Chrome trace (JSON array format),
+// which can be loaded in both chrome://tracing and the Perfetto UI.
+// A capture covers a fixed number of frame contexts and is triggered at runtime.
+class Profiler
+{
+public:
+	~Profiler();
+
+	// Capture starts at the next frame context. GPU regions require calibrated timestamps.
+	bool begin_capture(const char *path, unsigned frame_count, bool gpu_regions);
+	void end_capture();
+
+	bool is_capturing() const
+	{
+		return capturing.load(std::memory_order_relaxed);
+	}
+
+	bool is_capturing_gpu_regions() const
+	{
+		return is_capturing() && gpu_regions_supported;
+	}
+
+	// Regions on the calling thread. Must be balanced, but may straddle capture boundaries.
+	void begin_cpu_region(const char *name);
+	void end_cpu_region();
+
+	// Device hooks.
+	void next_frame_context(unsigned frames_in_flight);
+	void write_gpu_region(QueueIndices queue, const std::string &name, int64_t start_ns, int64_t end_ns);
+	void write_submission(QueueIndices queue, int64_t start_ns, int64_t end_ns);
+
+private:
+	enum class State
+	{
+		Idle,
+		Pending,
+		Capturing,
+		// Frames recorded during the capture still have GPU regions in flight.
+		Draining
+	};
+
+	std::mutex lock;
+	std::atomic_bool capturing{false};
+	State state = State::Idle;
+	FILE *file = nullptr;
+	bool gpu_regions_supported = false;
+	bool first_event = true;
+	unsigned frames_remaining = 0;
+	unsigned capture_frame_count = 0;
+	unsigned frame_index = 0;
+	uint32_t capture_generation = 0;
+	int64_t base_ns = 0;
+
+	void begin_event();
+	void write_duration_event(const char *cat, const char *name, uint32_t tid, int64_t start_ns, int64_t end_ns);
+	void write_thread_name(uint32_t tid, const char *name);
+	void close_file();
+};
+
+class ProfilerScope
+{
+public:
+	ProfilerScope(Profiler &profiler, const char *name);
+	~ProfilerScope();
+
+	ProfilerScope(const ProfilerScope &) = delete;
+	void operator=(const ProfilerScope &) = delete;
+
+private:
+	Profiler &profiler;
+};
+}
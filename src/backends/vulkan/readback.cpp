@@ -0,0 +1,538 @@
+/* Copyright (c) 2017-2026 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "readback.hpp"
+#include "device.hpp"
+#include "format.hpp"
+#include "bitops.hpp"
+#include "logging.hpp"
+#include <string.h>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define READBACK_SSE2
+#include <emmintrin.h>
+#if defined(__F16C__)
+#define READBACK_F16C
+#include <immintrin.h>
+#endif
+#elif defined(__ARM_NEON)
+#define READBACK_NEON
+#include <arm_neon.h>
+#endif
+
+namespace Vulkan
+{
+static inline uint8_t quantize_unorm8(float v)
+{
+	// Written so that NaN becomes 0, like the SIMD paths.
+	v = v > 0.0f ? v : 0.0f;
+	v = v < 1.0f ? v : 1.0f;
+	return uint8_t(v * 255.0f + 0.5f);
+}
+
+static inline float half_to_float(uint16_t h)
+{
+	uint32_t sign = uint32_t(h & 0x8000u) << 16;
+	uint32_t exponent = (h >> 10) & 0x1fu;
+	uint32_t mantissa = h & 0x3ffu;
+	uint32_t bits;
+
+	if (exponent == 0)
+	{
+		if (mantissa == 0)
+		{
+			bits = sign;
+		}
+		else
+		{
+			// Denormal, renormalize.
+			exponent = 113;
+			while ((mantissa & 0x400u) == 0)
+			{
+				mantissa <<= 1;
+				exponent--;
+			}
+			mantissa &= 0x3ffu;
+			bits = sign | (exponent << 23) | (mantissa << 13);
+		}
+	}
+	else if (exponent == 31)
+		bits = sign | 0x7f800000u | (mantissa << 13);
+	else
+		bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+
+	float f;
+	memcpy(&f, &bits, sizeof(f));
+	return f;
+}
+
+static size_t convert_bgra8_simd(uint8_t *dst, const uint8_t *src, size_t count)
+{
+	size_t i = 0;
+#if defined(READBACK_SSE2)
+	const __m128i mask_ga = _mm_set1_epi32(int(0xff00ff00u));
+	const __m128i mask_b = _mm_set1_epi32(0xff);
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 4 * i));
+		__m128i ga = _mm_and_si128(v, mask_ga);
+		__m128i r = _mm_and_si128(_mm_srli_epi32(v, 16), mask_b);
+		__m128i b = _mm_slli_epi32(_mm_and_si128(v, mask_b), 16);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 4 * i), _mm_or_si128(ga, _mm_or_si128(r, b)));
+	}
+#elif defined(READBACK_NEON)
+	for (; i + 16 <= count; i += 16)
+	{
+		uint8x16x4_t v = vld4q_u8(src + 4 * i);
+		uint8x16_t tmp = v.val[0];
+		v.val[0] = v.val[2];
+		v.val[2] = tmp;
+		vst4q_u8(dst + 4 * i, v);
+	}
+#else
+	(void)dst;
+	(void)src;
+	(void)count;
+#endif
+	return i;
+}
+
+static void convert_bgra8(uint8_t *dst, const uint8_t *src, size_t count)
+{
+	for (size_t i = convert_bgra8_simd(dst, src, count); i < count; i++)
+	{
+		uint8_t b = src[4 * i + 0];
+		uint8_t g = src[4 * i + 1];
+		uint8_t r = src[4 * i + 2];
+		uint8_t a = src[4 * i + 3];
+		dst[4 * i + 0] = r;
+		dst[4 * i + 1] = g;
+		dst[4 * i + 2] = b;
+		dst[4 * i + 3] = a;
+	}
+}
+
+#if defined(READBACK_SSE2)
+// Four RGBA pixels in, 16 bytes out.
+static inline __m128i quantize_rgba32f_sse2(__m128 p0, __m128 p1, __m128 p2, __m128 p3)
+{
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 scale = _mm_set1_ps(255.0f);
+	const __m128 bias = _mm_set1_ps(0.5f);
+
+	// max(x, 0) returns 0 for NaN.
+	const auto q = [&](__m128 v) {
+		v = _mm_min_ps(_mm_max_ps(v, zero), one);
+		return _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(v, scale), bias));
+	};
+
+	__m128i lo = _mm_packs_epi32(q(p0), q(p1));
+	__m128i hi = _mm_packs_epi32(q(p2), q(p3));
+	return _mm_packus_epi16(lo, hi);
+}
+#elif defined(READBACK_NEON)
+static inline uint8x8_t quantize_rgba32f_neon(float32x4_t p0, float32x4_t p1)
+{
+	const float32x4_t zero = vdupq_n_f32(0.0f);
+	const float32x4_t one = vdupq_n_f32(1.0f);
+	const float32x4_t scale = vdupq_n_f32(255.0f);
+	const float32x4_t bias = vdupq_n_f32(0.5f);
+
+	// Out-of-range and NaN inputs saturate to 0 in the conversion.
+	p0 = vminq_f32(vmaxq_f32(p0, zero), one);
+	p1 = vminq_f32(vmaxq_f32(p1, zero), one);
+	uint32x4_t q0 = vcvtq_u32_f32(vmlaq_f32(bias, p0, scale));
+	uint32x4_t q1 = vcvtq_u32_f32(vmlaq_f32(bias, p1, scale));
+	return vmovn_u16(vcombine_u16(vmovn_u32(q0), vmovn_u32(q1)));
+}
+#endif
+
+static void convert_rgba32f(uint8_t *dst, const uint8_t *src, size_t count)
+{
+	size_t i = 0;
+#if defined(READBACK_SSE2)
+	for (; i + 4 <= count; i += 4)
+	{
+		auto *s = reinterpret_cast<const float *>(src + 16 * i);
+		__m128i v = quantize_rgba32f_sse2(_mm_loadu_ps(s + 0), _mm_loadu_ps(s + 4),
+		                                  _mm_loadu_ps(s + 8), _mm_loadu_ps(s + 12));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 4 * i), v);
+	}
+#elif defined(READBACK_NEON)
+	for (; i + 2 <= count; i += 2)
+	{
+		auto *s = reinterpret_cast<const float *>(src + 16 * i);
+		vst1_u8(dst + 4 * i, quantize_rgba32f_neon(vld1q_f32(s), vld1q_f32(s + 4)));
+	}
+#endif
+
+	for (; i < count; i++)
+	{
+		float rgba[4];
+		memcpy(rgba, src + 16 * i, sizeof(rgba));
+		for (unsigned c = 0; c < 4; c++)
+			dst[4 * i + c] = quantize_unorm8(rgba[c]);
+	}
+}
+
+static void convert_rgba16f(uint8_t *dst, const uint8_t *src, size_t count)
+{
+	size_t i = 0;
+#if defined(READBACK_F16C)
+	for (; i + 4 <= count; i += 4)
+	{
+		auto *s = reinterpret_cast<const __m128i *>(src + 8 * i);
+		__m128i h01 = _mm_loadu_si128(s + 0);
+		__m128i h23 = _mm_loadu_si128(s + 1);
+		__m128i v = quantize_rgba32f_sse2(_mm_cvtph_ps(h01), _mm_cvtph_ps(_mm_unpackhi_epi64(h01, h01)),
+		                                  _mm_cvtph_ps(h23), _mm_cvtph_ps(_mm_unpackhi_epi64(h23, h23)));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 4 * i), v);
+	}
+#elif defined(READBACK_NEON) && defined(__aarch64__)
+	for (; i + 2 <= count; i += 2)
+	{
+		float16x8_t h = vreinterpretq_f16_u16(vld1q_u16(reinterpret_cast<const uint16_t *>(src + 8 * i)));
+		vst1_u8(dst + 4 * i, quantize_rgba32f_neon(vcvt_f32_f16(vget_low_f16(h)), vcvt_high_f32_f16(h)));
+	}
+#endif
+
+	for (; i < count; i++)
+	{
+		uint16_t rgba[4];
+		memcpy(rgba, src + 8 * i, sizeof(rgba));
+		for (unsigned c = 0; c < 4; c++)
+			dst[4 * i + c] = quantize_unorm8(half_to_float(rgba[c]));
+	}
+}
+
+static void convert_a2b10g10r10(uint8_t *dst, const uint8_t *src, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		uint32_t v;
+		memcpy(&v, src + 4 * i, sizeof(v));
+		uint32_t r = v & 0x3ffu;
+		uint32_t g = (v >> 10) & 0x3ffu;
+		uint32_t b = (v >> 20) & 0x3ffu;
+		uint32_t a = v >> 30;
+		dst[4 * i + 0] = uint8_t((r * 255u + 511u) / 1023u);
+		dst[4 * i + 1] = uint8_t((g * 255u + 511u) / 1023u);
+		dst[4 * i + 2] = uint8_t((b * 255u + 511u) / 1023u);
+		dst[4 * i + 3] = uint8_t(a * 85u);
+	}
+}
+
+static bool supports_rgba8_conversion(VkFormat format)
+{
+	switch (format)
+	{
+	case VK_FORMAT_R8G8B8A8_UNORM:
+	case VK_FORMAT_R8G8B8A8_SRGB:
+	case VK_FORMAT_B8G8R8A8_UNORM:
+	case VK_FORMAT_B8G8R8A8_SRGB:
+	case VK_FORMAT_A2B10G10R10_UNORM_PACK32:
+	case VK_FORMAT_R16G16B16A16_SFLOAT:
+	case VK_FORMAT_R32G32B32A32_SFLOAT:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+bool convert_readback_to_rgba8(uint8_t *dst, const void *src_, size_t count, VkFormat format)
+{
+	// All conversions write at most as many bytes per pixel as they read, and every pixel (or SIMD block)
+	// is loaded before it is stored, so dst == src works.
+	auto *src = static_cast<const uint8_t *>(src_);
+
+	switch (format)
+	{
+	case VK_FORMAT_R8G8B8A8_UNORM:
+	case VK_FORMAT_R8G8B8A8_SRGB:
+		if (dst != src)
+			memmove(dst, src, count * 4);
+		return true;
+
+	case VK_FORMAT_B8G8R8A8_UNORM:
+	case VK_FORMAT_B8G8R8A8_SRGB:
+		convert_bgra8(dst, src, count);
+		return true;
+
+	case VK_FORMAT_A2B10G10R10_UNORM_PACK32:
+		convert_a2b10g10r10(dst, src, count);
+		return true;
+
+	case VK_FORMAT_R16G16B16A16_SFLOAT:
+		convert_rgba16f(dst, src, count);
+		return true;
+
+	case VK_FORMAT_R32G32B32A32_SFLOAT:
+		convert_rgba32f(dst, src, count);
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+Readback::Readback(ReadbackManager *manager_)
+	: manager(manager_), ready(false)
+{
+}
+
+Readback::~Readback()
+{
+	if (buffer)
+		manager->recycle_staging(std::move(buffer));
+}
+
+void Readback::wait() const
+{
+	if (is_ready())
+		return;
+
+	std::unique_lock<std::mutex> holder{lock};
+	cond.wait(holder, [this]() { return is_ready(); });
+}
+
+void ReadbackManager::init(Device *device_)
+{
+	device = device_;
+}
+
+void ReadbackManager::teardown()
+{
+	std::lock_guard<std::mutex> holder{lock};
+	for (auto &bucket : pool)
+		bucket.clear();
+}
+
+static unsigned staging_bucket(VkDeviceSize size)
+{
+	// 64 KiB minimum so small readbacks such as GPU picking share buffers.
+	unsigned bucket = 16;
+	while ((VkDeviceSize(1) << bucket) < size)
+		bucket++;
+	return bucket;
+}
+
+BufferHandle ReadbackManager::request_staging(VkDeviceSize size)
+{
+	unsigned bucket = staging_bucket(size);
+
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		if (!pool[bucket].empty())
+		{
+			auto buffer = std::move(pool[bucket].back());
+			pool[bucket].pop_back();
+			return buffer;
+		}
+	}
+
+	BufferCreateInfo info;
+	info.domain = BufferDomain::CachedHost;
+	info.size = VkDeviceSize(1) << bucket;
+	info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	auto buffer = device->create_buffer(info);
+	if (buffer)
+		device->set_name(*buffer, "readback-staging");
+	return buffer;
+}
+
+void ReadbackManager::recycle_staging(BufferHandle buffer)
+{
+	// Keep a few buffers per size class around, readbacks tend to repeat.
+	constexpr size_t MaxRetainedPerBucket = 4;
+	unsigned bucket = staging_bucket(buffer->get_create_info().size);
+	std::lock_guard<std::mutex> holder{lock};
+	if (pool[bucket].size() < MaxRetainedPerBucket)
+		pool[bucket].push_back(std::move(buffer));
+}
+
+CommandBufferHandle ReadbackManager::begin_copy(CommandBuffer::Type src_queue, bool shareable,
+                                                CommandBuffer::Type &copy_queue)
+{
+	auto src_physical = device->get_physical_queue_type(src_queue);
+	auto transfer_physical = device->get_physical_queue_type(CommandBuffer::Type::AsyncTransfer);
+
+	if (src_physical == transfer_physical)
+	{
+		// Same VkQueue, the barrier in the copy command buffer orders against earlier submissions.
+		copy_queue = CommandBuffer::Type::AsyncTransfer;
+	}
+	else if (shareable)
+	{
+		// Signal a semaphore after everything submitted to src_queue so far.
+		Semaphore sem;
+		auto marker = device->request_command_buffer(src_queue);
+		device->submit(marker, nullptr, 1, &sem);
+		device->add_wait_semaphore(CommandBuffer::Type::AsyncTransfer, std::move(sem),
+		                           VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, true);
+		copy_queue = CommandBuffer::Type::AsyncTransfer;
+	}
+	else
+	{
+		// Exclusive ownership, copy on the source queue instead.
+		copy_queue = src_queue;
+	}
+
+	return device->request_command_buffer(copy_queue);
+}
+
+void ReadbackManager::end_copy(CommandBufferHandle &cmd, CommandBuffer::Type src_queue,
+                               CommandBuffer::Type copy_queue, ReadbackHandle readback)
+{
+	cmd->barrier(VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+	             VK_PIPELINE_STAGE_2_HOST_BIT, VK_ACCESS_2_HOST_READ_BIT);
+
+	if (device->get_physical_queue_type(src_queue) != device->get_physical_queue_type(copy_queue))
+	{
+		// Later writes on the source queue must not race with the copy.
+		Semaphore sem;
+		device->submit(cmd, nullptr, 1, &sem);
+		device->add_wait_semaphore(src_queue, std::move(sem), VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, true);
+	}
+	else
+		device->submit(cmd);
+
+	device->add_completion_callback(copy_queue, [this, readback]() {
+		resolve(*readback);
+	});
+}
+
+void ReadbackManager::resolve(Readback &readback)
+{
+	auto *mapped = static_cast<uint8_t *>(device->map_host_buffer(*readback.buffer, MEMORY_ACCESS_READ_BIT));
+
+	if (mapped && readback.conversion == ReadbackConversion::RGBA8)
+	{
+		size_t count = size_t(readback.width) * readback.height;
+		convert_readback_to_rgba8(mapped, mapped, count, readback.src_format);
+		readback.size = count * 4;
+		readback.row_pitch = size_t(readback.width) * 4;
+		// Flush the in-place conversion so that dirty lines cannot clobber the next GPU copy into this buffer.
+		device->unmap_host_buffer(*readback.buffer, MEMORY_ACCESS_WRITE_BIT);
+	}
+
+	if (!mapped)
+		LOGE("Failed to map readback buffer.\n");
+
+	readback.data = mapped;
+	std::lock_guard<std::mutex> holder{readback.lock};
+	readback.ready.store(true, std::memory_order_release);
+	readback.cond.notify_all();
+}
+
+ReadbackHandle ReadbackManager::read_buffer(CommandBuffer::Type src_queue, const Buffer &buffer,
+                                            VkDeviceSize offset, VkDeviceSize size)
+{
+	ReadbackHandle readback(new Readback(this));
+	readback->buffer = request_staging(size);
+	if (!readback->buffer)
+		return {};
+	readback->size = size_t(size);
+
+	// Buffers are created with concurrent sharing.
+	CommandBuffer::Type copy_queue;
+	auto cmd = begin_copy(src_queue, true, copy_queue);
+	cmd->barrier(VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_MEMORY_WRITE_BIT,
+	             VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_READ_BIT);
+	cmd->copy_buffer(*readback->buffer, 0, buffer, offset, size);
+	end_copy(cmd, src_queue, copy_queue, readback);
+	return readback;
+}
+
+ReadbackHandle ReadbackManager::read_image(CommandBuffer::Type src_queue, const Image &image, VkImageLayout layout,
+                                           const VkImageSubresourceLayers &subresource,
+                                           ReadbackConversion conversion)
+{
+	VkFormat format = image.get_format();
+	uint32_t block_width, block_height;
+	TextureFormatLayout::format_block_dim(format, block_width, block_height);
+	if (block_width != 1 || block_height != 1 || subresource.layerCount != 1 ||
+	    Util::popcount32(subresource.aspectMask) != 1)
+	{
+		LOGE("Image readback requires an uncompressed format and a single layer and aspect.\n");
+		return {};
+	}
+
+	if (conversion == ReadbackConversion::RGBA8 && !supports_rgba8_conversion(format))
+	{
+		LOGE("Format %u cannot be converted to RGBA8.\n", unsigned(format));
+		return {};
+	}
+
+	ReadbackHandle readback(new Readback(this));
+	readback->width = image.get_width(subresource.mipLevel);
+	readback->height = image.get_height(subresource.mipLevel);
+	readback->row_pitch = size_t(readback->width) *
+	                      TextureFormatLayout::format_block_size(format, subresource.aspectMask);
+	readback->size = readback->row_pitch * readback->height;
+	readback->src_format = format;
+	readback->conversion = conversion;
+	readback->format = conversion == ReadbackConversion::RGBA8 ? VK_FORMAT_R8G8B8A8_UNORM : format;
+	readback->buffer = request_staging(readback->size);
+	if (!readback->buffer)
+		return {};
+
+	auto &queue_info = device->get_queue_info();
+	bool shareable =
+			(image.get_create_info().misc & IMAGE_MISC_CONCURRENT_QUEUE_ASYNC_TRANSFER_BIT) != 0 ||
+			queue_info.family_indices[device->get_physical_queue_type(src_queue)] ==
+			queue_info.family_indices[device->get_physical_queue_type(CommandBuffer::Type::AsyncTransfer)];
+
+	CommandBuffer::Type copy_queue;
+	auto cmd = begin_copy(src_queue, shareable, copy_queue);
+
+	VkImageLayout transfer_layout = image.get_layout(VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+	bool transition = layout != transfer_layout;
+
+	if (transition)
+	{
+		cmd->image_barrier(image, layout, transfer_layout,
+		                   VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_MEMORY_WRITE_BIT,
+		                   VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_READ_BIT);
+	}
+	else
+	{
+		cmd->barrier(VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_MEMORY_WRITE_BIT,
+		             VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_READ_BIT);
+	}
+
+	cmd->copy_image_to_buffer(*readback->buffer, image, 0, {}, { readback->width, readback->height, 1 },
+	                          0, 0, subresource);
+
+	if (transition)
+	{
+		cmd->image_barrier(image, transfer_layout, layout,
+		                   VK_PIPELINE_STAGE_2_COPY_BIT, 0,
+		                   VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, 0);
+	}
+
+	end_copy(cmd, src_queue, copy_queue, readback);
+	return readback;
+}
+}
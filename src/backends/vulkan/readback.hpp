@@ -0,0 +1,156 @@
+/* Copyright (c) 2017-2026 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "vulkan_common.hpp"
+#include "buffer.hpp"
+#include "image.hpp"
+#include "command_buffer.hpp"
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+namespace Vulkan
+{
+class Device;
+class ReadbackManager;
+
+enum class ReadbackConversion
+{
+	None,
+	// Packs to tightly packed R8G8B8A8 on the CPU. Float formats are clamped to [0, 1] and quantized as-is,
+	// no color space conversion takes place.
+	// Supported for RGBA8, BGRA8, A2B10G10R10, RGBA16F and RGBA32F sources.
+	RGBA8
+};
+
+class Readback : public Util::IntrusivePtrEnabled<Readback, std::default_delete<Readback>, HandleCounter>
+{
+public:
+	~Readback();
+
+	// Non-blocking.
+	inline bool is_ready() const
+	{
+		return ready.load(std::memory_order_acquire);
+	}
+
+	// Without timeline semaphore support, readbacks resolve when the frame context is recycled,
+	// so this must not be called on the thread which drives frame contexts in that case.
+	void wait() const;
+
+	// nullptr until is_ready().
+	inline const void *get_data() const
+	{
+		return is_ready() ? data : nullptr;
+	}
+
+	inline size_t get_size() const
+	{
+		return size;
+	}
+
+	// Only meaningful for image readbacks. Rows are tightly packed.
+	inline unsigned get_width() const
+	{
+		return width;
+	}
+
+	inline unsigned get_height() const
+	{
+		return height;
+	}
+
+	inline size_t get_row_pitch() const
+	{
+		return row_pitch;
+	}
+
+	// After conversion, if any.
+	inline VkFormat get_format() const
+	{
+		return format;
+	}
+
+private:
+	friend class ReadbackManager;
+	explicit Readback(ReadbackManager *manager);
+
+	ReadbackManager *manager;
+	BufferHandle buffer;
+	const void *data = nullptr;
+	size_t size = 0;
+	size_t row_pitch = 0;
+	unsigned width = 0;
+	unsigned height = 0;
+	VkFormat format = VK_FORMAT_UNDEFINED;
+	VkFormat src_format = VK_FORMAT_UNDEFINED;
+	ReadbackConversion conversion = ReadbackConversion::None;
+
+	std::atomic_bool ready;
+	mutable std::mutex lock;
+	mutable std::condition_variable cond;
+};
+using ReadbackHandle = Util::IntrusivePtr<Readback>;
+
+// Asynchronous readbacks into pooled, host cached staging buffers.
+// The copy is recorded on the async transfer queue, and the handle resolves from the device's
+// completion thread once the copy completes. Optional format conversion also runs there.
+// Work which produced the data must have been submitted to src_queue before the readback is requested.
+// Work submitted to src_queue afterwards waits for the copy, so the readback observes a consistent snapshot.
+class ReadbackManager
+{
+public:
+	void init(Device *device);
+	void teardown();
+
+	ReadbackHandle read_buffer(CommandBuffer::Type src_queue, const Buffer &buffer,
+	                           VkDeviceSize offset, VkDeviceSize size);
+
+	// layout is the layout the image is in, and is restored after the copy.
+	ReadbackHandle read_image(CommandBuffer::Type src_queue, const Image &image, VkImageLayout layout,
+	                          const VkImageSubresourceLayers &subresource,
+	                          ReadbackConversion conversion = ReadbackConversion::None);
+
+private:
+	friend class Readback;
+	Device *device = nullptr;
+
+	std::mutex lock;
+	// Staging buffers, bucketed by power-of-two size.
+	std::vector<BufferHandle> pool[64];
+
+	BufferHandle request_staging(VkDeviceSize size);
+	void recycle_staging(BufferHandle buffer);
+
+	CommandBufferHandle begin_copy(CommandBuffer::Type src_queue, bool shareable, CommandBuffer::Type &copy_queue);
+	void end_copy(CommandBufferHandle &cmd, CommandBuffer::Type src_queue, CommandBuffer::Type copy_queue,
+	              ReadbackHandle readback);
+	void resolve(Readback &readback);
+};
+
+// CPU conversion to tightly packed RGBA8, used by ReadbackConversion::RGBA8. Works in-place if dst == src.
+// Returns false if the format is not supported.
+bool convert_readback_to_rgba8(uint8_t *dst, const void *src, size_t count, VkFormat format);
+}
@@ -34,6 +34,60 @@ using namespace Util;
 
 namespace Vulkan
 {
+static VkAttachmentLoadOp get_color_load_op(const RenderPassInfo &info, unsigned index)
+{
+	if ((info.clear_attachments & (1u << index)) != 0)
+		return VK_ATTACHMENT_LOAD_OP_CLEAR;
+	else if ((info.load_attachments & (1u << index)) != 0)
+		return VK_ATTACHMENT_LOAD_OP_LOAD;
+	else
+		return VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+}
+
+static VkAttachmentStoreOp get_color_store_op(const RenderPassInfo &info, unsigned index)
+{
+	if ((info.store_attachments & (1u << index)) != 0)
+		return VK_ATTACHMENT_STORE_OP_STORE;
+	else
+		return VK_ATTACHMENT_STORE_OP_DONT_CARE;
+}
+
+static void get_depth_stencil_ops(const Device &device, const RenderPassInfo &info,
+                                  VkAttachmentLoadOp &ds_load_op, VkAttachmentStoreOp &ds_store_op)
+{
+	ds_load_op = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	ds_store_op = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+
+	if (info.op_flags & RENDER_PASS_OP_CLEAR_DEPTH_STENCIL_BIT)
+		ds_load_op = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	else if (info.op_flags & RENDER_PASS_OP_LOAD_DEPTH_STENCIL_BIT)
+		ds_load_op = VK_ATTACHMENT_LOAD_OP_LOAD;
+
+	if (info.op_flags & RENDER_PASS_OP_STORE_DEPTH_STENCIL_BIT)
+	{
+		ds_store_op = VK_ATTACHMENT_STORE_OP_STORE;
+	}
+	else if (info.op_flags & RENDER_PASS_OP_PRESERVE_DEPTH_STENCIL_BIT)
+	{
+		ds_store_op = device.get_device_features().supports_store_op_none ?
+		              VK_ATTACHMENT_STORE_OP_NONE : VK_ATTACHMENT_STORE_OP_STORE;
+
+		if (ds_load_op != VK_ATTACHMENT_LOAD_OP_LOAD)
+			ds_store_op = VK_ATTACHMENT_STORE_OP_STORE;
+	}
+}
+
+static void get_default_subpass(const RenderPassInfo &info, RenderPassInfo::Subpass &subpass)
+{
+	subpass.num_color_attachments = info.num_color_attachments;
+	if (info.op_flags & RENDER_PASS_OP_DEPTH_STENCIL_READ_ONLY_BIT)
+		subpass.depth_stencil_mode = RenderPassInfo::DepthStencil::ReadOnly;
+	else
+		subpass.depth_stencil_mode = RenderPassInfo::DepthStencil::ReadWrite;
+	for (unsigned i = 0; i < info.num_color_attachments; i++)
+		subpass.color_attachments[i] = i;
+}
+
 void RenderPass::setup_subpasses(const VkRenderPassCreateInfo2 &create_info)
 {
 	auto *attachments = create_info.pAttachments;
@@ -102,6 +156,8 @@ RenderPass::RenderPass(Hash hash, Device *device_, const VkRenderPassCreateInfo2
 	// Store the important subpass information for later.
 	setup_subpasses(create_info);
 
+	pipeline_compatibility_hash = get_hash();
+
 #ifdef VULKAN_DEBUG
 	LOGI("Creating render pass.\n");
 #endif
@@ -132,14 +188,7 @@ RenderPass::RenderPass(Hash hash, Device *device_, const RenderPassInfo &info)
 	RenderPassInfo::Subpass default_subpass_info;
 	if (!info.subpasses)
 	{
-		default_subpass_info.num_color_attachments = info.num_color_attachments;
-		if (info.op_flags & RENDER_PASS_OP_DEPTH_STENCIL_READ_ONLY_BIT)
-			default_subpass_info.depth_stencil_mode = RenderPassInfo::DepthStencil::ReadOnly;
-		else
-			default_subpass_info.depth_stencil_mode = RenderPassInfo::DepthStencil::ReadWrite;
-
-		for (unsigned i = 0; i < info.num_color_attachments; i++)
-			default_subpass_info.color_attachments[i] = i;
+		get_default_subpass(info, default_subpass_info);
 		num_subpasses = 1;
 		subpass_infos = &default_subpass_info;
 	}
@@ -155,39 +204,15 @@ RenderPass::RenderPass(Hash hash, Device *device_, const RenderPassInfo &info)
 
 	VK_ASSERT(!(info.clear_attachments & info.load_attachments));
 
-	const auto color_load_op = [&info](unsigned index) -> VkAttachmentLoadOp {
-		if ((info.clear_attachments & (1u << index)) != 0)
-			return VK_ATTACHMENT_LOAD_OP_CLEAR;
-		else if ((info.load_attachments & (1u << index)) != 0)
-			return VK_ATTACHMENT_LOAD_OP_LOAD;
-		else
-			return VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	const auto color_load_op = [&info](unsigned index) {
+		return get_color_load_op(info, index);
 	};
 
-	const auto color_store_op = [&info](unsigned index) -> VkAttachmentStoreOp {
-		if ((info.store_attachments & (1u << index)) != 0)
-			return VK_ATTACHMENT_STORE_OP_STORE;
-		else
-			return VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	const auto color_store_op = [&info](unsigned index) {
+		return get_color_store_op(info, index);
 	};
 
-	if (info.op_flags & RENDER_PASS_OP_CLEAR_DEPTH_STENCIL_BIT)
-		ds_load_op = VK_ATTACHMENT_LOAD_OP_CLEAR;
-	else if (info.op_flags & RENDER_PASS_OP_LOAD_DEPTH_STENCIL_BIT)
-		ds_load_op = VK_ATTACHMENT_LOAD_OP_LOAD;
-
-	if (info.op_flags & RENDER_PASS_OP_STORE_DEPTH_STENCIL_BIT)
-	{
-		ds_store_op = VK_ATTACHMENT_STORE_OP_STORE;
-	}
-	else if (info.op_flags & RENDER_PASS_OP_PRESERVE_DEPTH_STENCIL_BIT)
-	{
-		ds_store_op = device->get_device_features().supports_store_op_none ?
-		              VK_ATTACHMENT_STORE_OP_NONE : VK_ATTACHMENT_STORE_OP_STORE;
-
-		if (ds_load_op != VK_ATTACHMENT_LOAD_OP_LOAD)
-			ds_store_op = VK_ATTACHMENT_STORE_OP_STORE;
-	}
+	get_depth_stencil_ops(*device, info, ds_load_op, ds_store_op);
 
 	bool ds_read_only = (info.op_flags & RENDER_PASS_OP_DEPTH_STENCIL_READ_ONLY_BIT) != 0;
 	VkImageLayout depth_stencil_layout = VK_IMAGE_LAYOUT_UNDEFINED;
@@ -825,6 +850,17 @@ RenderPass::RenderPass(Hash hash, Device *device_, const RenderPassInfo &info)
 	// Store the important subpass information for later.
 	setup_subpasses(rp_info);
 
+	// Input attachments would need dynamic rendering local read, so those passes keep using VkRenderPass.
+	// Subpass count and input attachment count are part of the compatibility hash, so this choice is stable.
+	if (num_subpasses == 1 && subpass_infos[0].num_input_attachments == 0 &&
+	    device->get_device_features().vk13_features.dynamicRendering)
+	{
+		setup_rendering_info(info, subpass_infos[0]);
+		return;
+	}
+
+	pipeline_compatibility_hash = get_hash();
+
 #ifdef VULKAN_DEBUG
 	LOGI("Creating render pass.\n");
 #endif
@@ -837,6 +873,277 @@ RenderPass::RenderPass(Hash hash, Device *device_, const RenderPassInfo &info)
 #endif
 }
 
+void RenderPass::setup_rendering_info(const RenderPassInfo &info, const RenderPassInfo::Subpass &subpass)
+{
+	dynamic_rendering = true;
+
+	for (unsigned i = 0; i < subpass.num_color_attachments; i++)
+	{
+		uint32_t att = subpass.color_attachments[i];
+		rendering_color_formats[i] = att != VK_ATTACHMENT_UNUSED ? color_attachments[att] : VK_FORMAT_UNDEFINED;
+	}
+
+	rendering_info.colorAttachmentCount = subpass.num_color_attachments;
+	rendering_info.pColorAttachmentFormats = rendering_color_formats;
+	if (has_depth(0))
+		rendering_info.depthAttachmentFormat = depth_stencil;
+	if (has_stencil(0))
+		rendering_info.stencilAttachmentFormat = depth_stencil;
+	if (info.num_layers > 1 && device->get_device_features().vk11_features.multiview)
+		rendering_info.viewMask = ((1u << info.num_layers) - 1u) << info.base_layer;
+
+	// Pipelines only care about formats, sample count and view mask, not load/store or layouts.
+	Hasher h;
+	h.data(rendering_color_formats, subpass.num_color_attachments * sizeof(VkFormat));
+	h.u32(subpass.num_color_attachments);
+	h.u32(rendering_info.depthAttachmentFormat);
+	h.u32(rendering_info.stencilAttachmentFormat);
+	h.u32(rendering_info.viewMask);
+	h.u32(get_sample_count(0));
+	// Marked for dynamic rendering.
+	h.u32(3);
+	pipeline_compatibility_hash = h.get();
+}
+
+static VkImageSubresourceRange get_attachment_range(const RenderPassInfo &info, const ImageView &view)
+{
+	auto &view_info = view.get_create_info();
+	VkImageSubresourceRange range = {};
+	range.aspectMask = format_to_aspect_mask(view.get_format());
+	range.baseMipLevel = view_info.base_level;
+	range.levelCount = 1;
+	range.baseArrayLayer = view_info.base_layer;
+
+	// Transient images only have one layer, and multiview renders to all layers of the view.
+	if (view.get_image().get_create_info().domain == ImageDomain::Transient || info.num_layers > 1)
+	{
+		range.layerCount = view_info.layers;
+	}
+	else
+	{
+		range.baseArrayLayer += info.base_layer;
+		range.layerCount = 1;
+	}
+
+	return range;
+}
+
+static VkImageView get_attachment_view(const RenderPassInfo &info, const ImageView &view)
+{
+	// For multiview, we use view indices to pick right layers.
+	if (info.num_layers > 1)
+		return view.get_view().view;
+	else
+		return view.get_render_target_view(info.base_layer).view;
+}
+
+void RenderPass::setup_dynamic_rendering(const RenderPassInfo &info, DynamicRenderingState &state) const
+{
+	VK_ASSERT(dynamic_rendering);
+	VK_ASSERT(!(info.clear_attachments & info.load_attachments));
+
+	bool enable_transient_store = (info.op_flags & RENDER_PASS_OP_ENABLE_TRANSIENT_STORE_BIT) != 0;
+	bool enable_transient_load = (info.op_flags & RENDER_PASS_OP_ENABLE_TRANSIENT_LOAD_BIT) != 0;
+
+	RenderPassInfo::Subpass default_subpass_info;
+	const RenderPassInfo::Subpass *subpass = info.subpasses;
+	if (!subpass)
+	{
+		get_default_subpass(info, default_subpass_info);
+		subpass = &default_subpass_info;
+	}
+
+	state.num_begin_barriers = 0;
+	state.num_end_barriers = 0;
+
+	// Transitions which VkRenderPass would have done through initialLayout/finalLayout and external dependencies.
+	const auto add_barrier = [&](VkImageMemoryBarrier2 *barriers, unsigned &count, const ImageView &view,
+	                             VkImageLayout old_layout, VkImageLayout new_layout,
+	                             VkPipelineStageFlags2 src_stages, VkAccessFlags2 src_access,
+	                             VkPipelineStageFlags2 dst_stages, VkAccessFlags2 dst_access) {
+		auto &b = barriers[count++];
+		b = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2 };
+		b.image = view.get_image().get_image();
+		b.subresourceRange = get_attachment_range(info, view);
+		b.oldLayout = old_layout;
+		b.newLayout = new_layout;
+		b.srcStageMask = src_stages;
+		b.srcAccessMask = src_access;
+		b.dstStageMask = dst_stages;
+		b.dstAccessMask = dst_access;
+		b.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		b.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	};
+
+	// Returns the layout the color attachment is rendered in.
+	const auto setup_color_layout = [&](unsigned index, VkAttachmentLoadOp load_op) -> VkImageLayout {
+		auto &view = *info.color_attachments[index];
+		auto &image = view.get_image();
+		VkImageLayout initial_layout;
+		bool implicit = false;
+
+		if (image.get_create_info().domain == ImageDomain::Transient)
+		{
+			if (enable_transient_load)
+				initial_layout = image.get_layout(VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL);
+			else
+				initial_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+			implicit = true;
+		}
+		else if (image.is_swapchain_image())
+		{
+			initial_layout = load_op == VK_ATTACHMENT_LOAD_OP_LOAD ?
+			                 image.get_swapchain_layout() : VK_IMAGE_LAYOUT_UNDEFINED;
+			implicit = true;
+		}
+		else
+			initial_layout = image.get_layout(VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL);
+
+		VkImageLayout layout = initial_layout == VK_IMAGE_LAYOUT_GENERAL ?
+		                       VK_IMAGE_LAYOUT_GENERAL : VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL;
+
+		if (implicit || initial_layout != layout)
+		{
+			// Transitioning away from PRESENT_SRC_KHR must wait for BOTTOM_OF_PIPE.
+			VkPipelineStageFlags2 src_stages = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
+			if (image.is_swapchain_image() && load_op == VK_ATTACHMENT_LOAD_OP_LOAD)
+				src_stages |= VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT;
+
+			add_barrier(state.begin_barriers, state.num_begin_barriers, view, initial_layout, layout,
+			            src_stages, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+			            VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+			            VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT);
+		}
+
+		if (image.is_swapchain_image())
+		{
+			add_barrier(state.end_barriers, state.num_end_barriers, view, layout, image.get_swapchain_layout(),
+			            VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+			            VK_PIPELINE_STAGE_2_NONE, 0);
+		}
+
+		return layout;
+	};
+
+	const auto is_transient = [](const ImageView &view) {
+		return view.get_image().get_create_info().domain == ImageDomain::Transient;
+	};
+
+	for (unsigned i = 0; i < subpass->num_color_attachments; i++)
+	{
+		auto &att = state.color_attachments[i];
+		att = { VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO };
+
+		uint32_t index = subpass->color_attachments[i];
+		if (index == VK_ATTACHMENT_UNUSED)
+			continue;
+
+		VK_ASSERT(index < info.num_color_attachments && info.color_attachments[index]);
+		auto &view = *info.color_attachments[index];
+
+		att.imageView = get_attachment_view(info, view);
+		att.loadOp = get_color_load_op(info, index);
+		att.storeOp = get_color_store_op(info, index);
+		att.clearValue.color = info.clear_color[index];
+
+		if (is_transient(view))
+		{
+			if (!enable_transient_load)
+			{
+				// Force a clean discard.
+				VK_ASSERT(att.loadOp != VK_ATTACHMENT_LOAD_OP_LOAD);
+			}
+
+			if (!enable_transient_store)
+				att.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		}
+
+		att.imageLayout = setup_color_layout(index, att.loadOp);
+
+		if (i < subpass->num_resolve_attachments && subpass->resolve_attachments[i] != VK_ATTACHMENT_UNUSED)
+		{
+			uint32_t resolve_index = subpass->resolve_attachments[i];
+			VK_ASSERT(resolve_index < info.num_color_attachments && info.color_attachments[resolve_index]);
+			auto &resolve_view = *info.color_attachments[resolve_index];
+
+			att.resolveMode = format_is_integer(view.get_format()) ?
+			                  VK_RESOLVE_MODE_SAMPLE_ZERO_BIT : VK_RESOLVE_MODE_AVERAGE_BIT;
+			att.resolveImageView = get_attachment_view(info, resolve_view);
+			att.resolveImageLayout = setup_color_layout(resolve_index, get_color_load_op(info, resolve_index));
+		}
+	}
+
+	state.depth_attachment = { VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO };
+	state.stencil_attachment = { VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO };
+
+	if (info.depth_stencil && subpass->depth_stencil_mode != RenderPassInfo::DepthStencil::None)
+	{
+		auto &view = *info.depth_stencil;
+		auto &image = view.get_image();
+		bool ds_read_only = (info.op_flags & RENDER_PASS_OP_DEPTH_STENCIL_READ_ONLY_BIT) != 0;
+
+		VkAttachmentLoadOp ds_load_op;
+		VkAttachmentStoreOp ds_store_op;
+		get_depth_stencil_ops(*device, info, ds_load_op, ds_store_op);
+
+		VkImageLayout initial_layout = image.get_layout(
+				ds_read_only ? VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL);
+
+		if (is_transient(view))
+		{
+			if (!enable_transient_load)
+			{
+				if (ds_load_op == VK_ATTACHMENT_LOAD_OP_LOAD)
+					ds_load_op = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+				// For transient attachments we force the layouts.
+				initial_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+			}
+
+			if (!enable_transient_store)
+				ds_store_op = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		}
+
+		VkImageLayout layout;
+		if (initial_layout == VK_IMAGE_LAYOUT_GENERAL)
+			layout = VK_IMAGE_LAYOUT_GENERAL;
+		else if (subpass->depth_stencil_mode == RenderPassInfo::DepthStencil::ReadWrite)
+			layout = VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL;
+		else
+			layout = VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL;
+
+		if (is_transient(view) || initial_layout != layout)
+		{
+			add_barrier(state.begin_barriers, state.num_begin_barriers, view, initial_layout, layout,
+			            VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+			            VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+			            VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+			            VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT);
+		}
+
+		VkRenderingAttachmentInfo ds = { VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO };
+		ds.imageView = get_attachment_view(info, view);
+		ds.imageLayout = layout;
+		ds.loadOp = ds_load_op;
+		ds.storeOp = ds_store_op;
+		ds.clearValue.depthStencil = info.clear_depth_stencil;
+
+		if (has_depth(0))
+			state.depth_attachment = ds;
+		if (has_stencil(0))
+			state.stencil_attachment = ds;
+	}
+
+	state.info = { VK_STRUCTURE_TYPE_RENDERING_INFO };
+	state.info.layerCount = 1;
+	state.info.viewMask = rendering_info.viewMask;
+	state.info.colorAttachmentCount = subpass->num_color_attachments;
+	state.info.pColorAttachments = state.color_attachments;
+	if (has_depth(0))
+		state.info.pDepthAttachment = &state.depth_attachment;
+	if (has_stencil(0))
+		state.info.pStencilAttachment = &state.stencil_attachment;
+}
+
 RenderPass::~RenderPass()
 {
 	auto &table = device->get_device_table();
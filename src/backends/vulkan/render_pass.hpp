@@ -86,6 +86,21 @@ struct RenderPassInfo
 	unsigned num_subpasses = 0;
 };
 
+// Everything needed to begin a single-subpass render pass with vkCmdBeginRendering.
+// Layout transitions which VkRenderPass would perform implicitly are expressed as barriers.
+struct DynamicRenderingState
+{
+	VkRenderingInfo info;
+	VkRenderingAttachmentInfo color_attachments[VULKAN_NUM_ATTACHMENTS];
+	VkRenderingAttachmentInfo depth_attachment;
+	VkRenderingAttachmentInfo stencil_attachment;
+
+	VkImageMemoryBarrier2 begin_barriers[2 * VULKAN_NUM_ATTACHMENTS + 1];
+	VkImageMemoryBarrier2 end_barriers[2 * VULKAN_NUM_ATTACHMENTS];
+	unsigned num_begin_barriers;
+	unsigned num_end_barriers;
+};
+
 class RenderPass : public HashedObject<RenderPass>, public NoCopyNoMove
 {
 public:
@@ -160,15 +175,42 @@ public:
 		       format_has_stencil_aspect(depth_stencil);
 	}
 
+	// Single-subpass passes without input attachments are begun with vkCmdBeginRendering if supported.
+	// No VkRenderPass or VkFramebuffer is created for them.
+	bool uses_dynamic_rendering() const
+	{
+		return dynamic_rendering;
+	}
+
+	// Pipelines are keyed by this hash. For dynamic rendering, it only covers attachment formats.
+	Util::Hash get_pipeline_compatibility_hash() const
+	{
+		return pipeline_compatibility_hash;
+	}
+
+	const VkPipelineRenderingCreateInfo &get_pipeline_rendering_info() const
+	{
+		VK_ASSERT(dynamic_rendering);
+		return rendering_info;
+	}
+
+	// info must be compatible with the info this render pass was created from.
+	void setup_dynamic_rendering(const RenderPassInfo &info, DynamicRenderingState &state) const;
+
 private:
 	Device *device;
 	VkRenderPass render_pass = VK_NULL_HANDLE;
+	Util::Hash pipeline_compatibility_hash = 0;
+	bool dynamic_rendering = false;
+	VkPipelineRenderingCreateInfo rendering_info = { VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO };
+	VkFormat rendering_color_formats[VULKAN_NUM_ATTACHMENTS] = {};
 
 	VkFormat color_attachments[VULKAN_NUM_ATTACHMENTS] = {};
 	VkFormat depth_stencil = VK_FORMAT_UNDEFINED;
 	std::vector<SubpassInfo> subpasses_info;
 
 	void setup_subpasses(const VkRenderPassCreateInfo2 &create_info);
+	void setup_rendering_info(const RenderPassInfo &info, const RenderPassInfo::Subpass &subpass);
 };
 
 class Framebuffer : public Cookie, public NoCopyNoMove, public InternalSyncEnabled
@@ -0,0 +1,428 @@
+/* Copyright (c) 2017-2026 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "render_queue.hpp"
+#include "command_buffer.hpp"
+#include "thread_id.hpp"
+#include <string.h>
+#include <algorithm>
+#ifdef GRANITE_VULKAN_SYSTEM_HANDLES
+#include "thread_group.hpp"
+#endif
+
+namespace Vulkan
+{
+static constexpr size_t RenderQueueBlockSize = 64 * 1024;
+static constexpr unsigned RadixPasses = 8;
+
+struct RadixHistogram
+{
+	uint32_t counts[RadixPasses][256];
+	uint32_t offsets[256];
+};
+
+static uint32_t quantize_depth(float depth)
+{
+	// Non-negative IEEE floats order the same way as their bit patterns.
+	if (!(depth > 0.0f))
+		depth = 0.0f;
+	uint32_t bits;
+	memcpy(&bits, &depth, sizeof(bits));
+	return bits;
+}
+
+uint64_t RenderQueue::get_sort_key(uint32_t pass, Util::Hash pipeline_hash, Util::Hash material_hash, float depth)
+{
+	uint64_t key = uint64_t(pass & 0xf) << 60;
+	key |= (pipeline_hash & 0xfffff) << 40;
+	key |= (material_hash & 0xffffff) << 16;
+	key |= quantize_depth(depth) >> 16;
+	return key;
+}
+
+uint64_t RenderQueue::get_sort_key_back_to_front(uint32_t pass, Util::Hash pipeline_hash,
+                                                 Util::Hash material_hash, float depth)
+{
+	uint64_t key = uint64_t(pass & 0xf) << 60;
+	key |= uint64_t(~quantize_depth(depth) >> 4) << 32;
+	key |= (pipeline_hash & 0xffff) << 16;
+	key |= material_hash & 0xffff;
+	return key;
+}
+
+void RenderQueue::init(unsigned num_thread_indices)
+{
+	threads.clear();
+	threads.resize(num_thread_indices);
+	sorted.clear();
+	stats = {};
+}
+
+RenderQueue::ThreadData &RenderQueue::get_thread_data()
+{
+	unsigned index = Util::get_current_thread_index();
+	VK_ASSERT(index < threads.size());
+	return threads[index];
+}
+
+void RenderQueue::push(uint64_t sort_key, RenderPacketFunc render, const void *render_info, const void *instance_data)
+{
+	get_thread_data().packets.push_back({ sort_key, render, render_info, instance_data });
+}
+
+void *RenderQueue::allocate(size_t size, size_t alignment)
+{
+	auto &thread = get_thread_data();
+
+	for (;;)
+	{
+		if (thread.block_index >= thread.blocks.size())
+		{
+			Block block;
+			block.size = std::max(RenderQueueBlockSize, size + alignment);
+			block.data.reset(new uint8_t[block.size]);
+			thread.blocks.push_back(std::move(block));
+		}
+
+		auto &block = thread.blocks[thread.block_index];
+		auto base = reinterpret_cast<uintptr_t>(block.data.get());
+		size_t offset = ((base + thread.block_offset + alignment - 1) & ~uintptr_t(alignment - 1)) - base;
+
+		if (offset + size <= block.size)
+		{
+			thread.block_offset = offset + size;
+			return block.data.get() + offset;
+		}
+
+		thread.block_index++;
+		thread.block_offset = 0;
+	}
+}
+
+void RenderQueue::reset()
+{
+	for (auto &thread : threads)
+	{
+		thread.packets.clear();
+		thread.block_index = 0;
+		thread.block_offset = 0;
+	}
+	sorted.clear();
+	stats = {};
+}
+
+static size_t count_render_calls(const RenderPacket *packets, size_t count)
+{
+	size_t calls = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		if (i == 0 || packets[i].render != packets[i - 1].render ||
+		    packets[i].render_info != packets[i - 1].render_info)
+		{
+			calls++;
+		}
+	}
+	return calls;
+}
+
+void RenderQueue::gather()
+{
+	gathered.clear();
+	for (auto &thread : threads)
+	{
+		gathered.insert(gathered.end(), thread.packets.begin(), thread.packets.end());
+		thread.packets.clear();
+	}
+
+	size_t count = gathered.size();
+	keys.resize(count);
+	tmp_keys.resize(count);
+	indices.resize(count);
+	tmp_indices.resize(count);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		keys[i] = gathered[i].sort_key;
+		indices[i] = uint32_t(i);
+	}
+
+	stats.packets = count;
+	stats.render_calls_unsorted = count_render_calls(gathered.data(), count);
+}
+
+void RenderQueue::finish_sort()
+{
+	size_t count = gathered.size();
+	sorted.resize(count);
+	for (size_t i = 0; i < count; i++)
+		sorted[i] = gathered[indices[i]];
+	stats.render_calls = count_render_calls(sorted.data(), count);
+}
+
+static void count_digits(RadixHistogram &hist, const uint64_t *keys, size_t begin, size_t end)
+{
+	memset(hist.counts, 0, sizeof(hist.counts));
+	for (size_t i = begin; i < end; i++)
+	{
+		uint64_t key = keys[i];
+		for (unsigned pass = 0; pass < RadixPasses; pass++)
+			hist.counts[pass][(key >> (8 * pass)) & 0xff]++;
+	}
+}
+
+static void count_digits(RadixHistogram &hist, const uint64_t *keys, size_t begin, size_t end, unsigned pass)
+{
+	auto &counts = hist.counts[pass];
+	memset(counts, 0, sizeof(counts));
+	for (size_t i = begin; i < end; i++)
+		counts[(keys[i] >> (8 * pass)) & 0xff]++;
+}
+
+static void scatter_digits(RadixHistogram &hist,
+                           const uint64_t *src_keys, const uint32_t *src_indices,
+                           uint64_t *dst_keys, uint32_t *dst_indices,
+                           size_t begin, size_t end, unsigned pass)
+{
+	for (size_t i = begin; i < end; i++)
+	{
+		uint32_t slot = hist.offsets[(src_keys[i] >> (8 * pass)) & 0xff]++;
+		dst_keys[slot] = src_keys[i];
+		dst_indices[slot] = src_indices[i];
+	}
+}
+
+// A pass where every key has the same digit would be an identity permutation.
+static bool radix_pass_is_trivial(const RadixHistogram *hists, unsigned num_hists,
+                                  unsigned pass, uint64_t first_key, size_t count)
+{
+	unsigned digit = (first_key >> (8 * pass)) & 0xff;
+	size_t total = 0;
+	for (unsigned i = 0; i < num_hists; i++)
+		total += hists[i].counts[pass][digit];
+	return total == count;
+}
+
+void RenderQueue::sort()
+{
+	gather();
+	sort_gathered();
+	finish_sort();
+}
+
+void RenderQueue::sort_gathered()
+{
+	size_t count = gathered.size();
+	if (!count)
+		return;
+
+	RadixHistogram hist;
+	count_digits(hist, keys.data(), 0, count);
+
+	uint64_t *src_keys = keys.data();
+	uint32_t *src_indices = indices.data();
+	uint64_t *dst_keys = tmp_keys.data();
+	uint32_t *dst_indices = tmp_indices.data();
+
+	for (unsigned pass = 0; pass < RadixPasses; pass++)
+	{
+		if (radix_pass_is_trivial(&hist, 1, pass, src_keys[0], count))
+			continue;
+
+		uint32_t offset = 0;
+		for (unsigned digit = 0; digit < 256; digit++)
+		{
+			hist.offsets[digit] = offset;
+			offset += hist.counts[pass][digit];
+		}
+
+		scatter_digits(hist, src_keys, src_indices, dst_keys, dst_indices, 0, count, pass);
+		std::swap(src_keys, dst_keys);
+		std::swap(src_indices, dst_indices);
+	}
+
+	if (src_indices != indices.data())
+		memcpy(indices.data(), src_indices, count * sizeof(uint32_t));
+}
+
+size_t RenderQueue::find_run_begin(size_t index) const
+{
+	while (index > 0 && index < sorted.size() &&
+	       sorted[index].render == sorted[index - 1].render &&
+	       sorted[index].render_info == sorted[index - 1].render_info)
+	{
+		index--;
+	}
+	return index;
+}
+
+void RenderQueue::replay(CommandBuffer &cmd) const
+{
+	replay(cmd, 0, sorted.size());
+}
+
+void RenderQueue::replay(CommandBuffer &cmd, size_t begin, size_t end) const
+{
+	end = std::min(end, sorted.size());
+	while (begin < end)
+	{
+		auto &packet = sorted[begin];
+		size_t run_end = begin + 1;
+		while (run_end < end && sorted[run_end].render == packet.render &&
+		       sorted[run_end].render_info == packet.render_info)
+		{
+			run_end++;
+		}
+
+		packet.render(cmd, &packet, unsigned(run_end - begin));
+		begin = run_end;
+	}
+}
+
+#ifdef GRANITE_VULKAN_SYSTEM_HANDLES
+// Below this size, task overhead dominates the sort itself.
+static constexpr size_t ParallelSortThreshold = 16 * 1024;
+
+template <typename Func>
+static void run_workers(Granite::ThreadGroup &group, const char *desc, unsigned num_workers, const Func &func)
+{
+	auto task = group.create_task();
+	task->set_desc(desc);
+	for (unsigned i = 0; i < num_workers; i++)
+		task->enqueue_task([&func, i]() { func(i); });
+	task->flush();
+	task->wait();
+}
+
+void RenderQueue::sort(Granite::ThreadGroup &group, unsigned num_workers)
+{
+	if (num_workers <= 1)
+	{
+		sort();
+		return;
+	}
+
+	gather();
+
+	size_t count = gathered.size();
+	if (count < ParallelSortThreshold)
+	{
+		sort_gathered();
+		finish_sort();
+		return;
+	}
+
+	size_t chunk = (count + num_workers - 1) / num_workers;
+	std::vector<RadixHistogram> hists(num_workers);
+
+	uint64_t *src_keys = keys.data();
+	uint32_t *src_indices = indices.data();
+	uint64_t *dst_keys = tmp_keys.data();
+	uint32_t *dst_indices = tmp_indices.data();
+
+	run_workers(group, "render-queue-count", num_workers, [&](unsigned worker) {
+		size_t begin = std::min(count, worker * chunk);
+		size_t end = std::min(count, begin + chunk);
+		count_digits(hists[worker], src_keys, begin, end);
+	});
+
+	bool reordered = false;
+	for (unsigned pass = 0; pass < RadixPasses; pass++)
+	{
+		// Digit totals do not depend on order, so the initial histograms decide which passes are needed.
+		if (radix_pass_is_trivial(hists.data(), num_workers, pass, src_keys[0], count))
+			continue;
+
+		// Per-worker counts are only valid for the order they were computed in.
+		if (reordered)
+		{
+			run_workers(group, "render-queue-count", num_workers, [&](unsigned worker) {
+				size_t begin = std::min(count, worker * chunk);
+				size_t end = std::min(count, begin + chunk);
+				count_digits(hists[worker], src_keys, begin, end, pass);
+			});
+		}
+
+		// Workers own consecutive slots within every digit, which keeps the sort stable.
+		uint32_t offset = 0;
+		for (unsigned digit = 0; digit < 256; digit++)
+		{
+			for (auto &hist : hists)
+			{
+				hist.offsets[digit] = offset;
+				offset += hist.counts[pass][digit];
+			}
+		}
+
+		run_workers(group, "render-queue-scatter", num_workers, [&](unsigned worker) {
+			size_t begin = std::min(count, worker * chunk);
+			size_t end = std::min(count, begin + chunk);
+			scatter_digits(hists[worker], src_keys, src_indices, dst_keys, dst_indices, begin, end, pass);
+		});
+
+		std::swap(src_keys, dst_keys);
+		std::swap(src_indices, dst_indices);
+		reordered = true;
+	}
+
+	if (src_indices != indices.data())
+		memcpy(indices.data(), src_indices, count * sizeof(uint32_t));
+
+	finish_sort();
+}
+
+void RenderQueue::replay(Granite::ThreadGroup &group, CommandBuffer &primary, unsigned num_secondaries) const
+{
+	size_t count = sorted.size();
+	if (!count)
+		return;
+
+	num_secondaries = unsigned(std::min<size_t>(std::max(num_secondaries, 1u), count));
+
+	// Split on run boundaries so that no render call is broken up across command buffers.
+	std::vector<size_t> splits(num_secondaries + 1);
+	splits[0] = 0;
+	splits[num_secondaries] = count;
+	for (unsigned i = 1; i < num_secondaries; i++)
+		splits[i] = std::max(splits[i - 1], find_run_begin(i * count / num_secondaries));
+
+	std::vector<CommandBufferHandle> secondaries(num_secondaries);
+	unsigned subpass = primary.get_current_subpass();
+
+	run_workers(group, "render-queue-replay", num_secondaries, [&](unsigned i) {
+		if (splits[i] == splits[i + 1])
+			return;
+
+		auto cmd = primary.request_secondary_command_buffer(Util::get_current_thread_index(), subpass);
+		replay(*cmd, splits[i], splits[i + 1]);
+		// Must end on the recording thread.
+		cmd->end_threaded_recording();
+		secondaries[i] = std::move(cmd);
+	});
+
+	for (auto &cmd : secondaries)
+	{
+		if (cmd)
+			primary.submit_secondary(std::move(cmd));
+	}
+}
+#endif
+}
@@ -0,0 +1,151 @@
+/* Copyright (c) 2017-2026 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "hash.hpp"
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <vector>
+
+namespace Granite
+{
+class ThreadGroup;
+}
+
+namespace Vulkan
+{
+class CommandBuffer;
+struct RenderPacket;
+
+// Renders count consecutive packets which share render function and render_info.
+using RenderPacketFunc = void (*)(CommandBuffer &cmd, const RenderPacket *packets, unsigned count);
+
+struct RenderPacket
+{
+	uint64_t sort_key;
+	RenderPacketFunc render;
+	// State shared between packets, e.g. program and material.
+	const void *render_info;
+	// Per-packet data, e.g. transforms or draw parameters.
+	const void *instance_data;
+};
+
+struct RenderQueueStats
+{
+	size_t packets;
+	// Number of render function calls after sorting, i.e. the number of state changes replay will emit.
+	size_t render_calls;
+	// Number of render function calls if packets were replayed in submission order.
+	size_t render_calls_unsorted;
+};
+
+// Collects draw packets from any number of threads, sorts them by a 64-bit key with a radix sort
+// and replays them into command buffers in key order.
+// Replaying calls the render function once for every run of packets sharing render and render_info.
+class RenderQueue
+{
+public:
+	// Opaque layout, most significant first: pass (4), pipeline (20), material (24), depth (16), front-to-back.
+	static uint64_t get_sort_key(uint32_t pass, Util::Hash pipeline_hash, Util::Hash material_hash, float depth);
+	// Blended layout: pass (4), depth (28), back-to-front, pipeline (16), material (16).
+	static uint64_t get_sort_key_back_to_front(uint32_t pass, Util::Hash pipeline_hash,
+	                                           Util::Hash material_hash, float depth);
+
+	void init(unsigned num_thread_indices);
+
+	// push() and allocate() may be called concurrently from threads with distinct thread indices.
+	void push(uint64_t sort_key, RenderPacketFunc render, const void *render_info, const void *instance_data);
+
+	// Linear per-thread allocation for packet data. Valid until reset().
+	void *allocate(size_t size, size_t alignment = 16);
+
+	template <typename T>
+	T *allocate_items(size_t count)
+	{
+		return static_cast<T *>(allocate(count * sizeof(T), alignof(T)));
+	}
+
+	// Gathers packets from all threads and sorts them. No pushes may happen concurrently.
+	void sort();
+#ifdef GRANITE_VULKAN_SYSTEM_HANDLES
+	// Splits every radix pass across num_workers tasks. Small queues are sorted on the calling thread.
+	void sort(Granite::ThreadGroup &group, unsigned num_workers);
+#endif
+
+	void replay(CommandBuffer &cmd) const;
+	// Replays sorted packets [begin, end).
+	void replay(CommandBuffer &cmd, size_t begin, size_t end) const;
+#ifdef GRANITE_VULKAN_SYSTEM_HANDLES
+	// Records into up to num_secondaries secondary command buffers in parallel and submits them in order.
+	// primary must be inside a render pass begun with VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS.
+	void replay(Granite::ThreadGroup &group, CommandBuffer &primary, unsigned num_secondaries) const;
+#endif
+
+	// Drops all packets and recycles allocated memory.
+	void reset();
+
+	size_t get_packet_count() const
+	{
+		return sorted.size();
+	}
+
+	const RenderPacket *get_sorted_packets() const
+	{
+		return sorted.data();
+	}
+
+	const RenderQueueStats &get_stats() const
+	{
+		return stats;
+	}
+
+private:
+	struct Block
+	{
+		std::unique_ptr<uint8_t[]> data;
+		size_t size;
+	};
+
+	struct ThreadData
+	{
+		std::vector<RenderPacket> packets;
+		std::vector<Block> blocks;
+		size_t block_index = 0;
+		size_t block_offset = 0;
+	};
+
+	std::vector<ThreadData> threads;
+	std::vector<RenderPacket> sorted;
+	std::vector<uint64_t> keys, tmp_keys;
+	std::vector<uint32_t> indices, tmp_indices;
+	std::vector<RenderPacket> gathered;
+	RenderQueueStats stats = {};
+
+	ThreadData &get_thread_data();
+	void gather();
+	void sort_gathered();
+	void finish_sort();
+	size_t find_run_begin(size_t index) const;
+};
+}
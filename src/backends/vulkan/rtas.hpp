@@ -81,6 +81,9 @@ struct TopRTASCreateInfo
 {
 	const RTASInstance *instances;
 	size_t count;
+	// If non-zero, instances is ignored and count tightly packed VkAccelerationStructureInstanceKHR are read from here.
+	// See rtas_instances.hpp.
+	VkDeviceAddress packed_instances;
 };
 
 class RTAS : public Util::IntrusivePtrEnabled<RTAS, RTASDeleter, HandleCounter>,
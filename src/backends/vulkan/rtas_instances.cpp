@@ -0,0 +1,300 @@
+/* Copyright (c) 2017-2026 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "rtas_instances.hpp"
+#include <string.h>
+#include <algorithm>
+#ifdef GRANITE_VULKAN_SYSTEM_HANDLES
+#include "thread_group.hpp"
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RTAS_INSTANCES_SSE2
+#include <emmintrin.h>
+#if defined(__AVX2__)
+#define RTAS_INSTANCES_AVX2
+#include <immintrin.h>
+#endif
+#elif defined(__ARM_NEON)
+#define RTAS_INSTANCES_NEON
+#include <arm_neon.h>
+#endif
+
+namespace Vulkan
+{
+// The tail of an instance is two 24:8 bitfield words followed by the BLAS address.
+static_assert(sizeof(VkAccelerationStructureInstanceKHR) == 64, "Unexpected instance layout.");
+static constexpr size_t InstanceTailOffset = 48;
+
+static inline uint8_t *instance_tail(VkAccelerationStructureInstanceKHR *instance)
+{
+	return reinterpret_cast<uint8_t *>(instance) + InstanceTailOffset;
+}
+
+static void pack_transform_scalar(float *dst, const float *src, RTASTransformLayout layout)
+{
+	if (layout == RTASTransformLayout::RowMajor3x4)
+	{
+		memcpy(dst, src, 12 * sizeof(float));
+	}
+	else
+	{
+		for (unsigned r = 0; r < 3; r++)
+			for (unsigned c = 0; c < 4; c++)
+				dst[4 * r + c] = src[4 * c + r];
+	}
+}
+
+static void pack_instance_scalar(VkAccelerationStructureInstanceKHR *out, const RTASInstanceStreams &streams, size_t i)
+{
+	unsigned transform_stride = streams.transform_layout == RTASTransformLayout::RowMajor3x4 ? 12 : 16;
+	pack_transform_scalar(&out[i].transform.matrix[0][0], streams.transforms + i * transform_stride,
+	                      streams.transform_layout);
+
+	uint32_t index = streams.custom_indices ? streams.custom_indices[i] : uint32_t(i);
+	uint32_t mask = streams.masks ? streams.masks[i] : 0xffu;
+	uint32_t sbt_offset = streams.sbt_offsets ? streams.sbt_offsets[i] : 0u;
+	uint32_t flags = streams.flags ? streams.flags[i] : 0u;
+
+	uint32_t words[2];
+	words[0] = (index & 0xffffffu) | (mask << 24);
+	words[1] = (sbt_offset & 0xffffffu) | (flags << 24);
+
+	uint8_t *tail = instance_tail(&out[i]);
+	memcpy(tail, words, sizeof(words));
+	memcpy(tail + sizeof(words), &streams.blas_addresses[i], sizeof(VkDeviceAddress));
+}
+
+#if defined(RTAS_INSTANCES_SSE2)
+static inline void pack_transform_sse2(float *dst, const float *src, RTASTransformLayout layout)
+{
+	if (layout == RTASTransformLayout::RowMajor3x4)
+	{
+		_mm_storeu_ps(dst + 0, _mm_loadu_ps(src + 0));
+		_mm_storeu_ps(dst + 4, _mm_loadu_ps(src + 4));
+		_mm_storeu_ps(dst + 8, _mm_loadu_ps(src + 8));
+	}
+	else
+	{
+		__m128 c0 = _mm_loadu_ps(src + 0);
+		__m128 c1 = _mm_loadu_ps(src + 4);
+		__m128 c2 = _mm_loadu_ps(src + 8);
+		__m128 c3 = _mm_loadu_ps(src + 12);
+		_MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+		_mm_storeu_ps(dst + 0, c0);
+		_mm_storeu_ps(dst + 4, c1);
+		_mm_storeu_ps(dst + 8, c2);
+	}
+}
+
+static inline __m128i load_u8x4_sse2(const uint8_t *src)
+{
+	int32_t v;
+	memcpy(&v, src, sizeof(v));
+	__m128i zero = _mm_setzero_si128();
+	__m128i x = _mm_unpacklo_epi8(_mm_cvtsi32_si128(v), zero);
+	return _mm_unpacklo_epi16(x, zero);
+}
+
+static inline __m128i pack_24_8_sse2(__m128i lo, __m128i hi)
+{
+	return _mm_or_si128(_mm_and_si128(lo, _mm_set1_epi32(0xffffff)), _mm_slli_epi32(hi, 24));
+}
+
+// Interleaves the bitfield words of four instances with their BLAS addresses.
+static inline void store_tails_sse2(VkAccelerationStructureInstanceKHR *out,
+                                    __m128i words0, __m128i words1, const VkDeviceAddress *addresses)
+{
+	__m128i a01 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(addresses + 0));
+	__m128i a23 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(addresses + 2));
+	__m128i lo = _mm_unpacklo_epi32(words0, words1);
+	__m128i hi = _mm_unpackhi_epi32(words0, words1);
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(instance_tail(out + 0)), _mm_unpacklo_epi64(lo, a01));
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(instance_tail(out + 1)), _mm_unpackhi_epi64(lo, a01));
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(instance_tail(out + 2)), _mm_unpacklo_epi64(hi, a23));
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(instance_tail(out + 3)), _mm_unpackhi_epi64(hi, a23));
+}
+
+static void pack_instances4_sse2(VkAccelerationStructureInstanceKHR *out, const RTASInstanceStreams &streams, size_t i)
+{
+	unsigned transform_stride = streams.transform_layout == RTASTransformLayout::RowMajor3x4 ? 12 : 16;
+	for (unsigned j = 0; j < 4; j++)
+	{
+		pack_transform_sse2(&out[i + j].transform.matrix[0][0],
+		                    streams.transforms + (i + j) * transform_stride, streams.transform_layout);
+	}
+
+	__m128i index = streams.custom_indices ?
+	                _mm_loadu_si128(reinterpret_cast<const __m128i *>(streams.custom_indices + i)) :
+	                _mm_add_epi32(_mm_set1_epi32(int32_t(i)), _mm_setr_epi32(0, 1, 2, 3));
+	__m128i mask = streams.masks ? load_u8x4_sse2(streams.masks + i) : _mm_set1_epi32(0xff);
+	__m128i sbt_offset = streams.sbt_offsets ?
+	                     _mm_loadu_si128(reinterpret_cast<const __m128i *>(streams.sbt_offsets + i)) :
+	                     _mm_setzero_si128();
+	__m128i flags = streams.flags ? load_u8x4_sse2(streams.flags + i) : _mm_setzero_si128();
+
+	store_tails_sse2(out + i, pack_24_8_sse2(index, mask), pack_24_8_sse2(sbt_offset, flags),
+	                 streams.blas_addresses + i);
+}
+#endif
+
+#if defined(RTAS_INSTANCES_AVX2)
+static inline __m256i load_u8x8_avx2(const uint8_t *src)
+{
+	return _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(src)));
+}
+
+static inline __m256i pack_24_8_avx2(__m256i lo, __m256i hi)
+{
+	return _mm256_or_si256(_mm256_and_si256(lo, _mm256_set1_epi32(0xffffff)), _mm256_slli_epi32(hi, 24));
+}
+
+static void pack_instances8_avx2(VkAccelerationStructureInstanceKHR *out, const RTASInstanceStreams &streams, size_t i)
+{
+	unsigned transform_stride = streams.transform_layout == RTASTransformLayout::RowMajor3x4 ? 12 : 16;
+	for (unsigned j = 0; j < 8; j++)
+	{
+		pack_transform_sse2(&out[i + j].transform.matrix[0][0],
+		                    streams.transforms + (i + j) * transform_stride, streams.transform_layout);
+	}
+
+	__m256i index = streams.custom_indices ?
+	                _mm256_loadu_si256(reinterpret_cast<const __m256i *>(streams.custom_indices + i)) :
+	                _mm256_add_epi32(_mm256_set1_epi32(int32_t(i)), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+	__m256i mask = streams.masks ? load_u8x8_avx2(streams.masks + i) : _mm256_set1_epi32(0xff);
+	__m256i sbt_offset = streams.sbt_offsets ?
+	                     _mm256_loadu_si256(reinterpret_cast<const __m256i *>(streams.sbt_offsets + i)) :
+	                     _mm256_setzero_si256();
+	__m256i flags = streams.flags ? load_u8x8_avx2(streams.flags + i) : _mm256_setzero_si256();
+
+	__m256i words0 = pack_24_8_avx2(index, mask);
+	__m256i words1 = pack_24_8_avx2(sbt_offset, flags);
+
+	store_tails_sse2(out + i, _mm256_castsi256_si128(words0), _mm256_castsi256_si128(words1),
+	                 streams.blas_addresses + i);
+	store_tails_sse2(out + i + 4, _mm256_extracti128_si256(words0, 1), _mm256_extracti128_si256(words1, 1),
+	                 streams.blas_addresses + i + 4);
+}
+#endif
+
+#if defined(RTAS_INSTANCES_NEON)
+static inline void pack_transform_neon(float *dst, const float *src, RTASTransformLayout layout)
+{
+	if (layout == RTASTransformLayout::RowMajor3x4)
+	{
+		vst1q_f32(dst + 0, vld1q_f32(src + 0));
+		vst1q_f32(dst + 4, vld1q_f32(src + 4));
+		vst1q_f32(dst + 8, vld1q_f32(src + 8));
+	}
+	else
+	{
+		// De-interleaving load of a column-major matrix yields its rows.
+		float32x4x4_t m = vld4q_f32(src);
+		vst1q_f32(dst + 0, m.val[0]);
+		vst1q_f32(dst + 4, m.val[1]);
+		vst1q_f32(dst + 8, m.val[2]);
+	}
+}
+
+static inline uint32x4_t load_u8x4_neon(const uint8_t *src)
+{
+	uint32_t v;
+	memcpy(&v, src, sizeof(v));
+	uint16x8_t x = vmovl_u8(vreinterpret_u8_u32(vdup_n_u32(v)));
+	return vmovl_u16(vget_low_u16(x));
+}
+
+static inline uint32x4_t pack_24_8_neon(uint32x4_t lo, uint32x4_t hi)
+{
+	return vorrq_u32(vandq_u32(lo, vdupq_n_u32(0xffffff)), vshlq_n_u32(hi, 24));
+}
+
+static void pack_instances4_neon(VkAccelerationStructureInstanceKHR *out, const RTASInstanceStreams &streams, size_t i)
+{
+	unsigned transform_stride = streams.transform_layout == RTASTransformLayout::RowMajor3x4 ? 12 : 16;
+	for (unsigned j = 0; j < 4; j++)
+	{
+		pack_transform_neon(&out[i + j].transform.matrix[0][0],
+		                    streams.transforms + (i + j) * transform_stride, streams.transform_layout);
+	}
+
+	static const uint32_t iota[4] = { 0, 1, 2, 3 };
+	uint32x4_t index = streams.custom_indices ?
+	                   vld1q_u32(streams.custom_indices + i) :
+	                   vaddq_u32(vdupq_n_u32(uint32_t(i)), vld1q_u32(iota));
+	uint32x4_t mask = streams.masks ? load_u8x4_neon(streams.masks + i) : vdupq_n_u32(0xff);
+	uint32x4_t sbt_offset = streams.sbt_offsets ? vld1q_u32(streams.sbt_offsets + i) : vdupq_n_u32(0);
+	uint32x4_t flags = streams.flags ? load_u8x4_neon(streams.flags + i) : vdupq_n_u32(0);
+
+	uint32x4x2_t words = vzipq_u32(pack_24_8_neon(index, mask), pack_24_8_neon(sbt_offset, flags));
+	const auto *addresses = reinterpret_cast<const uint64_t *>(streams.blas_addresses + i);
+
+	vst1q_u32(reinterpret_cast<uint32_t *>(instance_tail(out + i + 0)),
+	          vcombine_u32(vget_low_u32(words.val[0]), vreinterpret_u32_u64(vld1_u64(addresses + 0))));
+	vst1q_u32(reinterpret_cast<uint32_t *>(instance_tail(out + i + 1)),
+	          vcombine_u32(vget_high_u32(words.val[0]), vreinterpret_u32_u64(vld1_u64(addresses + 1))));
+	vst1q_u32(reinterpret_cast<uint32_t *>(instance_tail(out + i + 2)),
+	          vcombine_u32(vget_low_u32(words.val[1]), vreinterpret_u32_u64(vld1_u64(addresses + 2))));
+	vst1q_u32(reinterpret_cast<uint32_t *>(instance_tail(out + i + 3)),
+	          vcombine_u32(vget_high_u32(words.val[1]), vreinterpret_u32_u64(vld1_u64(addresses + 3))));
+}
+#endif
+
+void pack_rtas_instances(VkAccelerationStructureInstanceKHR *out, const RTASInstanceStreams &streams,
+                         size_t begin, size_t end)
+{
+	end = std::min(end, streams.count);
+	size_t i = begin;
+
+#if defined(RTAS_INSTANCES_AVX2)
+	for (; i + 8 <= end; i += 8)
+		pack_instances8_avx2(out, streams, i);
+#endif
+#if defined(RTAS_INSTANCES_SSE2)
+	for (; i + 4 <= end; i += 4)
+		pack_instances4_sse2(out, streams, i);
+#elif defined(RTAS_INSTANCES_NEON)
+	for (; i + 4 <= end; i += 4)
+		pack_instances4_neon(out, streams, i);
+#endif
+
+	for (; i < end; i++)
+		pack_instance_scalar(out, streams, i);
+}
+
+#ifdef GRANITE_VULKAN_SYSTEM_HANDLES
+void enqueue_rtas_instance_packing(Granite::TaskGroup &task, VkAccelerationStructureInstanceKHR *out,
+                                   const RTASInstanceStreams &streams, size_t instances_per_task)
+{
+	// Keep every task except the last on the widest SIMD path.
+	instances_per_task = std::max<size_t>((instances_per_task + 7) & ~size_t(7), 8);
+
+	for (size_t begin = 0; begin < streams.count; begin += instances_per_task)
+	{
+		size_t end = std::min(streams.count, begin + instances_per_task);
+		task.enqueue_task([out, streams, begin, end]() {
+			pack_rtas_instances(out, streams, begin, end);
+		});
+	}
+}
+#endif
+}
@@ -0,0 +1,69 @@
+/* Copyright (c) 2017-2026 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "vulkan_common.hpp"
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Granite
+{
+struct TaskGroup;
+}
+
+namespace Vulkan
+{
+enum class RTASTransformLayout
+{
+	// 12 floats per instance, same as VkTransformMatrixKHR.
+	RowMajor3x4,
+	// 16 floats per instance, e.g. a column-major mat4 model matrix. Only the affine part is used.
+	ColumnMajor4x4
+};
+
+// Structure-of-arrays input for bulk instance packing.
+// Optional streams may be null, in which case custom index defaults to the instance index,
+// mask to 0xff, and SBT offset and flags to 0.
+struct RTASInstanceStreams
+{
+	const float *transforms;
+	RTASTransformLayout transform_layout;
+	const VkDeviceAddress *blas_addresses;
+	const uint32_t *custom_indices;
+	const uint8_t *masks;
+	const uint32_t *sbt_offsets;
+	const uint8_t *flags;
+	size_t count;
+};
+
+// Packs instances [begin, end) into out[begin, end).
+// out is typically a mapped LinkedDeviceHost buffer which is passed as TopRTASCreateInfo::packed_instances.
+void pack_rtas_instances(VkAccelerationStructureInstanceKHR *out, const RTASInstanceStreams &streams,
+                         size_t begin, size_t end);
+
+#ifdef GRANITE_VULKAN_SYSTEM_HANDLES
+// Splits packing into tasks of instances_per_task.
+void enqueue_rtas_instance_packing(Granite::TaskGroup &task, VkAccelerationStructureInstanceKHR *out,
+                                   const RTASInstanceStreams &streams, size_t instances_per_task = 16 * 1024);
+#endif
+}
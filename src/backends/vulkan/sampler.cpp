@@ -51,6 +51,7 @@ Sampler::Sampler(Device *device_, VkSampler sampler_, const SamplerCreateInfo &i
 
 Sampler::~Sampler()
 {
+	device->notify_cookie_destroyed(get_cookie());
 	if (sampler)
 	{
 		if (immutable)
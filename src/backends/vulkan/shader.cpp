@@ -23,6 +23,7 @@
 #define NOMINMAX
 #include "shader.hpp"
 #include "device.hpp"
+#include "spirv_reflect.hpp"
 #ifdef GRANITE_VULKAN_SPIRV_CROSS
 #include "spirv_cross.hpp"
 using namespace spirv_cross;
@@ -502,6 +503,36 @@ void PipelineLayout::init_legacy(const ImmutableSamplerBank *immutable_samplers)
 	if (push_set_index != UINT32_MAX)
 		layouts[push_set_index] = set_allocators[push_set_index]->get_layout_for_push();
 
+	// Bind uniform buffers with dynamic offsets where the limits allow, so that rebinding
+	// suballocated constant data only needs a vkCmdBindDescriptorSets and no new set.
+	// The limit is shared by the whole layout, so prefer the higher frequency sets first.
+	if (!device->get_device_features().supports_descriptor_buffer)
+	{
+		uint32_t budget = std::min<uint32_t>(device->get_gpu_properties().limits.maxDescriptorSetUniformBuffersDynamic,
+		                                     VULKAN_NUM_DYNAMIC_UBOS);
+
+		for (unsigned i = num_sets; i-- > 0; )
+		{
+			if (i == push_set_index || (layout.bindless_descriptor_set_mask & (1u << i)) != 0)
+				continue;
+
+			uint32_t count = 0;
+			for_each_bit(layout.sets[i].uniform_buffer_mask, [&](uint32_t binding) {
+				count += layout.sets[i].meta[binding].array_size;
+			});
+
+			if (count == 0 || count > budget)
+				continue;
+
+			set_allocators[i] = device->request_descriptor_set_allocator(
+					layout.sets[i], layout.stages_for_bindings[i],
+					immutable_samplers ? immutable_samplers->samplers[i] : nullptr, true);
+			layouts[i] = set_allocators[i]->get_layout_for_pool();
+			dynamic_uniform_buffer_set_mask |= 1u << i;
+			budget -= count;
+		}
+	}
+
 	if (num_sets > VULKAN_NUM_DESCRIPTOR_SETS)
 		LOGE("Number of sets %u exceeds limit of %u.\n", num_sets, VULKAN_NUM_DESCRIPTOR_SETS);
 
@@ -558,6 +589,8 @@ void PipelineLayout::create_update_templates()
 		uint32_t update_count = 0;
 
 		auto &set_layout = layout.sets[desc_set];
+		auto ubo_type = (dynamic_uniform_buffer_set_mask & (1u << desc_set)) != 0 ?
+		                VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
 
 		for_each_bit(set_layout.uniform_buffer_mask, [&](uint32_t binding) {
 			unsigned array_size = set_layout.meta[binding].array_size;
@@ -566,7 +599,7 @@ void PipelineLayout::create_update_templates()
 			for (unsigned i = 0; i < array_size; i++)
 			{
 				auto &entry = update_entries[update_count++];
-				entry.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+				entry.descriptorType = ubo_type;
 				entry.dstBinding = binding;
 				entry.dstArrayElement = i;
 				entry.descriptorCount = 1;
@@ -872,14 +905,11 @@ static void update_array_info(ResourceLayout &layout, const SPIRType &type, unsi
 	}
 }
 
-bool Shader::reflect_resource_layout(ResourceLayout &layout, const uint32_t *data, size_t size)
+// Reference implementation, only used to validate the built-in reflection in debug builds.
+static bool reflect_resource_layout_spirv_cross(ResourceLayout &layout, const uint32_t *data, size_t size)
 {
 	Compiler compiler(data, size / sizeof(uint32_t));
 
-#ifdef VULKAN_DEBUG
-	LOGI("Reflecting shader layout.\n");
-#endif
-
 	bool has_array_length = false;
 	auto &ir = compiler.get_ir();
 
@@ -1055,13 +1085,25 @@ bool Shader::reflect_resource_layout(ResourceLayout &layout, const uint32_t *dat
 
 	return true;
 }
-#else
-bool Shader::reflect_resource_layout(ResourceLayout &, const uint32_t *, size_t)
+#endif
+
+bool Shader::reflect_resource_layout(ResourceLayout &layout, const uint32_t *data, size_t size)
 {
-	return false;
-}
+	if (!reflect_spirv_resource_layout(layout, data, size))
+		return false;
+
+#if (defined(VULKAN_DEBUG) || defined(GRANITE_VULKAN_SPIRV_REFLECT_VALIDATE)) && defined(GRANITE_VULKAN_SPIRV_CROSS)
+	ResourceLayout reference;
+	if (reflect_resource_layout_spirv_cross(reference, data, size) &&
+	    memcmp(&reference, &layout, sizeof(layout)) != 0)
+	{
+		LOGE("Built-in SPIR-V reflection does not match SPIRV-Cross.\n");
+	}
 #endif
 
+	return true;
+}
+
 Shader::Shader(Hash hash, Device *device_, const uint32_t *data, size_t size,
                const ResourceLayout *resource_layout)
 	: IntrusiveHashMapEnabled<Shader>(hash)
@@ -1088,10 +1130,8 @@ Shader::Shader(Hash hash, Device *device_, const uint32_t *data, size_t size,
 
 	if (resource_layout)
 		layout = *resource_layout;
-#ifdef GRANITE_VULKAN_SPIRV_CROSS
 	else if (!reflect_resource_layout(layout, data, size))
 		LOGE("Failed to reflect resource layout.\n");
-#endif
 
 	if (layout.bindless_set_mask != 0 && !device->get_device_features().vk12_features.descriptorIndexing)
 		LOGE("Sufficient features for descriptor indexing is not supported on this device.\n");
@@ -174,6 +174,12 @@ public:
 		return push_set_index;
 	}
 
+	// Sets whose uniform buffers are bound with dynamic offsets.
+	uint32_t get_dynamic_uniform_buffer_set_mask() const
+	{
+		return dynamic_uniform_buffer_set_mask;
+	}
+
 	// Heap
 	enum class DescriptorStrategy
 	{
@@ -258,6 +264,7 @@ private:
 	DescriptorSetAllocator *set_allocators[VULKAN_NUM_DESCRIPTOR_SETS] = {};
 	VkDescriptorUpdateTemplate update_template[VULKAN_NUM_DESCRIPTOR_SETS] = {};
 	uint32_t push_set_index = UINT32_MAX;
+	uint32_t dynamic_uniform_buffer_set_mask = 0;
 	void create_update_templates();
 
 	void init_heap();
@@ -0,0 +1,854 @@
+/* Copyright (c) 2017-2026 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "spirv_reflect.hpp"
+#include "logging.hpp"
+#include <algorithm>
+#include <vector>
+
+namespace Vulkan
+{
+// Only the subset of the SPIR-V grammar which the reflection cares about.
+namespace SPIRV
+{
+enum : uint32_t
+{
+	MagicNumber = 0x07230203,
+	Version14 = 0x10400
+};
+
+enum Op : uint32_t
+{
+	OpEntryPoint = 15,
+	OpTypeVoid = 19,
+	OpTypeInt = 21,
+	OpTypeFloat = 22,
+	OpTypeVector = 23,
+	OpTypeMatrix = 24,
+	OpTypeImage = 25,
+	OpTypeSampler = 26,
+	OpTypeSampledImage = 27,
+	OpTypeArray = 28,
+	OpTypeRuntimeArray = 29,
+	OpTypeStruct = 30,
+	OpTypePointer = 32,
+	OpConstant = 43,
+	OpSpecConstant = 50,
+	OpFunction = 54,
+	OpVariable = 59,
+	OpArrayLength = 68,
+	OpDecorate = 71,
+	OpMemberDecorate = 72,
+	OpTypeAccelerationStructureKHR = 5341
+};
+
+enum Decoration : uint32_t
+{
+	DecorationSpecId = 1,
+	DecorationBlock = 2,
+	DecorationBufferBlock = 3,
+	DecorationRowMajor = 4,
+	DecorationArrayStride = 6,
+	DecorationMatrixStride = 7,
+	DecorationBuiltIn = 11,
+	DecorationLocation = 30,
+	DecorationBinding = 33,
+	DecorationDescriptorSet = 34,
+	DecorationOffset = 35
+};
+
+enum StorageClass : uint32_t
+{
+	StorageClassUniformConstant = 0,
+	StorageClassInput = 1,
+	StorageClassUniform = 2,
+	StorageClassOutput = 3,
+	StorageClassPushConstant = 9,
+	StorageClassStorageBuffer = 12
+};
+
+enum Dim : uint32_t
+{
+	DimBuffer = 5,
+	DimSubpassData = 6
+};
+}
+
+namespace
+{
+struct ArrayInfo
+{
+	uint32_t dimensions;
+	uint32_t size;
+	bool literal;
+};
+
+class SPIRVScanner
+{
+public:
+	SPIRVScanner(const uint32_t *words_, uint32_t word_count_)
+		: words(words_), word_count(word_count_)
+	{
+	}
+
+	bool scan(ResourceLayout &layout);
+
+private:
+	const uint32_t *words;
+	uint32_t word_count;
+	uint32_t version = 0;
+	uint32_t bound = 0;
+
+	// Guards against allocating absurd tables for a corrupt header.
+	enum { MaxIdBound = 4 * 1024 * 1024 };
+
+	enum IdFlagBits : uint32_t
+	{
+		ID_DESCRIPTOR_SET_BIT = 1 << 0,
+		ID_BINDING_BIT = 1 << 1,
+		ID_LOCATION_BIT = 1 << 2,
+		ID_ARRAY_STRIDE_BIT = 1 << 3,
+		ID_BLOCK_BIT = 1 << 4,
+		ID_BUFFER_BLOCK_BIT = 1 << 5,
+		ID_BUILTIN_BIT = 1 << 6,
+		ID_MEMBER_BUILTIN_BIT = 1 << 7,
+		ID_INTERFACE_BIT = 1 << 8
+	};
+
+	// Everything the reflection needs about an ID, gathered in one pass over the module.
+	struct IdInfo
+	{
+		uint32_t definition;
+		uint32_t flags;
+		uint32_t descriptor_set;
+		uint32_t binding;
+		uint32_t location;
+		uint32_t array_stride;
+		uint32_t member_begin;
+		uint32_t member_count;
+	};
+
+	struct MemberDecoration
+	{
+		uint32_t id;
+		uint32_t member;
+		uint32_t decoration;
+		uint32_t value;
+	};
+
+	std::vector<IdInfo> ids;
+	// Sorted by ID once the module has been scanned, IdInfo::member_begin/count index into it.
+	std::vector<MemberDecoration> member_decorations;
+	std::vector<uint32_t> variables;
+	bool has_array_length = false;
+
+	void decorate(const uint32_t *inst, uint32_t count);
+	void member_decorate(const uint32_t *inst, uint32_t count);
+	void index_member_decorations();
+
+	static uint32_t op(uint32_t word)
+	{
+		return word & 0xffffu;
+	}
+
+	static uint32_t length(uint32_t word)
+	{
+		return word >> 16;
+	}
+
+	const uint32_t *find(uint32_t id) const;
+	bool get_decoration(uint32_t id, uint32_t decoration, uint32_t *value = nullptr) const;
+	bool get_member_decoration(uint32_t id, uint32_t member, uint32_t decoration, uint32_t *value = nullptr) const;
+	bool has_id_flags(uint32_t id, uint32_t flags) const;
+	void get_array_length(uint32_t length_id, uint32_t &size, bool &literal) const;
+	const uint32_t *strip_arrays(uint32_t type_id, ArrayInfo &info) const;
+
+	uint32_t get_declared_struct_size(uint32_t struct_id, unsigned depth) const;
+	uint32_t get_declared_member_size(uint32_t struct_id, uint32_t member, unsigned depth) const;
+
+	void add_variable(ResourceLayout &layout, const uint32_t *inst) const;
+	static void update_array_info(ResourceLayout &layout, const ArrayInfo &array, bool bindless_capable,
+	                              unsigned set, unsigned binding);
+};
+
+static bool is_result_declaration(uint32_t opcode)
+{
+	switch (opcode)
+	{
+	case SPIRV::OpTypeVoid:
+	case SPIRV::OpTypeInt:
+	case SPIRV::OpTypeFloat:
+	case SPIRV::OpTypeVector:
+	case SPIRV::OpTypeMatrix:
+	case SPIRV::OpTypeImage:
+	case SPIRV::OpTypeSampler:
+	case SPIRV::OpTypeSampledImage:
+	case SPIRV::OpTypeArray:
+	case SPIRV::OpTypeRuntimeArray:
+	case SPIRV::OpTypeStruct:
+	case SPIRV::OpTypePointer:
+	case SPIRV::OpTypeAccelerationStructureKHR:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+// Instructions whose result ID is in word 2 rather than word 1.
+static bool is_typed_declaration(uint32_t opcode)
+{
+	return opcode == SPIRV::OpConstant || opcode == SPIRV::OpSpecConstant || opcode == SPIRV::OpVariable;
+}
+
+const uint32_t *SPIRVScanner::find(uint32_t id) const
+{
+	if (id >= bound || ids[id].definition == 0)
+		return nullptr;
+	return &words[ids[id].definition];
+}
+
+bool SPIRVScanner::has_id_flags(uint32_t id, uint32_t flags) const
+{
+	return id < bound && (ids[id].flags & flags) == flags;
+}
+
+bool SPIRVScanner::get_decoration(uint32_t id, uint32_t decoration, uint32_t *value) const
+{
+	if (id >= bound)
+		return false;
+
+	auto &info = ids[id];
+	uint32_t flag;
+	uint32_t decoration_value = 0;
+
+	switch (decoration)
+	{
+	case SPIRV::DecorationDescriptorSet:
+		flag = ID_DESCRIPTOR_SET_BIT;
+		decoration_value = info.descriptor_set;
+		break;
+
+	case SPIRV::DecorationBinding:
+		flag = ID_BINDING_BIT;
+		decoration_value = info.binding;
+		break;
+
+	case SPIRV::DecorationLocation:
+		flag = ID_LOCATION_BIT;
+		decoration_value = info.location;
+		break;
+
+	case SPIRV::DecorationArrayStride:
+		flag = ID_ARRAY_STRIDE_BIT;
+		decoration_value = info.array_stride;
+		break;
+
+	case SPIRV::DecorationBlock:
+		flag = ID_BLOCK_BIT;
+		break;
+
+	case SPIRV::DecorationBufferBlock:
+		flag = ID_BUFFER_BLOCK_BIT;
+		break;
+
+	case SPIRV::DecorationBuiltIn:
+		flag = ID_BUILTIN_BIT;
+		break;
+
+	default:
+		return false;
+	}
+
+	if ((info.flags & flag) == 0)
+		return false;
+
+	if (value)
+		*value = decoration_value;
+	return true;
+}
+
+bool SPIRVScanner::get_member_decoration(uint32_t id, uint32_t member, uint32_t decoration, uint32_t *value) const
+{
+	if (id >= bound)
+		return false;
+
+	auto &info = ids[id];
+	for (uint32_t i = info.member_begin, end = info.member_begin + info.member_count; i < end; i++)
+	{
+		auto &dec = member_decorations[i];
+		if (dec.member == member && dec.decoration == decoration)
+		{
+			if (value)
+				*value = dec.value;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void SPIRVScanner::decorate(const uint32_t *inst, uint32_t count)
+{
+	if (count < 3 || inst[1] >= bound)
+		return;
+
+	auto &info = ids[inst[1]];
+	uint32_t value = count >= 4 ? inst[3] : 0;
+
+	// Only the first decoration of a kind counts.
+	switch (inst[2])
+	{
+	case SPIRV::DecorationDescriptorSet:
+		if ((info.flags & ID_DESCRIPTOR_SET_BIT) == 0)
+			info.descriptor_set = value;
+		info.flags |= ID_DESCRIPTOR_SET_BIT;
+		break;
+
+	case SPIRV::DecorationBinding:
+		if ((info.flags & ID_BINDING_BIT) == 0)
+			info.binding = value;
+		info.flags |= ID_BINDING_BIT;
+		break;
+
+	case SPIRV::DecorationLocation:
+		if ((info.flags & ID_LOCATION_BIT) == 0)
+			info.location = value;
+		info.flags |= ID_LOCATION_BIT;
+		break;
+
+	case SPIRV::DecorationArrayStride:
+		if ((info.flags & ID_ARRAY_STRIDE_BIT) == 0)
+			info.array_stride = value;
+		info.flags |= ID_ARRAY_STRIDE_BIT;
+		break;
+
+	case SPIRV::DecorationBlock:
+		info.flags |= ID_BLOCK_BIT;
+		break;
+
+	case SPIRV::DecorationBufferBlock:
+		info.flags |= ID_BUFFER_BLOCK_BIT;
+		break;
+
+	case SPIRV::DecorationBuiltIn:
+		info.flags |= ID_BUILTIN_BIT;
+		break;
+
+	default:
+		break;
+	}
+}
+
+void SPIRVScanner::member_decorate(const uint32_t *inst, uint32_t count)
+{
+	if (count < 4 || inst[1] >= bound)
+		return;
+
+	switch (inst[3])
+	{
+	case SPIRV::DecorationBuiltIn:
+		ids[inst[1]].flags |= ID_MEMBER_BUILTIN_BIT;
+		break;
+
+	case SPIRV::DecorationOffset:
+	case SPIRV::DecorationMatrixStride:
+	case SPIRV::DecorationRowMajor:
+		member_decorations.push_back({ inst[1], inst[2], inst[3], count >= 5 ? inst[4] : 0 });
+		break;
+
+	default:
+		break;
+	}
+}
+
+void SPIRVScanner::index_member_decorations()
+{
+	// Stable, so the first decoration of a kind still wins in get_member_decoration().
+	std::stable_sort(member_decorations.begin(), member_decorations.end(),
+	                 [](const MemberDecoration &a, const MemberDecoration &b) {
+		                 return a.id < b.id;
+	                 });
+
+	for (uint32_t i = 0, n = uint32_t(member_decorations.size()); i < n; i++)
+	{
+		auto &info = ids[member_decorations[i].id];
+		if (info.member_count == 0)
+			info.member_begin = i;
+		info.member_count++;
+	}
+}
+
+void SPIRVScanner::get_array_length(uint32_t length_id, uint32_t &size, bool &literal) const
+{
+	// Anything which is not a plain OpConstant, e.g. spec constant ops, is not a literal length.
+	auto *inst = find(length_id);
+	if (inst && length(inst[0]) >= 4)
+	{
+		literal = op(inst[0]) == SPIRV::OpConstant;
+		size = inst[3];
+	}
+	else
+	{
+		literal = false;
+		size = 0;
+	}
+}
+
+const uint32_t *SPIRVScanner::strip_arrays(uint32_t type_id, ArrayInfo &info) const
+{
+	info = {};
+	auto *type = find(type_id);
+
+	while (type && (op(type[0]) == SPIRV::OpTypeArray || op(type[0]) == SPIRV::OpTypeRuntimeArray))
+	{
+		// Only the outermost dimension matters, more than one dimension is an error anyway.
+		if (info.dimensions++ == 0)
+		{
+			if (op(type[0]) == SPIRV::OpTypeRuntimeArray)
+			{
+				info.size = 0;
+				info.literal = true;
+			}
+			else
+				get_array_length(type[3], info.size, info.literal);
+		}
+
+		type = find(type[2]);
+	}
+
+	return type;
+}
+
+uint32_t SPIRVScanner::get_declared_member_size(uint32_t struct_id, uint32_t member, unsigned depth) const
+{
+	auto *parent = find(struct_id);
+	auto *type = find(parent[2 + member]);
+	if (!type)
+		return 0;
+
+	switch (op(type[0]))
+	{
+	case SPIRV::OpTypePointer:
+		// Physical storage buffer pointers.
+		return 8;
+
+	case SPIRV::OpTypeArray:
+	case SPIRV::OpTypeRuntimeArray:
+	{
+		uint32_t stride = 0;
+		get_decoration(parent[2 + member], SPIRV::DecorationArrayStride, &stride);
+
+		uint32_t size = 0;
+		bool literal = false;
+		if (op(type[0]) == SPIRV::OpTypeArray)
+			get_array_length(type[3], size, literal);
+		return stride * size;
+	}
+
+	case SPIRV::OpTypeStruct:
+		return get_declared_struct_size(parent[2 + member], depth + 1);
+
+	case SPIRV::OpTypeInt:
+	case SPIRV::OpTypeFloat:
+		return type[2] / 8;
+
+	case SPIRV::OpTypeVector:
+	{
+		auto *component = find(type[2]);
+		return component ? type[3] * (component[2] / 8) : 0;
+	}
+
+	case SPIRV::OpTypeMatrix:
+	{
+		auto *column = find(type[2]);
+		if (!column)
+			return 0;
+
+		uint32_t stride = 0;
+		get_member_decoration(struct_id, member, SPIRV::DecorationMatrixStride, &stride);
+		if (get_member_decoration(struct_id, member, SPIRV::DecorationRowMajor))
+			return stride * column[3];
+		else
+			return stride * type[3];
+	}
+
+	default:
+		return 0;
+	}
+}
+
+uint32_t SPIRVScanner::get_declared_struct_size(uint32_t struct_id, unsigned depth) const
+{
+	auto *type = find(struct_id);
+	if (!type || op(type[0]) != SPIRV::OpTypeStruct || depth > 16)
+		return 0;
+
+	uint32_t num_members = length(type[0]) - 2;
+	if (num_members == 0)
+		return 0;
+
+	// Offsets can be declared out of order, so find the member with the highest offset.
+	uint32_t member_index = 0;
+	uint32_t highest_offset = 0;
+	for (uint32_t i = 0; i < num_members; i++)
+	{
+		uint32_t offset = 0;
+		get_member_decoration(struct_id, i, SPIRV::DecorationOffset, &offset);
+		if (offset > highest_offset)
+		{
+			highest_offset = offset;
+			member_index = i;
+		}
+	}
+
+	return highest_offset + get_declared_member_size(struct_id, member_index, depth);
+}
+
+void SPIRVScanner::update_array_info(ResourceLayout &layout, const ArrayInfo &array, bool bindless_capable,
+                                     unsigned set, unsigned binding)
+{
+	auto &meta = layout.sets[set].meta[binding];
+
+	if (array.dimensions)
+	{
+		if (array.dimensions != 1)
+			LOGE("Array dimension must be 1.\n");
+		else if (!array.literal)
+			LOGE("Array dimension must be a literal.\n");
+		else
+		{
+			if (array.size == 0)
+			{
+				if (binding != 0)
+					LOGE("Bindless textures can only be used with binding = 0 in a set.\n");
+
+				if (!bindless_capable)
+				{
+					LOGE("Can only use bindless for sampled images.\n");
+				}
+				else
+				{
+					layout.bindless_set_mask |= 1u << set;
+					// Ignore fp_mask for bindless since we can mix and match.
+					layout.sets[set].fp_mask = 0;
+				}
+
+				meta.array_size = DescriptorSetLayout::UNSIZED_ARRAY;
+			}
+			else if (meta.array_size && meta.array_size != array.size)
+				LOGE("Array dimension for (%u, %u) is inconsistent.\n", set, binding);
+			else if (array.size + binding > VULKAN_NUM_BINDINGS)
+				LOGE("Binding array will go out of bounds.\n");
+			else
+				meta.array_size = uint8_t(array.size);
+		}
+	}
+	else
+	{
+		if (meta.array_size && meta.array_size != 1)
+			LOGE("Array dimension for (%u, %u) is inconsistent.\n", set, binding);
+		meta.array_size = 1;
+	}
+}
+
+void SPIRVScanner::add_variable(ResourceLayout &layout, const uint32_t *inst) const
+{
+	if (length(inst[0]) < 4)
+		return;
+
+	uint32_t id = inst[2];
+	uint32_t storage = inst[3];
+
+	switch (storage)
+	{
+	case SPIRV::StorageClassUniformConstant:
+	case SPIRV::StorageClassInput:
+	case SPIRV::StorageClassUniform:
+	case SPIRV::StorageClassOutput:
+	case SPIRV::StorageClassPushConstant:
+	case SPIRV::StorageClassStorageBuffer:
+		break;
+
+	default:
+		return;
+	}
+
+	auto *pointer = find(inst[1]);
+	if (!pointer || op(pointer[0]) != SPIRV::OpTypePointer)
+		return;
+
+	ArrayInfo array;
+	uint32_t base_id = pointer[3];
+	auto *base = strip_arrays(base_id, array);
+	if (!base)
+		return;
+	if (array.dimensions)
+		base_id = base[1];
+
+	uint32_t base_op = op(base[0]);
+
+	// Builtins are never reflected as resources.
+	if (get_decoration(id, SPIRV::DecorationBuiltIn) ||
+	    (base_op == SPIRV::OpTypeStruct && has_id_flags(base_id, ID_MEMBER_BUILTIN_BIT)))
+	{
+		return;
+	}
+
+	// From SPIR-V 1.4, the entry point lists every global it uses.
+	if (version >= SPIRV::Version14 && !has_id_flags(id, ID_INTERFACE_BIT))
+		return;
+
+	if (storage == SPIRV::StorageClassInput || storage == SPIRV::StorageClassOutput)
+	{
+		if (!has_id_flags(id, ID_INTERFACE_BIT))
+			return;
+
+		uint32_t location = 0;
+		get_decoration(id, SPIRV::DecorationLocation, &location);
+		if (location >= 32)
+			return;
+
+		if (storage == SPIRV::StorageClassInput)
+			layout.input_mask |= 1u << location;
+		else
+			layout.output_mask |= 1u << location;
+		return;
+	}
+
+	if (storage == SPIRV::StorageClassPushConstant)
+	{
+		// Don't bother trying to extract which part of a push constant block we're using.
+		// Just assume we're accessing everything.
+		if (layout.push_constant_size == 0)
+			layout.push_constant_size = get_declared_struct_size(base_id, 0);
+		return;
+	}
+
+	uint32_t set = 0;
+	uint32_t binding = 0;
+	get_decoration(id, SPIRV::DecorationDescriptorSet, &set);
+	get_decoration(id, SPIRV::DecorationBinding, &binding);
+	if (set >= VULKAN_NUM_DESCRIPTOR_SETS || binding >= VULKAN_NUM_BINDINGS)
+	{
+		LOGE("Resource (%u, %u) is out of range.\n", set, binding);
+		return;
+	}
+
+	auto &layout_set = layout.sets[set];
+
+	if (storage == SPIRV::StorageClassUniform || storage == SPIRV::StorageClassStorageBuffer)
+	{
+		if (storage == SPIRV::StorageClassStorageBuffer || get_decoration(base_id, SPIRV::DecorationBufferBlock))
+			layout_set.storage_buffer_mask |= 1u << binding;
+		else if (get_decoration(base_id, SPIRV::DecorationBlock))
+			layout_set.uniform_buffer_mask |= 1u << binding;
+		else
+			return;
+
+		update_array_info(layout, array, false, set, binding);
+		return;
+	}
+
+	// UniformConstant from here.
+	const uint32_t *image = nullptr;
+	if (base_op == SPIRV::OpTypeImage)
+		image = base;
+	else if (base_op == SPIRV::OpTypeSampledImage)
+		image = find(base[2]);
+
+	bool is_fp = false;
+	bool is_storage = false;
+	uint32_t dim = 0;
+	if (image)
+	{
+		if (length(image[0]) < 9)
+			return;
+		auto *sampled_type = find(image[2]);
+		is_fp = sampled_type && op(sampled_type[0]) == SPIRV::OpTypeFloat;
+		dim = image[3];
+		is_storage = image[7] == 2;
+	}
+
+	if (base_op == SPIRV::OpTypeImage && dim == SPIRV::DimSubpassData)
+	{
+		layout_set.input_attachment_mask |= 1u << binding;
+		if (is_fp)
+			layout_set.fp_mask |= 1u << binding;
+	}
+	else if (base_op == SPIRV::OpTypeImage && is_storage)
+	{
+		if (dim == SPIRV::DimBuffer)
+			layout_set.storage_texel_buffer_mask |= 1u << binding;
+		else
+			layout_set.storage_image_mask |= 1u << binding;
+		if (is_fp)
+			layout_set.fp_mask |= 1u << binding;
+	}
+	else if (base_op == SPIRV::OpTypeImage)
+	{
+		if (is_fp)
+			layout_set.fp_mask |= 1u << binding;
+		if (dim == SPIRV::DimBuffer)
+			layout_set.sampled_texel_buffer_mask |= 1u << binding;
+		else
+			layout_set.separate_image_mask |= 1u << binding;
+	}
+	else if (base_op == SPIRV::OpTypeSampler)
+		layout_set.sampler_mask |= 1u << binding;
+	else if (base_op == SPIRV::OpTypeSampledImage)
+	{
+		if (dim == SPIRV::DimBuffer)
+			layout_set.sampled_texel_buffer_mask |= 1u << binding;
+		else
+			layout_set.sampled_image_mask |= 1u << binding;
+		if (is_fp)
+			layout_set.fp_mask |= 1u << binding;
+	}
+	else if (base_op == SPIRV::OpTypeAccelerationStructureKHR)
+		layout_set.rtas_mask |= 1u << binding;
+	else
+		return;
+
+	update_array_info(layout, array, base_op == SPIRV::OpTypeImage && dim != SPIRV::DimBuffer, set, binding);
+}
+
+bool SPIRVScanner::scan(ResourceLayout &layout)
+{
+	if (word_count < 5 || words[0] != SPIRV::MagicNumber)
+	{
+		LOGE("Invalid SPIR-V header.\n");
+		return false;
+	}
+
+	version = words[1];
+	bound = words[3];
+	if (bound == 0 || bound > MaxIdBound)
+	{
+		LOGE("Invalid SPIR-V ID bound %u.\n", bound);
+		return false;
+	}
+
+	ids.resize(bound);
+	bool in_declarations = true;
+	bool has_entry_point = false;
+
+	uint32_t offset = 5;
+	while (offset < word_count)
+	{
+		auto *inst = &words[offset];
+		uint32_t opcode = op(inst[0]);
+		uint32_t count = length(inst[0]);
+
+		if (count == 0 || offset + count > word_count)
+		{
+			LOGE("Malformed SPIR-V instruction at word %u.\n", offset);
+			return false;
+		}
+
+		if (!in_declarations)
+		{
+			if (opcode == SPIRV::OpArrayLength)
+				has_array_length = true;
+			offset += count;
+			continue;
+		}
+
+		switch (opcode)
+		{
+		case SPIRV::OpEntryPoint:
+			// Only the first entry point is reflected. Interface IDs follow the null-terminated name.
+			if (!has_entry_point && count >= 4)
+			{
+				has_entry_point = true;
+				uint32_t i = 3;
+				while (i < count && (inst[i] & 0xff000000u) != 0)
+					i++;
+				for (i++; i < count; i++)
+					if (inst[i] < bound)
+						ids[inst[i]].flags |= ID_INTERFACE_BIT;
+			}
+			break;
+
+		case SPIRV::OpDecorate:
+			if (count >= 4 && inst[2] == SPIRV::DecorationSpecId)
+			{
+				if (inst[3] >= VULKAN_NUM_TOTAL_SPEC_CONSTANTS)
+					LOGE("Spec constant ID: %u is out of range, will be ignored.\n", inst[3]);
+				else
+					layout.spec_constant_mask |= 1u << inst[3];
+			}
+			decorate(inst, count);
+			break;
+
+		case SPIRV::OpMemberDecorate:
+			member_decorate(inst, count);
+			break;
+
+		case SPIRV::OpFunction:
+			// Everything after this is code. Only OpArrayLength is interesting there.
+			in_declarations = false;
+			break;
+
+		case SPIRV::OpVariable:
+			// Global variables are reflected once every decoration has been indexed.
+			if (count >= 4)
+				variables.push_back(offset);
+			break;
+
+		default:
+			break;
+		}
+
+		if (in_declarations)
+		{
+			if (is_result_declaration(opcode) && count >= 2 && inst[1] < bound)
+				ids[inst[1]].definition = offset;
+			else if (is_typed_declaration(opcode) && count >= 3 && inst[2] < bound)
+				ids[inst[2]].definition = offset;
+		}
+
+		offset += count;
+	}
+
+	index_member_decorations();
+	for (auto variable : variables)
+		add_variable(layout, &words[variable]);
+
+	if (has_array_length)
+	{
+		for (auto &set : layout.sets)
+			Util::for_each_bit(set.storage_buffer_mask, [&](uint32_t binding) {
+				set.meta[binding].requires_descriptor_size = 1;
+			});
+	}
+
+	return true;
+}
+}
+
+bool reflect_spirv_resource_layout(ResourceLayout &layout, const uint32_t *data, size_t size)
+{
+	SPIRVScanner scanner(data, uint32_t(size / sizeof(uint32_t)));
+	return scanner.scan(layout);
+}
+}
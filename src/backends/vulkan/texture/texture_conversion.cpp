@@ -0,0 +1,736 @@
+/* Copyright (c) 2017-2026 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "texture_conversion.hpp"
+#include "texture_format.hpp"
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TEXTURE_CONVERSION_SSE2
+#include <emmintrin.h>
+#if defined(__SSSE3__)
+#define TEXTURE_CONVERSION_SSSE3
+#include <tmmintrin.h>
+#endif
+#elif defined(__ARM_NEON)
+#define TEXTURE_CONVERSION_NEON
+#include <arm_neon.h>
+#if defined(__aarch64__)
+// FP16 conversions are only guaranteed on AArch64.
+#define TEXTURE_CONVERSION_NEON_FP16
+#endif
+#endif
+
+namespace Vulkan
+{
+namespace TextureConversion
+{
+struct SRGBTables
+{
+	enum { LinearToSRGBEntries = 1 << 14 };
+
+	SRGBTables()
+	{
+		for (unsigned i = 0; i < 256; i++)
+		{
+			float v = float(i) / 255.0f;
+			to_linear[i] = v <= 0.04045f ? (v / 12.92f) : powf((v + 0.055f) / 1.055f, 2.4f);
+		}
+
+		for (unsigned i = 0; i < LinearToSRGBEntries; i++)
+		{
+			float v = float(i) / float(LinearToSRGBEntries - 1);
+			float s = v <= 0.0031308f ? (12.92f * v) : (1.055f * powf(v, 1.0f / 2.4f) - 0.055f);
+			from_linear[i] = uint8_t(std::min(255.0f, s * 255.0f + 0.5f));
+		}
+	}
+
+	float to_linear[256];
+	uint8_t from_linear[LinearToSRGBEntries];
+};
+
+static const SRGBTables &get_srgb_tables()
+{
+	static const SRGBTables tables;
+	return tables;
+}
+
+static inline uint8_t encode_srgb(const SRGBTables &tables, float v)
+{
+	v = std::max(0.0f, std::min(1.0f, v));
+	return tables.from_linear[unsigned(v * float(SRGBTables::LinearToSRGBEntries - 1) + 0.5f)];
+}
+
+float srgb8_to_linear(uint8_t v)
+{
+	return get_srgb_tables().to_linear[v];
+}
+
+uint8_t linear_to_srgb8(float v)
+{
+	return encode_srgb(get_srgb_tables(), v);
+}
+
+uint16_t float_to_half(float v)
+{
+	uint32_t f;
+	memcpy(&f, &v, sizeof(f));
+	uint32_t sign = (f >> 16) & 0x8000u;
+	f &= 0x7fffffffu;
+
+	uint32_t o;
+	if (f >= ((127u + 16u) << 23))
+	{
+		// Overflow to Inf, or NaN.
+		o = f > 0x7f800000u ? 0x7e00u : 0x7c00u;
+	}
+	else if (f < ((127u - 14u) << 23))
+	{
+		// Result is subnormal. Let the FPU do the rounding by adding a magic number.
+		const uint32_t magic_bits = ((127u - 15u) + (23u - 10u) + 1u) << 23;
+		float magic, abs_v;
+		memcpy(&magic, &magic_bits, sizeof(magic));
+		memcpy(&abs_v, &f, sizeof(abs_v));
+		abs_v += magic;
+		memcpy(&o, &abs_v, sizeof(o));
+		o -= magic_bits;
+	}
+	else
+	{
+		// Rebias exponent and round to nearest even.
+		uint32_t mant_odd = (f >> 13) & 1u;
+		f += 0xfffu - ((127u - 15u) << 23);
+		f += mant_odd;
+		o = f >> 13;
+	}
+
+	return uint16_t(o | sign);
+}
+
+float half_to_float(uint16_t v)
+{
+	const uint32_t magic_bits = (254u - 15u) << 23;
+	uint32_t expmant = v & 0x7fffu;
+	uint32_t shifted = expmant << 13;
+
+	float magic, scaled;
+	memcpy(&magic, &magic_bits, sizeof(magic));
+	memcpy(&scaled, &shifted, sizeof(scaled));
+	scaled *= magic;
+
+	uint32_t bits;
+	memcpy(&bits, &scaled, sizeof(bits));
+	if (expmant >= 0x7c00u)
+		bits |= 255u << 23;
+	bits |= uint32_t(v & 0x8000u) << 16;
+
+	float result;
+	memcpy(&result, &bits, sizeof(result));
+	return result;
+}
+
+#ifdef TEXTURE_CONVERSION_SSE2
+// Returns FP16 values in the low 16 bits of each lane, sign-extended so that _mm_packs_epi32 is lossless.
+static inline __m128i float_to_half_sse2(__m128 f)
+{
+	const __m128 mask_sign = _mm_set1_ps(-0.0f);
+	const __m128i c_f16max = _mm_set1_epi32((127 + 16) << 23);
+	const __m128i c_nanbit = _mm_set1_epi32(0x200);
+	const __m128i c_infty_as_fp16 = _mm_set1_epi32(0x7c00);
+	const __m128i c_min_normal = _mm_set1_epi32((127 - 14) << 23);
+	const __m128i c_subnorm_magic = _mm_set1_epi32(((127 - 15) + (23 - 10) + 1) << 23);
+	const __m128i c_normal_bias = _mm_set1_epi32(0xfff - ((127 - 15) << 23));
+
+	__m128 justsign = _mm_and_ps(f, mask_sign);
+	__m128 absf = _mm_xor_ps(f, justsign);
+	__m128i absf_int = _mm_castps_si128(absf);
+	__m128 b_isnan = _mm_cmpunord_ps(absf, absf);
+	__m128i b_isregular = _mm_cmpgt_epi32(c_f16max, absf_int);
+	__m128i nanbit = _mm_and_si128(_mm_castps_si128(b_isnan), c_nanbit);
+	__m128i inf_or_nan = _mm_or_si128(nanbit, c_infty_as_fp16);
+	__m128i b_issub = _mm_cmpgt_epi32(c_min_normal, absf_int);
+
+	__m128 subnorm1 = _mm_add_ps(absf, _mm_castsi128_ps(c_subnorm_magic));
+	__m128i subnorm2 = _mm_sub_epi32(_mm_castps_si128(subnorm1), c_subnorm_magic);
+
+	__m128i mantodd = _mm_srai_epi32(_mm_slli_epi32(absf_int, 31 - 13), 31);
+	__m128i round1 = _mm_add_epi32(absf_int, c_normal_bias);
+	__m128i normal = _mm_srli_epi32(_mm_sub_epi32(round1, mantodd), 13);
+
+	__m128i nonspecial = _mm_or_si128(_mm_and_si128(subnorm2, b_issub), _mm_andnot_si128(b_issub, normal));
+	__m128i joined = _mm_or_si128(_mm_and_si128(nonspecial, b_isregular), _mm_andnot_si128(b_isregular, inf_or_nan));
+	__m128i sign_shift = _mm_srai_epi32(_mm_castps_si128(justsign), 16);
+	return _mm_or_si128(joined, sign_shift);
+}
+
+// Expects zero-extended FP16 values in each 32-bit lane.
+static inline __m128 half_to_float_sse2(__m128i h)
+{
+	const __m128i mask_nosign = _mm_set1_epi32(0x7fff);
+	const __m128 magic = _mm_castsi128_ps(_mm_set1_epi32((254 - 15) << 23));
+	const __m128i was_infnan = _mm_set1_epi32(0x7bff);
+	const __m128 exp_infnan = _mm_castsi128_ps(_mm_set1_epi32(255 << 23));
+
+	__m128i expmant = _mm_and_si128(mask_nosign, h);
+	__m128i justsign = _mm_xor_si128(h, expmant);
+	__m128 scaled = _mm_mul_ps(_mm_castsi128_ps(_mm_slli_epi32(expmant, 13)), magic);
+	__m128i b_wasinfnan = _mm_cmpgt_epi32(expmant, was_infnan);
+	__m128i sign = _mm_slli_epi32(justsign, 16);
+	__m128 infnanexp = _mm_and_ps(_mm_castsi128_ps(b_wasinfnan), exp_infnan);
+	return _mm_or_ps(scaled, _mm_or_ps(_mm_castsi128_ps(sign), infnanexp));
+}
+
+// Loads two RGBA16F pixels and returns them as two float vectors.
+static inline void load_rgba16f_x2_sse2(const uint16_t *src, __m128 &p0, __m128 &p1)
+{
+	__m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+	p0 = half_to_float_sse2(_mm_unpacklo_epi16(h, _mm_setzero_si128()));
+	p1 = half_to_float_sse2(_mm_unpackhi_epi16(h, _mm_setzero_si128()));
+}
+#endif
+
+// The sRGB tables have no vector gather on SSE2/NEON, so lookups stay scalar while the arithmetic
+// and LUT index computation run four pixels at a time. Results match the scalar paths exactly.
+#if defined(TEXTURE_CONVERSION_SSE2)
+// Linearizes the same channel of four RGBA8 pixels, stride bytes apart.
+static inline __m128 load_linear_x4_sse2(const SRGBTables &tables, const uint8_t *channel, size_t stride)
+{
+	return _mm_setr_ps(tables.to_linear[channel[0]], tables.to_linear[channel[stride]],
+	                   tables.to_linear[channel[2 * stride]], tables.to_linear[channel[3 * stride]]);
+}
+
+// Vector form of the clamp and index computation in encode_srgb().
+static inline void encode_srgb_indices_sse2(uint32_t *indices, __m128 v)
+{
+	const __m128 scale = _mm_set1_ps(float(SRGBTables::LinearToSRGBEntries - 1));
+	v = _mm_max_ps(_mm_min_ps(v, _mm_set1_ps(1.0f)), _mm_setzero_ps());
+	__m128i index = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(v, scale), _mm_set1_ps(0.5f)));
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(indices), index);
+}
+#elif defined(TEXTURE_CONVERSION_NEON)
+static inline float32x4_t load_linear_x4_neon(const SRGBTables &tables, const uint8_t *channel, size_t stride)
+{
+	const float linear[4] = {
+		tables.to_linear[channel[0]], tables.to_linear[channel[stride]],
+		tables.to_linear[channel[2 * stride]], tables.to_linear[channel[3 * stride]],
+	};
+	return vld1q_f32(linear);
+}
+
+static inline void encode_srgb_indices_neon(uint32_t *indices, float32x4_t v)
+{
+	const float32x4_t scale = vdupq_n_f32(float(SRGBTables::LinearToSRGBEntries - 1));
+	v = vmaxq_f32(vminq_f32(v, vdupq_n_f32(1.0f)), vdupq_n_f32(0.0f));
+	vst1q_u32(indices, vcvtq_u32_f32(vaddq_f32(vmulq_f32(v, scale), vdupq_n_f32(0.5f))));
+}
+#endif
+
+void expand_to_rgba8(uint8_t *dst, const uint8_t *src, size_t count, unsigned components)
+{
+	size_t i = 0;
+
+	switch (components)
+	{
+	case 4:
+		memcpy(dst, src, count * 4);
+		break;
+
+	case 3:
+#if defined(TEXTURE_CONVERSION_SSSE3)
+	{
+		const __m128i shuf = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+		const __m128i alpha = _mm_set1_epi32(int(0xff000000u));
+		// 16 byte loads read 4 bytes past the 4 pixels we consume, so stop early.
+		for (; i + 6 <= count; i += 4)
+		{
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 3 * i));
+			v = _mm_or_si128(_mm_shuffle_epi8(v, shuf), alpha);
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 4 * i), v);
+		}
+	}
+#elif defined(TEXTURE_CONVERSION_NEON)
+		for (; i + 16 <= count; i += 16)
+		{
+			uint8x16x3_t v = vld3q_u8(src + 3 * i);
+			uint8x16x4_t o;
+			o.val[0] = v.val[0];
+			o.val[1] = v.val[1];
+			o.val[2] = v.val[2];
+			o.val[3] = vdupq_n_u8(0xff);
+			vst4q_u8(dst + 4 * i, o);
+		}
+#endif
+		for (; i < count; i++)
+		{
+			dst[4 * i + 0] = src[3 * i + 0];
+			dst[4 * i + 1] = src[3 * i + 1];
+			dst[4 * i + 2] = src[3 * i + 2];
+			dst[4 * i + 3] = 0xff;
+		}
+		break;
+
+	case 2:
+#if defined(TEXTURE_CONVERSION_NEON)
+		for (; i + 16 <= count; i += 16)
+		{
+			uint8x16x2_t v = vld2q_u8(src + 2 * i);
+			uint8x16x4_t o;
+			o.val[0] = v.val[0];
+			o.val[1] = v.val[0];
+			o.val[2] = v.val[0];
+			o.val[3] = v.val[1];
+			vst4q_u8(dst + 4 * i, o);
+		}
+#elif defined(TEXTURE_CONVERSION_SSE2)
+		for (; i + 8 <= count; i += 8)
+		{
+			// [g0 a0 g1 a1 ...] -> [g0 g0 a0 a0 ...] -> [g0 g0 g0 a0 ...].
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 2 * i));
+			__m128i gg = _mm_unpacklo_epi8(v, v);
+			__m128i gg_hi = _mm_unpackhi_epi8(v, v);
+			const __m128i gray_mask = _mm_set1_epi32(0x00ffffff);
+			__m128i lo = _mm_or_si128(_mm_and_si128(_mm_shufflelo_epi16(_mm_shufflehi_epi16(gg, _MM_SHUFFLE(2, 2, 0, 0)), _MM_SHUFFLE(2, 2, 0, 0)), gray_mask),
+			                          _mm_andnot_si128(gray_mask, gg));
+			__m128i hi = _mm_or_si128(_mm_and_si128(_mm_shufflelo_epi16(_mm_shufflehi_epi16(gg_hi, _MM_SHUFFLE(2, 2, 0, 0)), _MM_SHUFFLE(2, 2, 0, 0)), gray_mask),
+			                          _mm_andnot_si128(gray_mask, gg_hi));
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 4 * i), lo);
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 4 * i + 16), hi);
+		}
+#endif
+		for (; i < count; i++)
+		{
+			dst[4 * i + 0] = src[2 * i + 0];
+			dst[4 * i + 1] = src[2 * i + 0];
+			dst[4 * i + 2] = src[2 * i + 0];
+			dst[4 * i + 3] = src[2 * i + 1];
+		}
+		break;
+
+	case 1:
+#if defined(TEXTURE_CONVERSION_NEON)
+		for (; i + 16 <= count; i += 16)
+		{
+			uint8x16_t v = vld1q_u8(src + i);
+			uint8x16x4_t o;
+			o.val[0] = v;
+			o.val[1] = v;
+			o.val[2] = v;
+			o.val[3] = vdupq_n_u8(0xff);
+			vst4q_u8(dst + 4 * i, o);
+		}
+#elif defined(TEXTURE_CONVERSION_SSE2)
+		for (; i + 16 <= count; i += 16)
+		{
+			const __m128i alpha = _mm_set1_epi32(int(0xff000000u));
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+			__m128i v8_lo = _mm_unpacklo_epi8(v, v);
+			__m128i v8_hi = _mm_unpackhi_epi8(v, v);
+			__m128i v16[4] = {
+				_mm_unpacklo_epi16(v8_lo, v8_lo),
+				_mm_unpackhi_epi16(v8_lo, v8_lo),
+				_mm_unpacklo_epi16(v8_hi, v8_hi),
+				_mm_unpackhi_epi16(v8_hi, v8_hi),
+			};
+			for (unsigned j = 0; j < 4; j++)
+				_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 4 * i + 16 * j), _mm_or_si128(v16[j], alpha));
+		}
+#endif
+		for (; i < count; i++)
+		{
+			dst[4 * i + 0] = src[i];
+			dst[4 * i + 1] = src[i];
+			dst[4 * i + 2] = src[i];
+			dst[4 * i + 3] = 0xff;
+		}
+		break;
+
+	default:
+		break;
+	}
+}
+
+void convert_rgb32f_to_rgba16f(uint16_t *dst, const float *src, size_t count)
+{
+	size_t i = 0;
+
+#if defined(TEXTURE_CONVERSION_SSE2)
+	const __m128 rgb_mask = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+	const __m128 alpha_one = _mm_setr_ps(0.0f, 0.0f, 0.0f, 1.0f);
+	// Each pixel load reads one float past the pixel, so make sure pixel i + 2 exists.
+	for (; i + 3 <= count; i += 2)
+	{
+		__m128 p0 = _mm_or_ps(_mm_and_ps(_mm_loadu_ps(src + 3 * i), rgb_mask), alpha_one);
+		__m128 p1 = _mm_or_ps(_mm_and_ps(_mm_loadu_ps(src + 3 * i + 3), rgb_mask), alpha_one);
+		__m128i h = _mm_packs_epi32(float_to_half_sse2(p0), float_to_half_sse2(p1));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 4 * i), h);
+	}
+#elif defined(TEXTURE_CONVERSION_NEON_FP16)
+	for (; i + 4 <= count; i += 4)
+	{
+		float32x4x3_t v = vld3q_f32(src + 3 * i);
+		uint16x4x4_t o;
+		o.val[0] = vreinterpret_u16_f16(vcvt_f16_f32(v.val[0]));
+		o.val[1] = vreinterpret_u16_f16(vcvt_f16_f32(v.val[1]));
+		o.val[2] = vreinterpret_u16_f16(vcvt_f16_f32(v.val[2]));
+		o.val[3] = vdup_n_u16(0x3c00);
+		vst4_u16(dst + 4 * i, o);
+	}
+#endif
+
+	for (; i < count; i++)
+	{
+		dst[4 * i + 0] = float_to_half(src[3 * i + 0]);
+		dst[4 * i + 1] = float_to_half(src[3 * i + 1]);
+		dst[4 * i + 2] = float_to_half(src[3 * i + 2]);
+		dst[4 * i + 3] = 0x3c00;
+	}
+}
+
+static void premultiply_alpha_rgba8_unorm(uint8_t *data, size_t count)
+{
+	size_t i = 0;
+
+#if defined(TEXTURE_CONVERSION_SSE2)
+	// Exact rounding of c * a / 255: x = c * a + 128, (x + (x >> 8)) >> 8.
+	const __m128i bias = _mm_set1_epi16(128);
+	// Forces the alpha channel multiplier to 255 so alpha is passed through.
+	const __m128i alpha_keep = _mm_setr_epi16(0, 0, 0, 255, 0, 0, 0, 255);
+	const __m128i alpha_clear = _mm_setr_epi16(-1, -1, -1, 0, -1, -1, -1, 0);
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 4 * i));
+		__m128i halves[2] = {
+			_mm_unpacklo_epi8(v, _mm_setzero_si128()),
+			_mm_unpackhi_epi8(v, _mm_setzero_si128()),
+		};
+
+		for (auto &c : halves)
+		{
+			__m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(c, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+			a = _mm_or_si128(_mm_and_si128(a, alpha_clear), alpha_keep);
+			__m128i x = _mm_add_epi16(_mm_mullo_epi16(c, a), bias);
+			c = _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+		}
+
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(data + 4 * i), _mm_packus_epi16(halves[0], halves[1]));
+	}
+#elif defined(TEXTURE_CONVERSION_NEON)
+	for (; i + 8 <= count; i += 8)
+	{
+		uint8x8x4_t v = vld4_u8(data + 4 * i);
+		for (unsigned c = 0; c < 3; c++)
+		{
+			uint16x8_t x = vaddq_u16(vmull_u8(v.val[c], v.val[3]), vdupq_n_u16(128));
+			v.val[c] = vaddhn_u16(x, vshrq_n_u16(x, 8));
+		}
+		vst4_u8(data + 4 * i, v);
+	}
+#endif
+
+	for (; i < count; i++)
+	{
+		uint32_t a = data[4 * i + 3];
+		for (unsigned c = 0; c < 3; c++)
+		{
+			uint32_t x = data[4 * i + c] * a + 128;
+			data[4 * i + c] = uint8_t((x + (x >> 8)) >> 8);
+		}
+	}
+}
+
+void premultiply_alpha_rgba8(uint8_t *data, size_t count, bool srgb)
+{
+	if (!srgb)
+	{
+		premultiply_alpha_rgba8_unorm(data, count);
+		return;
+	}
+
+	auto &tables = get_srgb_tables();
+	size_t i = 0;
+
+#if defined(TEXTURE_CONVERSION_SSE2) || defined(TEXTURE_CONVERSION_NEON)
+	for (; i + 4 <= count; i += 4)
+	{
+		uint8_t *pixels = data + 4 * i;
+		uint32_t indices[3][4];
+
+#if defined(TEXTURE_CONVERSION_SSE2)
+		__m128i rgba = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pixels));
+		__m128 a = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(rgba, 24)), _mm_set1_ps(1.0f / 255.0f));
+		for (unsigned c = 0; c < 3; c++)
+			encode_srgb_indices_sse2(indices[c], _mm_mul_ps(load_linear_x4_sse2(tables, pixels + c, 4), a));
+#else
+		uint32x4_t rgba = vreinterpretq_u32_u8(vld1q_u8(pixels));
+		float32x4_t a = vmulq_n_f32(vcvtq_f32_u32(vshrq_n_u32(rgba, 24)), 1.0f / 255.0f);
+		for (unsigned c = 0; c < 3; c++)
+			encode_srgb_indices_neon(indices[c], vmulq_f32(load_linear_x4_neon(tables, pixels + c, 4), a));
+#endif
+
+		for (unsigned p = 0; p < 4; p++)
+		{
+			if (pixels[4 * p + 3] == 0xff)
+				continue;
+			for (unsigned c = 0; c < 3; c++)
+				pixels[4 * p + c] = tables.from_linear[indices[c][p]];
+		}
+	}
+#endif
+
+	for (; i < count; i++)
+	{
+		uint8_t alpha = data[4 * i + 3];
+		if (alpha == 0xff)
+			continue;
+
+		float a = float(alpha) * (1.0f / 255.0f);
+		for (unsigned c = 0; c < 3; c++)
+			data[4 * i + c] = encode_srgb(tables, tables.to_linear[data[4 * i + c]] * a);
+	}
+}
+
+void premultiply_alpha_rgba16f(uint16_t *data, size_t count)
+{
+	size_t i = 0;
+
+#if defined(TEXTURE_CONVERSION_SSE2)
+	const __m128 rgb_mask = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+	for (; i + 2 <= count; i += 2)
+	{
+		__m128 p0, p1;
+		load_rgba16f_x2_sse2(data + 4 * i, p0, p1);
+		__m128 a0 = _mm_shuffle_ps(p0, p0, _MM_SHUFFLE(3, 3, 3, 3));
+		__m128 a1 = _mm_shuffle_ps(p1, p1, _MM_SHUFFLE(3, 3, 3, 3));
+		p0 = _mm_or_ps(_mm_and_ps(_mm_mul_ps(p0, a0), rgb_mask), _mm_andnot_ps(rgb_mask, p0));
+		p1 = _mm_or_ps(_mm_and_ps(_mm_mul_ps(p1, a1), rgb_mask), _mm_andnot_ps(rgb_mask, p1));
+		__m128i h = _mm_packs_epi32(float_to_half_sse2(p0), float_to_half_sse2(p1));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(data + 4 * i), h);
+	}
+#elif defined(TEXTURE_CONVERSION_NEON_FP16)
+	for (; i + 4 <= count; i += 4)
+	{
+		uint16x4x4_t v = vld4_u16(data + 4 * i);
+		float32x4_t a = vcvt_f32_f16(vreinterpret_f16_u16(v.val[3]));
+		for (unsigned c = 0; c < 3; c++)
+		{
+			float32x4_t f = vcvt_f32_f16(vreinterpret_f16_u16(v.val[c]));
+			v.val[c] = vreinterpret_u16_f16(vcvt_f16_f32(vmulq_f32(f, a)));
+		}
+		vst4_u16(data + 4 * i, v);
+	}
+#endif
+
+	for (; i < count; i++)
+	{
+		float a = half_to_float(data[4 * i + 3]);
+		for (unsigned c = 0; c < 3; c++)
+			data[4 * i + c] = float_to_half(half_to_float(data[4 * i + c]) * a);
+	}
+}
+
+static void box_row_rgba8_unorm(uint8_t *dst, const uint8_t *row0, const uint8_t *row1,
+                                uint32_t src_width, uint32_t dst_width)
+{
+	uint32_t x = 0;
+
+#if defined(TEXTURE_CONVERSION_SSE2)
+	const __m128i round = _mm_set1_epi16(2);
+	for (; x + 2 <= dst_width && 2 * x + 4 <= src_width; x += 2)
+	{
+		__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row0 + 8 * x));
+		__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row1 + 8 * x));
+		__m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, _mm_setzero_si128()), _mm_unpacklo_epi8(b, _mm_setzero_si128()));
+		__m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, _mm_setzero_si128()), _mm_unpackhi_epi8(b, _mm_setzero_si128()));
+		lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+		hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+		__m128i sum = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(lo, hi), round), 2);
+		_mm_storel_epi64(reinterpret_cast<__m128i *>(dst + 4 * x), _mm_packus_epi16(sum, sum));
+	}
+#elif defined(TEXTURE_CONVERSION_NEON)
+	for (; x + 2 <= dst_width && 2 * x + 4 <= src_width; x += 2)
+	{
+		uint8x16_t a = vld1q_u8(row0 + 8 * x);
+		uint8x16_t b = vld1q_u8(row1 + 8 * x);
+		uint16x8_t lo = vaddl_u8(vget_low_u8(a), vget_low_u8(b));
+		uint16x8_t hi = vaddl_u8(vget_high_u8(a), vget_high_u8(b));
+		uint16x4_t out0 = vadd_u16(vget_low_u16(lo), vget_high_u16(lo));
+		uint16x4_t out1 = vadd_u16(vget_low_u16(hi), vget_high_u16(hi));
+		vst1_u8(dst + 4 * x, vrshrn_n_u16(vcombine_u16(out0, out1), 2));
+	}
+#endif
+
+	for (; x < dst_width; x++)
+	{
+		uint32_t x0 = std::min(2 * x, src_width - 1);
+		uint32_t x1 = std::min(2 * x + 1, src_width - 1);
+		for (unsigned c = 0; c < 4; c++)
+		{
+			uint32_t sum = row0[4 * x0 + c] + row0[4 * x1 + c] + row1[4 * x0 + c] + row1[4 * x1 + c];
+			dst[4 * x + c] = uint8_t((sum + 2) >> 2);
+		}
+	}
+}
+
+static void box_row_rgba8_srgb(const SRGBTables &tables, uint8_t *dst, const uint8_t *row0, const uint8_t *row1,
+                               uint32_t src_width, uint32_t dst_width)
+{
+	// Alpha is linear, so the UNORM kernel filters it. RGB is overwritten below.
+	box_row_rgba8_unorm(dst, row0, row1, src_width, dst_width);
+
+	uint32_t x = 0;
+
+#if defined(TEXTURE_CONVERSION_SSE2) || defined(TEXTURE_CONVERSION_NEON)
+	for (; x + 4 <= dst_width && 2 * x + 8 <= src_width; x += 4)
+	{
+		uint32_t indices[3][4];
+		for (unsigned c = 0; c < 3; c++)
+		{
+			const uint8_t *a = row0 + 8 * x + c;
+			const uint8_t *b = row1 + 8 * x + c;
+#if defined(TEXTURE_CONVERSION_SSE2)
+			__m128 sum = _mm_add_ps(load_linear_x4_sse2(tables, a, 8), load_linear_x4_sse2(tables, a + 4, 8));
+			sum = _mm_add_ps(sum, load_linear_x4_sse2(tables, b, 8));
+			sum = _mm_add_ps(sum, load_linear_x4_sse2(tables, b + 4, 8));
+			encode_srgb_indices_sse2(indices[c], _mm_mul_ps(sum, _mm_set1_ps(0.25f)));
+#else
+			float32x4_t sum = vaddq_f32(load_linear_x4_neon(tables, a, 8), load_linear_x4_neon(tables, a + 4, 8));
+			sum = vaddq_f32(sum, load_linear_x4_neon(tables, b, 8));
+			sum = vaddq_f32(sum, load_linear_x4_neon(tables, b + 4, 8));
+			encode_srgb_indices_neon(indices[c], vmulq_n_f32(sum, 0.25f));
+#endif
+		}
+
+		for (unsigned p = 0; p < 4; p++)
+			for (unsigned c = 0; c < 3; c++)
+				dst[4 * (x + p) + c] = tables.from_linear[indices[c][p]];
+	}
+#endif
+
+	for (; x < dst_width; x++)
+	{
+		uint32_t x0 = std::min(2 * x, src_width - 1);
+		uint32_t x1 = std::min(2 * x + 1, src_width - 1);
+		for (unsigned c = 0; c < 3; c++)
+		{
+			float sum = tables.to_linear[row0[4 * x0 + c]] + tables.to_linear[row0[4 * x1 + c]] +
+			            tables.to_linear[row1[4 * x0 + c]] + tables.to_linear[row1[4 * x1 + c]];
+			dst[4 * x + c] = encode_srgb(tables, 0.25f * sum);
+		}
+	}
+}
+
+static void box_row_rgba16f(uint16_t *dst, const uint16_t *row0, const uint16_t *row1,
+                            uint32_t src_width, uint32_t dst_width)
+{
+	uint32_t x = 0;
+
+#if defined(TEXTURE_CONVERSION_SSE2)
+	const __m128 quarter = _mm_set1_ps(0.25f);
+	for (; x + 2 <= dst_width && 2 * x + 4 <= src_width; x += 2)
+	{
+		__m128 a0, a1, a2, a3, b0, b1, b2, b3;
+		load_rgba16f_x2_sse2(row0 + 8 * x, a0, a1);
+		load_rgba16f_x2_sse2(row0 + 8 * x + 8, a2, a3);
+		load_rgba16f_x2_sse2(row1 + 8 * x, b0, b1);
+		load_rgba16f_x2_sse2(row1 + 8 * x + 8, b2, b3);
+		__m128 out0 = _mm_mul_ps(_mm_add_ps(_mm_add_ps(a0, a1), _mm_add_ps(b0, b1)), quarter);
+		__m128 out1 = _mm_mul_ps(_mm_add_ps(_mm_add_ps(a2, a3), _mm_add_ps(b2, b3)), quarter);
+		__m128i h = _mm_packs_epi32(float_to_half_sse2(out0), float_to_half_sse2(out1));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 4 * x), h);
+	}
+#elif defined(TEXTURE_CONVERSION_NEON_FP16)
+	for (; x < dst_width && 2 * x + 2 <= src_width; x++)
+	{
+		float32x4_t a0 = vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(row0 + 8 * x)));
+		float32x4_t a1 = vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(row0 + 8 * x + 4)));
+		float32x4_t b0 = vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(row1 + 8 * x)));
+		float32x4_t b1 = vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(row1 + 8 * x + 4)));
+		float32x4_t sum = vmulq_n_f32(vaddq_f32(vaddq_f32(a0, a1), vaddq_f32(b0, b1)), 0.25f);
+		vst1_u16(dst + 4 * x, vreinterpret_u16_f16(vcvt_f16_f32(sum)));
+	}
+#endif
+
+	for (; x < dst_width; x++)
+	{
+		uint32_t x0 = std::min(2 * x, src_width - 1);
+		uint32_t x1 = std::min(2 * x + 1, src_width - 1);
+		for (unsigned c = 0; c < 4; c++)
+		{
+			float sum = half_to_float(row0[4 * x0 + c]) + half_to_float(row0[4 * x1 + c]) +
+			            half_to_float(row1[4 * x0 + c]) + half_to_float(row1[4 * x1 + c]);
+			dst[4 * x + c] = float_to_half(0.25f * sum);
+		}
+	}
+}
+
+bool generate_mipmaps(const TextureFormatLayout &layout)
+{
+	auto format = layout.get_format();
+	bool is_srgb = format == VK_FORMAT_R8G8B8A8_SRGB;
+	bool is_unorm = format == VK_FORMAT_R8G8B8A8_UNORM;
+	bool is_half = format == VK_FORMAT_R16G16B16A16_SFLOAT;
+
+	if ((!is_srgb && !is_unorm && !is_half) || layout.get_image_type() != VK_IMAGE_TYPE_2D)
+		return false;
+
+	auto &tables = get_srgb_tables();
+
+	for (uint32_t layer = 0; layer < layout.get_layers(); layer++)
+	{
+		for (uint32_t level = 1; level < layout.get_levels(); level++)
+		{
+			auto &src_mip = layout.get_mip_info(level - 1);
+			auto &dst_mip = layout.get_mip_info(level);
+			auto *src = static_cast<const uint8_t *>(layout.data(layer, level - 1));
+			auto *dst = static_cast<uint8_t *>(layout.data(layer, level));
+			size_t src_stride = layout.get_row_size(level - 1);
+			size_t dst_stride = layout.get_row_size(level);
+
+			for (uint32_t y = 0; y < dst_mip.height; y++)
+			{
+				uint32_t y0 = std::min(2 * y, src_mip.height - 1);
+				uint32_t y1 = std::min(2 * y + 1, src_mip.height - 1);
+				const uint8_t *row0 = src + y0 * src_stride;
+				const uint8_t *row1 = src + y1 * src_stride;
+				uint8_t *dst_row = dst + y * dst_stride;
+
+				if (is_half)
+				{
+					box_row_rgba16f(reinterpret_cast<uint16_t *>(dst_row),
+					                reinterpret_cast<const uint16_t *>(row0),
+					                reinterpret_cast<const uint16_t *>(row1),
+					                src_mip.width, dst_mip.width);
+				}
+				else if (is_srgb)
+					box_row_rgba8_srgb(tables, dst_row, row0, row1, src_mip.width, dst_mip.width);
+				else
+					box_row_rgba8_unorm(dst_row, row0, row1, src_mip.width, dst_mip.width);
+			}
+		}
+	}
+
+	return true;
+}
+}
+}
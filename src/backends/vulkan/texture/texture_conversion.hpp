@@ -0,0 +1,59 @@
+/* Copyright (c) 2017-2026 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace Vulkan
+{
+class TextureFormatLayout;
+
+// CPU-side pixel conversion kernels used by the texture importers.
+// SSE2 (x86) and NEON (ARM) paths are selected at compile time with a scalar fallback.
+// All kernels operate on tightly packed rows, and src and dst must not alias unless noted.
+namespace TextureConversion
+{
+// Expands 1, 2 or 3 component 8-bit pixels to RGBA8 with the same rules as stb_image.
+// Gray is replicated into RGB and missing alpha becomes 255.
+void expand_to_rgba8(uint8_t *dst, const uint8_t *src, size_t count, unsigned components);
+
+// Converts RGB32F to RGBA16F with alpha = 1.0, rounding to nearest even.
+void convert_rgb32f_to_rgba16f(uint16_t *dst, const float *src, size_t count);
+
+// Single value helpers, mostly useful for verifying the vectorized paths.
+uint16_t float_to_half(float v);
+float half_to_float(uint16_t v);
+float srgb8_to_linear(uint8_t v);
+uint8_t linear_to_srgb8(float v);
+
+// In-place alpha premultiplication. For sRGB data, color is premultiplied in linear space.
+void premultiply_alpha_rgba8(uint8_t *data, size_t count, bool srgb);
+void premultiply_alpha_rgba16f(uint16_t *data, size_t count);
+
+// Fills mip levels [1, levels) of every layer with a 2x2 box filter of the previous level.
+// Level 0 must already be written. Supports RGBA8 (UNORM and SRGB) and RGBA16F 2D layouts.
+// Returns false if the layout format is not supported.
+bool generate_mipmaps(const TextureFormatLayout &layout);
+}
+}
@@ -21,55 +21,86 @@
  */
 
 #include "texture_files.hpp"
+#include "texture_conversion.hpp"
 #include "stb_image.h"
 #include "filesystem.hpp"
-#include "muglm/muglm_impl.hpp"
+#include "thread_group.hpp"
+#include "logging.hpp"
 #include <string.h>
 
 namespace Vulkan
 {
-static MemoryMappedTexture load_stb(const void *data, size_t size, ColorSpace color)
+static MemoryMappedTexture load_stb(const void *data, size_t size, ColorSpace color, TextureImportFlags flags)
 {
 	int width, height;
 	int components;
-	auto *buffer = stbi_load_from_memory(static_cast<const stbi_uc *>(data), size, &width, &height, &components, 4);
+	// Decode with native component count and expand straight into the layout to avoid a second full-size copy.
+	auto *buffer = stbi_load_from_memory(static_cast<const stbi_uc *>(data), int(size), &width, &height, &components, 0);
 
 	if (!buffer)
 		return {};
 
+	bool cpu_mipgen = (flags & TEXTURE_IMPORT_GENERATE_MIPMAPS_BIT) != 0;
+	bool srgb = color == ColorSpace::sRGB;
+
 	MemoryMappedTexture tex;
-	tex.set_2d(color == ColorSpace::sRGB ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM, width, height);
-	tex.set_generate_mipmaps_on_load(true);
+	tex.set_2d(srgb ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM, width, height, 1,
+	           cpu_mipgen ? TextureFormatLayout::num_miplevels(width, height) : 1);
+	tex.set_generate_mipmaps_on_load(!cpu_mipgen);
 	if (!tex.map_write_scratch())
+	{
+		stbi_image_free(buffer);
 		return {};
+	}
 
-	memcpy(tex.get_layout().data(), buffer, width * height * 4);
+	auto &layout = tex.get_layout();
+	auto *pixels = static_cast<uint8_t *>(layout.data());
+	size_t count = size_t(width) * size_t(height);
+	TextureConversion::expand_to_rgba8(pixels, buffer, count, unsigned(components));
 	stbi_image_free(buffer);
+
+	if ((flags & TEXTURE_IMPORT_PREMULTIPLY_ALPHA_BIT) != 0 && (components == 2 || components == 4))
+		TextureConversion::premultiply_alpha_rgba8(pixels, count, srgb);
+	if (cpu_mipgen)
+		TextureConversion::generate_mipmaps(layout);
+
 	return tex;
 }
 
-static MemoryMappedTexture load_hdr(const void *data, size_t size)
+static MemoryMappedTexture load_hdr(const void *data, size_t size, TextureImportFlags flags)
 {
 	int width, height;
 	int components;
-	auto *buffer = stbi_loadf_from_memory(static_cast<const stbi_uc *>(data), size, &width, &height, &components, 3);
+	auto *buffer = stbi_loadf_from_memory(static_cast<const stbi_uc *>(data), int(size), &width, &height, &components, 3);
 
-	MemoryMappedTexture tex;
-	tex.set_2d(VK_FORMAT_R16G16B16A16_SFLOAT, width, height);
-	if (!tex.map_write_scratch())
+	if (!buffer)
 		return {};
-	tex.set_generate_mipmaps_on_load(true);
 
-	auto *converted = static_cast<muglm::u16vec4 *>(tex.get_layout().data());
-	for (int i = 0; i < width * height; i++)
+	bool cpu_mipgen = (flags & TEXTURE_IMPORT_GENERATE_MIPMAPS_BIT) != 0;
+
+	MemoryMappedTexture tex;
+	tex.set_2d(VK_FORMAT_R16G16B16A16_SFLOAT, width, height, 1,
+	           cpu_mipgen ? TextureFormatLayout::num_miplevels(width, height) : 1);
+	tex.set_generate_mipmaps_on_load(!cpu_mipgen);
+	if (!tex.map_write_scratch())
 	{
-		converted[i] = muglm::floatToHalf(muglm::vec4(buffer[3 * i + 0], buffer[3 * i + 1], buffer[3 * i + 2], 1.0f));
+		stbi_image_free(buffer);
+		return {};
 	}
+
+	auto &layout = tex.get_layout();
+	TextureConversion::convert_rgb32f_to_rgba16f(static_cast<uint16_t *>(layout.data()), buffer,
+	                                             size_t(width) * size_t(height));
 	stbi_image_free(buffer);
+
+	// Alpha is always 1, so premultiplication is a no-op here.
+	if (cpu_mipgen)
+		TextureConversion::generate_mipmaps(layout);
+
 	return tex;
 }
 
-MemoryMappedTexture load_texture_from_memory(const void *data, size_t size, ColorSpace color)
+MemoryMappedTexture load_texture_from_memory(const void *data, size_t size, ColorSpace color, TextureImportFlags flags)
 {
 	static const uint8_t png_magic[] = {
 		0x89, 'P', 'N', 'G', 0x0d, 0x0a, 0x1a, 0x0a,
@@ -84,11 +115,11 @@ MemoryMappedTexture load_texture_from_memory(const void *data, size_t size, Colo
 	};
 
 	if (size >= sizeof(png_magic) && memcmp(data, png_magic, sizeof(png_magic)) == 0)
-		return load_stb(data, size, color);
+		return load_stb(data, size, color, flags);
 	else if (size >= 2 && memcmp(data, jpg_magic, sizeof(jpg_magic)) == 0)
-		return load_stb(data, size, color);
+		return load_stb(data, size, color, flags);
 	else if (size >= sizeof(hdr_magic) && memcmp(data, hdr_magic, sizeof(hdr_magic)) == 0)
-		return load_hdr(data, size);
+		return load_hdr(data, size, flags);
 	else if (MemoryMappedTexture::is_header(data, size))
 	{
 		MemoryMappedTexture mapped;
@@ -98,11 +129,12 @@ MemoryMappedTexture load_texture_from_memory(const void *data, size_t size, Colo
 	else
 	{
 		// YOLO!
-		return load_stb(data, size, color);
+		return load_stb(data, size, color, flags);
 	}
 }
 
-MemoryMappedTexture load_texture_from_file(Granite::Filesystem &fs, const std::string &path, ColorSpace color)
+MemoryMappedTexture load_texture_from_file(Granite::Filesystem &fs, const std::string &path,
+                                           ColorSpace color, TextureImportFlags flags)
 {
 	auto file = fs.open(path, Granite::FileMode::ReadOnly);
 	if (!file)
@@ -119,6 +151,31 @@ MemoryMappedTexture load_texture_from_file(Granite::Filesystem &fs, const std::s
 		return tex;
 	}
 
-	return load_texture_from_memory(mapped->data(), mapped->get_size(), color);
+	return load_texture_from_memory(mapped->data(), mapped->get_size(), color, flags);
+}
+
+void enqueue_texture_imports(Granite::TaskGroup &task, Granite::Filesystem &fs,
+                             const TextureImportInfo *infos, size_t count,
+                             MemoryMappedTexture *output)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		task.enqueue_task([&fs, info = &infos[i], tex = &output[i]]() {
+			*tex = load_texture_from_file(fs, info->path, info->color, info->flags);
+			if (tex->empty())
+				LOGE("Failed to import texture %s.\n", info->path.c_str());
+		});
+	}
+}
+
+void load_textures_from_files(Granite::ThreadGroup &group, Granite::Filesystem &fs,
+                              const TextureImportInfo *infos, size_t count,
+                              MemoryMappedTexture *output)
+{
+	auto task = group.create_task();
+	task->set_desc("texture-import");
+	enqueue_texture_imports(*task, fs, infos, count, output);
+	task->flush();
+	task->wait();
 }
 }
\ No newline at end of file
@@ -28,6 +28,8 @@
 namespace Granite
 {
 class Filesystem;
+class ThreadGroup;
+struct TaskGroup;
 }
 
 namespace Vulkan
@@ -38,7 +40,36 @@ enum class ColorSpace
 	sRGB
 };
 
-MemoryMappedTexture load_texture_from_file(Granite::Filesystem &fs, const std::string &path, ColorSpace color = ColorSpace::sRGB);
+enum TextureImportFlagBits
+{
+	// Builds the full mip chain on the CPU instead of deferring to blits at upload time.
+	TEXTURE_IMPORT_GENERATE_MIPMAPS_BIT = 1 << 0,
+	// Premultiplies color by alpha. sRGB textures are premultiplied in linear space.
+	TEXTURE_IMPORT_PREMULTIPLY_ALPHA_BIT = 1 << 1
+};
+using TextureImportFlags = uint32_t;
+
+struct TextureImportInfo
+{
+	std::string path;
+	ColorSpace color = ColorSpace::sRGB;
+	TextureImportFlags flags = 0;
+};
+
+MemoryMappedTexture load_texture_from_file(Granite::Filesystem &fs, const std::string &path,
+                                           ColorSpace color = ColorSpace::sRGB, TextureImportFlags flags = 0);
 MemoryMappedTexture load_texture_from_memory(const void *data, size_t size,
-                                             ColorSpace color = ColorSpace::sRGB);
+                                             ColorSpace color = ColorSpace::sRGB, TextureImportFlags flags = 0);
+
+// Enqueues one decode task per texture into task.
+// output must hold count textures and outlive the task group.
+// Textures which fail to load are left empty.
+void enqueue_texture_imports(Granite::TaskGroup &task, Granite::Filesystem &fs,
+                             const TextureImportInfo *infos, size_t count,
+                             MemoryMappedTexture *output);
+
+// Decodes all textures on the thread group and blocks until they are complete.
+void load_textures_from_files(Granite::ThreadGroup &group, Granite::Filesystem &fs,
+                              const TextureImportInfo *infos, size_t count,
+                              MemoryMappedTexture *output);
 }
\ No newline at end of file
@@ -1445,6 +1445,45 @@ void WSI::set_enable_timing_feedback(bool enable)
 	present_feedback_enable = enable;
 }
 
+void WSI::set_frame_pacing(bool enable)
+{
+	if (enable && !frame_pacing_enable)
+		frame_pacer.reset();
+	frame_pacing_enable = enable;
+	if (enable)
+		present_feedback_enable = true;
+}
+
+void WSI::pace_frame()
+{
+	PresentationStats stats;
+	if (get_presentation_stats(stats) && stats.present_done_ts)
+		frame_pacer.add_feedback(stats.feedback_present_id, stats.gpu_done_ts, stats.present_done_ts);
+
+	RefreshRateInfo info;
+	if (get_refresh_rate_info(info))
+		frame_pacer.set_refresh_rate(info.refresh_duration, info.mode == RefreshMode::VRR);
+
+	uint64_t now = Util::get_current_time_nsecs();
+	uint64_t wake_time = 0, target_present = 0;
+	if (current_present_mode == PresentMode::SyncToVBlank &&
+	    frame_pacer.plan_frame(next_present_id, now, wake_time, target_present))
+	{
+		if (wake_time > now)
+		{
+			auto wait_ts = device->write_calibrated_timestamp();
+			std::this_thread::sleep_for(std::chrono::nanoseconds(wake_time - now));
+			device->register_time_interval("WSI", std::move(wait_ts), device->write_calibrated_timestamp(),
+			                               "frame_pacing");
+		}
+
+		if (!set_target_presentation_time(target_present, 0, false))
+			target_present = 0;
+	}
+
+	frame_pacer.begin_frame(next_present_id, Util::get_current_time_nsecs(), target_present);
+}
+
 bool WSI::begin_frame()
 {
 	if (frame_is_external)
@@ -1557,6 +1596,10 @@ bool WSI::begin_frame()
 				poll_present_timing_feedback();
 			}
 
+			// Sleep before sampling time and input, so the frame observes the latest possible state.
+			if (frame_pacing_enable)
+				pace_frame();
+
 			auto frame_time = platform->get_frame_timer().frame();
 			auto elapsed_time = platform->get_frame_timer().get_elapsed();
 
@@ -1708,6 +1751,9 @@ bool WSI::end_frame()
 			info.pNext = &present_mode_info;
 		}
 
+		if (frame_pacing_enable)
+			frame_pacer.end_frame(next_present_id, Util::get_current_time_nsecs());
+
 		if (supports_present_timing.feedback && present_feedback_enable)
 		{
 			timing_info.presentStageQueries = supports_present_timing.feedback;
@@ -26,6 +26,7 @@
 #include "semaphore_manager.hpp"
 #include "vulkan_headers.hpp"
 #include "timer.hpp"
+#include "frame_pacing.hpp"
 #include <vector>
 #include <thread>
 #include <chrono>
@@ -367,6 +368,16 @@ public:
 	bool set_target_presentation_time(uint64_t absolute_time_ns, uint64_t relative_time_ns, bool force_vrr);
 	void set_enable_timing_feedback(bool enable);
 
+	// Closes the loop on presentation feedback for FIFO presentation.
+	// begin_frame() delays input sampling just enough for the frame to complete in time for its target present,
+	// and the target presentation time is set automatically every frame, overriding set_target_presentation_time().
+	// Requires present timing feedback support, otherwise this is a no-op.
+	void set_frame_pacing(bool enable);
+	inline const FramePacer &get_frame_pacer() const
+	{
+		return frame_pacer;
+	}
+
 private:
 	void update_framebuffer(unsigned width, unsigned height);
 
@@ -515,6 +526,10 @@ private:
 	Semaphore low_latency_semaphore;
 	uint64_t low_latency_semaphore_value = 0;
 
+	FramePacer frame_pacer;
+	bool frame_pacing_enable = false;
+	void pace_frame();
+
 	bool next_present_is_dupe = false;
 	bool frame_dupe_aware = false;
 	bool current_frame_dupe_aware = false;